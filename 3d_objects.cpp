@@ -11,8 +11,8 @@
 #define WIN32_LEAN_AND_MEAN		// Exclude rarely-used stuff from Windows headers
 #include <D3DX9.h>
 #include <dinput.h>
-#include <fstream>
-#include <iostream>
+#include <mmsystem.h>
+#include <math.h>
 #include <tchar.h>
 #include <vector>
 #include <wchar.h>
@@ -20,6 +20,38 @@
 #include "../common/dhD3D.h"
 #include "../common/dhUtility.h"
 #include "../Common/dhUserPrefsDialog.h"
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "asset_loader.h"
+#include "file_watch.h"
+#include "vertex.h"
+#include "float_decode.h"
+#include "render_device.h"
+#include "d3d9_device.h"
+#include "null_device.h"
+#include "soft_device.h"
+#include "scene_sim.h"
+#include "frame_stats.h"
+#include "hires_timer.h"
+#include "profiler.h"
+#include "vec_math.h"
+#include "mesh_build.h"
+#include "scene_bvh.h"
+#include "vertex_ring.h"
+#include "render_queue.h"
+#include "job_system.h"
+#include "input_thread.h"
+#include "input_latency.h"
+#include "frame_pacer.h"
+#include "text_renderer.h"
+#include "frame_arena.h"
+#include "alloc_track.h"
+#include "resource_registry.h"
+#include "device_trace.h"
+#include "trace_replay.h"
+#include "vertex_quant.h"
+#include "dump_decode.h"
+#include "mesh_bvh.h"
 
 // This is causes the required libraries to be linked in, the same thing can be accomplished by
 // adding it to your compiler's link list (Project->Settings->Link in VC++),
@@ -29,6 +61,7 @@
 #pragma comment (lib, "d3d9.lib")
 #pragma comment (lib, "dinput8.lib")
 #pragma comment (lib, "dxguid.lib")
+#pragma comment (lib, "winmm.lib")
 
 #ifdef _DEBUG
   #pragma comment(lib,"d3dx9d.lib")
@@ -39,12 +72,14 @@
 using namespace std;
 
 #define C_WHITE D3DCOLOR_RGBA(255,255,255,255)
-#include <sstream>
-
-#define SSTR( x ) static_cast< std::ostringstream & >( \
-        ( std::ostringstream() << std::dec << x ) ).str()
 IDirect3D9 *g_D3D = NULL;
 IDirect3DDevice9 *g_d3d_device = NULL;
+
+//Everything the scene draws goes through g_device, g_d3d_device is only set when the
+//D3D9 backend is in use
+RenderDevice *g_device = NULL;
+enum device_backend { BACKEND_D3D9, BACKEND_NULL, BACKEND_SOFT };
+device_backend g_backend = BACKEND_D3D9;
 D3DPRESENT_PARAMETERS g_pp;
 
 
@@ -53,23 +88,89 @@ LPD3DXFONT gFont;
 D3DVIEWPORT9 d3dViewport;
 bool CreateDefaultFont();
 
-vector<BYTE> readFile(const char* filename)
+//The vertex dump is mapped on first use rather than read in up front, it can be hundreds
+//of MB and we don't want to pay for it before the window even opens.
+const char *g_vert_path = "c:\\temp\\verttest";
+MappedFile g_vert_file;
+bool g_vert_file_tried = false;
+
+//What we actually read is a native-endian cache of it (see mesh_cache.h), by default
+//next to the dump with .dhmc on the end.  It is built the first time, and rebuilt
+//whenever the dump changes.  g_loader opens (or builds) it in the background and
+//uploads it a slice per frame, the scene draws a placeholder cube until it's ready.
+const char *g_cache_path = NULL;
+bool g_build_cache = false;
+AssetLoader g_loader;
+int g_model = -1;
+size_t g_upload_budget = g_al_default_budget;
+bool g_sync_load = false;
+//-quantize: the model goes up as 8 byte tri_qvertex (see vertex_quant.h) when the device
+//can draw them
+bool g_quantize = false;
+
+//The dump is watched while we run; when it changes the loader diffs it against what's
+//on the card and re-uploads only what moved
+FileWatcher g_watcher;
+bool g_watch = true;
+unsigned int g_reloads_reported = 0;
+bool g_reload_failure_reported = false;
+
+//Startup and load timings: time to the first presented frame, and the worst frame
+//while the loader still had work
+double g_start_time = 0.0;
+bool g_first_frame_done = false;
+double g_load_worst_frame = 0.0;
+unsigned long g_load_frames = 0;
+bool g_load_reported = false;
+
+const char *get_cache_path(void)
+{
+	static char path[MAX_PATH];
+
+	if (g_cache_path == NULL)
+	{
+		_snprintf(path, sizeof(path) - 1, "%s.dhmc", g_vert_path);
+		path[sizeof(path) - 1] = 0;
+		g_cache_path = path;
+	}
+
+	return g_cache_path;
+}
+
+const MappedFile &get_vert_file(void)
+{
+	if (!g_vert_file_tried)
+	{
+		g_vert_file_tried = true;
+
+		if (g_vert_file.Open(g_vert_path))
+		{
+			g_vert_file.Advise(MF_ADVISE_SEQUENTIAL);
+			g_vert_file.Prefetch(0, 64 * 1024);
+		}
+		else
+		{
+			dhLog("Unable to map vertex file\n");
+		}
+	}
+
+	return g_vert_file;
+}
+
+//The model's resident data, or NULL while it's still loading (or failed to)
+const al_mesh_data *get_vert_data(void)
 {
-	// open the file:
-	streampos fileSize;
-	ifstream file(filename, ios::binary);
-
-	// get its size:
-	file.seekg(0, ios::end);
-	fileSize = file.tellg();
-	file.seekg(0, ios::beg);
-	
-	// read the data:
-	vector<BYTE> fileData(fileSize);
-	file.read((char*)&fileData[0], fileSize);
-	return fileData;
-}
-vector<BYTE> fileData = readFile("c:\\temp\\verttest");
+	al_state state;
+
+	if (g_model < 0)
+		return NULL;
+
+	state = g_loader.GetState(g_model);
+	if (state < AL_STAGED || state == AL_FAILED)
+		return NULL;
+
+	return &g_loader.GetData(g_model);
+}
 void DrawScreenText(LPD3DXFONT font, LPCSTR text, int x, int y, D3DCOLOR color)
 {
 	if (font == NULL)
@@ -80,7 +181,7 @@ void DrawScreenText(LPD3DXFONT font, LPCSTR text, int x, int y, D3DCOLOR color)
 }
 bool CreateDefaultFont()
 {
-	if (gFont == NULL)
+	if (gFont == NULL && g_d3d_device != NULL)
 	{
 		//printf("\tgFont == NULL\n");
 		g_d3d_device->GetViewport(&d3dViewport);
@@ -106,13 +207,37 @@ HRESULT render(void);
 void set_device_states(void);
 void init_matrices(void);
 HRESULT init_lists(void);
+void update_objects(void);
+void update_scene(void);
 void draw_pyramid(void);
 void draw_cube(void);
 void draw_cube2(void);
+void draw_model(void);
+void upload_assets(void);
+void init_wave(void);
+void draw_wave(void);
+void init_stress(void);
+void init_objects(void);
+void update_stress(void);
+void update_stress_range(void *p_data, size_t p_begin, size_t p_end);
+void draw_stress(void);
+void record_stress_range(void *p_data, size_t p_begin, size_t p_end);
+void count_stress_range(void *p_data, size_t p_begin, size_t p_end);
+void pack_stress_range(void *p_data, size_t p_begin, size_t p_end);
+float view_depth(const float *p_world);
+void submesh_item(const mesh_submesh &p_mesh, const float *p_world, rq_item *p_item);
+void draw_submesh(const mesh_submesh &p_mesh, const float *p_world);
 void move_cam(void);
+void pick_scene(void);
+float pick_test(void *p_data, int p_id, const float *p_origin, const float *p_dir, float p_max_t);
+HRESULT reset_device(void);
+void handle_lost_device(HRESULT p_hr);
+void update_capture(void);
+void run_trace_replay(void);
 bool InitInput(HWND hWnd);
 bool UpdateInput(void);
 bool ReleaseInput(void);
+void start_input(bool p_dinput);
 
 const char *g_app_name = "3D Objects";
 
@@ -124,518 +249,3098 @@ bool g_app_done = false;
 
 
 
-struct tri_vertex
-{
-    float x, y, z;  // The transformed(screen space) position for the vertex.
-    DWORD colour;        // The vertex colour.
-};
+const DWORD tri_fvf = RD_FVF_XYZ | RD_FVF_DIFFUSE;
 
-const DWORD tri_fvf = D3DFVF_XYZ | D3DFVF_DIFFUSE;
-
-IDirect3DVertexBuffer9 *g_list_vb = NULL;
+RenderBuffer *g_list_vb = NULL;
+RenderBuffer *g_list_ib = NULL;
 
 const int g_pyramid_count = 4 * 1; //4 sides, each side made up of 1 triangle
 const int g_cube_count = 6 * 2; //6 faces, each face is 2 triangles
 
+//Where each shape landed in the welded, cache optimized buffers (see init_lists)
+mesh_submesh g_pyramid_mesh;
+mesh_submesh g_cube_mesh;
+
+//Linear fog distances, in view space z
+const float g_fog_start = 8.0f;
+const float g_fog_end = 9.0f;
+
+//Every object is in g_scene, which is refit and culled against the view each frame
+//before anything is drawn.  In the normal scene the ids are the OBJ_ values, in the
+//stress test they are the instance indices.  Culling at the fog end is optional since
+//fully fogged objects still show up grey against our black clear colour.
+enum scene_object { OBJ_CUBE2, OBJ_PYRAMID, OBJ_CUBE, OBJ_MODEL, OBJ_WAVE, OBJ_COUNT };
+vm_matrix g_object_world[OBJ_COUNT];
+SceneBVH g_scene;
+sb_frustum g_frustum;
+bool g_cull = true;
+bool g_fog_cull = false;
+//Totals since the last reset, for the benchmark
+unsigned long long g_objects_drawn = 0;
+unsigned long long g_objects_culled = 0;
+
+//Picking: every frame the cursor is cast into the scene and whatever it's over shows
+//on the HUD.  The shapes' triangle trees are built by init_lists, the model's by the
+//loader's worker.
+bool g_pick = true;
+bool g_cursor_valid = false;      //No WM_MOUSEMOVE yet
+float g_cursor_x = 0.0f;          //Normalised device coordinates
+float g_cursor_y = 0.0f;
+MeshBVH g_cube_bvh;
+MeshBVH g_pyramid_bvh;
+int g_pick_object = -1;           //Scene id under the cursor, or -1
+int g_pick_triangle = -1;         //Of its mesh, the shapes' counted from their submesh's first
+float g_pick_distance = 0.0f;     //From the eye
+double g_pick_us = 0.0;
+
 
 LPDIRECTINPUT8         lpdi;
 LPDIRECTINPUTDEVICE8   m_keyboard;
 LPDIRECTINPUTDEVICE8   m_mouse;
 
-UCHAR keystate[256];
-DIMOUSESTATE mouse_state;
+//DirectInput is read on the input thread, which queues what it finds for the frame to
+//apply.  A replay can stand in for it.
+class DirectInputSource : public InputSource
+{
+public:
+   DirectInputSource(void) { memset(m_keys,0,sizeof(m_keys)); }
+   virtual int Sample(in_event *p_events, int p_max);
+
+private:
+   UCHAR m_keys[256];   //As of the last read, key events are the changes from it
+};
+DirectInputSource g_dinput_source;
+ReplaySource g_replay_source;
+InputThread g_input;
+InputRecorder g_input_recorder;
+LatencyTracker g_input_latency;
+double g_input_rate = g_in_default_rate;
+const char *g_replay_input = NULL;
+double g_synthetic_input = 0.0;      //Seconds of generated sweep
+const char *g_record_input = NULL;
+bool g_input_enabled = true;         //The benchmark drives the camera itself
+bool g_replay_reported = false;
+unsigned int g_input_frame_events = 0;
+const int g_input_drain = 256;
+//A held numpad key steps again after the delay and then at the rate, Windows' default
+//keyboard autorepeat, as it did when the keys came from WM_KEYDOWN
+const double g_key_repeat_delay = 0.5;
+const double g_key_repeat_rate = 30.0;
+const unsigned int g_repeat_keys[2] = { DIK_NUMPAD4,DIK_NUMPAD6 };
+const float g_repeat_steps[2] = { -1.0f,1.0f };
+unsigned long long g_key_repeat[2] = { 0,0 };   //Ticks of the next repeat, 0 while up
+
+//Frame pacing, off unless -fps is given
+FramePacer g_pacer;
+double g_pace_fps = 0.0;
+bool g_pace_jit = false;
+int g_max_in_flight = 0;
+double g_pace_spin = g_fp_default_spin;
+const char *g_pace_csv = NULL;
+
+//Screen text, batched into one draw.  -d3dx_text puts it back through ID3DXFont to
+//compare against.
+TextRenderer g_text;
+bool g_d3dx_text = false;
+
+//Per frame scratch, emptied after EndScene (see frame_arena.h).  The stress test's
+//instances get their own room on top of -frame_arena's.
+FrameArena g_frame_arena;
+size_t g_frame_arena_kb = g_fa_default_size / 1024;
+//Frames the benchmark lets the containers reach their working size in before it
+//expects render() to stop allocating
+const unsigned long g_alloc_warmup = 8;
+
+//Everything on the card and the pool it's in, so a device reset only rebuilds the
+//default pool, and the render states to put back after (see resource_registry.h).
+//-static_pool default puts the scene's static buffers and the model's in the default
+//pool too, with the registry keeping the scene's data to refill them and the loader
+//refilling the model from what it has resident.
+ResourceRegistry g_resources;
+rr_state_block g_states;
+rd_pool g_static_pool = RD_POOL_MANAGED;
+//How often a lost device is looked at again, short so we're back as soon as it can be
+const DWORD g_lost_poll_ms = 10;
+//-bench_reset: reset the device this many times, log how long it took and exit
+unsigned long g_bench_resets = 0;
+//Resets since startup, the last one all told and just its IDirect3DDevice9::Reset,
+//and the slowest
+unsigned int g_resets = 0;
+double g_reset_last_ms = 0.0;
+double g_reset_device_ms = 0.0;
+double g_reset_worst_ms = 0.0;
+
+//-capture puts a CaptureDevice in front of the backend (see device_trace.h).  F11, or
+//-capture_at's frame, writes the next g_capture_frames frames to g_capture_path for
+//trace_replay to play.  -replay plays a trace on the backend instead of the scene.
+RenderDevice *g_backend_device = NULL;   //g_device, without the capture in front
+CaptureDevice *g_capture = NULL;
+const char *g_capture_path = NULL;
+unsigned int g_capture_frames = 1;
+long g_capture_at = -1;                  //-1 waits for F11
+bool g_capture_requested = false;
+const char *g_replay_path = NULL;
+int g_replay_loops = 1;
 
 
 float x = 0, y = 0, z = 0;
 
-D3DXMATRIX view_matrix;
-D3DXMATRIX projection_matrix;
-D3DXVECTOR3 eye_vector;
-D3DXVECTOR3 lookat_vector;
-D3DXVECTOR3 up_vector;
-D3DXMATRIX world_matrix;
+vm_matrix view_matrix;
+vm_matrix projection_matrix;
+vm_vec3 eye_vector;
+vm_vec3 lookat_vector;
+vm_vec3 up_vector;
+vm_matrix world_matrix;
 float aspect;
 
-int APIENTRY WinMain(HINSTANCE ,HINSTANCE ,LPSTR ,int ){
-bool fullscreen;
-HWND window = NULL;
-D3DFORMAT format;
-HRESULT hr;
-dhUserPrefs user_prefs(g_app_name);
+bool g_bench_decode = false;
+//-check_dump: decode and check the dump on every core without building anything
+bool g_check_dump = false;
+//-bench_pick: rays to time against the model's triangle tree
+unsigned long g_bench_pick = 0;
+unsigned long g_bench_frames = 0;
+//What WinMain returns, non-zero when a benchmark's check failed
+int g_exit_code = 0;
+
+//Animation state, advanced in fixed steps independent of the frame rate
+SceneSim g_sim;
+sim_state g_draw_state;
+
+//Primitives submitted since the last reset, for throughput numbers
+unsigned long long g_prims_drawn = 0;
+
+//Profiler HUD (toggled with F3) and where to dump the timings on exit (F9 dumps now)
+bool g_show_profile = true;
+const char *g_profile_csv = NULL;
+const char *g_profile_trace = NULL;
+
+//Instancing stress test: a grid of g_stress_count small cubes and pyramids drawn in
+//place of the normal scene.  The cubes fill the front of the array, the pyramids the
+//rest, so each shape is one DrawInstanced call (or one draw per instance when naive).
+unsigned long g_stress_count = 0;
+bool g_stress_naive = false;
+std::vector<rd_instance> g_stress_instances;
+rd_instance *g_stress_visible = NULL;   //The instances that survived culling, in g_frame_arena
+//Per object inputs to vm_compose_srt_y_batch, kept as separate arrays
+std::vector<float> g_stress_phase;
+std::vector<float> g_stress_angle;
+std::vector<float> g_stress_scale;
+std::vector<float> g_stress_x;
+std::vector<float> g_stress_y;
+std::vector<float> g_stress_z;
+unsigned long g_stress_cubes = 0;
+
+//The stress grid's animation, culling and recording run as jobs over pieces of
+//g_stress_grain objects.  Each piece keeps what it found, and the render thread takes
+//the pieces in order so the frame comes out the same on any number of threads.
+JobSystem g_jobs;
+int g_job_threads = 0;          //0 is one per hardware thread
+unsigned long g_bench_jobs = 0;
+js_stats g_job_stats;           //The last frame's
+const size_t g_stress_min_grain = 256;
+size_t g_stress_grain = 1;
+struct stress_piece
+{
+   RenderList list;             //Naive draws
+   unsigned long long prims;
+   unsigned long cubes;         //Visible instances, and where they're packed to
+   unsigned long pyramids;
+   unsigned long cube_offset;
+   unsigned long pyramid_offset;
+};
+std::vector<stress_piece> g_stress_pieces;
+
+//Streamed geometry: a rippling g_wave_size x g_wave_size grid under the scene, rebuilt
+//on the CPU every frame into g_ring and drawn with a static index buffer
+VertexRing g_ring;
+UINT g_ring_size = g_vr_default_size;
+unsigned long g_wave_size = 0;
+RenderBuffer *g_wave_ib = NULL;
+const float g_wave_extent = 3.0f;      //Half the grid's width
+const float g_wave_height = 0.25f;
+
+//Everything is drawn through the queue, which sorts it back to front (there's no Z
+//buffer) and drops the state changes that wouldn't change anything
+RenderQueue g_queue;
+bool g_queue_sort = true;
+bool g_state_cache = true;
+//The shapes and the model, and the wave, which is a sheet and seen from both sides
+const rq_material g_solid_material = { 0,tri_fvf,2,{ { RD_RS_CULLMODE,RD_CULL_CCW },{ RD_RS_FOGENABLE,TRUE } },NULL };
+const rq_material g_wave_material = { 1,tri_fvf,2,{ { RD_RS_CULLMODE,RD_CULL_NONE },{ RD_RS_FOGENABLE,TRUE } },NULL };
+//g_solid_material for the quantized model, with its decoding filled in by draw_model
+rq_material g_quant_material = { 2,RD_FVF_QUANTIZED,2,{ { RD_RS_CULLMODE,RD_CULL_CCW },{ RD_RS_FOGENABLE,TRUE } },
+                                  NULL };
 
-   dhLogErase();  //Erase the log file to start fresh
+//******************************************************************************************
+// Function:run_decode_bench
+// Whazzit:Logs GB/s for each big-endian decode path against the old per-call decode
+//******************************************************************************************
+void run_decode_bench(void){
+decode_bench_result results[16];
+char buf[128];
+int count;
 
-	dhLog("Starting application\n");
+   count = bench_float_decode(64 * 1024 * 1024,results,16);
 
-   // Prompt the user for their preferences
-   if (!user_prefs.QueryUser())
+   for(int i = 0;i < count;i++)
 	{
-      dhLog("Exiting\n");
-      return 0;
+      sprintf(buf,"%-28s %6.2f GB/s\n",results[i].name,results[i].gb_per_sec);
+      dhLog(buf);
    }
 
-   fullscreen = user_prefs.GetFullscreen();
+}
+//******************************************************************************************
+// Function:run_frame_bench
+// Whazzit:Renders g_bench_frames frames with input ignored, the simulation stepped exactly
+//         once per frame and the camera on a fixed path, so every run does identical
+//         work.  Logs min/avg/p50/p99/max frame time and throughput.
+//******************************************************************************************
+HRESULT run_frame_bench(void){
+FrameStats stats;
+frame_summary summary;
+char buf[512];
+HRESULT hr = D3D_OK;
+double start;
+unsigned long long allocs = 0;
+unsigned long long alloc_bytes = 0;
+unsigned long alloc_frames = 0;
+long first_alloc_frame = -1;
+unsigned long long ring_bytes;
+unsigned int ring_stalls;
+unsigned int ring_wraps;
+
+   //Every run measures the same scene, so the model is in before the first frame
+   g_loader.Finish(g_device);
+   upload_assets();
+
+   stats.Reserve(g_bench_frames);
+   g_sim.Reset();
+   g_input_enabled = false;
+   g_prims_drawn = 0;
+   g_objects_drawn = 0;
+   g_objects_culled = 0;
+   ring_bytes = g_ring.GetStats().bytes;
+   ring_stalls = g_ring.GetStats().stalls;
+   ring_wraps = g_ring.GetStats().wraps;
+
+   for(unsigned long frame = 0;frame < g_bench_frames && !g_app_done;frame++)
+	{
+      g_pacer.BeginFrame(g_device);
+      dhMessagePump();
 
+      g_sim.Step();
+      g_draw_state = g_sim.GetState();
+      SceneSim::BenchCamera(g_sim.GetTick(),&x,&y);
 
-   // Build our window.
-   hr=dhInitWindow(fullscreen, g_app_name, g_width, g_height, default_window_proc, &window);
-   if(FAILED(hr))
+      //Past the warm up the frame should never touch the heap
+      if(frame >= g_alloc_warmup)
+		{
+         at_arm();
+      }
+      start = hires_seconds();
+      hr = render();
+      stats.Add(hires_seconds() - start);
+      if(frame >= g_alloc_warmup)
+		{
+         at_stats frame_allocs;
+
+         at_disarm();
+         at_get_stats(&frame_allocs);
+         allocs += frame_allocs.allocs;
+         alloc_bytes += frame_allocs.bytes;
+         alloc_frames++;
+         if(frame_allocs.allocs && first_alloc_frame < 0)
+			{
+            first_alloc_frame = (long)frame;
+         }
+      }
+      prof_end_frame();
+
+      if(FAILED(hr))
+		{
+         dhLog("Error rendering",hr);
+         break;
+      }
+   }
+
+   summary = stats.Summarize();
+   if(g_stress_count)
 	{
-      dhLog("Failed to create Window",hr);
-      return 0;
+      sprintf(buf,"bench stress=%lu mode=%s\n",g_stress_count,g_stress_naive ? "naive" : "instanced");
+      dhLog(buf);
+   }
+   if(g_wave_size && summary.count)
+	{
+      const vr_stats &ring = g_ring.GetStats();
+      sprintf(buf,"bench wave=%lu ring=%uKB streamed/frame=%.1fKB peak=%.1fKB stalls=%u wraps=%u\n",g_wave_size,
+              g_ring_size / 1024,(double)(ring.bytes - ring_bytes) / summary.count / 1024.0,
+              ring.peak_frame_bytes / 1024.0,ring.stalls - ring_stalls,ring.wraps - ring_wraps);
+      dhLog(buf);
+   }
+   if(summary.count)
+	{
+      const rq_stats &queue = g_queue.GetStats();
+      sprintf(buf,"bench queue sort=%s state_cache=%s items=%u draws=%u merged=%u states=%u skipped=%u "
+                  "sort=%.3fms\n",g_queue_sort ? "on" : "off",g_state_cache ? "on" : "off",queue.items,
+              queue.draws,queue.merged,queue.states_issued,queue.states_skipped,queue.sort_ms);
+      dhLog(buf);
+   }
+   if(summary.count)
+	{
+      const std::vector<fp_frame> &frames = g_pacer.GetFrames();
+      const fp_stats &pace = g_pacer.GetStats();
+      FrameStats latency;
+      FrameStats jitter;
+      frame_summary latency_summary;
+      frame_summary jitter_summary;
+
+      for(size_t i = 0;i < frames.size();i++)
+		{
+         latency.Add(frames[i].latency);
+         jitter.Add(frames[i].jitter);
+      }
+      latency_summary = latency.Summarize();
+      jitter_summary = jitter.Summarize();
+      sprintf(buf,"bench pace mode=%s fps=%.0f max_in_flight=%d latency p50=%.3fms p99=%.3fms max=%.3fms "
+                  "jitter p50=%.3fms p99=%.3fms busy=%.0f%% timeouts=%u\n",
+              g_pacer.GetMode() == FP_OFF ? "off" : (g_pacer.GetMode() == FP_CAP ? "cap" : "jit"),g_pace_fps,
+              g_pacer.GetMaxInFlight(),latency_summary.p50 * 1000.0,latency_summary.p99 * 1000.0,
+              latency_summary.max * 1000.0,jitter_summary.p50 * 1000.0,jitter_summary.p99 * 1000.0,
+              pace.busy * 100.0,pace.timeouts);
+      dhLog(buf);
+   }
+   if(g_input.IsRunning())
+	{
+      const frame_summary latency = g_input_latency.GetLatencies().Summarize();
+      in_stats stats;
+
+      g_input.GetStats(&stats);
+      sprintf(buf,"bench input rate=%.0fHz events=%llu dropped=%llu timed=%lu untimed=%lu latency p50=%.3fms "
+                  "p99=%.3fms max=%.3fms\n",g_input_rate,stats.events,stats.dropped,(unsigned long)latency.count,
+              (unsigned long)g_input_latency.GetLatencies().GetDropped(),latency.p50 * 1000.0,
+              latency.p99 * 1000.0,latency.max * 1000.0);
+      dhLog(buf);
+   }
+   {
+      const fa_stats &arena = g_frame_arena.GetStats();
+      sprintf(buf,"bench alloc frames=%lu allocs=%llu bytes=%llu first_frame=%ld arena=%uKB peak=%.1fKB "
+                  "overflows=%u\n",alloc_frames,allocs,alloc_bytes,first_alloc_frame,
+              (unsigned int)(arena.size / 1024),arena.peak / 1024.0,arena.overflows);
+      dhLog(buf);
+      //Something on the render path went to the heap, first_frame says when.  Checked in
+      //every build, the release builds are the ones that get benchmarked.
+      if(allocs != 0)
+		{
+         sprintf(buf,"bench alloc FAILED first_frame=%ld\n",first_alloc_frame);
+         dhLog(buf);
+         g_exit_code = 1;
+      }
+   }
+   if(summary.count && !g_d3dx_text)
+	{
+      const tx_stats &text = g_text.GetStats();
+      sprintf(buf,"bench text strings=%u glyphs=%u draws=%u dropped=%u arena_peak=%.1fKB overflows=%u\n",
+              text.strings,text.glyphs,text.draws,text.dropped,text.arena_peak / 1024.0,text.overflows);
+      dhLog(buf);
+   }
+   if(summary.count)
+	{
+      sprintf(buf,"bench cull=%s fog_cull=%s drawn/frame=%.1f culled/frame=%.1f\n",g_cull ? "on" : "off",
+              g_fog_cull ? "on" : "off",(double)g_objects_drawn / summary.count,
+              (double)g_objects_culled / summary.count);
+      dhLog(buf);
+   }
+   sprintf(buf,"bench device=%s frames=%lu min=%.3fms avg=%.3fms p50=%.3fms p99=%.3fms max=%.3fms "
+               "fps=%.1f prims/s=%.0f\n",
+           g_device->GetName(),(unsigned long)summary.count,summary.min * 1000.0,summary.avg * 1000.0,
+           summary.p50 * 1000.0,summary.p99 * 1000.0,summary.max * 1000.0,
+           summary.total > 0.0 ? summary.count / summary.total : 0.0,
+           summary.total > 0.0 ? g_prims_drawn / summary.total : 0.0);
+   dhLog(buf);
+
+   //The software backend can prove the runs really did the same work
+   if(g_backend == BACKEND_SOFT)
+	{
+      sprintf(buf,"bench checksum=%08X\n",((SoftDevice *)g_backend_device)->GetRaster().GetChecksum());
+      dhLog(buf);
    }
 
-   //Build the D3D object
-   hr=dhInitD3D(&g_D3D);
-   if(FAILED(hr))
+   return hr;
+}
+//******************************************************************************************
+// Function:run_job_bench
+// Whazzit:Times the stress grid's update, culling and recording on 1, 2, 4... threads, up
+//         to one per hardware thread, over the same g_bench_jobs frames each time.  The
+//         queue is dropped rather than drawn so only the work the jobs share is timed,
+//         plus the gathering up on this thread that they can't share.
+//******************************************************************************************
+void run_job_bench(void){
+const int hardware = (int)std::thread::hardware_concurrency();
+const int most = hardware > 0 ? hardware : 1;
+FrameStats stats;
+frame_summary summary;
+js_stats jobs;
+double base = 0.0;
+double start;
+char buf[256];
+
+   if(g_stress_count == 0)
 	{
-      dhKillWindow(&window);
-      dhLog("Failed to create D3D",hr);
-      return 0;
+      dhLog("The job benchmark needs -stress\n");
+      return;
    }
 
-   //Find a good display/pixel format
-   hr=dhGetFormat(g_D3D,fullscreen,g_depth,&format);
-   if(FAILED(hr))
+   sprintf(buf,"bench jobs stress=%lu mode=%s frames=%lu hardware_threads=%d\n",g_stress_count,
+           g_stress_naive ? "naive" : "instanced",g_bench_jobs,most);
+   dhLog(buf);
+
+   for(int threads = 1;!g_app_done;threads = threads * 2 < most ? threads * 2 : most)
 	{
-      dhKillWindow(&window);
-      dhLog("Failed to get a display format",hr);
-      return 0;
+      unsigned long long run = 0;
+      unsigned long long stolen = 0;
+
+      g_jobs.Init(threads);
+      g_sim.Reset();
+      stats.Clear();
+      stats.Reserve(g_bench_jobs);
+
+      for(unsigned long frame = 0;frame < g_bench_jobs && !g_app_done;frame++)
+		{
+         dhMessagePump();
+
+         g_sim.Step();
+         g_draw_state = g_sim.GetState();
+         SceneSim::BenchCamera(g_sim.GetTick(),&x,&y);
+         move_cam();
+
+         start = hires_seconds();
+         update_scene();
+         draw_stress();
+         stats.Add(hires_seconds() - start);
+
+         g_queue.Clear();
+      }
+
+      g_jobs.GetStats(&jobs);
+      for(int i = 0;i < threads;i++)
+		{
+         run += jobs.jobs[i];
+         stolen += jobs.steals[i];
+      }
+
+      summary = stats.Summarize();
+      base = threads == 1 ? summary.p50 : base;
+      sprintf(buf,"bench jobs threads=%d p50=%.3fms avg=%.3fms speedup=%.2fx jobs/frame=%.1f stolen/frame=%.1f\n",
+              threads,summary.p50 * 1000.0,summary.avg * 1000.0,summary.p50 > 0.0 ? base / summary.p50 : 0.0,
+              summary.count ? (double)run / summary.count : 0.0,summary.count ? (double)stolen / summary.count : 0.0);
+      dhLog(buf);
+
+      if(threads == most)
+		{
+         break;
+      }
    }
 
-   DWORD adapter = user_prefs.GetAdapter();
-   D3DDEVTYPE dev_type = user_prefs.GetDeviceType();
+   g_jobs.Init(g_job_threads);
 
-   //Initialize our PresentParameters
-   dhInitPresentParameters(fullscreen,window,g_width,g_height,format,D3DFMT_UNKNOWN,&g_pp);
+}
+//******************************************************************************************
+// Function:log_scan
+// Whazzit:Logs a check of the dump: totals, throughput and the first bad records
+//******************************************************************************************
+void log_scan(const char *p_what, const dd_result &p_scan){
+static char report[4096];
+size_t length;
 
-   //Create our device
-   hr=dhInitDevice(g_D3D,adapter,dev_type,window,&g_pp,&g_d3d_device);
-   if(FAILED(hr))
+   length = sprintf(report,"%s: ",p_what);
+   dd_format_report(p_scan,report + length,sizeof(report) - length);
+   dhLog(report);
+
+}
+//******************************************************************************************
+// Function:check_dump
+// Whazzit:Decodes and checks the dump a window at a time without keeping the vertices
+//******************************************************************************************
+void check_dump(void){
+dd_result scan;
+char buf[MAX_PATH + 64];
+
+   if(!dd_decode(g_vert_path,g_be_tri_vertex_layout,g_dd_default_options,&scan,NULL))
 	{
-      dhKillD3D(&g_D3D,&g_d3d_device);
-      dhKillWindow(&window);
-      dhLog("Failed to create the device",hr);
-      return 0;
+      sprintf(buf,"Unable to read vertex dump %s\n",g_vert_path);
+      dhLog(buf);
+      return;
    }
 
-   //One-time preparation of objects and other stuff required for rendering
-   if(FAILED(init_scene()))
+   log_scan(g_vert_path,scan);
+
+}
+//******************************************************************************************
+// Function:build_cache
+// Whazzit:Converts the vertex dump to its cache, then reopens the result with the full
+//         checksum and index verification and logs what went in
+//******************************************************************************************
+void build_cache(void){
+MeshCache cache;
+mc_status status;
+dd_result scan;
+char buf[MAX_PATH + 256];
+double start;
+
+   start = hires_seconds();
+   status = mc_convert(g_vert_path,get_cache_path(),g_be_tri_vertex_layout,&scan);
+   if(status == MC_OK || status == MC_BAD_DATA)
 	{
-      kill_scene();
-      dhKillD3D(&g_D3D,&g_d3d_device);
-      dhKillWindow(&window);
-      return 0;
+      log_scan(g_vert_path,scan);
+   }
+   if(status == MC_OK)
+	{
+      status = cache.Open(get_cache_path(),g_vert_path,g_be_tri_vertex_layout,true);
    }
 
-   InitInput(window);
+   if(status != MC_OK)
+	{
+      sprintf(buf,"Unable to build vertex cache %s from %s: %s\n",get_cache_path(),g_vert_path,mc_status_name(status));
+      dhLog(buf);
+      return;
+   }
 
-   //Loop until the user aborts (closes the window,presses the left mouse button or hits a key)
-   while(!g_app_done)
+   sprintf(buf,"cache %s: %u vertices, %u %d-bit indices, %u bounds, %.0f KB, built in %.1fms\n",get_cache_path(),
+           cache.GetVertexCount(),cache.GetIndexCount(),cache.GetIndexSize() * 8,cache.GetBoundsCount(),
+           cache.GetHeader().file_size / 1024.0,(hires_seconds() - start) * 1000.0);
+   dhLog(buf);
+
+}
+//******************************************************************************************
+// Function:run_pick_bench
+// Whazzit:Casts g_bench_pick rays at the model from all round it, singly, in packets of
+//         four and (for the first few) against every triangle, and logs rays per second
+//******************************************************************************************
+void run_pick_bench(void){
+MeshCache cache;
+mc_status status;
+mb_bench_result result;
+char buf[MAX_PATH + 256];
+
+   status = cache.OpenOrBuild(get_cache_path(),g_vert_path,g_be_tri_vertex_layout);
+   if(status == MC_OK && cache.GetVertices() == NULL)
 	{
-      
-      dhMessagePump();   //Check for window messages
-	  UpdateInput();
+      status = MC_BAD_HEADER;
+   }
+   if(status != MC_OK)
+	{
+      sprintf(buf,"Unable to open vertex cache %s: %s\n",get_cache_path(),mc_status_name(status));
+      dhLog(buf);
+      return;
+   }
 
-      hr = g_d3d_device->TestCooperativeLevel();
+   mb_bench(cache.GetVertices(),cache.GetIndices(),cache.GetIndexSize(),cache.GetIndexCount() / 3,
+            (UINT)g_bench_pick,&result);
+
+   sprintf(buf,"pick tree: %u triangles, %u nodes (%u leaves), depth %d, expected cost %.2f, %.0f KB, "
+               "built in %.1fms\n",result.stats.triangles,result.stats.nodes,result.stats.leaves,result.stats.depth,
+           result.stats.sah_cost,result.stats.bytes / 1024.0,result.stats.build_ms);
+   dhLog(buf);
+   sprintf(buf,"pick: %u rays, %u hit, %.0f rays/s single, %.0f rays/s in packets of 4, %.0f rays/s brute force, "
+               "%u mismatches\n",result.rays,result.hits,result.single_rays_per_sec,result.packet_rays_per_sec,
+           result.brute_rays_per_sec,result.mismatches);
+   dhLog(buf);
+
+}
+//******************************************************************************************
+// Function:dump_profile
+// Whazzit:Writes whatever the profiler's ring buffer still holds, either path may be NULL
+//******************************************************************************************
+void dump_profile(const char *p_csv,const char *p_trace){
+
+   if(p_csv && !prof_write_csv(p_csv))
+	{
+      dhLog("Unable to write profile CSV\n");
+   }
+
+   if(p_trace && !prof_write_trace(p_trace))
+	{
+      dhLog("Unable to write profile trace\n");
+   }
+
+}
+//******************************************************************************************
+// Function:run_reset_bench
+// Whazzit:Draws a frame and resets the device, g_bench_resets times over, and logs how
+//         long the resets took and how much of that was the Reset itself.  Without a
+//         D3D9 device there's no Reset to call, so only our side of it is timed.
+//******************************************************************************************
+void run_reset_bench(void){
+FrameStats totals;
+FrameStats resets;
+frame_summary total;
+frame_summary reset;
+char buf[512];
+HRESULT hr = D3D_OK;
+
+   g_loader.Finish(g_device);
+   upload_assets();
+
+   totals.Reserve(g_bench_resets);
+   resets.Reserve(g_bench_resets);
+   g_input_enabled = false;
+
+   for(unsigned long i = 0;i < g_bench_resets && !g_app_done;i++)
+	{
+      dhMessagePump();
 
+      hr = render();
       if(SUCCEEDED(hr))
 		{
-         hr = render();   //Draw our incredibly cool graphics
+         hr = reset_device();
+      }
+      if(FAILED(hr))
+		{
+         dhLog("Error resetting",hr);
+         break;
       }
 
-      //Our device is lost
-      if(hr == D3DERR_DEVICELOST || hr == D3DERR_DEVICENOTRESET){
+      totals.Add(g_reset_last_ms / 1000.0);
+      resets.Add(g_reset_device_ms / 1000.0);
+   }
 
-         dhHandleLostDevice(g_d3d_device,&g_pp,hr);
+   total = totals.Summarize();
+   reset = resets.Summarize();
+   {
+      const rr_stats &resources = g_resources.GetStats();
+
+      sprintf(buf,"bench reset device=%s resets=%lu avg=%.3fms p99=%.3fms max=%.3fms Reset avg=%.3fms "
+                  "release=%.3fms rebuild=%.3fms rebuilt=%u default=%u managed=%u copies=%.1fKB failures=%u\n",
+              g_device->GetName(),(unsigned long)total.count,total.avg * 1000.0,total.p99 * 1000.0,
+              total.max * 1000.0,reset.avg * 1000.0,resources.lost_ms,resources.reset_ms,resources.rebuilt,
+              resources.count[RD_POOL_DEFAULT],resources.count[RD_POOL_MANAGED],resources.copy_bytes / 1024.0,
+              resources.failures);
+      dhLog(buf);
+   }
 
-      }
-		else if(FAILED(hr)) //Any other error
-		{ 
-         g_app_done=true;
-         dhLog("Error rendering",hr);
-      }
+}
+//******************************************************************************************
+// Function:run_trace_replay
+// Whazzit:Plays g_replay_path on the device g_replay_loops times and logs what it cost.
+//         Nothing of the scene is made, the trace brings everything it draws with it.
+//******************************************************************************************
+void run_trace_replay(void){
+TraceReplay replay;
+static char report[8192];
+char buf[MAX_PATH + 128];
+HRESULT hr;
 
+   if(!replay.Load(g_replay_path))
+	{
+      sprintf(buf,"Unable to load the trace %s\n",g_replay_path);
+      dhLog(buf);
+      return;
    }
 
-   //Free all of our objects and other resources
-   kill_scene();
+   sprintf(buf,"replay %s device=%s size=%ux%u frames=%u loops=%d\n",g_replay_path,g_device->GetName(),
+           replay.GetHeader().width,replay.GetHeader().height,replay.GetHeader().frames,g_replay_loops);
+   dhLog(buf);
 
-   //Clean up all of our Direct3D objects
-   dhKillD3D(&g_D3D,&g_d3d_device);
+   hr = replay.Play(g_device,g_replay_loops);
+   replay.FormatReport(report,sizeof(report));
+   dhLog(report);
 
-   ReleaseInput();
+   if(g_backend == BACKEND_SOFT)
+	{
+      sprintf(buf,"replay checksum=%08X\n",((SoftDevice *)g_device)->GetRaster().GetChecksum());
+      dhLog(buf);
+   }
+   if(FAILED(hr))
+	{
+      dhLog("The replay had errors",hr);
+   }
 
-   //Close down our window
-   dhKillWindow(&window);
+}
+//******************************************************************************************
+// Function:hud_text
+// Whazzit:One line of HUD text, through whichever text path is in use
+//******************************************************************************************
+void hud_text(const char *p_text, int p_x, int p_y){
 
-	dhLog("Exiting normally\n");
+   if(g_d3dx_text)
+	{
+      DrawScreenText(gFont, p_text, p_x, p_y, C_WHITE);
+   }
+   else
+	{
+      g_text.Print(p_x,p_y,C_WHITE,p_text);
+   }
 
-   //Exit happily
-   return 0;
 }
+//******************************************************************************************
+// Function:draw_profile_hud
+// Whazzit:Rolling per stage timings from the profiler, one line per stage under the
+//         existing text.
+//******************************************************************************************
+void draw_profile_hud(void){
+static char text[4096];
+char *line;
+char *end;
+int y = 20;
 
+   if(!g_show_profile)
+	{
+      return;
+   }
 
-bool InitInput(HWND hWnd)
-{
-	if (FAILED(DirectInput8Create(GetModuleHandle(NULL), DIRECTINPUT_VERSION,
-		IID_IDirectInput8, (void**)&lpdi, NULL)))
-		return false;
+   prof_format_hud(text,sizeof(text));
 
-	// initialize the keyboard
-	if (FAILED(lpdi->CreateDevice(GUID_SysKeyboard, &m_keyboard, NULL)))
-		return false;
-	if (FAILED(m_keyboard->SetDataFormat(&c_dfDIKeyboard)))
-		return false;
-	if (FAILED(m_keyboard->SetCooperativeLevel(hWnd, DISCL_BACKGROUND |
-		DISCL_NONEXCLUSIVE)))
-		return false;
-	if (FAILED(m_keyboard->Acquire()))
-		return false;
+   for(line = text;*line;line = end + 1)
+	{
+      end = strchr(line,'\n');
+      if(end == NULL)
+		{
+         break;
+      }
+      *end = 0;
+      hud_text(line,5,y);
+      y += 12;
+   }
 
-	// initialize the mouse
-	if (FAILED(lpdi->CreateDevice(GUID_SysMouse, &m_mouse, NULL)))
-		return false;
-	if (FAILED(m_mouse->SetCooperativeLevel(hWnd, DISCL_BACKGROUND |
-		DISCL_NONEXCLUSIVE)))
-		return false;
-	if (FAILED(m_mouse->SetDataFormat(&c_dfDIMouse)))
-		return false;
-	if (FAILED(m_mouse->Acquire()))
-		return false;
+   const sb_stats &cull = g_scene.GetStats();
+   hud_text(g_text.Format("%-12s %s, nodes %u visited %u culled %u inside, objects %u drawn %u culled","cull",
+                          g_cull ? "on" : "off",cull.nodes_visited,cull.nodes_culled,cull.nodes_inside,
+                          cull.objects_drawn,cull.objects_culled),5,y);
+   y += 12;
 
-	return true;
-}
-bool UpdateInput(void)
-{
-	if (FAILED(m_keyboard->GetDeviceState(sizeof(UCHAR[256]), (LPVOID)keystate)))
-		//return false;
-	if (FAILED(m_mouse->GetDeviceState(sizeof(DIMOUSESTATE), (LPVOID)&mouse_state)))
-		return false;
+   if(g_pick)
+	{
+      static const char *object_names[] = { "cube2","pyramid","cube","model","wave" };
+
+      if(g_pick_object < 0)
+		{
+         hud_text(g_text.Format("%-12s nothing, %.1f us","pick",g_pick_us),5,y);
+      }
+      else
+		{
+         const char *name = g_stress_count ? ((unsigned long)g_pick_object < g_stress_cubes ? "cube" : "pyramid") :
+                                             object_names[g_pick_object];
+
+         hud_text(g_text.Format("%-12s %s (%d), triangle %d, %.2f away, %.1f us","pick",name,g_pick_object,
+                                g_pick_triangle,g_pick_distance,g_pick_us),5,y);
+      }
+      y += 12;
+   }
+
+   {
+      unsigned long long run = 0;
+      unsigned long long stolen = 0;
+
+      for(int i = 0;i < g_jobs.GetThreadCount();i++)
+		{
+         run += g_job_stats.jobs[i];
+         stolen += g_job_stats.steals[i];
+      }
+      hud_text(g_text.Format("%-12s %d threads, %llu run %llu stolen, %llu sleeps","jobs",
+                             g_jobs.GetThreadCount(),run,stolen,g_job_stats.sleeps),5,y);
+      y += 12;
+   }
+
+   {
+      const fp_stats &pace = g_pacer.GetStats();
+      hud_text(g_text.Format("%-12s %s, latency %.1f avg %.1f max ms, jitter %.2f avg %.2f max ms, %.0f%% busy",
+                             "pace",g_pacer.GetMode() == FP_OFF ? "uncapped" :
+                             (g_pacer.GetMode() == FP_CAP ? "capped" : "just in time"),pace.avg_latency * 1000.0,
+                             pace.max_latency * 1000.0,pace.avg_jitter * 1000.0,pace.max_jitter * 1000.0,
+                             pace.busy * 100.0),5,y);
+      y += 12;
+   }
+
+   if(g_input.IsRunning())
+	{
+      in_stats stats;
+
+      g_input.GetStats(&stats);
+      hud_text(g_text.Format("%-12s %u events last frame, worst %.1f ms to shown, %llu dropped","input",
+                             g_input_frame_events,g_input_latency.GetLastWorst() * 1000.0,stats.dropped),5,y);
+      y += 12;
+   }
+
+   {
+      const fa_stats &arena = g_frame_arena.GetStats();
+      hud_text(g_text.Format("%-12s %.1f KB last frame in %u allocs, %.1f KB peak of %.0f KB, %u overflows",
+                             "arena",arena.last_frame / 1024.0,arena.allocs,arena.peak / 1024.0,
+                             arena.size / 1024.0,arena.overflows),5,y);
+      y += 12;
+   }
+
+   {
+      const rr_stats &resources = g_resources.GetStats();
+      hud_text(g_text.Format("%-12s %u default %.1f MB, %u managed %.1f MB, %u resets, last %.2f ms (%.2f in Reset), "
+                             "worst %.2f ms","resources",resources.count[RD_POOL_DEFAULT],
+                             resources.bytes[RD_POOL_DEFAULT] / (1024.0 * 1024.0),resources.count[RD_POOL_MANAGED],
+                             resources.bytes[RD_POOL_MANAGED] / (1024.0 * 1024.0),g_resets,g_reset_last_ms,
+                             g_reset_device_ms,g_reset_worst_ms),5,y);
+      y += 12;
+   }
+
+   if(!g_d3dx_text)
+	{
+      const tx_stats &text = g_text.GetStats();
+      hud_text(g_text.Format("%-12s %u strings, %u glyphs in %u draws, %u dropped, %.1f KB arena","text",
+                             text.strings,text.glyphs,text.draws,text.dropped,text.arena_peak / 1024.0),5,y);
+      y += 12;
+   }
+
+   {
+      const rq_stats &queue = g_queue.GetStats();
+      hud_text(g_text.Format("%-12s %u items -> %u draws, %u merged, %u states set %u skipped, sort %.3f ms",
+                             "queue",queue.items,queue.draws,queue.merged,queue.states_issued,queue.states_skipped,
+                             queue.sort_ms),5,y);
+      y += 12;
+   }
+
+   if(g_wave_size)
+	{
+      const vr_stats &ring = g_ring.GetStats();
+      hud_text(g_text.Format("%-12s %.0f KB/frame in %u locks, %u frames in flight, %u stalls, %u wraps","stream",
+                             ring.frame_bytes / 1024.0,ring.frame_allocs,ring.frames_in_flight,ring.stalls,
+                             ring.wraps),5,y);
+      y += 12;
+   }
+
+   if(g_model >= 0)
+	{
+      static const char *state_names[] = { "queued","loading","staged","uploading","ready","failed" };
+      al_mesh_info info;
+
+      g_loader.GetInfo(g_model,&info);
+      hud_text(g_text.Format("%-12s %s, %.0f of %.0f KB in %u frames%s","model",state_names[info.state],
+                             info.bytes_uploaded / 1024.0,info.bytes_total / 1024.0,info.upload_frames,
+                             info.quantized ? ", quantized" : ""),5,y);
+      y += 12;
+
+      if(info.reload_pending)
+		{
+         hud_text(g_text.Format("%-12s in progress","reload"),5,y);
+      }
+      else if(info.reloads > 0)
+		{
+         hud_text(g_text.Format("%-12s %s, %.1fms, %.1f of %.0f KB in %u ranges (%u reloads)","reload",
+                                info.reload_full ? "full" : "patch",info.reload_ms,info.reload_bytes / 1024.0,
+                                info.bytes_total / 1024.0,info.reload_ranges,info.reloads),5,y);
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:next_arg
+// Whazzit:Splits the next argument off the command line buffer, honouring double quotes
+//         so paths with spaces survive.  Returns NULL when there is nothing left.
+//******************************************************************************************
+char *next_arg(char **p_cursor){
+char *start;
+char *end;
+
+   start = *p_cursor;
+   while(*start == ' ' || *start == '\t')
+	{
+      start++;
+   }
+
+   if(*start == 0)
+	{
+      return NULL;
+   }
+
+   if(*start == '"')
+	{
+      start++;
+      end = strchr(start,'"');
+   }
+   else
+	{
+      end = strpbrk(start," \t");
+   }
+
+   if(end)
+	{
+      *end = 0;
+      *p_cursor = end + 1;
+   }
+   else
+	{
+      *p_cursor = start + strlen(start);
+   }
+
+   return start;
+}
+//******************************************************************************************
+// Function:parse_command_line
+// Whazzit:Picks our options out of the command line.
+//         -file <path>   Vertex dump to map (default c:\temp\verttest)
+//         -cache <path>  Where to keep its native-endian cache (default <file>.dhmc)
+//         -build_cache   (Re)build the cache from the dump, log what's in it and exit
+//         -bench_decode  Log the throughput of the big-endian decoders and exit
+//         -check_dump    Decode and check every record of the dump, log the throughput
+//                        and where any NaN, infinite, out of range or truncated records
+//                        are, and exit.  Streams the dump, so it can be bigger than memory.
+//         -bench_pick <n>  Build the model's triangle tree, cast n rays at it, log rays per
+//                        second against brute force and exit
+//         -no_pick       Don't build triangle trees or pick what's under the cursor
+//         -device <name> Rendering backend: d3d9 (default), null or soft
+//         --bench <n>    Render exactly n frames on a fixed camera path, log frame time
+//                        statistics and exit
+//         -profile_csv <path>    Write the profiler's timings as CSV on exit
+//         -profile_trace <path>  Write them as a Chrome trace on exit
+//         -stress <n>    Replace the scene with a grid of n small instanced objects
+//         -stress_naive  Draw the stress grid with a SetTransform/DrawPrimitive pair
+//                        per object instead, for comparison
+//         -no_cull       Draw every object without frustum culling
+//         -fog_cull      Also cull objects entirely beyond the fog end
+//         -upload_budget <KB>  Most of the model to upload per frame (default 4096)
+//         -sync_load     Load and upload the model before the first frame, for comparison
+//         -quantize      Upload the model as 16 bit positions and palette colours, half
+//                        the vertex memory, if the device can decode them
+//         -no_watch      Don't reload the model when its dump changes
+//         -wave <n>      Stream an n x n vertex grid through the dynamic ring every frame
+//         -ring_size <KB>  Size of the dynamic vertex ring (default 4096)
+//         -no_sort       Draw in submission order instead of sorting the queue
+//         -no_state_cache  Send every state change to the device, even redundant ones
+//         -jobs <n>      Threads for the job system, counting this one (default one per
+//                        hardware thread)
+//         -bench_jobs <n>  Time n frames of the stress grid's jobs on 1, 2, 4... threads,
+//                        log the scaling and exit.  Needs -stress.
+//         -replay_input <path>  Play recorded input instead of reading the devices, then
+//                        log its input to shown latency
+//         -synthetic_input <s>  Likewise, with s seconds of generated mouse sweep
+//         -record_input <path>  Write whatever input was applied, for -replay_input
+//         -input_rate <hz>  How often the input thread samples (default 1000)
+//         -fps <n>       Cap the frame rate at n, sleeping away the rest of each frame
+//         -jit           With -fps, start each frame as late as it can and still make its
+//                        slot, so it samples the newest input
+//         -max_in_flight <n>  Don't start a frame while n are still on the device
+//         -pace_spin <ms>  Spin rather than sleep for the last ms of a wait (default 2)
+//         -pace_csv <path>  Write each frame's pacing and latency as CSV on exit
+//         -static_pool <default|managed>  Pool for the scene's and the model's static
+//                        buffers (default managed)
+//         -frame_arena <KB>  Per frame scratch for the render path (default 1024), the
+//                        stress test's instances get room on top of it
+//         -bench_reset <n>  Reset the device n times, log how long it took and exit
+//         -capture <path>  Put the capture device in front of the backend, F11 writes the
+//                        next frames' device calls to path
+//         -capture_frames <n>  Frames in a capture (default 1)
+//         -capture_at <n>  Capture at frame n without waiting for F11
+//         -replay <path>  Play a captured trace on the device as fast as it goes, log the
+//                        cost of each kind of call and exit
+//         -replay_loops <n>  Times through the trace's frames (default 1)
+//******************************************************************************************
+void parse_command_line(LPSTR p_cmd_line){
+static char buffer[1024];
+char *cursor;
+char *arg;
+
+   if(p_cmd_line == NULL)
+	{
+      return;
+   }
+
+   strncpy(buffer,p_cmd_line,sizeof(buffer) - 1);
+   buffer[sizeof(buffer) - 1] = 0;
+   cursor = buffer;
+
+   while((arg = next_arg(&cursor)) != NULL)
+	{
+      if(strcmp(arg,"-file") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_vert_path = arg;
+      }
+      else if(strcmp(arg,"-cache") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_cache_path = arg;
+      }
+      else if(strcmp(arg,"-build_cache") == 0)
+		{
+         g_build_cache = true;
+      }
+      else if(strcmp(arg,"-device") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         if(strcmp(arg,"null") == 0)
+			{
+            g_backend = BACKEND_NULL;
+         }
+         else if(strcmp(arg,"soft") == 0)
+			{
+            g_backend = BACKEND_SOFT;
+         }
+         else
+			{
+            g_backend = BACKEND_D3D9;
+         }
+      }
+      else if(strcmp(arg,"--bench") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_bench_frames = strtoul(arg,NULL,10);
+      }
+      else if(strcmp(arg,"-profile_csv") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_profile_csv = arg;
+      }
+      else if(strcmp(arg,"-profile_trace") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_profile_trace = arg;
+      }
+      else if(strcmp(arg,"-stress") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_stress_count = strtoul(arg,NULL,10);
+      }
+      else if(strcmp(arg,"-stress_naive") == 0)
+		{
+         g_stress_naive = true;
+      }
+      else if(strcmp(arg,"-no_cull") == 0)
+		{
+         g_cull = false;
+      }
+      else if(strcmp(arg,"-fog_cull") == 0)
+		{
+         g_fog_cull = true;
+      }
+      else if(strcmp(arg,"-upload_budget") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_upload_budget = (size_t)strtoul(arg,NULL,10) * 1024;
+      }
+      else if(strcmp(arg,"-sync_load") == 0)
+		{
+         g_sync_load = true;
+      }
+      else if(strcmp(arg,"-quantize") == 0)
+		{
+         g_quantize = true;
+      }
+      else if(strcmp(arg,"-no_watch") == 0)
+		{
+         g_watch = false;
+      }
+      else if(strcmp(arg,"-wave") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_wave_size = strtoul(arg,NULL,10);
+      }
+      else if(strcmp(arg,"-ring_size") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_ring_size = (UINT)strtoul(arg,NULL,10) * 1024;
+      }
+      else if(strcmp(arg,"-no_sort") == 0)
+		{
+         g_queue_sort = false;
+      }
+      else if(strcmp(arg,"-no_state_cache") == 0)
+		{
+         g_state_cache = false;
+      }
+      else if(strcmp(arg,"-jobs") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_job_threads = atoi(arg);
+      }
+      else if(strcmp(arg,"-bench_jobs") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_bench_jobs = strtoul(arg,NULL,10);
+      }
+      else if(strcmp(arg,"-replay_input") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_replay_input = arg;
+      }
+      else if(strcmp(arg,"-synthetic_input") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_synthetic_input = atof(arg);
+      }
+      else if(strcmp(arg,"-record_input") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_record_input = arg;
+      }
+      else if(strcmp(arg,"-input_rate") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_input_rate = atof(arg);
+      }
+      else if(strcmp(arg,"-fps") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_pace_fps = atof(arg);
+      }
+      else if(strcmp(arg,"-jit") == 0)
+		{
+         g_pace_jit = true;
+      }
+      else if(strcmp(arg,"-max_in_flight") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_max_in_flight = atoi(arg);
+      }
+      else if(strcmp(arg,"-pace_spin") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_pace_spin = atof(arg) / 1000.0;
+      }
+      else if(strcmp(arg,"-pace_csv") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_pace_csv = arg;
+      }
+      else if(strcmp(arg,"-frame_arena") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_frame_arena_kb = strtoul(arg,NULL,10);
+      }
+      else if(strcmp(arg,"-d3dx_text") == 0)
+		{
+         g_d3dx_text = true;
+      }
+      else if(strcmp(arg,"-static_pool") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_static_pool = strcmp(arg,"default") == 0 ? RD_POOL_DEFAULT : RD_POOL_MANAGED;
+      }
+      else if(strcmp(arg,"-bench_reset") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_bench_resets = strtoul(arg,NULL,10);
+      }
+      else if(strcmp(arg,"-capture") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_capture_path = arg;
+      }
+      else if(strcmp(arg,"-capture_frames") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_capture_frames = (unsigned int)strtoul(arg,NULL,10);
+      }
+      else if(strcmp(arg,"-capture_at") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_capture_at = strtol(arg,NULL,10);
+      }
+      else if(strcmp(arg,"-replay") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_replay_path = arg;
+      }
+      else if(strcmp(arg,"-replay_loops") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_replay_loops = atoi(arg);
+      }
+      else if(strcmp(arg,"-bench_decode") == 0)
+		{
+         g_bench_decode = true;
+      }
+      else if(strcmp(arg,"-check_dump") == 0)
+		{
+         g_check_dump = true;
+      }
+      else if(strcmp(arg,"-bench_pick") == 0 && (arg = next_arg(&cursor)) != NULL)
+		{
+         g_bench_pick = strtoul(arg,NULL,10);
+      }
+      else if(strcmp(arg,"-no_pick") == 0)
+		{
+         g_pick = false;
+      }
+   }
+
+}
+
+//******************************************************************************************
+// Function:init_device
+// Whazzit:Creates the RenderDevice for the selected backend.  Only the D3D9 backend needs
+//         the D3D object, a display format and the user's adapter choice.
+//******************************************************************************************
+HRESULT init_device(HWND p_window,bool p_fullscreen,dhUserPrefs &p_user_prefs){
+D3DFORMAT format;
+HRESULT hr;
+
+   if(g_backend == BACKEND_NULL)
+	{
+      NullDevice *null_device = new NullDevice();
+
+      //Its pretend GPU has to keep up with a tighter frames in flight limit, or the
+      //pacer would only ever time out waiting for it
+      if(g_max_in_flight > 0 && g_null_frame_latency > (UINT)g_max_in_flight - 1)
+		{
+         null_device->SetFrameLatency(g_max_in_flight - 1);
+      }
+      g_device = null_device;
+      return D3D_OK;
+   }
+
+   if(g_backend == BACKEND_SOFT)
+	{
+      SoftDevice *soft = new SoftDevice(g_width,g_height);
+      soft->SetPresentWindow(p_window);
+      g_device = soft;
+      return D3D_OK;
+   }
+
+   //Build the D3D object
+   hr=dhInitD3D(&g_D3D);
+   if(FAILED(hr))
+	{
+      dhLog("Failed to create D3D",hr);
+      return hr;
+   }
+
+   //Find a good display/pixel format
+   hr=dhGetFormat(g_D3D,p_fullscreen,g_depth,&format);
+   if(FAILED(hr))
+	{
+      dhLog("Failed to get a display format",hr);
+      return hr;
+   }
+
+   DWORD adapter = p_user_prefs.GetAdapter();
+   D3DDEVTYPE dev_type = p_user_prefs.GetDeviceType();
+
+   //Initialize our PresentParameters
+   dhInitPresentParameters(p_fullscreen,p_window,g_width,g_height,format,D3DFMT_UNKNOWN,&g_pp);
+
+   //Create our device
+   hr=dhInitDevice(g_D3D,adapter,dev_type,p_window,&g_pp,&g_d3d_device);
+   if(FAILED(hr))
+	{
+      dhKillD3D(&g_D3D,&g_d3d_device);
+      dhLog("Failed to create the device",hr);
+      return hr;
+   }
+
+   g_device = new D3D9Device(g_d3d_device);
+
+   return D3D_OK;
+}
+//******************************************************************************************
+// Function:kill_device
+// Whazzit:Frees the RenderDevice and, for the D3D9 backend, the D3D objects behind it.
+//******************************************************************************************
+void kill_device(void){
+
+   //The capture goes first, it finishes its file and lets go of the backend
+   if(g_capture)
+	{
+      delete g_capture;
+      g_capture = NULL;
+   }
+
+   delete g_backend_device;
+   g_device = NULL;
+   g_backend_device = NULL;
+
+   if(g_D3D)
+	{
+      dhKillD3D(&g_D3D,&g_d3d_device);
+   }
+
+}
+
+int APIENTRY WinMain(HINSTANCE ,HINSTANCE ,LPSTR p_cmd_line,int ){
+bool fullscreen;
+HWND window = NULL;
+HRESULT hr;
+dhUserPrefs user_prefs(g_app_name);
+
+   dhLogErase();  //Erase the log file to start fresh
+
+   parse_command_line(p_cmd_line);
+
+   if(g_bench_decode)
+	{
+      run_decode_bench();
+      return 0;
+   }
+
+   if(g_check_dump)
+	{
+      check_dump();
+      return 0;
+   }
+
+   if(g_build_cache)
+	{
+      build_cache();
+      return 0;
+   }
+
+   if(g_bench_pick > 0)
+	{
+      run_pick_bench();
+      return 0;
+   }
+
+	dhLog("Starting application\n");
+
+   // Prompt the user for their preferences
+   if (!user_prefs.QueryUser())
+	{
+      dhLog("Exiting\n");
+      return 0;
+   }
+
+   fullscreen = user_prefs.GetFullscreen();
+
+   //Time to first frame counts from here, the preferences dialog waits on the user
+   g_start_time = hires_seconds();
+
+
+   // Build our window.
+   hr=dhInitWindow(fullscreen, g_app_name, g_width, g_height, default_window_proc, &window);
+   if(FAILED(hr))
+	{
+      dhLog("Failed to create Window",hr);
+      return 0;
+   }
+
+   //Build the device for whichever backend we were asked for
+   hr=init_device(window,fullscreen,user_prefs);
+   if(FAILED(hr))
+	{
+      dhKillWindow(&window);
+      return 0;
+   }
+   g_backend_device = g_device;
+
+   //A trace only needs the device, not the scene
+   if(g_replay_path)
+	{
+      run_trace_replay();
+      kill_device();
+      dhKillWindow(&window);
+      return 0;
+   }
+
+   if(g_capture_path)
+	{
+      g_capture = new CaptureDevice(g_device,g_width,g_height);
+      g_device = g_capture;
+   }
+
+   //One-time preparation of objects and other stuff required for rendering
+   if(FAILED(init_scene()))
+	{
+      kill_scene();
+      kill_device();
+      dhKillWindow(&window);
+      return 0;
+   }
+
+   start_input(InitInput(window));
+
+   g_pacer.Init(g_pace_jit ? FP_JUST_IN_TIME : FP_CAP,g_pace_fps,g_max_in_flight);
+   g_pacer.SetSpin(g_pace_spin);
+   g_pacer.SetRecord(g_pace_csv != NULL || g_bench_frames > 0);
+   g_pacer.Reserve(g_bench_frames);
+   if(g_pacer.GetMode() != FP_OFF)
+	{
+      timeBeginPeriod(1);
+   }
+
+   if(g_bench_jobs > 0)
+	{
+      run_job_bench();
+      g_app_done = true;
+   }
+   else if(g_bench_resets > 0)
+	{
+      run_reset_bench();
+      g_app_done = true;
+   }
+   else if(g_bench_frames > 0)
+	{
+      run_frame_bench();
+      g_app_done = true;
+   }
+
+   double last_time = hires_seconds();
+
+   //Loop until the user aborts (closes the window,presses the left mouse button or hits a key)
+   while(!g_app_done)
+	{
+      //Waits out the rest of the frame rate cap, and for the device if it's too far behind
+      {
+         PROF_SCOPE("pace");
+         g_pacer.BeginFrame(g_device);
+      }
+      {
+         PROF_SCOPE("messages");
+         dhMessagePump();   //Check for window messages
+      }
+      //Step the animation by however much real time has passed
+      double now = hires_seconds();
+      g_sim.Advance(now - last_time);
+
+      //Hitches while the model is streaming in
+      if(g_first_frame_done && g_model >= 0 && !g_load_reported)
+		{
+         g_load_worst_frame = now - last_time > g_load_worst_frame ? now - last_time : g_load_worst_frame;
+         g_load_frames++;
+      }
+      last_time = now;
+      g_draw_state = g_sim.GetState();
+
+      hr = g_device->TestCooperativeLevel();
+
+      if(SUCCEEDED(hr))
+		{
+         hr = render();   //Draw our incredibly cool graphics
+
+         if(SUCCEEDED(hr) && !g_first_frame_done)
+			{
+            char buf[64];
+
+            g_first_frame_done = true;
+            sprintf(buf,"first frame after %.1fms\n",(hires_seconds() - g_start_time) * 1000.0);
+            dhLog(buf);
+         }
+      }
+
+      //Our device is lost
+      if(g_d3d_device && (hr == D3DERR_DEVICELOST || hr == D3DERR_DEVICENOTRESET)){
+
+         handle_lost_device(hr);
+
+      }
+		else if(FAILED(hr)) //Any other error
+		{ 
+         g_app_done=true;
+         dhLog("Error rendering",hr);
+      }
+
+      prof_end_frame();
+
+   }
+
+   dump_profile(g_profile_csv,g_profile_trace);
+   if(g_pace_csv && !g_pacer.WriteCsv(g_pace_csv))
+	{
+      dhLog("Couldn't write the pacing CSV\n");
+   }
+   if(g_pacer.GetMode() != FP_OFF)
+	{
+      timeEndPeriod(1);
+   }
+
+   //Free all of our objects and other resources
+   kill_scene();
+
+   g_vert_file.Close();
+
+   //Clean up all of our Direct3D objects
+   kill_device();
+
+   ReleaseInput();
+
+   //Close down our window
+   dhKillWindow(&window);
+
+	dhLog("Exiting normally\n");
+
+   //Exit happily, unless a benchmark's check failed
+   return g_exit_code;
+}
+
+
+bool InitInput(HWND hWnd)
+{
+	if (FAILED(DirectInput8Create(GetModuleHandle(NULL), DIRECTINPUT_VERSION,
+		IID_IDirectInput8, (void**)&lpdi, NULL)))
+		return false;
+
+	// initialize the keyboard
+	if (FAILED(lpdi->CreateDevice(GUID_SysKeyboard, &m_keyboard, NULL)))
+		return false;
+	if (FAILED(m_keyboard->SetDataFormat(&c_dfDIKeyboard)))
+		return false;
+	if (FAILED(m_keyboard->SetCooperativeLevel(hWnd, DISCL_BACKGROUND |
+		DISCL_NONEXCLUSIVE)))
+		return false;
+	if (FAILED(m_keyboard->Acquire()))
+		return false;
+
+	// initialize the mouse
+	if (FAILED(lpdi->CreateDevice(GUID_SysMouse, &m_mouse, NULL)))
+		return false;
+	if (FAILED(m_mouse->SetCooperativeLevel(hWnd, DISCL_BACKGROUND |
+		DISCL_NONEXCLUSIVE)))
+		return false;
+	if (FAILED(m_mouse->SetDataFormat(&c_dfDIMouse)))
+		return false;
+	if (FAILED(m_mouse->Acquire()))
+		return false;
+
+	return true;
+}
+//******************************************************************************************
+// Function:start_input
+// Whazzit:Starts sampling on the input thread, from the replay if there is one or the
+//         DirectInput devices if they came up.  The default 15ms scheduler tick would
+//         make a mockery of 1000Hz sampling.
+//******************************************************************************************
+void start_input(bool p_dinput){
+char buf[512];
+InputSource *source = NULL;
+
+   if(g_replay_input)
+	{
+      if(g_replay_source.Load(g_replay_input))
+		{
+         source = &g_replay_source;
+      }
+      else
+		{
+         sprintf(buf,"Couldn't load input replay %s\n",g_replay_input);
+         dhLog(buf);
+      }
+   }
+   else if(g_synthetic_input > 0.0)
+	{
+      g_replay_source.Generate(g_synthetic_input,1.0 / g_input_rate);
+      source = &g_replay_source;
+   }
+   else if(p_dinput)
+	{
+      source = &g_dinput_source;
+   }
+
+   if(g_record_input && !g_input_recorder.Open(g_record_input))
+	{
+      sprintf(buf,"Couldn't open %s to record input\n",g_record_input);
+      dhLog(buf);
+   }
+
+   if(source)
+	{
+      timeBeginPeriod(1);
+      g_input.Start(source,g_input_rate);
+   }
+
+}
+//******************************************************************************************
+// Function:Sample
+// Whazzit:Runs on the input thread.  Immediate mode DirectInput only gives us the state
+//         now, so key events are the changes since the last sample.
+//******************************************************************************************
+int DirectInputSource::Sample(in_event *p_events, int p_max){
+const unsigned long long now = hires_ticks();
+DIMOUSESTATE mouse_state;
+UCHAR keys[256];
+int count = 0;
+
+   if(FAILED(m_mouse->GetDeviceState(sizeof(mouse_state),&mouse_state)))
+	{
+      m_mouse->Acquire();
+   }
+   else if(mouse_state.lX || mouse_state.lY)
+	{
+      p_events[count].ticks = now;
+      p_events[count].type = IN_MOVE;
+      p_events[count].dx = mouse_state.lX;
+      p_events[count].dy = mouse_state.lY;
+      p_events[count].key = 0;
+      count++;
+   }
+
+   if(FAILED(m_keyboard->GetDeviceState(sizeof(keys),keys)))
+	{
+      m_keyboard->Acquire();
+      return count;
+   }
+
+   for(int i = 0;i < 256 && count < p_max;i++)
+	{
+      if((keys[i] & 0x80) != (m_keys[i] & 0x80))
+		{
+         p_events[count].ticks = now;
+         p_events[count].type = (keys[i] & 0x80) ? IN_KEY_DOWN : IN_KEY_UP;
+         p_events[count].dx = 0;
+         p_events[count].dy = 0;
+         p_events[count].key = i;
+         count++;
+      }
+      m_keys[i] = keys[i];
+   }
+
+   return count;
+}
+//******************************************************************************************
+// Function:repeat_keys
+// Whazzit:Steps x for every repeat of a held numpad key that is due by p_until
+//******************************************************************************************
+void repeat_keys(unsigned long long p_until){
+const unsigned long long interval = (unsigned long long)(1.0 / (g_key_repeat_rate * hires_tick_period()));
+
+   for(int i = 0;i < 2;i++)
+	{
+      while(g_key_repeat[i] != 0 && g_key_repeat[i] <= p_until)
+		{
+         x = x + g_repeat_steps[i];
+         g_key_repeat[i] += interval;
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:UpdateInput
+// Whazzit:Applies every event the input thread has queued since the last frame, called
+//         just before the camera is built so the frame shows the newest input there is
+//******************************************************************************************
+bool UpdateInput(void){
+//Read before the drain, the thread only says so after queueing its last event
+const bool finished = g_input.IsFinished();
+in_event events[g_input_drain];
+char buf[256];
+int count;
+
+   g_input_latency.Poll(g_device);
+   g_input_frame_events = 0;
+
+   while((count = g_input.Drain(events,g_input_drain)) > 0)
+	{
+      for(int i = 0;i < count;i++)
+		{
+         const in_event &event = events[i];
+
+         g_input_latency.Applied(event.ticks);
+         g_input_recorder.Write(event);
+
+         //The benchmark still times them, it just doesn't let them move the camera
+         if(!g_input_enabled)
+			{
+            continue;
+         }
+
+         if(event.type == IN_MOVE)
+			{
+            x = x + (event.dx/10.0f);
+            y = y - (event.dy/10.0f);
+         }
+         else if(event.type == IN_KEY_DOWN || event.type == IN_KEY_UP)
+			{
+            //Repeats due before this event happen before it
+            repeat_keys(event.ticks);
+            for(int k = 0;k < 2;k++)
+				{
+               if(event.key == g_repeat_keys[k] && event.type == IN_KEY_DOWN)
+					{
+                  x = x + g_repeat_steps[k];
+                  g_key_repeat[k] = event.ticks + (unsigned long long)(g_key_repeat_delay / hires_tick_period());
+               }
+               else if(event.key == g_repeat_keys[k])
+					{
+                  g_key_repeat[k] = 0;
+               }
+            }
+         }
+      }
+      g_input_frame_events += count;
+   }
+   if(g_input_enabled)
+	{
+      repeat_keys(hires_ticks());
+   }
+
+   //A replay's numbers are only worth having once it has all been shown
+   if(finished && !g_replay_reported && g_input_frame_events == 0 && g_input_latency.IsIdle())
+	{
+      const frame_summary latency = g_input_latency.GetLatencies().Summarize();
+      in_stats stats;
+
+      g_input.GetStats(&stats);
+      sprintf(buf,"input replay events=%llu dropped=%llu untimed=%lu latency p50=%.3fms p99=%.3fms max=%.3fms\n",
+              stats.events,stats.dropped,(unsigned long)g_input_latency.GetLatencies().GetDropped(),
+              latency.p50 * 1000.0,latency.p99 * 1000.0,latency.max * 1000.0);
+      dhLog(buf);
+      g_replay_reported = true;
+   }
+
+   return true;
+}
+bool ReleaseInput(void)
+{
+	//Nothing may be sampling the devices once they're gone
+	if (g_input.IsRunning())
+		timeEndPeriod(1);
+	g_input.Stop();
+	g_input_recorder.Close();
+
+	if (lpdi == NULL)
+		return true;
+
+	if (m_mouse)
+	{
+		m_mouse->Unacquire();
+		m_mouse->Release();
+		m_mouse = NULL;
+	}
+
+	if (m_keyboard)
+	{
+		m_keyboard->Unacquire();
+		m_keyboard->Release();
+		m_keyboard = NULL;
+	}
+
+	lpdi->Release();
+	lpdi = NULL;
+
+	return true;
+}
+//******************************************************************************************
+// Function:InitVolatileResources
+// Whazzit:Rebuild what a device Reset threw away: the default pool, from what the registry
+//         kept, and the render states as they were last set.  Everything else came
+//         through the Reset, so the scene setup isn't run again.
+//******************************************************************************************
+void InitVolatileResources(void)
+{
+const rr_stats &resources = g_resources.GetStats();
+
+   if(FAILED(g_resources.OnResetDevice(g_device)))
+	{
+      char buf[128];
+
+      sprintf(buf,"Couldn't rebuild %s after the reset\n",resources.failed);
+      dhLog(buf);
+   }
+
+   g_states.Apply(g_device);
+
+}
+//******************************************************************************************
+// Function:FreeVolatileResources
+// Whazzit:Free any of our resources that need to be freed so that we can Reset our device,
+//         also used to free these resources at the end of the program run.
+//******************************************************************************************
+void FreeVolatileResources(void)
+{
+
+   //Only the default pool, see the registrations in init_scene
+   g_resources.OnLostDevice();
+
+}
+//******************************************************************************************
+// Function:fences_lost
+// Whazzit:The pacer's and the latency tracker's fences went with the device
+//******************************************************************************************
+void fences_lost(void *p_data)
+{
+
+   g_input_latency.Reset();
+   g_pacer.Reset();
+
+}
+//******************************************************************************************
+// Function:font_lost
+// Whazzit:ID3DXFont keeps its glyph textures in the default pool, it lets go of them
+//         itself and makes them again on OnResetDevice
+//******************************************************************************************
+void font_lost(void *p_data)
+{
+
+   if(gFont)
+	{
+      gFont->OnLostDevice();
+   }
+
+}
+
+HRESULT font_reset(RenderDevice *p_device, void *p_data)
+{
+
+   return gFont ? gFont->OnResetDevice() : D3D_OK;
+}
+//******************************************************************************************
+// Function:reset_device
+// Whazzit:Releases the default pool, Resets the device and rebuilds what it lost, timing
+//         it all and the Reset on its own.  With no D3D9 device there's no Reset, only
+//         our side of it, which is what -bench_reset times on the other backends.
+//******************************************************************************************
+HRESULT reset_device(void)
+{
+const double start = hires_seconds();
+double reset_start;
+double reset_end;
+HRESULT hr = D3D_OK;
+
+   FreeVolatileResources();
+
+   reset_start = hires_seconds();
+   if(g_d3d_device)
+	{
+      hr = g_d3d_device->Reset(&g_pp);
+   }
+   reset_end = hires_seconds();
+
+   //Everything stays released until the next try
+   if(FAILED(hr))
+	{
+      return hr;
+   }
+
+   InitVolatileResources();
+
+   g_resets++;
+   g_reset_last_ms = (hires_seconds() - start) * 1000.0;
+   g_reset_device_ms = (reset_end - reset_start) * 1000.0;
+   g_reset_worst_ms = g_reset_last_ms > g_reset_worst_ms ? g_reset_last_ms : g_reset_worst_ms;
+
+   return D3D_OK;
+}
+//******************************************************************************************
+// Function:handle_lost_device
+// Whazzit:Takes over from dhHandleLostDevice.  While the device can't be reset we look
+//         again every g_lost_poll_ms, so we're back as soon as it can be, and then only
+//         what the Reset lost is rebuilt.
+//******************************************************************************************
+void handle_lost_device(HRESULT p_hr)
+{
+HRESULT hr = p_hr;
+char buf[128];
+
+   if(hr == D3DERR_DEVICELOST)
+	{
+      Sleep(g_lost_poll_ms);
+      hr = g_d3d_device->TestCooperativeLevel();
+   }
+   if(hr != D3DERR_DEVICENOTRESET)
+	{
+      return;
+   }
+
+   hr = reset_device();
+   if(hr == D3DERR_DEVICELOST)
+	{
+      return;
+   }
+   else if(FAILED(hr))
+	{
+      g_app_done = true;
+      dhLog("Error resetting the device",hr);
+      return;
+   }
+
+   sprintf(buf,"device reset in %.2fms, %.2fms of it in Reset\n",g_reset_last_ms,g_reset_device_ms);
+   dhLog(buf);
+
+}
+//******************************************************************************************
+// Function:init_scene
+// Whazzit:Prepare any objects required for rendering.
+//******************************************************************************************
+HRESULT init_scene(void)
+{
+HRESULT hr=D3D_OK;
+
+   set_device_states();
+
+   init_matrices();
+
+   //Only the comparison path needs it
+   if(g_d3dx_text)
+	{
+      CreateDefaultFont();
+   }
+
+   g_jobs.Init(g_job_threads);
+   
+   hr = init_lists();
+
+   init_stress();
+
+   init_wave();
+
+   init_objects();
+
+   g_frame_arena.Init(g_frame_arena_kb * 1024 + g_stress_count * sizeof(rd_instance));
+
+   if(FAILED(g_text.Init(g_device)))
+	{
+      dhLog("Unable to build the glyph atlas, there will be no text\n");
+   }
+
+   //Everything that has to be remade after a reset.  The D3D9 device goes first, its
+   //shadowed state has to be back to the defaults before g_states is replayed.
+   if(g_backend == BACKEND_D3D9)
+	{
+      g_resources.Register("d3d9 instances",RD_POOL_DEFAULT,0,(D3D9Device *)g_backend_device);
+      ((D3D9Device *)g_backend_device)->SetRegistry(&g_resources);
+   }
+   g_resources.Register("ring",RD_POOL_DEFAULT,g_ring_size,&g_ring);
+   g_resources.Register("text",RD_POOL_DEFAULT,g_tx_ring_size,&g_text);
+   if(g_text.GetAtlasBytes() > 0)
+	{
+      g_resources.Register("glyph atlas",RD_POOL_MANAGED,g_text.GetAtlasBytes(),NULL,NULL,NULL);
+   }
+   g_resources.Register("fences",RD_POOL_DEFAULT,0,fences_lost,NULL,NULL);
+   if(gFont)
+	{
+      g_resources.Register("d3dx font",RD_POOL_DEFAULT,0,font_lost,font_reset,NULL);
+   }
+
+   g_queue.SetSorting(g_queue_sort);
+   g_queue.SetStateCache(g_state_cache);
+
+   if(g_quantize && !g_device->CanQuantize())
+	{
+      dhLog("The device can't decode quantized vertices, the model stays float\n");
+      g_quantize = false;
+   }
+   g_loader.SetQuantize(g_quantize);
+   g_loader.SetPickable(g_pick);
+   g_loader.SetPool(g_static_pool,&g_resources);
+
+   //Returns straight away, the model turns up over the next few frames
+   g_model = g_loader.Load(get_cache_path(),g_vert_path);
+   if(g_sync_load)
+	{
+      g_loader.Finish(g_device);
+   }
+   if(g_watch && g_watcher.Watch(g_vert_path) < 0)
+	{
+      dhLog("Unable to watch the vertex file for changes\n");
+   }
+
+   return hr;
+
+}
+//******************************************************************************************
+// Function:kill_scene
+// Whazzit:Clean up any objects we required for rendering.
+//******************************************************************************************
+void kill_scene(void){
+
+   //Stops the worker and frees the model's buffers
+   g_watcher.Close();
+   g_loader.Shutdown();
+   g_jobs.Shutdown();
+   g_model = -1;
+   g_reloads_reported = 0;
+   g_reload_failure_reported = false;
+   g_pick_object = -1;
+
+   FreeVolatileResources();
+   //The static buffers the registry made, and it forgets the rest
+   if(g_backend == BACKEND_D3D9 && g_backend_device)
+	{
+      ((D3D9Device *)g_backend_device)->SetRegistry(NULL);
+   }
+   g_resources.Release();
+   g_ring.Release();
+   g_text.Release();
+   g_frame_arena.Release();
+
+   if(gFont)
+	{
+      gFont->Release();
+      gFont = NULL;
+   }
+
+}
+//******************************************************************************************
+// Function:set_device_states
+// Whazzit:Sets up required RenderStates, TextureStageStates and SamplerStates
+//******************************************************************************************
+void set_device_states(void){
+
+   //Turn off D3D lighting, since we are providing our own vertex colours
+   //Transformed Vertices are not lit by D3D but by their vertex colours by default.
+   //Untransformed vertices by default are lit by D3D, since we haven't added any
+   //lighting, we wouldn't see anything if we didn't do this.
+   g_states.SetRenderState(g_device,RD_RS_LIGHTING,FALSE);
+   
+
+
+   g_states.SetRenderState(g_device,RD_RS_FOGENABLE, TRUE);
+   g_states.SetRenderState(g_device,RD_RS_FOGCOLOR, 0x008F8F8F);
+   g_states.SetRenderState(g_device,RD_RS_FOGVERTEXMODE, RD_FOG_LINEAR);
+   g_states.SetRenderState(g_device,RD_RS_FOGSTART, rd_float_bits(g_fog_start));
+   g_states.SetRenderState(g_device,RD_RS_FOGEND, rd_float_bits(g_fog_end));
+
+   
+   g_states.SetRenderState(g_device,RD_RS_CULLMODE,RD_CULL_CCW);      //Default culling
+   //g_states.SetRenderState(g_device,RD_RS_CULLMODE,RD_CULL_NONE);   //No culling
+   //g_states.SetRenderState(g_device,RD_RS_FILLMODE, RD_FILL_WIREFRAME);
+}
+//******************************************************************************************
+// Function:init_matrices
+// Whazzit:One-time preparation of our View and Projection matrices
+//******************************************************************************************
+void init_matrices(void){
+
+
+   //Here we build our View Matrix, think of it as our camera.
+
+   //First we specify that our viewpoint is 8 units back on the Z-axis
+   eye_vector=vm_vec3( 0.0f, 0.0f,-8.0f );
+
+   //We are looking towards the origin
+   lookat_vector=vm_vec3( 0.0f, 0.0f, 0.0f );
+
+   //The "up" direction is the positive direction on the y-axis
+   up_vector=vm_vec3(0.0f,1.0f,0.0f);
+
+   vm_matrix_look_at_lh(&view_matrix,eye_vector,
+                                     lookat_vector,
+                                     up_vector);
+
+   //Since our 'camera' will never move, we can set this once at the
+   //beginning and never worry about it again
+   g_states.SetTransform(g_device,RD_TS_VIEW,view_matrix);
+
+   aspect=((float)g_width / (float)g_height);
+
+   vm_matrix_perspective_fov_lh(&projection_matrix, //Result Matrix
+                                VM_PI/4,            //Field of View, in radians.
+                                aspect,             //Aspect ratio
+                                1.0f,               //Near view plane
+                                100.0f );           //Far view plane
+
+   //Our Projection matrix won't change either, so we set it now and never touch
+   //it again.
+   g_states.SetTransform(g_device,RD_TS_PROJECTION, projection_matrix);
+
+}
+
+//******************************************************************************************
+// Function:update_capture
+// Whazzit:Starts a capture when F11 or -capture_at asks for one, and logs how the last
+//         one went once the capture device has stopped itself
+//******************************************************************************************
+void update_capture(void){
+static long frame = 0;
+static bool capturing = false;
+char buf[MAX_PATH + 128];
+
+   if(g_capture == NULL)
+	{
+      return;
+   }
+
+   if(frame++ == g_capture_at)
+	{
+      g_capture_requested = true;
+   }
+
+   if(capturing && !g_capture->IsCapturing())
+	{
+      const dt_capture_stats &stats = g_capture->GetStats();
+
+      sprintf(buf,"Captured %u frames to %s, %u records %.1fKB\n",stats.frames,g_capture_path,
+              (unsigned int)stats.records,stats.bytes / 1024.0);
+      dhLog(buf);
+   }
+
+   if(g_capture_requested && !g_capture->IsCapturing())
+	{
+      if(!g_capture->Start(g_capture_path,g_capture_frames))
+		{
+         sprintf(buf,"Unable to start a capture to %s\n",g_capture_path);
+         dhLog(buf);
+      }
+   }
+   g_capture_requested = false;
+   capturing = g_capture->IsCapturing();
+
+}
+//******************************************************************************************
+// Function:render
+// Whazzit:Clears the screen, renders our scene and then presents the results.
+//******************************************************************************************
+float bytesToFloatB(UINT loc)
+{
+	const al_mesh_data *data = get_vert_data();
+	float output;
+
+	//Whole fields come out of the loaded mesh already decoded, dump record i is its
+	//vertex al_index(i)
+	if (data && loc % 4 == 0 && loc / sizeof(tri_vertex) < data->index_count)
+	{
+		const tri_vertex &vertex = data->vertices[al_index(*data, loc / sizeof(tri_vertex))];
+
+		memcpy(&output, (const BYTE *)&vertex + loc % sizeof(tri_vertex), sizeof(output));
+		return output;
+	}
+
+	//Reads as zero until the loader is done with it, rather than blocking on the dump
+	if (g_model >= 0 && g_loader.GetState(g_model) != AL_FAILED)
+		return 0.0f;
+
+	const MappedFile &file = get_vert_file();
+
+	//Out of range (or no file at all) reads as zero
+	if (file.GetData() == NULL || (size_t)loc + 4 > file.GetSize())
+		return 0.0f;
+
+	//Single values go through the same path as bulk decodes, see decode_vertices_be
+	//for whole arrays
+	decode_floats_be(file.GetData() + loc, &output, 1);
+
+	return output;
+}
+
+HRESULT render(void){
+HRESULT hr;
+
+   //Before anything of this frame reaches the device, so a capture starts on a whole frame
+   update_capture();
+
+   //Last frame's strings are done with
+   g_text.BeginFrame();
+
+   //Everything up to now goes into this frame's camera
+   {
+      PROF_SCOPE("input");
+      UpdateInput();
+      g_pacer.MarkInput();
+   }
+   {
+      PROF_SCOPE("move_cam");
+      move_cam();
+   }
+   //Clear the buffer to our new colour.
+   //We don't have a Z Buffer or Stencil Buffer, so only the target is cleared
+   hr=g_device->Clear(0x00000000); //Colour to clear to (AARRGGBB)
+   if(FAILED(hr))
+	{
+      return hr;
+   }
+
+   //Notify the device that we're ready to render
+   hr=g_device->BeginScene();
+   if(FAILED(hr))
+	{
+      return hr;
+   }
+
+
+   upload_assets();
+
+   update_scene();
+
+   pick_scene();
+
+
+   if(g_stress_count)
+	{
+      draw_stress();
+   }
+   else
+	{
+      //The queue puts these in order
+      draw_wave();
+
+      draw_model();
+
+      draw_cube2();
+
+      draw_pyramid();
+
+      draw_cube();
+   }
+
+   {
+      PROF_SCOPE("queue");
+      g_queue.Flush(g_device);
+   }
+
+   {
+      PROF_SCOPE("text");
+
+      hud_text(g_text.Format("%f",bytesToFloatB(0)),5,5);
+
+      draw_profile_hud();
+
+      //Everything printed this frame in one draw
+      g_text.Flush(g_device);
+   }
+
+
+   //Notify the device that we're finished rendering for this frame
+   g_device->EndScene();
+
+   //This frame's scratch stays put for one more frame, then gets reused
+   g_frame_arena.EndFrame();
+
+   //Everything streamed this frame has been drawn
+   g_ring.EndFrame();
+
+   //Show the results
+   {
+      PROF_SCOPE("present");
+      hr=g_device->Present();
+   }
+   g_pacer.EndFrame(g_device);
+
+   //The events this frame showed are timed once the device has finished it
+   g_input_latency.EndFrame(g_device);
+   g_input_latency.Poll(g_device);
+
+   return hr;
+}
+//******************************************************************************************
+// Function:update_objects
+// Whazzit:Calculates the new rotations and positions of the three objects and hands
+//         them to the scene for culling
+//******************************************************************************************
+void update_objects(void){
+vm_matrix rot_matrix;
+vm_matrix trans_matrix;
+vm_matrix scale_matrix;
+PROF_SCOPE("update_objects");
+
+
+   vm_matrix_rotation_yaw_pitch_roll(&rot_matrix, 1.0f, 1.0f, 1.0f);  //Rotate the cube
+   vm_matrix_translation(&trans_matrix, 0.0f, 0.0f, -3.0f); //Shift it
+   vm_matrix_scaling(&scale_matrix, 1.0f, 1.0f, 1.0f);
+
+   vm_matrix_multiply(&g_object_world[OBJ_CUBE2], &rot_matrix, &trans_matrix);   //Rot & Trans
+   vm_matrix_multiply(&g_object_world[OBJ_CUBE2], &g_object_world[OBJ_CUBE2], &scale_matrix);
+
+   vm_matrix_rotation_y(&rot_matrix,g_draw_state.rot_triangle);  //Rotate the pyramid
+   vm_matrix_translation(&trans_matrix,-2.0f,0,0); //Shift it 2 units to the left
+   vm_matrix_multiply(&g_object_world[OBJ_PYRAMID],&rot_matrix,&trans_matrix);
+
+   vm_matrix_rotation_yaw_pitch_roll(&rot_matrix,0.0f,g_draw_state.rot_cube,g_draw_state.rot_cube);  //Rotate the cube
+   vm_matrix_translation(&trans_matrix,2.0f,0,0); //Shift it 2 units to the right
+   vm_matrix_multiply(&g_object_world[OBJ_CUBE],&rot_matrix,&trans_matrix);   //Rot & Trans
+
+   //The model (or its placeholder) turns slowly behind the others, scaled to fit a 2x2x2 box
+   vm_matrix_rotation_y(&rot_matrix,g_draw_state.rot_triangle * 0.5f);
+   vm_matrix_translation(&trans_matrix,0.0f,0.0f,2.0f);
+   vm_matrix_multiply(&g_object_world[OBJ_MODEL],&rot_matrix,&trans_matrix);
+   if(g_model >= 0 && g_loader.GetState(g_model) == AL_READY)
+	{
+      const mc_bounds &bounds = g_loader.GetData(g_model).bounds;
+      float size = 0.0f;
+
+      for(int k = 0;k < 3;k++)
+		{
+         size = bounds.max[k] - bounds.min[k] > size ? bounds.max[k] - bounds.min[k] : size;
+      }
+      size = size > 0.0f ? 2.0f / size : 1.0f;
+
+      vm_matrix_translation(&trans_matrix,-(bounds.min[0] + bounds.max[0]) * 0.5f,
+                            -(bounds.min[1] + bounds.max[1]) * 0.5f,-(bounds.min[2] + bounds.max[2]) * 0.5f);
+      vm_matrix_scaling(&scale_matrix,size,size,size);
+      vm_matrix_multiply(&scale_matrix,&trans_matrix,&scale_matrix);
+      vm_matrix_multiply(&g_object_world[OBJ_MODEL],&scale_matrix,&g_object_world[OBJ_MODEL]);
+   }
+
+   vm_matrix_translation(&g_object_world[OBJ_WAVE],0.0f,-2.0f,0.0f);
+
+   for(int i = 0;i < OBJ_COUNT;i++)
+	{
+      g_scene.SetTransform(i,g_object_world[i]);
+   }
+
+}
+//******************************************************************************************
+// Function:update_scene
+// Whazzit:Moves everything for this frame, then refits the scene's BVH and culls it
+//         against the current view
+//******************************************************************************************
+void update_scene(void){
+const sb_stats &stats = g_scene.GetStats();
 
+   //What the jobs did last frame, for the HUD
+   g_jobs.GetStats(&g_job_stats);
+   g_jobs.ResetStats();
 
-	x = x + (mouse_state.lX/10.0f);
-	y = y - (mouse_state.lY/10.0f);
+   if(g_stress_count)
+	{
+      update_stress();
+   }
+   else
+	{
+      update_objects();
+   }
 
+   PROF_SCOPE("cull");
 
-	return true;
-}
-bool ReleaseInput(void)
-{
-	m_mouse->Unacquire();
-	m_mouse->Release();
-	m_mouse = NULL;
+   g_scene.Refit(&g_jobs);
 
-	m_keyboard->Unacquire();
-	m_keyboard->Release();
-	m_keyboard = NULL;
+   if(g_cull)
+	{
+      sb_frustum_from_matrices(&g_frustum,view_matrix,projection_matrix);
+      if(g_fog_cull)
+		{
+         sb_frustum_add_far_plane(&g_frustum,view_matrix,g_fog_end);
+      }
+      g_scene.Cull(g_frustum,&g_jobs);
+   }
+   else
+	{
+      g_scene.ShowAll();
+   }
 
-	lpdi->Release();
-	lpdi = NULL;
+   g_objects_drawn += stats.objects_drawn;
+   g_objects_culled += stats.objects_culled;
 
-	return true;
 }
 //******************************************************************************************
-// Function:InitVolatileResources
-// Whazzit:Prepare any objects that will not survive a device Reset.  These are initialized
-//         separately so they can easily be recreated when we Reset our device.
+// Function:pick_scene
+// Whazzit:Unprojects the cursor to a ray from the near plane to the far plane and finds
+//         the nearest triangle on it.  The scene's tree narrows it down to the objects
+//         whose boxes the ray goes through and pick_test checks each of those against
+//         its mesh.  Needs this frame's Refit.
 //******************************************************************************************
-void InitVolatileResources(void)
-{
+void pick_scene(void){
+const double start = hires_seconds();
+vm_matrix view_projection;
+vm_matrix inverse;
+vm_vec3 near_point;
+vm_vec3 far_point;
+vm_vec3 dir;
+float length;
+float t;
+PROF_SCOPE("pick");
+
+   g_pick_object = -1;
+   g_pick_triangle = -1;
+   g_pick_us = 0.0;
+
+   if(!g_pick || !g_cursor_valid)
+	{
+      return;
+   }
 
-   set_device_states();
+   vm_matrix_multiply(&view_projection,&view_matrix,&projection_matrix);
+   if(vm_matrix_inverse(&inverse,&view_projection) == NULL)
+	{
+      return;
+   }
 
-   init_matrices();
+   near_point = vm_vec3_transform_coord(vm_vec3(g_cursor_x,g_cursor_y,0.0f),inverse);
+   far_point = vm_vec3_transform_coord(vm_vec3(g_cursor_x,g_cursor_y,1.0f),inverse);
+   dir = vm_vec3_sub(far_point,near_point);
+   length = sqrtf(vm_vec3_dot(dir,dir));
+   dir = vm_vec3_normalize(dir);
 
-   gFont = NULL;
+   const float origin[3] = { near_point.x,near_point.y,near_point.z };
+   const float direction[3] = { dir.x,dir.y,dir.z };
 
-   CreateDefaultFont();
+   g_pick_object = g_scene.Raycast(origin,direction,length,pick_test,NULL,&t);
+   if(g_pick_object >= 0)
+	{
+      const vm_vec3 from_eye = vm_vec3_sub(near_point,eye_vector);
 
+      g_pick_distance = t + sqrtf(vm_vec3_dot(from_eye,from_eye));
+   }
 
+   g_pick_us = (hires_seconds() - start) * 1000000.0;
 
 }
 //******************************************************************************************
-// Function:FreeVolatileResources
-// Whazzit:Free any of our resources that need to be freed so that we can Reset our device,
-//         also used to free these resources at the end of the program run.
+// Function:pick_test
+// Whazzit:The exact test for pick_scene: takes the ray into object p_id's space and
+//         walks its mesh's tree.  The direction isn't renormalised there, so t stays in
+//         world units whatever the object's scale.  The wave is rebuilt every frame and
+//         has no tree, so it can't be picked.
 //******************************************************************************************
-void FreeVolatileResources(void)
-{
+float pick_test(void *, int p_id, const float *p_origin, const float *p_dir, float p_max_t){
+const MeshBVH *bvh = NULL;
+const vm_matrix *world;
+vm_matrix inverse;
+al_state state;
+vm_vec3 origin;
+vm_vec3 dir;
+mb_ray ray;
+mb_hit hit;
+
+   if(g_stress_count)
+	{
+      bvh = (unsigned long)p_id < g_stress_cubes ? &g_cube_bvh : &g_pyramid_bvh;
+      world = (const vm_matrix *)g_stress_instances[p_id].world;
+   }
+   else
+	{
+      world = &g_object_world[p_id];
+      switch(p_id)
+		{
+         case OBJ_CUBE2:
+         case OBJ_CUBE:
+            bvh = &g_cube_bvh;
+            break;
+         case OBJ_PYRAMID:
+            bvh = &g_pyramid_bvh;
+            break;
+         case OBJ_MODEL:
+            //Whatever draw_model is drawing there
+            if(g_model >= 0)
+				{
+               state = g_loader.GetState(g_model);
+               if(state == AL_READY)
+					{
+                  bvh = g_loader.GetData(g_model).bvh;
+               }
+               else if(state != AL_FAILED)
+					{
+                  bvh = &g_cube_bvh;
+               }
+            }
+            break;
+      }
+   }
 
-   //This sample has no resources that need to be freed here.
+   if(bvh == NULL || bvh->IsEmpty() || vm_matrix_inverse(&inverse,world) == NULL)
+	{
+      return p_max_t;
+   }
+
+   origin = vm_vec3_transform_coord(vm_vec3(p_origin[0],p_origin[1],p_origin[2]),inverse);
+   dir = vm_vec3_transform_normal(vm_vec3(p_dir[0],p_dir[1],p_dir[2]),inverse);
+   ray.origin[0] = origin.x;
+   ray.origin[1] = origin.y;
+   ray.origin[2] = origin.z;
+   ray.dir[0] = dir.x;
+   ray.dir[1] = dir.y;
+   ray.dir[2] = dir.z;
+
+   hit.t = p_max_t;
+   hit.triangle = -1;
+   if(!bvh->Intersect(ray,&hit))
+	{
+      return p_max_t;
+   }
+
+   //Only a hit nearer than everything so far gets here, so this is the nearest yet
+   g_pick_triangle = hit.triangle;
 
+   return hit.t;
 }
 //******************************************************************************************
-// Function:init_scene
-// Whazzit:Prepare any objects required for rendering.
+// Function:draw_pyramid
+// Whazzit:Renders the pyramid, unless it was culled
 //******************************************************************************************
-HRESULT init_scene(void)
-{
-HRESULT hr=D3D_OK;
+void draw_pyramid(void){
+PROF_SCOPE("draw_pyramid");
 
-   InitVolatileResources();
-   
-   hr = init_lists();
+   if(!g_scene.IsVisible(OBJ_PYRAMID))
+	{
+      return;
+   }
 
-   return hr;
+   //Render from our Vertex and Index Buffers
+   draw_submesh(g_pyramid_mesh,g_object_world[OBJ_PYRAMID]);
 
 }
 //******************************************************************************************
-// Function:kill_scene
-// Whazzit:Clean up any objects we required for rendering.
+// Function:draw_cube
+// Whazzit:Renders the cube, unless it was culled
 //******************************************************************************************
-void kill_scene(void){
+void draw_cube(void){
+PROF_SCOPE("draw_cube");
 
-   if(g_list_vb)
+   if(!g_scene.IsVisible(OBJ_CUBE))
 	{
-      g_list_vb->Release();
-      g_list_vb = NULL;
+      return;
    }
 
-   FreeVolatileResources();
+   //Render from our Vertex and Index Buffers
+   draw_submesh(g_cube_mesh,g_object_world[OBJ_CUBE]);
+
+}
+void draw_cube2(void) {
+	PROF_SCOPE("draw_cube2");
+
+	if (!g_scene.IsVisible(OBJ_CUBE2))
+	{
+		return;
+	}
 
+	//Render from our Vertex and Index Buffers
+	draw_submesh(g_cube_mesh, g_object_world[OBJ_CUBE2]);
 }
 //******************************************************************************************
-// Function:set_device_states
-// Whazzit:Sets up required RenderStates, TextureStageStates and SamplerStates
+// Function:draw_model
+// Whazzit:Renders the loaded model, or the cube in its place while it's still loading.
+//         Nothing is drawn if there's no model to load.
 //******************************************************************************************
-void set_device_states(void){
+void draw_model(void){
+const UINT max_prims = 65535;   //The least MaxPrimitiveCount any D3D9 part reports
+al_state state;
+UINT prims;
+rq_item item;
+float depth;
+PROF_SCOPE("draw_model");
+
+   if(g_model < 0 || !g_scene.IsVisible(OBJ_MODEL))
+	{
+      return;
+   }
 
-   //Turn off D3D lighting, since we are providing our own vertex colours
-   //Transformed Vertices are not lit by D3D but by their vertex colours by default.
-   //Untransformed vertices by default are lit by D3D, since we haven't added any
-   //lighting, we wouldn't see anything if we didn't do this.
-   g_d3d_device->SetRenderState(D3DRS_LIGHTING,FALSE);
-   
+   state = g_loader.GetState(g_model);
+   if(state == AL_FAILED)
+	{
+      return;
+   }
+
+   if(state != AL_READY)
+	{
+      draw_submesh(g_cube_mesh,g_object_world[OBJ_MODEL]);
+      return;
+   }
+
+   const al_mesh_data &data = g_loader.GetData(g_model);
 
+   prims = data.index_count / 3;
+   if(prims == 0)
+	{
+      return;
+   }
 
-   float Start = 8.0f,    // Linear fog distances
-	End = 9.0f;
+   item.draw = RQ_DRAW_INDEXED;
+   item.material = &g_solid_material;
+   if(data.quant)
+	{
+      g_quant_material.quant = data.quant;
+      item.material = &g_quant_material;
+   }
+   item.vb = g_loader.GetVertexBuffer(g_model);
+   item.stride = data.stride;
+   item.ib = g_loader.GetIndexBuffer(g_model);
+   memcpy(item.world,g_object_world[OBJ_MODEL],sizeof(item.world));
+   item.base_vertex = 0;
+   item.min_index = 0;
+   item.num_vertices = data.vertex_count;
+   item.instances = NULL;
+   item.instance_count = 0;
+
+   //Each chunk sorts with the model, so they stay together in order
+   depth = view_depth(g_object_world[OBJ_MODEL]);
+   for(UINT start = 0;start < prims;start += max_prims)
+	{
+      item.start_index = start * 3;
+      item.prim_count = prims - start < max_prims ? prims - start : max_prims;
 
-   g_d3d_device->SetRenderState(D3DRS_FOGENABLE, TRUE);
-   g_d3d_device->SetRenderState(D3DRS_FOGCOLOR, 0x008F8F8F);
-   g_d3d_device->SetRenderState(D3DRS_FOGVERTEXMODE, D3DFOG_LINEAR);
-   g_d3d_device->SetRenderState(D3DRS_FOGSTART, *(DWORD *)(&Start));
-   g_d3d_device->SetRenderState(D3DRS_FOGEND, *(DWORD *)(&End));
+      g_queue.Submit(RQ_PASS_SORTED,depth,item);
+      g_prims_drawn += item.prim_count;
+   }
 
-   
-   g_d3d_device->SetRenderState(D3DRS_CULLMODE,D3DCULL_CCW);      //Default culling
-   //g_d3d_device->SetRenderState(D3DRS_CULLMODE,D3DCULL_NONE);   //No culling
-   //g_d3d_device->SetRenderState(D3DRS_FILLMODE, D3DFILL_WIREFRAME);
 }
 //******************************************************************************************
-// Function:init_matrices
-// Whazzit:One-time preparation of our View and Projection matrices
+// Function:upload_assets
+// Whazzit:Passes file changes on to the loader, gives it this frame's upload budget, and
+//         logs the load timings once the model is in and each reload as it finishes
 //******************************************************************************************
-void init_matrices(void){
+void upload_assets(void){
+al_mesh_info info;
+char buf[256];
+int changed[4];
+PROF_SCOPE("upload");
 
+   for(int i = g_watcher.Poll(changed,4) - 1;i >= 0 && g_model >= 0;i--)
+	{
+      g_loader.Reload(g_model);
+   }
 
-   //Here we build our View Matrix, think of it as our camera.
-
-   //First we specify that our viewpoint is 8 units back on the Z-axis
-   eye_vector=D3DXVECTOR3( 0.0f, 0.0f,-8.0f );
+   g_loader.Pump(g_device,g_upload_budget);
 
-   //We are looking towards the origin
-   lookat_vector=D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+   if(g_model >= 0 && g_load_reported)
+	{
+      g_loader.GetInfo(g_model,&info);
+      if(info.reloads != g_reloads_reported)
+		{
+         g_reloads_reported = info.reloads;
+         sprintf(buf,"model: reloaded (%s) in %.1fms, %.1f KB re-uploaded in %u ranges\n",
+                 info.reload_full ? "full" : "patch",info.reload_ms,info.reload_bytes / 1024.0,
+                 info.reload_ranges);
+         dhLog(buf);
+      }
+      if(info.reload_failed != g_reload_failure_reported)
+		{
+         g_reload_failure_reported = info.reload_failed;
+         if(info.reload_failed)
+			{
+            dhLog("model: reload failed, still drawing the old mesh\n");
+            if(g_loader.GetScan(g_model).bad_records > 0)
+				{
+               log_scan("model",g_loader.GetScan(g_model));
+            }
+         }
+      }
+   }
 
-   //The "up" direction is the positive direction on the y-axis
-   up_vector=D3DXVECTOR3(0.0f,1.0f,0.0f);
+   if(g_model < 0 || g_load_reported || g_loader.IsBusy())
+	{
+      return;
+   }
 
-   D3DXMatrixLookAtLH(&view_matrix,&eye_vector,
-                                   &lookat_vector,
-                                   &up_vector);
+   g_load_reported = true;
+   g_loader.GetInfo(g_model,&info);
+   if(info.state == AL_READY)
+	{
+      sprintf(buf,"model: staged after %.1fms, ready after %.1fms, %.0f KB over %u frames, worst frame "
+                  "while loading %.2fms (%lu frames)\n",info.staged_ms,info.ready_ms,info.bytes_total / 1024.0,
+              info.upload_frames,g_load_worst_frame * 1000.0,g_load_frames);
+   }
+   else
+	{
+      sprintf(buf,"model: not loaded (%s)\n",mc_status_name(info.status));
+   }
+   dhLog(buf);
 
-   //Since our 'camera' will never move, we can set this once at the
-   //beginning and never worry about it again
-   g_d3d_device->SetTransform(D3DTS_VIEW,&view_matrix);
+   //Only there when the cache had to be built from the dump
+   if(g_loader.GetScan(g_model).file_size > 0)
+	{
+      log_scan("model",g_loader.GetScan(g_model));
+   }
 
-   aspect=((float)g_width / (float)g_height);
+   if(info.state == AL_READY && info.quantized)
+	{
+      const vq_error &error = info.quant_error;
+      const UINT vertices = g_loader.GetData(g_model).vertex_count;
+
+      sprintf(buf,"model: quantized, %.0f KB of vertices instead of %.0f KB, worst position error %g (bound %g, "
+                  "%.2g of the box), %u colours %s, worst channel error %d, %u non-finite vertices\n",
+              vertices * sizeof(tri_qvertex) / 1024.0,vertices * sizeof(tri_vertex) / 1024.0,error.position_max,
+              error.position_bound,error.position_rel,error.colours,
+              error.colours <= g_vq_max_palette ? "in a palette" : "as R5G6B5",error.colour_max,error.non_finite);
+      dhLog(buf);
+   }
 
-   D3DXMatrixPerspectiveFovLH(&projection_matrix, //Result Matrix
-                              D3DX_PI/4,          //Field of View, in radians.
-                              aspect,             //Aspect ratio
-                              1.0f,               //Near view plane
-                              100.0f );           //Far view plane
+   if(info.state == AL_READY && info.bvh_stats.triangles > 0)
+	{
+      const mb_stats &tree = info.bvh_stats;
 
-   //Our Projection matrix won't change either, so we set it now and never touch
-   //it again.
-   g_d3d_device->SetTransform(D3DTS_PROJECTION, &projection_matrix);
+      sprintf(buf,"model: pick tree of %u nodes over %u triangles, depth %d, %.0f KB, built in %.1fms\n",
+              tree.nodes,tree.triangles,tree.depth,tree.bytes / 1024.0,tree.build_ms);
+      dhLog(buf);
+   }
 
 }
-
 //******************************************************************************************
-// Function:render
-// Whazzit:Clears the screen, renders our scene and then presents the results.
+// Function:init_wave
+// Whazzit:The wave's index buffer never changes, only its vertices do, so it is built
+//         once here.  Two clockwise (seen from above) triangles per grid square.
 //******************************************************************************************
-float bytesToFloatB(UINT loc)
-{
-	float output;
+void init_wave(void){
+const UINT side = (UINT)g_wave_size;
+const int index_size = mesh_index_size((size_t)side * side);
+std::vector<unsigned int> indices;
+std::vector<BYTE> packed;
 
-	*((BYTE*)(&output) + 3) = fileData.at(loc);
-	*((BYTE*)(&output) + 2) = fileData.at(loc+1);
-	*((BYTE*)(&output) + 1) = fileData.at(loc+2);
-	*((BYTE*)(&output) + 0) = fileData.at(loc+3);
+   g_ring.Init(g_device,g_ring_size,tri_fvf);
 
-	return output;
-}
+   if(side < 2)
+	{
+      g_wave_size = 0;
+      return;
+   }
 
-HRESULT render(void){
-HRESULT hr;
+   indices.reserve((size_t)(side - 1) * (side - 1) * 6);
+   for(UINT row = 0;row < side - 1;row++)
+	{
+      for(UINT col = 0;col < side - 1;col++)
+		{
+         const UINT a = row * side + col;
+         const UINT b = a + 1;
+         const UINT c = a + side;
+         const UINT d = c + 1;
 
-	move_cam();
-   //Clear the buffer to our new colour.
-   hr=g_d3d_device->Clear(0,  //Number of rectangles to clear, we're clearing everything so set it to 0
-                          NULL, //Pointer to the rectangles to clear, NULL to clear whole display
-                          D3DCLEAR_TARGET,   //What to clear.  We don't have a Z Buffer or Stencil Buffer
-                          0x00000000, //Colour to clear to (AARRGGBB)
-                          1.0f,  //Value to clear ZBuffer to, doesn't matter since we don't have one
-                          0 );   //Stencil clear value, again, we don't have one, this value doesn't matter
-   if(FAILED(hr))
+         indices.push_back(a); indices.push_back(c); indices.push_back(b);
+         indices.push_back(b); indices.push_back(c); indices.push_back(d);
+      }
+   }
+
+   packed.resize(indices.size() * index_size);
+   mesh_pack_indices(&indices[0],indices.size(),index_size,&packed[0]);
+   if(FAILED(g_resources.CreateIndexBuffer(g_device,"wave indices",&packed[0],(UINT)packed.size(),RD_USAGE_WRITEONLY,
+                                           index_size == 2 ? RD_FMT_INDEX16 : RD_FMT_INDEX32,g_static_pool,
+                                           &g_wave_ib)))
 	{
-      return hr;
+      dhLog("Unable to create the wave's index buffer\n");
+      g_wave_size = 0;
+      return;
    }
 
-   //Notify the device that we're ready to render
-   hr=g_d3d_device->BeginScene();
-   if(FAILED(hr))
+}
+//******************************************************************************************
+// Function:draw_wave
+// Whazzit:Writes this frame's grid straight into a slice of the ring and draws it from
+//         there.  The slice is vertex aligned so the base vertex can find it, and the
+//         draw is split into runs of rows under the 65535 primitive limit.
+//******************************************************************************************
+void draw_wave(void){
+const UINT side = (UINT)g_wave_size;
+const UINT count = side * side;
+const float step = 2.0f * g_wave_extent / (side - 1);
+const float t = g_draw_state.rot_cube;
+vr_alloc alloc;
+tri_vertex *vertex;
+UINT rows_per_draw;
+rq_item item;
+PROF_SCOPE("draw_wave");
+
+   if(side < 2 || !g_scene.IsVisible(OBJ_WAVE))
 	{
-      return hr;
+      return;
+   }
+
+   if(!g_ring.Lock(count * sizeof(tri_vertex),sizeof(tri_vertex),&alloc))
+	{
+      return;
    }
 
+   vertex = (tri_vertex *)alloc.data;
+   for(UINT row = 0;row < side;row++)
+	{
+      const float z = row * step - g_wave_extent;
+      const float ripple_z = cosf(z * 2.0f + t);
 
-   g_d3d_device->SetFVF(tri_fvf);
+      for(UINT col = 0;col < side;col++,vertex++)
+		{
+         const float x = col * step - g_wave_extent;
+         const float h = sinf(x * 3.0f + t * 2.0f) * ripple_z;
+         const int shade = 96 + (int)(h * 96.0f);
+
+         vertex->x = x;
+         vertex->y = h * g_wave_height;
+         vertex->z = z;
+         vertex->colour = D3DCOLOR_ARGB(255,0,shade / 2,shade + 32);
+      }
+   }
+   g_ring.Unlock();
+
+   item.draw = RQ_DRAW_INDEXED;
+   item.material = &g_wave_material;
+   item.vb = alloc.buffer;
+   item.stride = sizeof(tri_vertex);
+   item.ib = g_wave_ib;
+   memcpy(item.world,g_object_world[OBJ_WAVE],sizeof(item.world));
+   item.base_vertex = alloc.offset / sizeof(tri_vertex);
+   item.instances = NULL;
+   item.instance_count = 0;
+
+   rows_per_draw = 65535 / ((side - 1) * 2);
+   rows_per_draw = rows_per_draw ? rows_per_draw : 1;
+   for(UINT row = 0;row < side - 1;row += rows_per_draw)
+	{
+      const UINT rows = side - 1 - row < rows_per_draw ? side - 1 - row : rows_per_draw;
 
+      item.min_index = row * side;
+      item.num_vertices = (rows + 1) * side;
+      item.start_index = row * (side - 1) * 6;
+      item.prim_count = rows * (side - 1) * 2;
 
-   //Bind our Vertex Buffer
-   g_d3d_device->SetStreamSource(0,                   //StreamNumber
-                                 g_list_vb,           //StreamData
-                                 0,                   //OffsetInBytes
-                                 sizeof(tri_vertex)); //Stride
+      //Under everything else
+      g_queue.Submit(RQ_PASS_BACKGROUND,0.0f,item);
+      g_prims_drawn += item.prim_count;
+   }
 
+}
+//******************************************************************************************
+// Function:view_depth
+// Whazzit:View space z of an object's origin, which is what the queue sorts it by
+//******************************************************************************************
+float view_depth(const float *p_world){
 
+   return p_world[12] * view_matrix.m[0][2] + p_world[13] * view_matrix.m[1][2] +
+          p_world[14] * view_matrix.m[2][2] + view_matrix.m[3][2];
+}
+//******************************************************************************************
+// Function:submesh_item
+// Whazzit:One indexed draw of a shape out of g_list_vb/g_list_ib
+//******************************************************************************************
+void submesh_item(const mesh_submesh &p_mesh, const float *p_world, rq_item *p_item){
+
+   p_item->draw = RQ_DRAW_INDEXED;
+   p_item->material = &g_solid_material;
+   p_item->vb = g_list_vb;
+   p_item->stride = sizeof(tri_vertex);
+   p_item->ib = g_list_ib;
+   memcpy(p_item->world,p_world,sizeof(p_item->world));
+   p_item->base_vertex = 0;
+   p_item->min_index = p_mesh.min_vertex;
+   p_item->num_vertices = p_mesh.num_vertices;
+   p_item->start_index = p_mesh.start_index;
+   p_item->prim_count = p_mesh.prim_count;
+   p_item->instances = NULL;
+   p_item->instance_count = 0;
 
+}
+//******************************************************************************************
+// Function:draw_submesh
+// Whazzit:Queues a shape to be drawn
+//******************************************************************************************
+void draw_submesh(const mesh_submesh &p_mesh, const float *p_world){
+rq_item item;
 
-   
-   draw_cube2();
+   submesh_item(p_mesh,p_world,&item);
+   g_queue.Submit(RQ_PASS_SORTED,view_depth(p_world),item);
+   g_prims_drawn += p_mesh.prim_count;
 
-   draw_pyramid();
-   
-   draw_cube();
+}
+//******************************************************************************************
+// Function:init_stress
+// Whazzit:Lays the stress grid out across the view at z=0, in front of the fog.  Only
+//         the positions, scales and tints are set here, update_stress spins them.
+//******************************************************************************************
+void init_stress(void){
+unsigned long side;
+float spacing;
+float scale;
 
-   TCHAR buf[100];
-   sprintf(buf, _T("%f"), bytesToFloatB(0));
+   if(g_stress_count == 0)
+	{
+      return;
+   }
 
+   //Allocated once, every frame after this just rewrites the matrices
+   g_stress_instances.resize(g_stress_count);
+   g_stress_phase.resize(g_stress_count);
+   g_stress_angle.resize(g_stress_count);
+   g_stress_scale.resize(g_stress_count);
+   g_stress_x.resize(g_stress_count);
+   g_stress_y.resize(g_stress_count);
+   g_stress_z.resize(g_stress_count);
+   g_stress_cubes = (g_stress_count + 1) / 2;
+
+   side = (unsigned long)ceil(sqrt((double)g_stress_count));
+   spacing = 10.0f / side;
+   scale = spacing * 0.35f;
+
+   for(unsigned long i = 0;i < g_stress_count;i++)
+	{
+      rd_instance &instance = g_stress_instances[i];
+      //Interleave the two shapes on the grid even though they are stored apart
+      unsigned long cell = i < g_stress_cubes ? i * 2 : (i - g_stress_cubes) * 2 + 1;
+      unsigned long col = cell % side;
+      unsigned long row = cell / side;
+
+      memset(&instance,0,sizeof(instance));
+      instance.tint = D3DCOLOR_ARGB(255,128 + (int)(col * 127 / side),128 + (int)(row * 127 / side),255);
+
+      g_stress_scale[i] = scale;
+      g_stress_x[i] = (col + 0.5f) * spacing - 5.0f;
+      g_stress_y[i] = (row + 0.5f) * spacing * 0.6f - 3.0f;
+      g_stress_z[i] = 0.0f;
+      g_stress_phase[i] = (float)(cell % 64) * (VM_PI / 32.0f);
+   }
 
-   DrawScreenText(gFont, buf, 5, 5, C_WHITE);
+}
+//******************************************************************************************
+// Function:init_objects
+// Whazzit:Puts whatever init_stress/init_lists set up into the scene for culling, with
+//         the bounds of each object's mesh.  The transforms come every frame.
+//******************************************************************************************
+void init_objects(void){
 
+   g_scene.Clear();
 
+   if(g_stress_count)
+	{
+      for(unsigned long i = 0;i < g_stress_count;i++)
+		{
+         const mesh_submesh &mesh = i < g_stress_cubes ? g_cube_mesh : g_pyramid_mesh;
+         g_scene.AddObject(mesh.bounds_min,mesh.bounds_max);
+      }
+      return;
+   }
 
-   //Notify the device that we're finished rendering for this frame
-   g_d3d_device->EndScene();
+   g_scene.AddObject(g_cube_mesh.bounds_min,g_cube_mesh.bounds_max);        //OBJ_CUBE2
+   g_scene.AddObject(g_pyramid_mesh.bounds_min,g_pyramid_mesh.bounds_max);  //OBJ_PYRAMID
+   g_scene.AddObject(g_cube_mesh.bounds_min,g_cube_mesh.bounds_max);        //OBJ_CUBE
+   //The model is scaled to fit the cube's box, so the placeholder and the model share it
+   g_scene.AddObject(g_cube_mesh.bounds_min,g_cube_mesh.bounds_max);        //OBJ_MODEL
 
-   //Show the results
-   hr=g_d3d_device->Present(NULL,  //Source rectangle to display, NULL for all of it
-                            NULL,  //Destination rectangle, NULL to fill whole display
-                            NULL,  //Target window, if NULL uses device window set in CreateDevice
-                            NULL );//Unused parameter, set it to NULL
+   const float wave_min[3] = { -g_wave_extent,-g_wave_height,-g_wave_extent };
+   const float wave_max[3] = { g_wave_extent,g_wave_height,g_wave_extent };
+   g_scene.AddObject(wave_min,wave_max);                                    //OBJ_WAVE
 
-   return hr;
 }
 //******************************************************************************************
-// Function:draw_pyramid
-// Whazzit:Calculates the new rotation and position, then renders the pyramid
+// Function:update_stress
+// Whazzit:Spins every object about Y by the simulation's cube angle plus its own phase,
+//         a piece of the grid per job
 //******************************************************************************************
-void draw_pyramid(void){
-D3DXMATRIX rot_matrix;
-D3DXMATRIX trans_matrix;
-D3DXMATRIX world_matrix;
-static float rot_triangle=0.0f;
+void update_stress(void){
+PROF_SCOPE("update_stress");
+
+   g_stress_grain = g_jobs.AutoGrain(g_stress_count,g_stress_min_grain);
+   g_stress_pieces.resize((g_stress_count + g_stress_grain - 1) / g_stress_grain);
+   //The naive draws are an item each
+   for(size_t i = 0;i < g_stress_pieces.size();i++)
+	{
+      g_stress_pieces[i].list.Reserve(g_stress_grain);
+   }
+   g_queue.Reserve(g_stress_count);
+
+   g_jobs.ParallelFor(g_stress_count,g_stress_grain,update_stress_range,NULL);
 
+}
 
-   D3DXMatrixRotationY(&rot_matrix,rot_triangle);  //Rotate the pyramid
-   D3DXMatrixTranslation(&trans_matrix,-2.0f,0,0); //Shift it 2 units to the left
-   D3DXMatrixMultiply(&world_matrix,&rot_matrix,&trans_matrix);
+void update_stress_range(void *, size_t p_begin, size_t p_end){
+PROF_SCOPE("update_stress_job");
 
-   g_d3d_device->SetTransform(D3DTS_WORLD,&world_matrix);
+   for(size_t i = p_begin;i < p_end;i++)
+	{
+      g_stress_angle[i] = g_draw_state.rot_cube + g_stress_phase[i];
+   }
 
-   //Render from our Vertex Buffer
-   g_d3d_device->DrawPrimitive(D3DPT_TRIANGLELIST, //PrimitiveType
-                               0,                  //StartVertex
-                               g_pyramid_count);   //PrimitiveCount
+   //Written straight into the instance records, the tints are left alone
+   vm_compose_srt_y_batch(&g_stress_scale[p_begin],&g_stress_angle[p_begin],&g_stress_x[p_begin],
+                          &g_stress_y[p_begin],&g_stress_z[p_begin],p_end - p_begin,
+                          (vm_matrix *)g_stress_instances[p_begin].world,sizeof(rd_instance));
 
-   rot_triangle+=0.007f;
-   if(rot_triangle > D3DX_PI*2)
-	{  
-      rot_triangle-=D3DX_PI*2;
+   for(size_t i = p_begin;i < p_end;i++)
+	{
+      g_scene.SetTransform((int)i,*(const vm_matrix *)g_stress_instances[i].world);
    }
 
 }
 //******************************************************************************************
-// Function:draw_cube
-// Whazzit:Calculates the new rotation and position, then renders the cube
+// Function:draw_stress
+// Whazzit:Draws the stress grid, either as two instanced draws or the slow way with a
+//         transform and draw call per object.  The naive path can't apply the tints.
+//         Either way the jobs do the per object work and we only gather it up here.
 //******************************************************************************************
-void draw_cube(void){
-D3DXMATRIX rot_matrix;
-D3DXMATRIX trans_matrix;
-D3DXMATRIX world_matrix;
-static float rot_cube=0.0f;
-int start_vertex;
+void draw_stress(void){
+const rd_instance *cubes;
+const rd_instance *pyramids;
+unsigned long cube_count;
+unsigned long pyramid_count;
+rq_item item;
+PROF_SCOPE("draw_stress");
+
+   if(g_stress_naive)
+	{
+      g_jobs.ParallelFor(g_stress_count,g_stress_grain,record_stress_range,NULL);
+      for(size_t i = 0;i < g_stress_pieces.size();i++)
+		{
+         g_queue.Append(g_stress_pieces[i].list);
+         g_prims_drawn += g_stress_pieces[i].prims;
+      }
+      return;
+   }
 
+   cubes = &g_stress_instances[0];
+   pyramids = cubes + g_stress_cubes;
+   cube_count = g_stress_cubes;
+   pyramid_count = g_stress_count - g_stress_cubes;
 
-   //Offset past the pyramid, offset is given as the number of vertices to be skipped
-   start_vertex=g_pyramid_count * 3;
+   //Pack the survivors of culling, still cubes first so each shape stays one draw.  The
+   //jobs count their pieces' survivors, the offsets follow from the counts, then the
+   //jobs copy their survivors into place.
+   if(g_cull)
+	{
+      g_jobs.ParallelFor(g_stress_count,g_stress_grain,count_stress_range,NULL);
+
+      cube_count = 0;
+      pyramid_count = 0;
+      for(size_t i = 0;i < g_stress_pieces.size();i++)
+		{
+         g_stress_pieces[i].cube_offset = cube_count;
+         g_stress_pieces[i].pyramid_offset = pyramid_count;
+         cube_count += g_stress_pieces[i].cubes;
+         pyramid_count += g_stress_pieces[i].pyramids;
+      }
+      for(size_t i = 0;i < g_stress_pieces.size();i++)
+		{
+         g_stress_pieces[i].pyramid_offset += cube_count;
+      }
+
+      //Out of arena draws everything, unculled
+      g_stress_visible = g_frame_arena.Alloc<rd_instance>(cube_count + pyramid_count);
+      if(g_stress_visible)
+		{
+         g_jobs.ParallelFor(g_stress_count,g_stress_grain,pack_stress_range,NULL);
 
+         cubes = g_stress_visible;
+         pyramids = cubes + cube_count;
+      }
+      else
+		{
+         cube_count = g_stress_cubes;
+         pyramid_count = g_stress_count - g_stress_cubes;
+      }
+   }
 
-   D3DXMatrixRotationYawPitchRoll(&rot_matrix,0.0f,rot_cube,rot_cube);  //Rotate the cube
-   D3DXMatrixTranslation(&trans_matrix,2.0f,0,0); //Shift it 2 units to the right
-   D3DXMatrixMultiply(&world_matrix,&rot_matrix,&trans_matrix);   //Rot & Trans
+   //The grid is one layer at z=0, nothing overlaps so both sort at its depth
+   item.draw = RQ_DRAW_INDEXED_INSTANCED;
+   item.material = &g_solid_material;
+   item.vb = g_list_vb;
+   item.stride = sizeof(tri_vertex);
+   item.ib = g_list_ib;
+   memset(item.world,0,sizeof(item.world));
+   item.base_vertex = 0;
+
+   item.min_index = g_cube_mesh.min_vertex;
+   item.num_vertices = g_cube_mesh.num_vertices;
+   item.start_index = g_cube_mesh.start_index;
+   item.prim_count = g_cube_mesh.prim_count;
+   item.instances = cubes;
+   item.instance_count = cube_count;
+   g_queue.Submit(RQ_PASS_SORTED,view_matrix.m[3][2],item);
+
+   item.min_index = g_pyramid_mesh.min_vertex;
+   item.num_vertices = g_pyramid_mesh.num_vertices;
+   item.start_index = g_pyramid_mesh.start_index;
+   item.prim_count = g_pyramid_mesh.prim_count;
+   item.instances = pyramids;
+   item.instance_count = pyramid_count;
+   g_queue.Submit(RQ_PASS_SORTED,view_matrix.m[3][2],item);
+
+   g_prims_drawn += (unsigned long long)cube_count * g_cube_mesh.prim_count +
+                    (unsigned long long)pyramid_count * g_pyramid_mesh.prim_count;
+
+}
+//******************************************************************************************
+// Function:record_stress_range
+// Whazzit:The naive path's draws for a piece of the grid, into the piece's own list
+//******************************************************************************************
+void record_stress_range(void *, size_t p_begin, size_t p_end){
+stress_piece &piece = g_stress_pieces[p_begin / g_stress_grain];
+rq_item item;
+PROF_SCOPE("record_stress_job");
 
-   g_d3d_device->SetTransform(D3DTS_WORLD,&world_matrix);
+   piece.list.Clear();
+   piece.prims = 0;
 
-   //Render from our Vertex Buffer
-   g_d3d_device->DrawPrimitive(D3DPT_TRIANGLELIST, //PrimitiveType
-                               start_vertex,       //StartVertex
-                               g_cube_count);      //PrimitiveCount
+   for(size_t i = p_begin;i < p_end;i++)
+	{
+      if(g_scene.IsVisible((int)i))
+		{
+         const mesh_submesh &mesh = i < g_stress_cubes ? g_cube_mesh : g_pyramid_mesh;
+         const float *world = &g_stress_instances[i].world[0][0];
 
-   rot_cube+=0.006f;
-   if(rot_cube > D3DX_PI*2)
-	{  
-      rot_cube-=D3DX_PI*2;
+         submesh_item(mesh,world,&item);
+         piece.list.Submit(RQ_PASS_SORTED,view_depth(world),item);
+         piece.prims += mesh.prim_count;
+      }
    }
 
 }
-void draw_cube2(void) {
-	D3DXMATRIX rot_matrix;
-	D3DXMATRIX trans_matrix;
-	D3DXMATRIX scale_matrix;
-	D3DXMATRIX world_matrix;
-	
-	static float rot_cube = 0.0f;
-	int start_vertex;
 
+void count_stress_range(void *, size_t p_begin, size_t p_end){
+stress_piece &piece = g_stress_pieces[p_begin / g_stress_grain];
 
-	//Offset past the pyramid, offset is given as the number of vertices to be skipped
-	start_vertex = g_pyramid_count * 3;
+   piece.cubes = 0;
+   piece.pyramids = 0;
+   for(size_t i = p_begin;i < p_end;i++)
+	{
+      if(g_scene.IsVisible((int)i))
+		{
+         if(i < g_stress_cubes)
+			{
+            piece.cubes++;
+         }
+         else
+			{
+            piece.pyramids++;
+         }
+      }
+   }
 
+}
 
-	
-	D3DXMatrixRotationYawPitchRoll(&rot_matrix, 1.0f, 1.0f, 1.0f);  //Rotate the cube
-	D3DXMatrixTranslation(&trans_matrix, 0.0f, 0.0f, -3.0f); //Shift it
-	D3DXMatrixScaling(&scale_matrix, 1.0f, 1.0f, 1.0f);
-	
-	D3DXMatrixMultiply(&world_matrix, &rot_matrix, &trans_matrix);   //Rot & Trans
-	D3DXMatrixMultiply(&world_matrix, &world_matrix, &scale_matrix);
+void pack_stress_range(void *, size_t p_begin, size_t p_end){
+const stress_piece &piece = g_stress_pieces[p_begin / g_stress_grain];
+unsigned long cube = piece.cube_offset;
+unsigned long pyramid = piece.pyramid_offset;
+PROF_SCOPE("pack_stress_job");
 
-	g_d3d_device->SetTransform(D3DTS_WORLD, &world_matrix);
+   for(size_t i = p_begin;i < p_end;i++)
+	{
+      if(g_scene.IsVisible((int)i))
+		{
+         g_stress_visible[i < g_stress_cubes ? cube++ : pyramid++] = g_stress_instances[i];
+      }
+   }
 
-	//Render from our Vertex Buffer
-	g_d3d_device->DrawPrimitive(D3DPT_TRIANGLELIST, //PrimitiveType
-		start_vertex,       //StartVertex
-		g_cube_count);      //PrimitiveCount
 }
 //******************************************************************************************
 // Function:init_lists
-// Whazzit:Initialize the data in our Vertex Buffer
+// Whazzit:Build the shapes into an indexed mesh and load our Vertex and Index Buffers
 //******************************************************************************************
 HRESULT init_lists(void){
 tri_vertex data[]={
@@ -665,36 +3370,62 @@ tri_vertex data[]={
    { 1.0f, 1.0f, 1.0f,0xFF00FF00},{ 1.0f,-1.0f, 1.0f,0xFF00FF00},{ 1.0f,-1.0f,-1.0f,0xFF00FF00},
 
 };
-void *vb_vertices;
+const UINT prims[]={ g_pyramid_count, g_cube_count };
+mesh_data mesh;
+mesh_build_stats stats;
+std::vector<BYTE> ib_indices;
+rd_format index_format;
+int index_size;
+char buf[256];
 
 HRESULT hr;
 
-   hr=g_d3d_device->CreateVertexBuffer(sizeof(data),      //Length
-                                       D3DUSAGE_WRITEONLY,//Usage
-                                       tri_fvf,           //FVF
-                                       D3DPOOL_MANAGED,   //Pool
-                                       &g_list_vb,        //ppVertexBuffer
-                                       NULL);             //Handle
+   //Weld the expanded lists into shared vertices and reorder them for the vertex cache
+   mesh_build(data,prims,2,&mesh,&stats);
+   g_pyramid_mesh = mesh.submeshes[0];
+   g_cube_mesh = mesh.submeshes[1];
+
+   //Each shape's own triangles for picking, in object space
+   if(g_pick)
+	{
+      g_pyramid_bvh.Build(&mesh.vertices[0],&mesh.indices[g_pyramid_mesh.start_index],sizeof(unsigned int),
+                          g_pyramid_mesh.prim_count);
+      g_cube_bvh.Build(&mesh.vertices[0],&mesh.indices[g_cube_mesh.start_index],sizeof(unsigned int),
+                       g_cube_mesh.prim_count);
+   }
+
+   sprintf(buf,"mesh: %u -> %u vertices, ACMR %.2f unindexed, %.2f welded, %.2f optimized\n",
+           (UINT)stats.vertices_in,(UINT)stats.vertices_out,stats.acmr_before,stats.acmr_welded,stats.acmr_after);
+   dhLog(buf);
+
+   //The registry fills them, and refills them after a reset if they're in the default pool
+   hr=g_resources.CreateVertexBuffer(g_device,"scene vertices",  //Device, name
+                                     &mesh.vertices[0],         //Data
+                                     (UINT)(mesh.vertices.size() * sizeof(tri_vertex)),   //Length
+                                     RD_USAGE_WRITEONLY,        //Usage
+                                     tri_fvf,                   //FVF
+                                     g_static_pool,             //Pool
+                                     &g_list_vb);               //ppVertexBuffer
    if(FAILED(hr))
 	{
       dhLog("Error Creating vertex buffer",hr);
       return hr;
    }
 
-   hr=g_list_vb->Lock(0, //Offset
-                      0, //SizeToLock
-                      &vb_vertices, //Vertices
-                      0);  //Flags
+   index_size = mesh_index_size(mesh.vertices.size());
+   index_format = index_size == 2 ? RD_FMT_INDEX16 : RD_FMT_INDEX32;
+
+   ib_indices.resize(mesh.indices.size() * index_size);
+   mesh_pack_indices(&mesh.indices[0],mesh.indices.size(),index_size,&ib_indices[0]);
+
+   hr=g_resources.CreateIndexBuffer(g_device,"scene indices",&ib_indices[0],(UINT)ib_indices.size(),
+                                    RD_USAGE_WRITEONLY,index_format,g_static_pool,&g_list_ib);
    if(FAILED(hr))
 	{
-      dhLog("Error Locking vertex buffer",hr);
+      dhLog("Error Creating index buffer",hr);
       return hr;
    }
 
-   memcpy( vb_vertices, data,sizeof(data));
-
-   g_list_vb->Unlock();
-
 
    return D3D_OK;
 }
@@ -713,15 +3444,39 @@ LRESULT CALLBACK default_window_proc(HWND p_hwnd,UINT p_msg,WPARAM p_wparam,LPAR
             g_app_done=true;
          }
 
-		 if (p_wparam == VK_NUMPAD6)
-		 {
-			 x = x + 1.0;
-		 }
-		 if (p_wparam == VK_NUMPAD4)
-		 {
-			 x = x - 1.0;
-		 }
+         if(p_wparam == VK_F3) //Toggle the profiler HUD
+			{
+            g_show_profile = !g_show_profile;
+         }
+
+         if(p_wparam == VK_F4) //Toggle frustum culling
+			{
+            g_cull = !g_cull;
+         }
+
+         if(p_wparam == VK_F9) //Dump the profiler's timings now
+			{
+            dump_profile("profile.csv","profile.json");
+         }
+
+         if(p_wparam == VK_F11) //Capture the next frames, with -capture
+			{
+            g_capture_requested = true;
+         }
 
+         return 0;
+      case WM_MOUSEMOVE:   //Where picking aims
+         {
+            RECT client;
+
+            GetClientRect(p_hwnd,&client);
+            if(client.right > 0 && client.bottom > 0)
+				{
+               g_cursor_x = ((short)LOWORD(p_lparam) + 0.5f) * 2.0f / client.right - 1.0f;
+               g_cursor_y = 1.0f - ((short)HIWORD(p_lparam) + 0.5f) * 2.0f / client.bottom;
+               g_cursor_valid = true;
+            }
+         }
          return 0;
       case WM_CLOSE:    //User hit the Close Window button, end the app
       case WM_LBUTTONDOWN: //user hit the left mouse button
@@ -737,31 +3492,31 @@ void move_cam(void) {
 	//Here we build our View Matrix, think of it as our camera.
 
 	//First we specify that our viewpoint is 8 units back on the Z-axis
-	eye_vector = D3DXVECTOR3(0.0f, 0.0f, -8.0f);
+	eye_vector = vm_vec3(0.0f, 0.0f, -8.0f);
 
 	//We are looking towards the origin
-	lookat_vector = D3DXVECTOR3(x, y, z);
+	lookat_vector = vm_vec3(x, y, z);
 
 	//The "up" direction is the positive direction on the y-axis
-	up_vector = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+	up_vector = vm_vec3(0.0f, 1.0f, 0.0f);
 
-	D3DXMatrixLookAtLH(&view_matrix, &eye_vector,
-		&lookat_vector,
-		&up_vector);
+	vm_matrix_look_at_lh(&view_matrix, eye_vector,
+		lookat_vector,
+		up_vector);
 
 	//Since our 'camera' will never move, we can set this once at the
 	//beginning and never worry about it again
-	g_d3d_device->SetTransform(D3DTS_VIEW, &view_matrix);
+	g_states.SetTransform(g_device,RD_TS_VIEW, view_matrix);
 
 	aspect = ((float)g_width / (float)g_height);
 
-	D3DXMatrixPerspectiveFovLH(&projection_matrix, //Result Matrix
-		D3DX_PI / 4,          //Field of View, in radians.
+	vm_matrix_perspective_fov_lh(&projection_matrix, //Result Matrix
+		VM_PI / 4,          //Field of View, in radians.
 		aspect,             //Aspect ratio
 		1.0f,               //Near view plane
 		100.0f);           //Far view plane
 
 						   //Our Projection matrix won't change either, so we set it now and never touch
 						   //it again.
-	g_d3d_device->SetTransform(D3DTS_PROJECTION, &projection_matrix);
+	g_states.SetTransform(g_device,RD_TS_PROJECTION, projection_matrix);
 }
\ No newline at end of file
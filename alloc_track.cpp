@@ -0,0 +1,126 @@
+//
+// alloc_track.cpp - Counts heap allocations made while armed
+//
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include "alloc_track.h"
+
+#if defined(_MSC_VER) && defined(_DEBUG)
+  #include <crtdbg.h>
+  #define AT_CRT_HOOK
+#endif
+
+static std::atomic<bool> g_at_armed(false);
+static std::atomic<unsigned long long> g_at_allocs(0);
+static std::atomic<unsigned long long> g_at_bytes(0);
+
+static inline void count(size_t p_size){
+
+   if(g_at_armed.load(std::memory_order_relaxed))
+   {
+      g_at_allocs.fetch_add(1,std::memory_order_relaxed);
+      g_at_bytes.fetch_add(p_size,std::memory_order_relaxed);
+   }
+
+}
+
+#ifdef AT_CRT_HOOK
+static int __cdecl crt_hook(int p_type, void *, size_t p_size, int, long, const unsigned char *, int){
+
+   if(p_type == _HOOK_ALLOC || p_type == _HOOK_REALLOC)
+   {
+      count(p_size);
+   }
+
+   return TRUE;
+}
+#endif
+
+void at_arm(void){
+
+#ifdef AT_CRT_HOOK
+   static bool installed=false;
+
+   if(!installed)
+   {
+      _CrtSetAllocHook(crt_hook);
+      installed=true;
+   }
+#endif
+
+   g_at_allocs=0;
+   g_at_bytes=0;
+   g_at_armed=true;
+
+}
+
+unsigned long long at_disarm(void){
+
+   g_at_armed=false;
+
+   return g_at_allocs;
+}
+
+void at_get_stats(at_stats *p_stats){
+
+   p_stats->allocs=g_at_allocs;
+   p_stats->bytes=g_at_bytes;
+
+}
+//******************************************************************************************
+// Function:operator new
+// Whazzit:Every form ends up here.  Failure throws like the library's own, unless the
+//         caller asked for nothrow.
+//******************************************************************************************
+static void *allocate(size_t p_size){
+void *memory;
+
+#ifndef AT_CRT_HOOK
+   count(p_size);
+#endif
+
+   memory=malloc(p_size ? p_size : 1);
+   if(memory == NULL)
+   {
+      throw std::bad_alloc();
+   }
+
+   return memory;
+}
+
+void *operator new(size_t p_size) { return allocate(p_size); }
+void *operator new[](size_t p_size) { return allocate(p_size); }
+void operator delete(void *p_memory) noexcept { free(p_memory); }
+void operator delete[](void *p_memory) noexcept { free(p_memory); }
+void operator delete(void *p_memory, size_t) noexcept { free(p_memory); }
+void operator delete[](void *p_memory, size_t) noexcept { free(p_memory); }
+
+void *operator new(size_t p_size, const std::nothrow_t &) noexcept{
+
+   try
+   {
+      return allocate(p_size);
+   }
+   catch(...)
+   {
+      return NULL;
+   }
+
+}
+
+void *operator new[](size_t p_size, const std::nothrow_t &) noexcept{
+
+   try
+   {
+      return allocate(p_size);
+   }
+   catch(...)
+   {
+      return NULL;
+   }
+
+}
+
+void operator delete(void *p_memory, const std::nothrow_t &) noexcept { free(p_memory); }
+void operator delete[](void *p_memory, const std::nothrow_t &) noexcept { free(p_memory); }
@@ -0,0 +1,28 @@
+//
+// alloc_track.h - Counts heap allocations made while armed
+//
+// The global operator new and delete are replaced with versions that count every
+// allocation made between at_arm and at_disarm, on any thread.  That sees everything
+// the program allocates through new, the standard containers included.  The Microsoft
+// debug library also gets an allocation hook, which sees malloc, calloc and realloc
+// as well (new goes through it there, so it does the counting instead).  Release
+// builds elsewhere only see new.
+//
+// Arming costs nothing but an atomic load per allocation, so the benchmark wraps each
+// frame's render() in it to prove the frame runs without touching the heap.
+//
+#ifndef ALLOC_TRACK_H
+#define ALLOC_TRACK_H
+
+struct at_stats
+{
+   unsigned long long allocs;     //Since the last at_arm
+   unsigned long long bytes;
+};
+
+void at_arm(void);
+//Returns the allocations since at_arm
+unsigned long long at_disarm(void);
+void at_get_stats(at_stats *p_stats);
+
+#endif
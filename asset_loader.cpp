@@ -0,0 +1,870 @@
+//
+// asset_loader.cpp - Background mesh loading with a bounded per frame upload
+//
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "asset_loader.h"
+#include "mesh_build.h"
+#include "hires_timer.h"
+
+//Reading one byte per page is enough to fault the whole page in
+const size_t g_al_page_size = 4096;
+//Unchanged vertices a reload range will swallow rather than start another Lock
+const UINT g_al_reload_gap = 4;
+
+AssetLoader::AssetLoader(void) :
+   m_loading(0),m_quit(false),m_quantize(false),m_pickable(false),m_pool(RD_POOL_MANAGED),m_registry(NULL),
+   m_handle(-1)
+{
+}
+
+AssetLoader::~AssetLoader(void){
+
+   Shutdown();
+
+}
+
+int AssetLoader::Load(const char *p_cache, const char *p_source){
+mesh *item=new mesh;
+
+   item->cache_path=p_cache;
+   item->source_path=p_source;
+   item->state.store(AL_QUEUED);
+   item->status=MC_OK;
+   item->pool=m_pool;
+   item->vb=NULL;
+   item->ib=NULL;
+   item->vb_handle=-1;
+   item->ib_handle=-1;
+   item->vb_uploaded=0;
+   item->ib_uploaded=0;
+   item->upload_frames=0;
+   item->queued_time=hires_seconds();
+   item->staged_time=0.0;
+   item->ready_time=0.0;
+   memset(&item->data,0,sizeof(item->data));
+   item->quantize=m_quantize;
+   memset(&item->quant_params,0,sizeof(item->quant_params));
+   item->pickable=m_pickable;
+   item->reload.store(RL_IDLE);
+   item->reload_requested=false;
+   item->reload_full=false;
+   item->new_index_size=0;
+   item->dirty_next=0;
+   item->dirty_done=0;
+   item->index_done=0;
+   item->new_vb=NULL;
+   item->new_ib=NULL;
+   item->new_vb_handle=-1;
+   item->new_ib_handle=-1;
+   item->reload_bytes=0;
+   item->reload_time=0.0;
+   item->reloads=0;
+   item->last_full=false;
+   item->last_bytes=0;
+   item->last_ranges=0;
+   item->last_ms=0.0;
+   m_meshes.push_back(item);
+
+   Queue(item,false);
+
+   return (int)m_meshes.size() - 1;
+}
+
+void AssetLoader::SetPool(rd_pool p_pool, ResourceRegistry *p_registry){
+
+   m_pool=p_pool;
+   m_registry=p_registry;
+   if(m_registry && m_pool == RD_POOL_DEFAULT && m_handle < 0)
+   {
+      m_handle=m_registry->Register("mesh loader",RD_POOL_DEFAULT,0,LostThunk,ResetThunk,this);
+   }
+
+}
+
+void AssetLoader::Queue(mesh *p_mesh, bool p_reload){
+job entry={ p_mesh,p_reload };
+
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+
+      m_queue.push_back(entry);
+      m_quit=false;
+      if(!m_worker.joinable())
+      {
+         m_worker=std::thread(WorkerMain,this);
+      }
+   }
+   m_wake.notify_one();
+
+}
+
+void AssetLoader::Reload(int p_handle){
+mesh *item=m_meshes[p_handle];
+const int reload=item->reload.load(std::memory_order_acquire);
+
+   if(item->state.load(std::memory_order_acquire) == AL_FAILED)
+   {
+      //Nothing resident to diff against, so start over with a fresh load.  The worker
+      //is done with a failed mesh, and an upload that failed may have left buffers.
+      ReleaseBuffer(&item->vb,&item->vb_handle);
+      ReleaseBuffer(&item->ib,&item->ib_handle);
+      item->vb_uploaded=0;
+      item->ib_uploaded=0;
+      item->upload_frames=0;
+      item->queued_time=hires_seconds();
+      item->staged_time=0.0;
+      item->ready_time=0.0;
+      memset(&item->data,0,sizeof(item->data));
+      item->reload_requested=false;
+      item->state.store(AL_QUEUED);
+      Queue(item,false);
+      return;
+   }
+
+   if(item->state.load() != AL_READY || (reload != RL_IDLE && reload != RL_FAILED))
+   {
+      item->reload_requested=true;
+      return;
+   }
+
+   item->reload_requested=false;
+   item->reload_time=hires_seconds();
+   item->reload.store(RL_DECODING);
+   Queue(item,true);
+
+}
+//******************************************************************************************
+// Function:LoadMesh
+// Whazzit:Worker side.  OpenOrBuild does any decoding, then one read per page pulls the
+//         sections in so the render thread's copies don't fault.
+//******************************************************************************************
+void AssetLoader::LoadMesh(mesh *p_mesh){
+const MappedFile &file=p_mesh->cache.GetFile();
+const mc_header *header;
+volatile unsigned char sink=0;
+
+   p_mesh->state.store(AL_LOADING);
+   p_mesh->scan=dd_result();
+   p_mesh->status=p_mesh->cache.OpenOrBuild(p_mesh->cache_path.c_str(),p_mesh->source_path.c_str(),
+                                            g_be_tri_vertex_layout,&p_mesh->scan);
+
+   if(p_mesh->status == MC_OK && p_mesh->cache.GetVertices() == NULL)
+   {
+      //Not laid out like tri_vertex, we have no way to draw it
+      p_mesh->status=MC_BAD_HEADER;
+   }
+
+   if(p_mesh->status == MC_OK)
+   {
+      p_mesh->data.vertices=p_mesh->cache.GetVertices();
+      p_mesh->data.vertex_count=p_mesh->cache.GetVertexCount();
+      p_mesh->data.indices=p_mesh->cache.GetIndices();
+      p_mesh->data.index_count=p_mesh->cache.GetIndexCount();
+      p_mesh->data.index_size=p_mesh->cache.GetIndexSize();
+      p_mesh->data.bounds=p_mesh->cache.GetBounds()[0];
+      p_mesh->data.stride=sizeof(tri_vertex);
+
+      header=&p_mesh->cache.GetHeader();
+      file.Advise(MF_ADVISE_WILLNEED);
+
+      for(uint64_t i=header->vertices.offset;i < header->indices.offset + header->indices.size;i+=g_al_page_size)
+      {
+         sink=sink + file.GetData()[i];
+      }
+
+      if(p_mesh->quantize)
+      {
+         vq_encode(p_mesh->data.vertices,p_mesh->data.vertex_count,&p_mesh->quant);
+         vq_quantization(p_mesh->quant,&p_mesh->quant_params);
+         p_mesh->data.stride=sizeof(tri_qvertex);
+         p_mesh->data.quant=&p_mesh->quant_params;
+      }
+
+      if(p_mesh->pickable)
+      {
+         p_mesh->bvh.Build(p_mesh->data.vertices,p_mesh->data.indices,p_mesh->data.index_size,
+                           p_mesh->data.index_count / 3);
+         p_mesh->data.bvh=&p_mesh->bvh;
+      }
+   }
+
+   p_mesh->staged_time=hires_seconds();
+   p_mesh->state.store(p_mesh->status == MC_OK ? AL_STAGED : AL_FAILED,std::memory_order_release);
+
+}
+
+//Whether the two encodings decode with the same scale, bias and palette
+static bool same_decode(const vq_mesh &p_a, const vq_mesh &p_b){
+
+   return memcmp(p_a.scale,p_b.scale,sizeof(p_a.scale)) == 0 && memcmp(p_a.bias,p_b.bias,sizeof(p_a.bias)) == 0 &&
+          p_a.palette == p_b.palette;
+}
+
+//******************************************************************************************
+// Function:ReloadMesh
+// Whazzit:Worker side.  Index i of the resident mesh is still record i of the dump, so
+//         if the record count is the same each record's new value can go straight into
+//         its welded vertex.  That only works while every record sharing a vertex still
+//         agrees on it; the first that doesn't sends us down the full reweld instead.
+//         The resident data is only read here, the render thread doesn't change it
+//         until it sees RL_STAGED.
+//******************************************************************************************
+void AssetLoader::ReloadMesh(mesh *p_mesh){
+const al_mesh_data &old=p_mesh->data;
+std::vector<tri_vertex> decoded;
+std::vector<unsigned char> seen;
+std::vector<unsigned int> welded;
+bool patch;
+
+   if(!mc_decode_source(p_mesh->source_path.c_str(),g_be_tri_vertex_layout,&decoded,&p_mesh->scan))
+   {
+      p_mesh->reload.store(RL_FAILED,std::memory_order_release);
+      return;
+   }
+
+   patch=decoded.size() == old.index_count;
+   if(patch)
+   {
+      p_mesh->new_vertices.assign(old.vertices,old.vertices + old.vertex_count);
+      seen.assign(old.vertex_count,0);
+
+      for(UINT i=0;i<old.index_count && patch;i++)
+      {
+         const UINT index=al_index(old,i);
+
+         if(!seen[index])
+         {
+            seen[index]=1;
+            p_mesh->new_vertices[index]=decoded[i];
+         }
+         else
+         {
+            patch=memcmp(&p_mesh->new_vertices[index],&decoded[i],sizeof(tri_vertex)) == 0;
+         }
+      }
+   }
+
+   p_mesh->dirty.clear();
+   p_mesh->new_indices.clear();
+   if(patch)
+   {
+      for(UINT i=0;i<old.vertex_count;i++)
+      {
+         if(memcmp(&p_mesh->new_vertices[i],&old.vertices[i],sizeof(tri_vertex)) == 0)
+         {
+            continue;
+         }
+
+         if(!p_mesh->dirty.empty() &&
+            i - (p_mesh->dirty.back().start + p_mesh->dirty.back().count) <= g_al_reload_gap)
+         {
+            p_mesh->dirty.back().count=i + 1 - p_mesh->dirty.back().start;
+         }
+         else
+         {
+            range entry={ i,1 };
+            p_mesh->dirty.push_back(entry);
+         }
+      }
+      p_mesh->new_index_size=old.index_size;
+   }
+   else
+   {
+      mesh_weld(decoded.empty() ? NULL : &decoded[0],decoded.size(),&p_mesh->new_vertices,&welded);
+      p_mesh->new_index_size=mesh_index_size(p_mesh->new_vertices.size());
+      p_mesh->new_indices.resize(welded.size() * p_mesh->new_index_size);
+      if(!welded.empty())
+      {
+         mesh_pack_indices(&welded[0],welded.size(),p_mesh->new_index_size,&p_mesh->new_indices[0]);
+      }
+   }
+   if(p_mesh->quantize)
+   {
+      vq_encode(p_mesh->new_vertices.empty() ? NULL : &p_mesh->new_vertices[0],p_mesh->new_vertices.size(),
+                &p_mesh->new_quant);
+      if(patch && !same_decode(p_mesh->quant,p_mesh->new_quant))
+      {
+         //Every vertex decodes differently now, so it all goes up, into new buffers
+         //like any other full reload.  The indices are as they were.
+         patch=false;
+         p_mesh->dirty.clear();
+         p_mesh->new_indices.assign((const unsigned char *)old.indices,
+                                    (const unsigned char *)old.indices + (size_t)old.index_count * old.index_size);
+      }
+   }
+   p_mesh->reload_full=!patch;
+
+   for(int k=0;k<3;k++)
+   {
+      p_mesh->new_bounds.min[k]=p_mesh->new_vertices.empty() ? 0.0f : HUGE_VALF;
+      p_mesh->new_bounds.max[k]=p_mesh->new_vertices.empty() ? 0.0f : -HUGE_VALF;
+   }
+   for(size_t i=0;i<p_mesh->new_vertices.size();i++)
+   {
+      const float pos[3]={ p_mesh->new_vertices[i].x,p_mesh->new_vertices[i].y,p_mesh->new_vertices[i].z };
+
+      for(int k=0;k<3;k++)
+      {
+         p_mesh->new_bounds.min[k]=pos[k] < p_mesh->new_bounds.min[k] ? pos[k] : p_mesh->new_bounds.min[k];
+         p_mesh->new_bounds.max[k]=pos[k] > p_mesh->new_bounds.max[k] ? pos[k] : p_mesh->new_bounds.max[k];
+      }
+   }
+
+   if(p_mesh->pickable)
+   {
+      //A patch keeps the resident indices, a full reload has its own
+      if(p_mesh->reload_full)
+      {
+         p_mesh->new_bvh.Build(p_mesh->new_vertices.empty() ? NULL : &p_mesh->new_vertices[0],
+                               p_mesh->new_indices.empty() ? NULL : &p_mesh->new_indices[0],p_mesh->new_index_size,
+                               (UINT)(p_mesh->new_indices.size() / p_mesh->new_index_size / 3));
+      }
+      else
+      {
+         p_mesh->new_bvh.Build(p_mesh->new_vertices.empty() ? NULL : &p_mesh->new_vertices[0],old.indices,
+                               old.index_size,old.index_count / 3);
+      }
+   }
+
+   p_mesh->dirty_next=0;
+   p_mesh->dirty_done=0;
+   p_mesh->index_done=0;
+   p_mesh->reload_bytes=0;
+   p_mesh->reload.store(RL_STAGED,std::memory_order_release);
+
+}
+
+void AssetLoader::WorkerMain(AssetLoader *p_self){
+std::unique_lock<std::mutex> lock(p_self->m_lock);
+
+   for(;;)
+   {
+      while(!p_self->m_quit && p_self->m_queue.empty())
+      {
+         p_self->m_wake.wait(lock);
+      }
+      if(p_self->m_quit)
+      {
+         break;
+      }
+
+      job entry=p_self->m_queue.front();
+      p_self->m_queue.pop_front();
+      p_self->m_loading++;
+
+      lock.unlock();
+      if(entry.reload)
+      {
+         p_self->ReloadMesh(entry.item);
+      }
+      else
+      {
+         p_self->LoadMesh(entry.item);
+      }
+      lock.lock();
+
+      p_self->m_loading--;
+      if(p_self->m_queue.empty() && p_self->m_loading == 0)
+      {
+         p_self->m_idle.notify_all();
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:copy_chunk
+// Whazzit:Copies the next piece of p_src into p_buffer at p_offset, at most *p_budget
+//         bytes.  *p_done counts what has gone up so far.
+//******************************************************************************************
+static bool copy_chunk(RenderBuffer *p_buffer, size_t p_offset, const void *p_src, size_t p_size,
+                       size_t *p_done, size_t *p_budget){
+size_t amount=p_size - *p_done;
+void *dst;
+
+   if(amount > *p_budget)
+   {
+      amount=*p_budget;
+   }
+   if(amount == 0)
+   {
+      return true;
+   }
+
+   if(FAILED(p_buffer->Lock((UINT)(p_offset + *p_done),(UINT)amount,&dst,0)))
+   {
+      return false;
+   }
+   memcpy(dst,(const unsigned char *)p_src + *p_done,amount);
+   p_buffer->Unlock();
+
+   *p_done+=amount;
+   *p_budget-=amount;
+
+   return true;
+}
+
+static const tri_qvertex *vertex_data(const vq_mesh &p_quant){
+
+   return p_quant.vertices.empty() ? NULL : &p_quant.vertices[0];
+}
+
+static DWORD vertex_fvf(bool p_quantized){
+
+   return p_quantized ? RD_FVF_QUANTIZED : RD_FVF_XYZ | RD_FVF_DIFFUSE;
+}
+//******************************************************************************************
+// Function:UploadMesh
+// Whazzit:Creates the buffers the first time a staged mesh comes through, then copies
+//         vertices and then indices until the budget runs out.  Returns false if the
+//         mesh failed.
+//******************************************************************************************
+bool AssetLoader::UploadMesh(RenderDevice *p_device, mesh *p_mesh, size_t *p_budget){
+const al_mesh_data &data=p_mesh->data;
+const size_t vb_size=(size_t)data.vertex_count * data.stride;
+const size_t ib_size=(size_t)data.index_count * data.index_size;
+const void *vertices=p_mesh->quantize ? (const void *)vertex_data(p_mesh->quant) : (const void *)data.vertices;
+
+   if(p_mesh->state.load() == AL_STAGED)
+   {
+      if(vb_size && FAILED(p_device->CreateVertexBuffer((UINT)vb_size,RD_USAGE_WRITEONLY,vertex_fvf(p_mesh->quantize),
+                                                        p_mesh->pool,&p_mesh->vb)))
+      {
+         return false;
+      }
+      RegisterBuffer(p_mesh,"mesh vertices",p_mesh->vb,vb_size,&p_mesh->vb_handle);
+      if(ib_size && FAILED(p_device->CreateIndexBuffer((UINT)ib_size,RD_USAGE_WRITEONLY,
+                                                       data.index_size == 2 ? RD_FMT_INDEX16 : RD_FMT_INDEX32,
+                                                       p_mesh->pool,&p_mesh->ib)))
+      {
+         return false;
+      }
+      RegisterBuffer(p_mesh,"mesh indices",p_mesh->ib,ib_size,&p_mesh->ib_handle);
+      p_mesh->state.store(AL_UPLOADING);
+   }
+
+   if(*p_budget > 0)
+   {
+      p_mesh->upload_frames++;
+   }
+
+   if(!copy_chunk(p_mesh->vb,0,vertices,vb_size,&p_mesh->vb_uploaded,p_budget) ||
+      !copy_chunk(p_mesh->ib,0,data.indices,ib_size,&p_mesh->ib_uploaded,p_budget))
+   {
+      return false;
+   }
+
+   if(p_mesh->vb_uploaded == vb_size && p_mesh->ib_uploaded == ib_size)
+   {
+      p_mesh->ready_time=hires_seconds();
+      p_mesh->state.store(AL_READY);
+   }
+
+   return true;
+}
+
+//******************************************************************************************
+// Function:UploadReload
+// Whazzit:A patch goes range by range into the live vertex buffer; a full reload fills
+//         new buffers and swaps them in once they are complete, so nothing half
+//         written is ever drawn.  Once everything is up the new data becomes resident.
+//         Returns false if the buffers couldn't be made or locked.
+//******************************************************************************************
+bool AssetLoader::UploadReload(RenderDevice *p_device, mesh *p_mesh, size_t *p_budget){
+const size_t vb_size=p_mesh->new_vertices.size() * p_mesh->data.stride;
+const size_t ib_size=p_mesh->new_indices.size();
+const unsigned char *vertices=p_mesh->quantize ? (const unsigned char *)vertex_data(p_mesh->new_quant) :
+                                                 (const unsigned char *)(p_mesh->new_vertices.empty() ? NULL :
+                                                                         &p_mesh->new_vertices[0]);
+const size_t before=*p_budget;
+bool done;
+
+   if(p_mesh->reload_full)
+   {
+      if(p_mesh->new_vb == NULL && vb_size &&
+         FAILED(p_device->CreateVertexBuffer((UINT)vb_size,RD_USAGE_WRITEONLY,vertex_fvf(p_mesh->quantize),
+                                             p_mesh->pool,&p_mesh->new_vb)))
+      {
+         return false;
+      }
+      RegisterBuffer(p_mesh,"mesh vertices",p_mesh->new_vb,vb_size,&p_mesh->new_vb_handle);
+      if(p_mesh->new_ib == NULL && ib_size &&
+         FAILED(p_device->CreateIndexBuffer((UINT)ib_size,RD_USAGE_WRITEONLY,
+                                            p_mesh->new_index_size == 2 ? RD_FMT_INDEX16 : RD_FMT_INDEX32,
+                                            p_mesh->pool,&p_mesh->new_ib)))
+      {
+         return false;
+      }
+      RegisterBuffer(p_mesh,"mesh indices",p_mesh->new_ib,ib_size,&p_mesh->new_ib_handle);
+
+      if(!copy_chunk(p_mesh->new_vb,0,vertices,vb_size,&p_mesh->dirty_done,p_budget) ||
+         !copy_chunk(p_mesh->new_ib,0,p_mesh->new_indices.empty() ? NULL : &p_mesh->new_indices[0],ib_size,
+                     &p_mesh->index_done,p_budget))
+      {
+         return false;
+      }
+      done=p_mesh->dirty_done == vb_size && p_mesh->index_done == ib_size;
+   }
+   else
+   {
+      while(p_mesh->dirty_next < p_mesh->dirty.size() && *p_budget > 0)
+      {
+         const range &entry=p_mesh->dirty[p_mesh->dirty_next];
+         const size_t offset=(size_t)entry.start * p_mesh->data.stride;
+         const size_t size=(size_t)entry.count * p_mesh->data.stride;
+
+         if(!copy_chunk(p_mesh->vb,offset,vertices + offset,size,&p_mesh->dirty_done,p_budget))
+         {
+            return false;
+         }
+         if(p_mesh->dirty_done == size)
+         {
+            p_mesh->dirty_next++;
+            p_mesh->dirty_done=0;
+         }
+      }
+      done=p_mesh->dirty_next == p_mesh->dirty.size();
+   }
+
+   p_mesh->reload_bytes+=before - *p_budget;
+   if(!done)
+   {
+      return true;
+   }
+
+   if(p_mesh->reload_full)
+   {
+      ReleaseBuffer(&p_mesh->vb,&p_mesh->vb_handle);
+      ReleaseBuffer(&p_mesh->ib,&p_mesh->ib_handle);
+      p_mesh->vb=p_mesh->new_vb;
+      p_mesh->ib=p_mesh->new_ib;
+      p_mesh->vb_handle=p_mesh->new_vb_handle;
+      p_mesh->ib_handle=p_mesh->new_ib_handle;
+      p_mesh->new_vb=NULL;
+      p_mesh->new_ib=NULL;
+      p_mesh->new_vb_handle=-1;
+      p_mesh->new_ib_handle=-1;
+
+      p_mesh->indices.swap(p_mesh->new_indices);
+      p_mesh->data.indices=p_mesh->indices.empty() ? NULL : &p_mesh->indices[0];
+      p_mesh->data.index_size=p_mesh->new_index_size;
+      p_mesh->data.index_count=(UINT)(p_mesh->indices.size() / p_mesh->new_index_size);
+   }
+   p_mesh->vertices.swap(p_mesh->new_vertices);
+   p_mesh->data.vertices=p_mesh->vertices.empty() ? NULL : &p_mesh->vertices[0];
+   p_mesh->data.vertex_count=(UINT)p_mesh->vertices.size();
+   p_mesh->data.bounds=p_mesh->new_bounds;
+   if(p_mesh->quantize)
+   {
+      //A patch decodes exactly as before, so the parameters the device was given stay
+      //put and only the vertices change hands
+      p_mesh->quant.vertices.swap(p_mesh->new_quant.vertices);
+      p_mesh->quant.error=p_mesh->new_quant.error;
+      if(p_mesh->reload_full)
+      {
+         p_mesh->quant.palette.swap(p_mesh->new_quant.palette);
+         memcpy(p_mesh->quant.scale,p_mesh->new_quant.scale,sizeof(p_mesh->quant.scale));
+         memcpy(p_mesh->quant.bias,p_mesh->new_quant.bias,sizeof(p_mesh->quant.bias));
+         vq_quantization(p_mesh->quant,&p_mesh->quant_params);
+      }
+      p_mesh->new_quant=vq_mesh();
+   }
+   if(p_mesh->pickable)
+   {
+      p_mesh->bvh.Swap(p_mesh->new_bvh);
+      p_mesh->new_bvh.Clear();
+   }
+
+   p_mesh->reloads++;
+   p_mesh->last_full=p_mesh->reload_full;
+   p_mesh->last_bytes=p_mesh->reload_bytes;
+   p_mesh->last_ranges=p_mesh->reload_full ? 0 : (unsigned int)p_mesh->dirty.size();
+   p_mesh->last_ms=(hires_seconds() - p_mesh->reload_time) * 1000.0;
+
+   std::vector<tri_vertex>().swap(p_mesh->new_vertices);
+   std::vector<unsigned char>().swap(p_mesh->new_indices);
+   p_mesh->dirty.clear();
+   p_mesh->reload.store(RL_IDLE);
+
+   return true;
+}
+
+size_t AssetLoader::Pump(RenderDevice *p_device, size_t p_budget){
+size_t budget=p_budget;
+
+   for(size_t i=0;i<m_meshes.size() && budget > 0;i++)
+   {
+      mesh *item=m_meshes[i];
+      int state=item->state.load(std::memory_order_acquire);
+
+      if(state == AL_STAGED || state == AL_UPLOADING)
+      {
+         if(!UploadMesh(p_device,item,&budget))
+         {
+            item->status=MC_WRITE_FAILED;
+            item->state.store(AL_FAILED);
+         }
+         continue;
+      }
+
+      if(state == AL_FAILED && item->reload_requested)
+      {
+         //Asked for while it was loading, the file may be fixed by now
+         Reload((int)i);
+         continue;
+      }
+      if(state != AL_READY)
+      {
+         continue;
+      }
+
+      const int reload=item->reload.load(std::memory_order_acquire);
+      if(reload == RL_STAGED && !UploadReload(p_device,item,&budget))
+      {
+         //The old buffers are untouched on a full reload, and a patch that failed to
+         //lock leaves at worst some stale vertices, so keep drawing what we have
+         ReleaseBuffer(&item->new_vb,&item->new_vb_handle);
+         ReleaseBuffer(&item->new_ib,&item->new_ib_handle);
+         item->new_bvh.Clear();
+         item->reload.store(RL_FAILED);
+      }
+      else if(item->reload_requested && reload != RL_DECODING && reload != RL_STAGED)
+      {
+         Reload((int)i);
+      }
+   }
+
+   return p_budget - budget;
+}
+
+void AssetLoader::Finish(RenderDevice *p_device){
+
+   {
+      std::unique_lock<std::mutex> lock(m_lock);
+
+      while(!m_queue.empty() || m_loading > 0)
+      {
+         m_idle.wait(lock);
+      }
+   }
+
+   Pump(p_device,(size_t)-1);
+
+}
+
+bool AssetLoader::IsBusy(void) const{
+
+   for(size_t i=0;i<m_meshes.size();i++)
+   {
+      int state=m_meshes[i]->state.load();
+
+      if(state != AL_READY && state != AL_FAILED)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+al_state AssetLoader::GetState(int p_handle) const{
+
+   return (al_state)m_meshes[p_handle]->state.load(std::memory_order_acquire);
+}
+
+void AssetLoader::GetInfo(int p_handle, al_mesh_info *p_info) const{
+const mesh *item=m_meshes[p_handle];
+
+   p_info->state=GetState(p_handle);
+   p_info->status=item->status;
+   p_info->bytes_total=0;
+   p_info->bytes_uploaded=item->vb_uploaded + item->ib_uploaded;
+   p_info->upload_frames=item->upload_frames;
+   p_info->staged_ms=0.0;
+   p_info->ready_ms=0.0;
+   p_info->quantized=item->quantize;
+   memset(&p_info->quant_error,0,sizeof(p_info->quant_error));
+   memset(&p_info->bvh_stats,0,sizeof(p_info->bvh_stats));
+
+   if(p_info->state >= AL_STAGED && p_info->state != AL_FAILED)
+   {
+      p_info->bytes_total=(size_t)item->data.vertex_count * item->data.stride +
+                          (size_t)item->data.index_count * item->data.index_size;
+      p_info->staged_ms=(item->staged_time - item->queued_time) * 1000.0;
+      if(item->quantize)
+      {
+         p_info->quant_error=item->quant.error;
+      }
+      if(item->pickable)
+      {
+         p_info->bvh_stats=item->bvh.GetStats();
+      }
+   }
+   if(p_info->state == AL_READY)
+   {
+      p_info->ready_ms=(item->ready_time - item->queued_time) * 1000.0;
+   }
+
+   p_info->reloads=item->reloads;
+   p_info->reload_full=item->last_full;
+   p_info->reload_bytes=item->last_bytes;
+   p_info->reload_ranges=item->last_ranges;
+   p_info->reload_ms=item->last_ms;
+   p_info->reload_pending=item->reload_requested || item->reload.load() == RL_DECODING ||
+                          item->reload.load() == RL_STAGED;
+   p_info->reload_failed=item->reload.load() == RL_FAILED;
+
+}
+
+//******************************************************************************************
+// Function:release_buffer
+// Whazzit:Releases *p_buffer if there is one and clears it
+//******************************************************************************************
+static void release_buffer(RenderBuffer **p_buffer){
+
+   if(*p_buffer)
+   {
+      (*p_buffer)->Release();
+      *p_buffer=NULL;
+   }
+
+}
+//******************************************************************************************
+// Function:RegisterBuffer
+// Whazzit:Lists a buffer just made in the registry.  One that lost its buffer to a reset
+//         is still listed, so making it again doesn't add it twice.
+//******************************************************************************************
+void AssetLoader::RegisterBuffer(const mesh *p_mesh, const char *p_name, RenderBuffer *p_buffer, size_t p_bytes,
+                                 rr_handle *p_handle){
+
+   if(m_registry && p_buffer && *p_handle < 0)
+   {
+      *p_handle=m_registry->Register(p_name,p_mesh->pool,(UINT)p_bytes,NULL,NULL,NULL);
+   }
+
+}
+
+void AssetLoader::ReleaseBuffer(RenderBuffer **p_buffer, rr_handle *p_handle){
+
+   release_buffer(p_buffer);
+   if(m_registry && *p_handle >= 0)
+   {
+      m_registry->Unregister(*p_handle);
+   }
+   *p_handle=-1;
+
+}
+
+void AssetLoader::LostThunk(void *p_data){
+
+   ((AssetLoader *)p_data)->OnLostDevice();
+
+}
+
+HRESULT AssetLoader::ResetThunk(RenderDevice *p_device, void *p_data){
+
+   return ((AssetLoader *)p_data)->OnResetDevice(p_device);
+}
+//******************************************************************************************
+// Function:OnLostDevice
+// Whazzit:Every default pool buffer goes, they stay listed in the registry.  A reload
+//         that was uploading starts its upload again, a patch into the old vertex
+//         buffer would otherwise be written over by the refill.
+//******************************************************************************************
+void AssetLoader::OnLostDevice(void){
+
+   for(size_t i=0;i<m_meshes.size();i++)
+   {
+      mesh *item=m_meshes[i];
+
+      if(item->pool != RD_POOL_DEFAULT)
+      {
+         continue;
+      }
+
+      release_buffer(&item->vb);
+      release_buffer(&item->ib);
+      release_buffer(&item->new_vb);
+      release_buffer(&item->new_ib);
+      if(item->reload.load(std::memory_order_acquire) == RL_STAGED)
+      {
+         item->dirty_next=0;
+         item->dirty_done=0;
+         item->index_done=0;
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:OnResetDevice
+// Whazzit:Uploads every default pool mesh that had buffers again in one go.  A mesh that
+//         was part way through its first upload comes back finished.
+//******************************************************************************************
+HRESULT AssetLoader::OnResetDevice(RenderDevice *p_device){
+HRESULT result=S_OK;
+
+   for(size_t i=0;i<m_meshes.size();i++)
+   {
+      mesh *item=m_meshes[i];
+      const int state=item->state.load(std::memory_order_acquire);
+      const double ready_time=item->ready_time;
+      const unsigned int upload_frames=item->upload_frames;
+      size_t budget=(size_t)-1;
+
+      if(item->pool != RD_POOL_DEFAULT || (state != AL_UPLOADING && state != AL_READY))
+      {
+         continue;
+      }
+
+      item->state.store(AL_STAGED);
+      item->vb_uploaded=0;
+      item->ib_uploaded=0;
+      if(!UploadMesh(p_device,item,&budget))
+      {
+         item->status=MC_WRITE_FAILED;
+         item->state.store(AL_FAILED);
+         result=SUCCEEDED(result) ? E_FAIL : result;
+         continue;
+      }
+      item->ready_time=state == AL_READY ? ready_time : item->ready_time;
+      item->upload_frames=upload_frames;
+   }
+
+   return result;
+}
+
+void AssetLoader::Shutdown(void){
+
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+
+      m_quit=true;
+      m_queue.clear();
+   }
+   m_wake.notify_all();
+
+   if(m_worker.joinable())
+   {
+      m_worker.join();
+   }
+
+   for(size_t i=0;i<m_meshes.size();i++)
+   {
+      ReleaseBuffer(&m_meshes[i]->vb,&m_meshes[i]->vb_handle);
+      ReleaseBuffer(&m_meshes[i]->ib,&m_meshes[i]->ib_handle);
+      ReleaseBuffer(&m_meshes[i]->new_vb,&m_meshes[i]->new_vb_handle);
+      ReleaseBuffer(&m_meshes[i]->new_ib,&m_meshes[i]->new_ib_handle);
+      delete m_meshes[i];
+   }
+   m_meshes.clear();
+   m_loading=0;
+
+   if(m_registry)
+   {
+      m_registry->Unregister(m_handle);
+   }
+   m_registry=NULL;
+   m_handle=-1;
+
+}
@@ -0,0 +1,283 @@
+//
+// asset_loader.h - Background mesh loading with a bounded per frame upload
+//
+// Load queues a mesh cache (see mesh_cache.h) and returns at once.  A worker thread
+// opens it, rebuilding it from its dump first if it is stale, and then reads through
+// the vertex and index sections so they are resident before the render thread needs
+// them; the mapped file is the staging memory, nothing is copied on the worker.
+//
+// The render thread calls Pump once a frame.  It creates the buffers for each staged
+// mesh and copies at most p_budget bytes a frame into them with partial Locks, so a
+// big mesh is spread over several frames instead of stalling one.  Until a mesh is
+// AL_READY the caller draws a placeholder in its place.
+//
+// Reload re-reads a ready mesh's dump on the worker and diffs it against what is
+// resident.  When the dump has the same records and every welded vertex still gets one
+// value, the index buffer is kept and only the runs of vertices that changed go up,
+// through partial Locks on the live vertex buffer under the same budget.  Anything
+// else (records added or removed, a shared vertex split) rewelds the mesh and uploads
+// it into new buffers that replace the old ones once they are complete.  The cache
+// file is left alone; it is stale now and gets rebuilt on the next start.
+//
+// Whenever the worker reads a dump it checks every record as it decodes it (see
+// dump_decode.h).  A load that finds bad records fails with MC_BAD_DATA, a reload
+// fails and leaves the old mesh drawing, and GetScan says which records they were.
+//
+// With SetQuantize on, the worker also encodes each mesh to tri_qvertex (see
+// vertex_quant.h) and that is what goes into the vertex buffer, at half the size.  The
+// float vertices stay resident for picking and the like.  A reload that moves the
+// mesh's box or changes its colours changes how every vertex decodes, so it goes up
+// as a full reload even when the vertices could have been patched.
+//
+// With SetPickable on, the worker builds a MeshBVH (see mesh_bvh.h) over each mesh
+// after loading it, and again after each reload, so ray queries against it never
+// hold up the render thread.  A reload's tree replaces the old one when the reload's
+// buffers do.
+//
+// SetPool picks the pool the buffers go in and the ResourceRegistry that lists them.
+// In the default pool a device reset loses them, and the loader makes them again from
+// the resident data during the registry's OnResetDevice, all at once rather than
+// under the budget, so the mesh is back on the first frame after.
+//
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "render_device.h"
+#include "mesh_cache.h"
+#include "vertex_quant.h"
+#include "mesh_bvh.h"
+#include "resource_registry.h"
+
+//Upload budget per Pump when the caller has no better idea
+const size_t g_al_default_budget = 4 * 1024 * 1024;
+
+enum al_state
+{
+   AL_QUEUED,
+   AL_LOADING,          //Worker is opening/rebuilding the cache and paging it in
+   AL_STAGED,           //Waiting for the render thread
+   AL_UPLOADING,
+   AL_READY,
+   AL_FAILED
+};
+
+//What the render thread draws from, valid from AL_STAGED on
+struct al_mesh_data
+{
+   const tri_vertex *vertices;   //Always floats, whatever the vertex buffer holds
+   UINT vertex_count;
+   UINT stride;               //Of the vertex buffer
+   const rd_quantization *quant;   //NULL unless the vertex buffer is RD_FVF_QUANTIZED
+   const void *indices;
+   UINT index_count;
+   int index_size;
+   mc_bounds bounds;          //The whole mesh
+   const MeshBVH *bvh;        //NULL unless it was loaded pickable
+};
+
+//Index p_index of the mesh, whichever size they are
+inline UINT al_index(const al_mesh_data &p_data, UINT p_index){
+
+   if(p_data.index_size == 2)
+   {
+      return ((const uint16_t *)p_data.indices)[p_index];
+   }
+
+   return ((const uint32_t *)p_data.indices)[p_index];
+}
+
+struct al_mesh_info
+{
+   al_state state;
+   mc_status status;          //Why it failed, when it did
+   size_t bytes_total;        //Vertex and index bytes to upload
+   size_t bytes_uploaded;
+   unsigned int upload_frames;   //Pumps that uploaded part of it
+   double staged_ms;          //From Load to AL_STAGED
+   double ready_ms;           //From Load to AL_READY
+   bool quantized;            //The vertex buffer holds tri_qvertex
+   vq_error quant_error;      //Of the resident encoding, when it does
+   mb_stats bvh_stats;        //Of the resident tree, zero unless it is pickable
+
+   //The last finished reload
+   unsigned int reloads;
+   bool reload_full;          //Rewelded rather than patched
+   size_t reload_bytes;       //Uploaded for it
+   unsigned int reload_ranges;   //Partial Locks it took
+   double reload_ms;          //From Reload to the buffers being current
+   bool reload_pending;       //One is in flight
+   bool reload_failed;        //The last one didn't take, the dump was unreadable or bad
+};
+
+class AssetLoader
+{
+public:
+   AssetLoader(void);
+   ~AssetLoader(void);
+
+   //Queues the cache at p_cache, built from p_source when needed.  Returns a handle.
+   int Load(const char *p_cache, const char *p_source);
+   //Whether meshes Loaded from now on are uploaded quantized.  Only turn it on when the
+   //device CanQuantize.
+   void SetQuantize(bool p_quantize) { m_quantize=p_quantize; }
+   //Whether meshes Loaded from now on get a MeshBVH for ray queries
+   void SetPickable(bool p_pickable) { m_pickable=p_pickable; }
+   //The pool for the buffers of meshes Loaded from now on, and the registry to list
+   //every buffer in.  p_registry may be NULL; set it before the first Load, Shutdown
+   //forgets it.
+   void SetPool(rd_pool p_pool, ResourceRegistry *p_registry);
+   //Re-reads the mesh's dump and patches its buffers.  Calls that arrive before it is
+   //ready or while a reload is in flight are folded into one more reload afterwards.  A
+   //mesh that failed to load is queued for a fresh Load instead.
+   void Reload(int p_handle);
+
+   //Render thread only.  Uploads up to p_budget bytes of staged meshes, returns how
+   //much it did.
+   size_t Pump(RenderDevice *p_device, size_t p_budget=g_al_default_budget);
+   //Blocks until nothing is queued or loading, then uploads everything staged.  For
+   //benchmarks and the synchronous comparison path.
+   void Finish(RenderDevice *p_device);
+   //True while any mesh is neither AL_READY nor AL_FAILED
+   bool IsBusy(void) const;
+
+   al_state GetState(int p_handle) const;
+   void GetInfo(int p_handle, al_mesh_info *p_info) const;
+   //Valid once the mesh is AL_READY
+   RenderBuffer *GetVertexBuffer(int p_handle) const { return m_meshes[p_handle]->vb; }
+   RenderBuffer *GetIndexBuffer(int p_handle) const { return m_meshes[p_handle]->ib; }
+   //Render thread only, valid from AL_STAGED on
+   const al_mesh_data &GetData(int p_handle) const { return m_meshes[p_handle]->data; }
+   //Render thread only.  The check of the mesh's dump (see dump_decode.h) by the last
+   //load or reload that read it, valid from AL_STAGED or AL_FAILED on and not while a
+   //reload is pending.  Its file_size is 0 when the cache was current.
+   const dd_result &GetScan(int p_handle) const { return m_meshes[p_handle]->scan; }
+
+   //Render thread only.  Releases the default pool buffers, and makes them again from
+   //the resident data after the device's Reset.  The registry calls these.
+   void OnLostDevice(void);
+   HRESULT OnResetDevice(RenderDevice *p_device);
+
+   //Releases every mesh's buffers and stops the worker
+   void Shutdown(void);
+
+private:
+   AssetLoader(const AssetLoader &);
+   AssetLoader &operator=(const AssetLoader &);
+
+   enum reload_state
+   {
+      RL_IDLE,
+      RL_DECODING,         //Worker is reading the dump and diffing it
+      RL_STAGED,           //Render thread is uploading the result
+      RL_FAILED            //Dump unreadable or bad, the old mesh stays
+   };
+
+   //A run of vertices to re-upload, in vertices
+   struct range
+   {
+      UINT start;
+      UINT count;
+   };
+
+   struct mesh
+   {
+      std::string cache_path;
+      std::string source_path;
+      std::atomic<int> state;      //al_state, the worker publishes AL_STAGED/AL_FAILED
+      mc_status status;
+      dd_result scan;              //Written by the worker with status, and by a reload
+      MeshCache cache;
+      rd_pool pool;
+      RenderBuffer *vb;
+      RenderBuffer *ib;
+      rr_handle vb_handle;         //In the registry, -1 when there isn't one
+      rr_handle ib_handle;
+      size_t vb_uploaded;
+      size_t ib_uploaded;
+      unsigned int upload_frames;
+      double queued_time;
+      double staged_time;
+      double ready_time;
+
+      //Resident data, in the cache mapping until a reload replaces it
+      al_mesh_data data;
+      std::vector<tri_vertex> vertices;
+      std::vector<unsigned char> indices;
+      bool quantize;
+      vq_mesh quant;               //What the vertex buffer holds, when quantize is set
+      rd_quantization quant_params;
+      bool pickable;
+      MeshBVH bvh;                 //Over the resident data, when pickable is set
+
+      //Reload, written by the worker while RL_DECODING and read by the render thread
+      //once it sees RL_STAGED
+      std::atomic<int> reload;
+      bool reload_requested;
+      bool reload_full;
+      std::vector<tri_vertex> new_vertices;
+      std::vector<unsigned char> new_indices;
+      vq_mesh new_quant;
+      MeshBVH new_bvh;
+      int new_index_size;
+      mc_bounds new_bounds;
+      std::vector<range> dirty;
+      size_t dirty_next;           //Range being uploaded
+      size_t dirty_done;           //Bytes of it uploaded, or of the new vertex buffer
+      size_t index_done;           //Bytes of the new index buffer uploaded
+      RenderBuffer *new_vb;        //Full reloads only
+      RenderBuffer *new_ib;
+      rr_handle new_vb_handle;
+      rr_handle new_ib_handle;
+      size_t reload_bytes;
+      double reload_time;
+
+      //The last finished reload
+      unsigned int reloads;
+      bool last_full;
+      size_t last_bytes;
+      unsigned int last_ranges;
+      double last_ms;
+   };
+
+   struct job
+   {
+      mesh *item;
+      bool reload;
+   };
+
+   void LoadMesh(mesh *p_mesh);
+   void ReloadMesh(mesh *p_mesh);
+   bool UploadMesh(RenderDevice *p_device, mesh *p_mesh, size_t *p_budget);
+   bool UploadReload(RenderDevice *p_device, mesh *p_mesh, size_t *p_budget);
+   void RegisterBuffer(const mesh *p_mesh, const char *p_name, RenderBuffer *p_buffer, size_t p_bytes,
+                       rr_handle *p_handle);
+   void ReleaseBuffer(RenderBuffer **p_buffer, rr_handle *p_handle);
+   static void LostThunk(void *p_data);
+   static HRESULT ResetThunk(RenderDevice *p_device, void *p_data);
+   void Queue(mesh *p_mesh, bool p_reload);
+   static void WorkerMain(AssetLoader *p_self);
+
+   std::vector<mesh *> m_meshes;
+   std::deque<job> m_queue;
+   mutable std::mutex m_lock;
+   std::condition_variable m_wake;
+   std::condition_variable m_idle;
+   std::thread m_worker;
+   int m_loading;
+   bool m_quit;
+   bool m_quantize;
+   bool m_pickable;
+   rd_pool m_pool;
+   ResourceRegistry *m_registry;
+   rr_handle m_handle;          //Ours, for the lost and reset callbacks
+};
+
+#endif
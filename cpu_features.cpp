@@ -0,0 +1,114 @@
+//
+// cpu_features.cpp - Runtime detection of the SIMD instruction sets we have kernels for
+//
+#include "cpu_features.h"
+
+#ifdef CPU_X86
+   #ifdef _MSC_VER
+      #include <intrin.h>
+   #else
+      #include <cpuid.h>
+   #endif
+#endif
+
+static cpu_level g_max_level=CPU_LEVEL_AVX2;
+
+#ifdef CPU_X86
+//******************************************************************************************
+// Function:query_cpuid
+// Whazzit:Fills p_regs with eax,ebx,ecx,edx for the given leaf/subleaf
+//******************************************************************************************
+static void query_cpuid(int p_leaf, int p_subleaf, unsigned int p_regs[4]){
+#ifdef _MSC_VER
+int regs[4];
+
+   __cpuidex(regs,p_leaf,p_subleaf);
+   p_regs[0]=regs[0]; p_regs[1]=regs[1]; p_regs[2]=regs[2]; p_regs[3]=regs[3];
+#else
+   __cpuid_count(p_leaf,p_subleaf,p_regs[0],p_regs[1],p_regs[2],p_regs[3]);
+#endif
+}
+//******************************************************************************************
+// Function:os_saves_ymm
+// Whazzit:The CPU supporting AVX isn't enough, the OS has to save the YMM state on a
+//         context switch too.  That's what XGETBV tells us.
+//******************************************************************************************
+static bool os_saves_ymm(void){
+unsigned long long xcr0;
+
+#ifdef _MSC_VER
+   xcr0=_xgetbv(0);
+#else
+   unsigned int lo,hi;
+   __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+   xcr0=((unsigned long long)hi << 32) | lo;
+#endif
+
+   return (xcr0 & 6) == 6;
+}
+#endif
+//******************************************************************************************
+// Function:detect_level
+// Whazzit:Works out the best instruction set we can use, once.
+//******************************************************************************************
+static cpu_level detect_level(void){
+#ifdef CPU_X86
+unsigned int regs[4];
+unsigned int max_leaf;
+
+   query_cpuid(0,0,regs);
+   max_leaf=regs[0];
+   if(max_leaf < 1)
+   {
+      return CPU_LEVEL_SCALAR;
+   }
+
+   query_cpuid(1,0,regs);
+   if(!(regs[3] & (1 << 26)))
+   {
+      return CPU_LEVEL_SCALAR;
+   }
+   if(!(regs[2] & (1 << 9)))
+   {
+      return CPU_LEVEL_SSE2;
+   }
+   if(!(regs[2] & (1 << 19)))
+   {
+      return CPU_LEVEL_SSSE3;
+   }
+
+   //AVX (bit 28), OSXSAVE (bit 27) and FMA (bit 12) are all needed before we look at AVX2
+   if(!(regs[2] & (1 << 28)) || !(regs[2] & (1 << 27)) || !(regs[2] & (1 << 12)) ||
+      max_leaf < 7 || !os_saves_ymm())
+   {
+      return CPU_LEVEL_SSE41;
+   }
+
+   query_cpuid(7,0,regs);
+   if(!(regs[1] & (1 << 5)))
+   {
+      return CPU_LEVEL_SSE41;
+   }
+
+   return CPU_LEVEL_AVX2;
+#else
+   return CPU_LEVEL_SCALAR;
+#endif
+}
+
+cpu_level cpu_get_level(void){
+static cpu_level detected=detect_level();
+
+   return detected < g_max_level ? detected : g_max_level;
+}
+
+void cpu_set_max_level(cpu_level p_level){
+
+   g_max_level=p_level;
+
+}
+
+bool cpu_has_sse2(void)  { return cpu_get_level() >= CPU_LEVEL_SSE2; }
+bool cpu_has_ssse3(void) { return cpu_get_level() >= CPU_LEVEL_SSSE3; }
+bool cpu_has_sse41(void) { return cpu_get_level() >= CPU_LEVEL_SSE41; }
+bool cpu_has_avx2(void)  { return cpu_get_level() >= CPU_LEVEL_AVX2; }
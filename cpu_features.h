@@ -0,0 +1,42 @@
+//
+// cpu_features.h - Runtime detection of the SIMD instruction sets we have kernels for
+//
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+   #define CPU_X86 1
+#endif
+
+//GCC and Clang only let us use intrinsics for instruction sets the function is
+//compiled for, MSVC lets us use them anywhere.
+#if defined(CPU_X86) && defined(__GNUC__)
+   #define TARGET_SSE2  __attribute__((target("sse2")))
+   #define TARGET_SSSE3 __attribute__((target("ssse3")))
+   #define TARGET_SSE41 __attribute__((target("sse4.1")))
+   #define TARGET_AVX2  __attribute__((target("avx2,fma")))
+#else
+   #define TARGET_SSE2
+   #define TARGET_SSSE3
+   #define TARGET_SSE41
+   #define TARGET_AVX2
+#endif
+
+bool cpu_has_sse2(void);
+bool cpu_has_ssse3(void);
+bool cpu_has_sse41(void);
+bool cpu_has_avx2(void);   //Also requires FMA and OS support for the YMM registers
+
+//Lets benchmarks force the slower paths.  Disabling a level disables everything above it.
+enum cpu_level
+{
+   CPU_LEVEL_SCALAR,
+   CPU_LEVEL_SSE2,
+   CPU_LEVEL_SSSE3,
+   CPU_LEVEL_SSE41,
+   CPU_LEVEL_AVX2
+};
+void cpu_set_max_level(cpu_level p_level);
+cpu_level cpu_get_level(void);
+
+#endif
@@ -0,0 +1,1042 @@
+//
+// d3d9_device.cpp - RenderDevice on top of IDirect3DDevice9
+//
+#include <string.h>
+#include <d3dx9.h>
+#include "d3d9_device.h"
+#include "vertex_quant.h"
+
+//Instances per lock of the dynamic instance buffer
+const UINT g_instance_chunk = 4096;
+
+//Stream 0 is the mesh (tri_vertex), stream 1 is the rd_instance array as-is
+static const D3DVERTEXELEMENT9 g_instance_decl[]={
+   {0, 0,D3DDECLTYPE_FLOAT3,  D3DDECLMETHOD_DEFAULT,D3DDECLUSAGE_POSITION,0},
+   {0,12,D3DDECLTYPE_D3DCOLOR,D3DDECLMETHOD_DEFAULT,D3DDECLUSAGE_COLOR,   0},
+   {1, 0,D3DDECLTYPE_FLOAT4,  D3DDECLMETHOD_DEFAULT,D3DDECLUSAGE_TEXCOORD,0},
+   {1,16,D3DDECLTYPE_FLOAT4,  D3DDECLMETHOD_DEFAULT,D3DDECLUSAGE_TEXCOORD,1},
+   {1,32,D3DDECLTYPE_FLOAT4,  D3DDECLMETHOD_DEFAULT,D3DDECLUSAGE_TEXCOORD,2},
+   {1,48,D3DDECLTYPE_FLOAT4,  D3DDECLMETHOD_DEFAULT,D3DDECLUSAGE_TEXCOORD,3},
+   {1,64,D3DDECLTYPE_D3DCOLOR,D3DDECLMETHOD_DEFAULT,D3DDECLUSAGE_COLOR,   1},
+   D3DDECL_END()
+};
+
+//c0-c3 view*proj (transposed), c4 the z column of the view matrix,
+//c5 x=fog end, y=1/(end-start), z=fog on, w=0 when lit (no lights, so black)
+static const char g_instance_vs[]=
+   "float4x4 view_proj : register(c0);\n"
+   "float4 view_z : register(c4);\n"
+   "float4 params : register(c5);\n"
+   "struct vs_out { float4 pos : POSITION; float4 colour : COLOR0; float fog : TEXCOORD0; };\n"
+   "vs_out main(float3 pos : POSITION, float4 colour : COLOR0, float4 row0 : TEXCOORD0,\n"
+   "            float4 row1 : TEXCOORD1, float4 row2 : TEXCOORD2, float4 row3 : TEXCOORD3,\n"
+   "            float4 tint : COLOR1){\n"
+   "   vs_out o;\n"
+   "   float4 world=pos.x * row0 + pos.y * row1 + pos.z * row2 + row3;\n"
+   "   o.pos=mul(world,view_proj);\n"
+   "   o.colour=colour * tint;\n"
+   "   o.colour.rgb*=params.w;\n"
+   "   o.fog=lerp(1.0,saturate((params.x - dot(world,view_z)) * params.y),params.z);\n"
+   "   return o;\n"
+   "}\n";
+
+//c0 fog colour.  ps_3_0 has no fixed function fog, so it is blended here.
+static const char g_instance_ps[]=
+   "float4 fog_colour : register(c0);\n"
+   "float4 main(float4 colour : COLOR0, float fog : TEXCOORD0) : COLOR0 {\n"
+   "   return float4(lerp(fog_colour.rgb,colour.rgb,fog),colour.a);\n"
+   "}\n";
+
+//tri_qvertex, the colour index comes in as w
+static const D3DVERTEXELEMENT9 g_quant_decl[]={
+   {0,0,D3DDECLTYPE_SHORT4,D3DDECLMETHOD_DEFAULT,D3DDECLUSAGE_POSITION,0},
+   D3DDECL_END()
+};
+
+//First constant of the palette, after the ones below
+const UINT g_quant_palette_reg = 10;
+
+//c0-c3 world*view*proj (transposed), c4 the z column of world*view, c5 as for instancing,
+//c6 scale, c7 bias, c8 x=1 for R5G6B5 colours, y=last palette index, c10 on the palette
+//(g_vq_max_palette of them, which is as many as vs_2_0 has room for).  SHORT4 is signed,
+//so an index over 32767 arrives negative.
+static const char g_quant_vs[]=
+   "float4x4 world_view_proj : register(c0);\n"
+   "float4 view_z : register(c4);\n"
+   "float4 params : register(c5);\n"
+   "float4 scale : register(c6);\n"
+   "float4 bias : register(c7);\n"
+   "float4 colour_mode : register(c8);\n"
+   "float4 palette[240] : register(c10);\n"
+   "struct vs_out { float4 pos : POSITION; float4 colour : COLOR0; float fog : FOG; };\n"
+   "vs_out main(float4 packed : POSITION){\n"
+   "   vs_out o;\n"
+   "   float4 pos=float4(packed.xyz * scale.xyz + bias.xyz,1.0);\n"
+   "   float index=packed.w < 0.0 ? packed.w + 65536.0 : packed.w;\n"
+   "   float4 rgb=float4(floor(index / 2048.0) / 31.0,fmod(floor(index / 32.0),64.0) / 63.0,\n"
+   "                     fmod(index,32.0) / 31.0,1.0);\n"
+   "   o.pos=mul(pos,world_view_proj);\n"
+   "   o.colour=lerp(palette[(int)min(index,colour_mode.y)],rgb,colour_mode.x);\n"
+   "   o.colour.rgb*=params.w;\n"
+   "   o.fog=lerp(1.0,saturate((params.x - dot(pos,view_z)) * params.y),params.z);\n"
+   "   return o;\n"
+   "}\n";
+
+D3D9Device::D3D9Device(IDirect3DDevice9 *p_device) :
+   m_device(p_device),
+   m_fvf(0),
+   m_stream(NULL),
+   m_stream_offset(0),
+   m_stream_stride(0),
+   m_bound_indices(NULL),
+   m_lighting(true),
+   m_fog_enable(false),
+   m_cull_mode(D3DCULL_CCW),
+   m_fog_vertex_mode(D3DFOG_NONE),
+   m_fog_colour(0),
+   m_fog_start(0.0f),
+   m_fog_end(1.0f),
+   m_instancing_tried(false),
+   m_instancing(false),
+   m_decl(NULL),
+   m_vs(NULL),
+   m_ps(NULL),
+   m_indices(NULL),
+   m_index_count(0),
+   m_instance_vb(NULL),
+   m_instance_pos(0),
+   m_quant_tried(false),
+   m_quant_ok(false),
+   m_quant_decl(NULL),
+   m_quant_vs(NULL),
+   m_quant(NULL),
+   m_quant_dirty(true),
+   m_glyph_indices(NULL),
+   m_registry(NULL),
+   m_indices_handle(-1),
+   m_glyph_handle(-1),
+   m_fence_issued(0),
+   m_fence_done(0),
+   m_fence_failed(false){
+
+   for(int i=0;i<3;i++)
+   {
+      D3DXMatrixIdentity((D3DXMATRIX *)&m_transforms[i]);
+   }
+   memset(m_fence_queries,0,sizeof(m_fence_queries));
+
+}
+
+D3D9Device::~D3D9Device(void){
+
+   OnLostDevice();
+
+   if(m_glyph_indices)
+   {
+      m_glyph_indices->Release();
+   }
+   if(m_indices)
+   {
+      m_indices->Release();
+   }
+   if(m_ps)
+   {
+      m_ps->Release();
+   }
+   if(m_vs)
+   {
+      m_vs->Release();
+   }
+   if(m_decl)
+   {
+      m_decl->Release();
+   }
+   if(m_quant_vs)
+   {
+      m_quant_vs->Release();
+   }
+   if(m_quant_decl)
+   {
+      m_quant_decl->Release();
+   }
+
+}
+
+void D3D9Device::OnLostDevice(void){
+
+   if(m_instance_vb)
+   {
+      m_instance_vb->Release();
+      m_instance_vb=NULL;
+   }
+   m_instance_pos=0;
+
+   for(UINT i=0;i<g_fence_queries;i++)
+   {
+      if(m_fence_queries[i])
+      {
+         m_fence_queries[i]->Release();
+         m_fence_queries[i]=NULL;
+      }
+   }
+   //Reset finishes everything that was submitted
+   m_fence_done=m_fence_issued;
+
+}
+HRESULT D3D9Device::OnResetDevice(void){
+
+   //Reset put the device's state back to its defaults, so the shadows go back too
+   m_fvf=0;
+   m_stream=NULL;
+   m_stream_offset=0;
+   m_stream_stride=0;
+   m_bound_indices=NULL;
+   for(int i=0;i<3;i++)
+   {
+      D3DXMatrixIdentity((D3DXMATRIX *)&m_transforms[i]);
+   }
+   m_lighting=true;
+   m_fog_enable=false;
+   m_cull_mode=D3DCULL_CCW;
+   m_fog_vertex_mode=D3DFOG_NONE;
+   m_fog_colour=0;
+   m_fog_start=0.0f;
+   m_fog_end=1.0f;
+   m_quant_dirty=true;
+
+   if(m_instancing && m_instance_vb == NULL)
+   {
+      return CreateInstanceBuffer();
+   }
+
+   return D3D_OK;
+}
+
+HRESULT D3D9Device::CreateInstanceBuffer(void){
+HRESULT hr;
+
+   hr=m_device->CreateVertexBuffer(g_instance_chunk * sizeof(rd_instance),D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY,
+                                   0,D3DPOOL_DEFAULT,&m_instance_vb,NULL);
+   if(FAILED(hr))
+   {
+      m_instance_vb=NULL;
+      return hr;
+   }
+   m_instance_pos=0;
+
+   return D3D_OK;
+}
+//******************************************************************************************
+// Function:InsertFence
+// Whazzit:Issues an event query at the end of what has been submitted.  The query's
+//         slot is reused every g_fence_queries fences, so if the fence that had it is
+//         somehow still pending we wait for it first.
+//******************************************************************************************
+rd_fence D3D9Device::InsertFence(void){
+const rd_fence fence=m_fence_issued + 1;
+IDirect3DQuery9 **query=&m_fence_queries[fence % g_fence_queries];
+
+   m_fence_issued=fence;
+   if(m_fence_failed)
+   {
+      return fence;
+   }
+
+   if(fence > g_fence_queries)
+   {
+      while(!FenceDone(fence - g_fence_queries))
+      {
+      }
+   }
+
+   if(*query == NULL && FAILED(m_device->CreateQuery(D3DQUERYTYPE_EVENT,query)))
+   {
+      *query=NULL;
+      m_fence_failed=true;
+      return fence;
+   }
+   (*query)->Issue(D3DISSUE_END);
+
+   return fence;
+}
+//******************************************************************************************
+// Function:FenceDone
+// Whazzit:Fences finish in order, so this walks forward from the last one known to be
+//         done and stops at the first still pending.  The flush makes sure the queries
+//         actually reach the GPU rather than sitting in the command buffer.
+//******************************************************************************************
+bool D3D9Device::FenceDone(rd_fence p_fence){
+HRESULT hr;
+
+   while(m_fence_done < p_fence && !m_fence_failed)
+   {
+      IDirect3DQuery9 *query=m_fence_queries[(m_fence_done + 1) % g_fence_queries];
+
+      hr=query ? query->GetData(NULL,0,D3DGETDATA_FLUSH) : S_OK;
+      if(hr == S_FALSE)
+      {
+         return false;
+      }
+      //Done, or the device is lost, which finishes it just as well
+      m_fence_done++;
+   }
+
+   return p_fence <= m_fence_done;
+}
+
+HRESULT D3D9Device::CreateVertexBuffer(UINT p_length, DWORD p_usage, DWORD p_fvf, rd_pool p_pool,
+                                       RenderBuffer **p_buffer){
+IDirect3DVertexBuffer9 *vb;
+HRESULT hr;
+
+   //D3D only sees quantized vertices through the declaration
+   hr=m_device->CreateVertexBuffer(p_length,p_usage,(p_fvf & RD_FVF_QUANTIZED) ? 0 : p_fvf,(D3DPOOL)p_pool,&vb,
+                                   NULL);
+   if(FAILED(hr))
+   {
+      *p_buffer=NULL;
+      return hr;
+   }
+
+   *p_buffer=new D3D9Buffer(vb,p_length,p_pool);
+
+   return D3D_OK;
+}
+
+HRESULT D3D9Device::CreateIndexBuffer(UINT p_length, DWORD p_usage, rd_format p_format, rd_pool p_pool,
+                                      RenderBuffer **p_buffer){
+IDirect3DIndexBuffer9 *ib;
+HRESULT hr;
+
+   hr=m_device->CreateIndexBuffer(p_length,p_usage,(D3DFORMAT)p_format,(D3DPOOL)p_pool,&ib,NULL);
+   if(FAILED(hr))
+   {
+      *p_buffer=NULL;
+      return hr;
+   }
+
+   *p_buffer=new D3D9IndexBuffer(ib,p_length,p_pool);
+
+   return D3D_OK;
+}
+
+//******************************************************************************************
+// Function:CreateTexture
+// Whazzit:Plenty of D3D9 parts can't sample A8, those get a 32 bit texture instead
+//******************************************************************************************
+HRESULT D3D9Device::CreateTexture(UINT p_width, UINT p_height, RenderTexture **p_texture){
+IDirect3DTexture9 *texture;
+D3DFORMAT format=D3DFMT_A8;
+HRESULT hr;
+
+   hr=m_device->CreateTexture(p_width,p_height,1,0,format,D3DPOOL_MANAGED,&texture,NULL);
+   if(FAILED(hr))
+   {
+      format=D3DFMT_A8R8G8B8;
+      hr=m_device->CreateTexture(p_width,p_height,1,0,format,D3DPOOL_MANAGED,&texture,NULL);
+   }
+   if(FAILED(hr))
+   {
+      *p_texture=NULL;
+      return hr;
+   }
+
+   *p_texture=new D3D9Texture(texture,format,p_width,p_height);
+
+   return D3D_OK;
+}
+
+HRESULT D3D9Texture::Unlock(void){
+D3DLOCKED_RECT locked;
+HRESULT hr;
+
+   hr=m_texture->LockRect(0,&locked,NULL,0);
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   for(UINT y=0;y<m_height;y++)
+   {
+      const BYTE *src=&m_shadow[(size_t)y * m_width];
+      BYTE *row=(BYTE *)locked.pBits + (size_t)y * locked.Pitch;
+
+      if(m_format == D3DFMT_A8)
+      {
+         memcpy(row,src,m_width);
+      }
+      else
+      {
+         for(UINT x=0;x<m_width;x++)
+         {
+            ((DWORD *)row)[x]=((DWORD)src[x] << 24) | 0x00FFFFFF;
+         }
+      }
+   }
+
+   return m_texture->UnlockRect(0);
+}
+
+HRESULT D3D9Device::SetTransform(rd_transform p_which, const float *p_matrix){
+
+   switch(p_which)
+   {
+      case RD_TS_WORLD:      memcpy(&m_transforms[0],p_matrix,sizeof(D3DMATRIX)); break;
+      case RD_TS_VIEW:       memcpy(&m_transforms[1],p_matrix,sizeof(D3DMATRIX)); break;
+      case RD_TS_PROJECTION: memcpy(&m_transforms[2],p_matrix,sizeof(D3DMATRIX)); break;
+   }
+
+   return m_device->SetTransform((D3DTRANSFORMSTATETYPE)p_which,(const D3DMATRIX *)p_matrix);
+}
+
+HRESULT D3D9Device::SetRenderState(rd_render_state p_state, DWORD p_value){
+
+   switch(p_state)
+   {
+      case RD_RS_LIGHTING:      m_lighting=(p_value != FALSE); break;
+      case RD_RS_FOGENABLE:     m_fog_enable=(p_value != FALSE); break;
+      case RD_RS_CULLMODE:      m_cull_mode=p_value; break;
+      case RD_RS_FOGVERTEXMODE: m_fog_vertex_mode=p_value; break;
+      case RD_RS_FOGCOLOR:      m_fog_colour=p_value; break;
+      case RD_RS_FOGSTART:      m_fog_start=rd_bits_float(p_value); break;
+      case RD_RS_FOGEND:        m_fog_end=rd_bits_float(p_value); break;
+      default: break;
+   }
+
+   return m_device->SetRenderState((D3DRENDERSTATETYPE)p_state,p_value);
+}
+
+//******************************************************************************************
+// Function:SetFVF
+// Whazzit:RD_FVF_QUANTIZED binds the decoding shader, anything else is fixed function
+//******************************************************************************************
+HRESULT D3D9Device::SetFVF(DWORD p_fvf){
+
+   m_fvf=p_fvf;
+   if(p_fvf & RD_FVF_QUANTIZED)
+   {
+      if(!InitQuantized())
+      {
+         return D3DERR_INVALIDCALL;
+      }
+      m_device->SetVertexDeclaration(m_quant_decl);
+      return m_device->SetVertexShader(m_quant_vs);
+   }
+
+   m_device->SetVertexShader(NULL);
+
+   return m_device->SetFVF(p_fvf);
+}
+
+//Back to what SetFVF last set up, after a draw of ours changed it
+void D3D9Device::RestoreVertexFormat(void){
+
+   if((m_fvf & RD_FVF_QUANTIZED) && m_quant_ok)
+   {
+      m_device->SetVertexDeclaration(m_quant_decl);
+      m_device->SetVertexShader(m_quant_vs);
+   }
+   else
+   {
+      m_device->SetVertexShader(NULL);
+      m_device->SetFVF(m_fvf);
+   }
+
+}
+
+HRESULT D3D9Device::DrawPrimitive(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count){
+HRESULT hr;
+
+   if(m_fvf & RD_FVF_QUANTIZED)
+   {
+      hr=SetQuantizedConstants(m_transforms[0]);
+      if(FAILED(hr))
+      {
+         return hr;
+      }
+   }
+
+   return m_device->DrawPrimitive((D3DPRIMITIVETYPE)p_type,p_start_vertex,p_prim_count);
+}
+
+HRESULT D3D9Device::DrawIndexedPrimitive(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                         UINT p_num_vertices, UINT p_start_index, UINT p_prim_count){
+HRESULT hr;
+
+   if(m_fvf & RD_FVF_QUANTIZED)
+   {
+      hr=SetQuantizedConstants(m_transforms[0]);
+      if(FAILED(hr))
+      {
+         return hr;
+      }
+   }
+
+   return m_device->DrawIndexedPrimitive((D3DPRIMITIVETYPE)p_type,p_base_vertex,p_min_index,p_num_vertices,
+                                         p_start_index,p_prim_count);
+}
+
+HRESULT D3D9Device::SetStreamSource(UINT p_stream, RenderBuffer *p_buffer, UINT p_offset, UINT p_stride){
+IDirect3DVertexBuffer9 *vb=p_buffer ? ((D3D9Buffer *)p_buffer)->GetVB() : NULL;
+
+   if(p_stream == 0)
+   {
+      m_stream=vb;
+      m_stream_offset=p_offset;
+      m_stream_stride=p_stride;
+   }
+
+   return m_device->SetStreamSource(p_stream,vb,p_offset,p_stride);
+}
+//******************************************************************************************
+// Function:compile_shader
+// Whazzit:Compiles one of our HLSL snippets, sends any compiler errors to the debugger
+//******************************************************************************************
+static ID3DXBuffer *compile_shader(const char *p_source, size_t p_length, const char *p_profile){
+ID3DXBuffer *code=NULL;
+ID3DXBuffer *errors=NULL;
+HRESULT hr;
+
+   hr=D3DXCompileShader(p_source,(UINT)p_length,NULL,NULL,"main",p_profile,0,&code,&errors,NULL);
+   if(errors)
+   {
+      OutputDebugStringA((const char *)errors->GetBufferPointer());
+      errors->Release();
+   }
+
+   return SUCCEEDED(hr) ? code : NULL;
+}
+//******************************************************************************************
+// Function:InitInstancing
+// Whazzit:First instanced draw only.  Checks the caps and builds the shaders and vertex
+//         declaration, any failure leaves us on the DrawPrimitive loop for good.
+//******************************************************************************************
+bool D3D9Device::InitInstancing(void){
+ID3DXBuffer *vs_code;
+ID3DXBuffer *ps_code;
+D3DCAPS9 caps;
+
+   if(m_instancing_tried)
+   {
+      return m_instancing;
+   }
+   m_instancing_tried=true;
+
+   //Stream frequency instancing is a vs_3_0 feature, and we bind the instance data at an
+   //offset into the dynamic buffer
+   if(FAILED(m_device->GetDeviceCaps(&caps)) || caps.VertexShaderVersion < D3DVS_VERSION(3,0) ||
+      caps.PixelShaderVersion < D3DPS_VERSION(3,0) || !(caps.DevCaps2 & D3DDEVCAPS2_STREAMOFFSET))
+   {
+      return false;
+   }
+
+   vs_code=compile_shader(g_instance_vs,sizeof(g_instance_vs) - 1,"vs_3_0");
+   ps_code=compile_shader(g_instance_ps,sizeof(g_instance_ps) - 1,"ps_3_0");
+
+   if(vs_code && ps_code)
+   {
+      m_instancing=SUCCEEDED(m_device->CreateVertexDeclaration(g_instance_decl,&m_decl)) &&
+                   SUCCEEDED(m_device->CreateVertexShader((const DWORD *)vs_code->GetBufferPointer(),&m_vs)) &&
+                   SUCCEEDED(m_device->CreatePixelShader((const DWORD *)ps_code->GetBufferPointer(),&m_ps));
+   }
+
+   if(vs_code)
+   {
+      vs_code->Release();
+   }
+   if(ps_code)
+   {
+      ps_code->Release();
+   }
+
+   return m_instancing;
+}
+//******************************************************************************************
+// Function:InitQuantized
+// Whazzit:Once, like InitInstancing.  vs_2_0 is all the decoding shader needs.
+//******************************************************************************************
+bool D3D9Device::InitQuantized(void){
+ID3DXBuffer *vs_code;
+D3DCAPS9 caps;
+
+   if(m_quant_tried)
+   {
+      return m_quant_ok;
+   }
+   m_quant_tried=true;
+
+   if(FAILED(m_device->GetDeviceCaps(&caps)) || caps.VertexShaderVersion < D3DVS_VERSION(2,0) ||
+      caps.MaxVertexShaderConst < g_quant_palette_reg + g_vq_max_palette)
+   {
+      return false;
+   }
+
+   vs_code=compile_shader(g_quant_vs,sizeof(g_quant_vs) - 1,"vs_2_0");
+   if(vs_code)
+   {
+      m_quant_ok=SUCCEEDED(m_device->CreateVertexDeclaration(g_quant_decl,&m_quant_decl)) &&
+                 SUCCEEDED(m_device->CreateVertexShader((const DWORD *)vs_code->GetBufferPointer(),&m_quant_vs));
+      vs_code->Release();
+   }
+
+   return m_quant_ok;
+}
+//******************************************************************************************
+// Function:SetQuantizedConstants
+// Whazzit:The matrices and fog every draw, since p_world is per draw (or per instance).
+//         Scale, bias and palette only after SetQuantization or a reset.
+//******************************************************************************************
+HRESULT D3D9Device::SetQuantizedConstants(const D3DMATRIX &p_world){
+D3DXMATRIX world_view;
+D3DXMATRIX world_view_proj;
+float view_z[4];
+float params[4];
+float mode[4];
+float palette[g_vq_max_palette][4];
+UINT count;
+
+   if(m_quant == NULL || !m_quant_ok)
+   {
+      return D3DERR_INVALIDCALL;
+   }
+
+   D3DXMatrixMultiply(&world_view,(const D3DXMATRIX *)&p_world,(const D3DXMATRIX *)&m_transforms[1]);
+   D3DXMatrixMultiply(&world_view_proj,&world_view,(const D3DXMATRIX *)&m_transforms[2]);
+   D3DXMatrixTranspose(&world_view_proj,&world_view_proj);
+
+   for(int r=0;r<4;r++)
+   {
+      view_z[r]=world_view.m[r][2];
+   }
+
+   params[0]=m_fog_end;
+   params[1]=m_fog_end != m_fog_start ? 1.0f / (m_fog_end - m_fog_start) : 0.0f;
+   params[2]=(m_fog_enable && m_fog_vertex_mode == D3DFOG_LINEAR) ? 1.0f : 0.0f;
+   params[3]=m_lighting ? 0.0f : 1.0f;
+
+   m_device->SetVertexShaderConstantF(0,(const float *)&world_view_proj,4);
+   m_device->SetVertexShaderConstantF(4,view_z,1);
+   m_device->SetVertexShaderConstantF(5,params,1);
+
+   if(m_quant_dirty)
+   {
+      const float scale[4]={ m_quant->scale[0],m_quant->scale[1],m_quant->scale[2],0.0f };
+      const float bias[4]={ m_quant->bias[0],m_quant->bias[1],m_quant->bias[2],0.0f };
+
+      count=m_quant->palette ? m_quant->palette_count : 0;
+      count=count < g_vq_max_palette ? count : g_vq_max_palette;
+      mode[0]=count == 0 ? 1.0f : 0.0f;
+      mode[1]=count == 0 ? 0.0f : (float)(count - 1);
+      mode[2]=0.0f;
+      mode[3]=0.0f;
+      for(UINT i=0;i<count;i++)
+      {
+         const DWORD colour=m_quant->palette[i];
+
+         palette[i][0]=(float)((colour >> 16) & 0xFF) / 255.0f;
+         palette[i][1]=(float)((colour >> 8) & 0xFF) / 255.0f;
+         palette[i][2]=(float)(colour & 0xFF) / 255.0f;
+         palette[i][3]=(float)(colour >> 24) / 255.0f;
+      }
+
+      m_device->SetVertexShaderConstantF(6,scale,1);
+      m_device->SetVertexShaderConstantF(7,bias,1);
+      m_device->SetVertexShaderConstantF(8,mode,1);
+      if(count)
+      {
+         m_device->SetVertexShaderConstantF(g_quant_palette_reg,palette[0],count);
+      }
+      m_quant_dirty=false;
+   }
+
+   return D3D_OK;
+}
+//******************************************************************************************
+// Function:PrepareIndices
+// Whazzit:Instancing only works with indexed draws, so we keep a 0,1,2,... index buffer
+//         at least p_vertex_count long and offset it with BaseVertexIndex.
+//******************************************************************************************
+HRESULT D3D9Device::PrepareIndices(UINT p_vertex_count){
+WORD *indices;
+UINT count;
+HRESULT hr;
+
+   if(m_indices && m_index_count >= p_vertex_count)
+   {
+      return D3D_OK;
+   }
+
+   if(m_indices)
+   {
+      m_indices->Release();
+      m_indices=NULL;
+      ListIndices(NULL,NULL,0,&m_indices_handle);
+   }
+
+   //Round up so a slightly bigger mesh doesn't mean a new buffer every time
+   count=(p_vertex_count + 1023) & ~1023;
+   if(count > 65536)
+   {
+      count=65536;
+   }
+
+   hr=m_device->CreateIndexBuffer(count * sizeof(WORD),D3DUSAGE_WRITEONLY,D3DFMT_INDEX16,D3DPOOL_MANAGED,
+                                  &m_indices,NULL);
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   hr=m_indices->Lock(0,0,(void **)&indices,0);
+   if(FAILED(hr))
+   {
+      m_indices->Release();
+      m_indices=NULL;
+      return hr;
+   }
+
+   for(UINT i=0;i<count;i++)
+   {
+      indices[i]=(WORD)i;
+   }
+
+   m_indices->Unlock();
+   m_index_count=count;
+   ListIndices(m_indices,"d3d9 indices",count * sizeof(WORD),&m_indices_handle);
+
+   return D3D_OK;
+}
+//******************************************************************************************
+// Function:DrawHardwareInstanced
+// Whazzit:Streams the instance array through the dynamic buffer in chunks, one
+//         DrawIndexedPrimitive per chunk with whatever index buffer is set, then puts the
+//         fixed function state back.
+//******************************************************************************************
+HRESULT D3D9Device::DrawHardwareInstanced(int p_base_vertex, UINT p_min_index, UINT p_num_vertices,
+                                          UINT p_start_index, UINT p_prim_count, const rd_instance *p_instances,
+                                          UINT p_instance_count){
+D3DXMATRIX view_proj;
+float view_z[4];
+float params[4];
+float fog_colour[4];
+void *data;
+UINT count;
+DWORD flags;
+HRESULT hr;
+
+   if(m_instance_vb == NULL)
+   {
+      hr=CreateInstanceBuffer();
+      if(FAILED(hr))
+      {
+         return hr;
+      }
+   }
+
+   D3DXMatrixMultiply(&view_proj,(const D3DXMATRIX *)&m_transforms[1],(const D3DXMATRIX *)&m_transforms[2]);
+   D3DXMatrixTranspose(&view_proj,&view_proj);
+
+   for(int r=0;r<4;r++)
+   {
+      view_z[r]=m_transforms[1].m[r][2];
+   }
+
+   params[0]=m_fog_end;
+   params[1]=m_fog_end != m_fog_start ? 1.0f / (m_fog_end - m_fog_start) : 0.0f;
+   params[2]=(m_fog_enable && m_fog_vertex_mode == D3DFOG_LINEAR) ? 1.0f : 0.0f;
+   params[3]=m_lighting ? 0.0f : 1.0f;
+
+   fog_colour[0]=(float)((m_fog_colour >> 16) & 0xFF) / 255.0f;
+   fog_colour[1]=(float)((m_fog_colour >> 8) & 0xFF) / 255.0f;
+   fog_colour[2]=(float)(m_fog_colour & 0xFF) / 255.0f;
+   fog_colour[3]=1.0f;
+
+   m_device->SetVertexDeclaration(m_decl);
+   m_device->SetVertexShader(m_vs);
+   m_device->SetPixelShader(m_ps);
+   m_device->SetVertexShaderConstantF(0,(const float *)&view_proj,4);
+   m_device->SetVertexShaderConstantF(4,view_z,1);
+   m_device->SetVertexShaderConstantF(5,params,1);
+   m_device->SetPixelShaderConstantF(0,fog_colour,1);
+
+   while(p_instance_count)
+   {
+      count=p_instance_count < g_instance_chunk ? p_instance_count : g_instance_chunk;
+
+      //Append while there is room, start over with a fresh buffer when there isn't
+      flags=D3DLOCK_NOOVERWRITE;
+      if(m_instance_pos + count > g_instance_chunk)
+      {
+         flags=D3DLOCK_DISCARD;
+         m_instance_pos=0;
+      }
+
+      hr=m_instance_vb->Lock(m_instance_pos * sizeof(rd_instance),count * sizeof(rd_instance),&data,flags);
+      if(FAILED(hr))
+      {
+         break;
+      }
+      memcpy(data,p_instances,count * sizeof(rd_instance));
+      m_instance_vb->Unlock();
+
+      m_device->SetStreamSourceFreq(0,D3DSTREAMSOURCE_INDEXEDDATA | count);
+      m_device->SetStreamSource(1,m_instance_vb,m_instance_pos * sizeof(rd_instance),sizeof(rd_instance));
+      m_device->SetStreamSourceFreq(1,D3DSTREAMSOURCE_INSTANCEDATA | 1);
+
+      hr=m_device->DrawIndexedPrimitive(D3DPT_TRIANGLELIST,p_base_vertex,p_min_index,p_num_vertices,p_start_index,
+                                        p_prim_count);
+      if(FAILED(hr))
+      {
+         break;
+      }
+
+      m_instance_pos+=count;
+      p_instances+=count;
+      p_instance_count-=count;
+   }
+
+   m_device->SetStreamSourceFreq(0,1);
+   m_device->SetStreamSourceFreq(1,1);
+   m_device->SetStreamSource(1,NULL,0,0);
+   m_device->SetIndices(m_bound_indices);
+   m_device->SetPixelShader(NULL);
+   RestoreVertexFormat();
+
+   return hr;
+}
+//******************************************************************************************
+// Function:DrawInstancedLoop
+// Whazzit:Fallback for devices without vs_3_0, and for quantized vertices.  The tint goes
+//         through the texture factor modulated with the diffuse colour in stage 0, which
+//         the quantized shader leaves to fixed function as well.
+//******************************************************************************************
+HRESULT D3D9Device::DrawInstancedLoop(bool p_indexed, rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                      UINT p_num_vertices, UINT p_start_index, UINT p_prim_count,
+                                      const rd_instance *p_instances, UINT p_instance_count){
+HRESULT hr=D3D_OK;
+
+   m_device->SetTextureStageState(0,D3DTSS_COLOROP,D3DTOP_MODULATE);
+   m_device->SetTextureStageState(0,D3DTSS_COLORARG1,D3DTA_DIFFUSE);
+   m_device->SetTextureStageState(0,D3DTSS_COLORARG2,D3DTA_TFACTOR);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAOP,D3DTOP_MODULATE);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAARG1,D3DTA_DIFFUSE);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAARG2,D3DTA_TFACTOR);
+
+   for(UINT i=0;i<p_instance_count && SUCCEEDED(hr);i++)
+   {
+      m_device->SetRenderState(D3DRS_TEXTUREFACTOR,p_instances[i].tint);
+      m_device->SetTransform(D3DTS_WORLD,(const D3DMATRIX *)p_instances[i].world);
+      if(m_fvf & RD_FVF_QUANTIZED)
+      {
+         hr=SetQuantizedConstants(*(const D3DMATRIX *)p_instances[i].world);
+         if(FAILED(hr))
+         {
+            break;
+         }
+      }
+      if(p_indexed)
+      {
+         hr=m_device->DrawIndexedPrimitive((D3DPRIMITIVETYPE)p_type,p_base_vertex,p_min_index,p_num_vertices,
+                                           p_start_index,p_prim_count);
+      }
+      else
+      {
+         hr=m_device->DrawPrimitive((D3DPRIMITIVETYPE)p_type,p_base_vertex,p_prim_count);
+      }
+   }
+
+   //Back to the D3D defaults, which is what everything else expects
+   m_device->SetTextureStageState(0,D3DTSS_COLOROP,D3DTOP_MODULATE);
+   m_device->SetTextureStageState(0,D3DTSS_COLORARG1,D3DTA_TEXTURE);
+   m_device->SetTextureStageState(0,D3DTSS_COLORARG2,D3DTA_CURRENT);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAOP,D3DTOP_SELECTARG1);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAARG1,D3DTA_TEXTURE);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAARG2,D3DTA_CURRENT);
+   m_device->SetTransform(D3DTS_WORLD,&m_transforms[0]);
+
+   return hr;
+}
+
+//The shader path only knows our one vertex layout
+bool D3D9Device::CanInstance(rd_primitive p_type){
+
+   return p_type == RD_PT_TRIANGLELIST && m_stream && m_fvf == (RD_FVF_XYZ | RD_FVF_DIFFUSE) &&
+          m_stream_stride == 16 && InitInstancing();
+}
+
+HRESULT D3D9Device::DrawInstanced(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count,
+                                  const rd_instance *p_instances, UINT p_instance_count){
+
+   if(p_instance_count == 0)
+   {
+      return D3D_OK;
+   }
+
+   //Instancing needs an indexed draw, so a plain range goes through our 0,1,2,... indices
+   if(p_prim_count * 3 <= 65536 && CanInstance(p_type) && SUCCEEDED(PrepareIndices(p_prim_count * 3)))
+   {
+      m_device->SetIndices(m_indices);
+      return DrawHardwareInstanced(p_start_vertex,0,p_prim_count * 3,0,p_prim_count,p_instances,p_instance_count);
+   }
+
+   return DrawInstancedLoop(false,p_type,p_start_vertex,0,0,0,p_prim_count,p_instances,p_instance_count);
+}
+
+HRESULT D3D9Device::DrawIndexedInstanced(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                         UINT p_num_vertices, UINT p_start_index, UINT p_prim_count,
+                                         const rd_instance *p_instances, UINT p_instance_count){
+
+   if(p_instance_count == 0)
+   {
+      return D3D_OK;
+   }
+
+   if(m_bound_indices && CanInstance(p_type))
+   {
+      return DrawHardwareInstanced(p_base_vertex,p_min_index,p_num_vertices,p_start_index,p_prim_count,
+                                   p_instances,p_instance_count);
+   }
+
+   return DrawInstancedLoop(true,p_type,p_base_vertex,p_min_index,p_num_vertices,p_start_index,p_prim_count,
+                            p_instances,p_instance_count);
+}
+//******************************************************************************************
+// Function:PrepareGlyphIndices
+// Whazzit:0,1,2 2,1,3 for every quad, the corners in rd_glyph_corner order, built once
+//******************************************************************************************
+HRESULT D3D9Device::PrepareGlyphIndices(void){
+WORD *indices;
+HRESULT hr;
+
+   if(m_glyph_indices)
+   {
+      return D3D_OK;
+   }
+
+   hr=m_device->CreateIndexBuffer(g_glyph_batch * 6 * sizeof(WORD),D3DUSAGE_WRITEONLY,D3DFMT_INDEX16,
+                                  D3DPOOL_MANAGED,&m_glyph_indices,NULL);
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   hr=m_glyph_indices->Lock(0,0,(void **)&indices,0);
+   if(FAILED(hr))
+   {
+      m_glyph_indices->Release();
+      m_glyph_indices=NULL;
+      return hr;
+   }
+
+   for(UINT i=0;i<g_glyph_batch;i++)
+   {
+      const WORD corner=(WORD)(i * RD_GLYPH_CORNERS);
+
+      indices[i * 6 + 0]=corner + RD_GLYPH_TOP_LEFT;
+      indices[i * 6 + 1]=corner + RD_GLYPH_TOP_RIGHT;
+      indices[i * 6 + 2]=corner + RD_GLYPH_BOTTOM_LEFT;
+      indices[i * 6 + 3]=corner + RD_GLYPH_BOTTOM_LEFT;
+      indices[i * 6 + 4]=corner + RD_GLYPH_TOP_RIGHT;
+      indices[i * 6 + 5]=corner + RD_GLYPH_BOTTOM_RIGHT;
+   }
+
+   m_glyph_indices->Unlock();
+   ListIndices(m_glyph_indices,"d3d9 glyph indices",g_glyph_batch * 6 * sizeof(WORD),&m_glyph_handle);
+
+   return D3D_OK;
+}
+//******************************************************************************************
+// Function:ListIndices
+// Whazzit:Swaps whatever *p_handle listed for p_buffer, or for nothing when it is NULL
+//******************************************************************************************
+void D3D9Device::ListIndices(IDirect3DIndexBuffer9 *p_buffer, const char *p_name, UINT p_bytes,
+                             rr_handle *p_handle){
+
+   if(m_registry && *p_handle >= 0)
+   {
+      m_registry->Unregister(*p_handle);
+   }
+   *p_handle=-1;
+
+   if(m_registry && p_buffer)
+   {
+      *p_handle=m_registry->Register(p_name,RD_POOL_MANAGED,p_bytes,NULL,NULL,NULL);
+   }
+
+}
+
+void D3D9Device::SetRegistry(ResourceRegistry *p_registry){
+
+   ListIndices(NULL,NULL,0,&m_indices_handle);
+   ListIndices(NULL,NULL,0,&m_glyph_handle);
+   m_registry=p_registry;
+   ListIndices(m_indices,"d3d9 indices",m_index_count * sizeof(WORD),&m_indices_handle);
+   ListIndices(m_glyph_indices,"d3d9 glyph indices",g_glyph_batch * 6 * sizeof(WORD),&m_glyph_handle);
+
+}
+//******************************************************************************************
+// Function:DrawGlyphs
+// Whazzit:Colour from the vertex, alpha from the atlas times the vertex's, blended over
+//         the target.  Fog and culling are off for the draw and everything goes back to
+//         the shadowed state (or the D3D default, for what we never change) after it.
+//******************************************************************************************
+HRESULT D3D9Device::DrawGlyphs(RenderTexture *p_atlas, RenderBuffer *p_vertices, UINT p_start_vertex,
+                               UINT p_glyph_count){
+HRESULT hr=D3D_OK;
+
+   if(p_glyph_count == 0)
+   {
+      return D3D_OK;
+   }
+   if(p_atlas == NULL || p_vertices == NULL)
+   {
+      return E_INVALIDARG;
+   }
+
+   hr=PrepareGlyphIndices();
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   m_device->SetVertexShader(NULL);
+   m_device->SetFVF(D3DFVF_XYZRHW | D3DFVF_DIFFUSE | D3DFVF_TEX1);
+   m_device->SetStreamSource(0,((D3D9Buffer *)p_vertices)->GetVB(),0,sizeof(rd_glyph_vertex));
+   m_device->SetIndices(m_glyph_indices);
+   m_device->SetTexture(0,((D3D9Texture *)p_atlas)->GetTexture());
+   m_device->SetRenderState(D3DRS_CULLMODE,D3DCULL_NONE);
+   m_device->SetRenderState(D3DRS_FOGENABLE,FALSE);
+   m_device->SetRenderState(D3DRS_ALPHABLENDENABLE,TRUE);
+   m_device->SetRenderState(D3DRS_SRCBLEND,D3DBLEND_SRCALPHA);
+   m_device->SetRenderState(D3DRS_DESTBLEND,D3DBLEND_INVSRCALPHA);
+   m_device->SetTextureStageState(0,D3DTSS_COLOROP,D3DTOP_SELECTARG2);
+   m_device->SetTextureStageState(0,D3DTSS_COLORARG2,D3DTA_DIFFUSE);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAOP,D3DTOP_MODULATE);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAARG1,D3DTA_TEXTURE);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAARG2,D3DTA_DIFFUSE);
+
+   for(UINT done=0;done < p_glyph_count && SUCCEEDED(hr);done+=g_glyph_batch)
+   {
+      const UINT count=p_glyph_count - done < g_glyph_batch ? p_glyph_count - done : g_glyph_batch;
+
+      hr=m_device->DrawIndexedPrimitive(D3DPT_TRIANGLELIST,p_start_vertex + done * RD_GLYPH_CORNERS,0,
+                                        count * RD_GLYPH_CORNERS,0,count * 2);
+   }
+
+   m_device->SetTextureStageState(0,D3DTSS_COLOROP,D3DTOP_MODULATE);
+   m_device->SetTextureStageState(0,D3DTSS_COLORARG2,D3DTA_CURRENT);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAOP,D3DTOP_SELECTARG1);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAARG1,D3DTA_TEXTURE);
+   m_device->SetTextureStageState(0,D3DTSS_ALPHAARG2,D3DTA_CURRENT);
+   m_device->SetRenderState(D3DRS_ALPHABLENDENABLE,FALSE);
+   m_device->SetRenderState(D3DRS_SRCBLEND,D3DBLEND_ONE);
+   m_device->SetRenderState(D3DRS_DESTBLEND,D3DBLEND_ZERO);
+   m_device->SetRenderState(D3DRS_FOGENABLE,m_fog_enable);
+   m_device->SetRenderState(D3DRS_CULLMODE,m_cull_mode);
+   m_device->SetTexture(0,NULL);
+   m_device->SetIndices(m_bound_indices);
+   m_device->SetStreamSource(0,m_stream,m_stream_offset,m_stream_stride);
+   RestoreVertexFormat();
+
+   return hr;
+}
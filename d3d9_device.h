@@ -0,0 +1,242 @@
+//
+// d3d9_device.h - RenderDevice on top of IDirect3DDevice9
+//
+// Mostly a straight passthrough.  DrawInstanced is the exception: the fixed function
+// pipeline can't instance, so it uses a small vs_3_0/ps_3_0 pair that reproduces our
+// fixed function setup (world*view*proj, vertex colour, linear vertex fog) with the
+// per instance world matrix and tint coming from a second vertex stream.  Devices
+// without vs_3_0 get a SetTransform/DrawPrimitive loop instead.
+//
+// RD_FVF_QUANTIZED vertices go through a vs_2_0 shader too, since fixed function only
+// takes float positions.  It reads the tri_qvertex as SHORT4, decodes the position and
+// the colour (the palette sits in the constants after the matrices) and hands fixed
+// function fog and texture stages the same outputs they would get from our FVF.  The
+// constants are sent with each draw, so world and fog changes are always picked up.
+// Without vs_2_0 CanQuantize is false and the caller keeps its float vertices.
+//
+// DrawGlyphs is fixed function: pretransformed vertices, the atlas's alpha modulated
+// with the vertex colour and alpha blended.  It goes through a managed index buffer of
+// quads and puts every state it touched back afterwards.
+//
+#ifndef D3D9_DEVICE_H
+#define D3D9_DEVICE_H
+
+#include <d3d9.h>
+#include <vector>
+#include "render_device.h"
+#include "resource_registry.h"
+
+//Fences that can be pending at once
+const UINT g_fence_queries = 16;
+//Quads per glyph draw, as many as 16 bit indices reach
+const UINT g_glyph_batch = 16384;
+
+class D3D9Buffer : public RenderBuffer
+{
+public:
+   D3D9Buffer(IDirect3DVertexBuffer9 *p_vb, UINT p_size, rd_pool p_pool) :
+      m_vb(p_vb),m_size(p_size),m_pool(p_pool) {}
+
+   virtual HRESULT Lock(UINT p_offset, UINT p_size, void **p_data, DWORD p_flags){
+      return m_vb->Lock(p_offset,p_size,p_data,p_flags);
+   }
+   virtual HRESULT Unlock(void) { return m_vb->Unlock(); }
+   virtual UINT GetSize(void) const { return m_size; }
+   virtual rd_pool GetPool(void) const { return m_pool; }
+   virtual void Release(void) { m_vb->Release(); delete this; }
+
+   IDirect3DVertexBuffer9 *GetVB(void) const { return m_vb; }
+
+private:
+   IDirect3DVertexBuffer9 *m_vb;
+   UINT m_size;
+   rd_pool m_pool;
+};
+
+class D3D9IndexBuffer : public RenderBuffer
+{
+public:
+   D3D9IndexBuffer(IDirect3DIndexBuffer9 *p_ib, UINT p_size, rd_pool p_pool) :
+      m_ib(p_ib),m_size(p_size),m_pool(p_pool) {}
+
+   virtual HRESULT Lock(UINT p_offset, UINT p_size, void **p_data, DWORD p_flags){
+      return m_ib->Lock(p_offset,p_size,p_data,p_flags);
+   }
+   virtual HRESULT Unlock(void) { return m_ib->Unlock(); }
+   virtual UINT GetSize(void) const { return m_size; }
+   virtual rd_pool GetPool(void) const { return m_pool; }
+   virtual void Release(void) { m_ib->Release(); delete this; }
+
+   IDirect3DIndexBuffer9 *GetIB(void) const { return m_ib; }
+
+private:
+   IDirect3DIndexBuffer9 *m_ib;
+   UINT m_size;
+   rd_pool m_pool;
+};
+
+//D3DFMT_A8 where the card has it, A8R8G8B8 with white texels where it doesn't.  Lock
+//hands out a system memory copy in the one byte format, Unlock sends it to the card.
+class D3D9Texture : public RenderTexture
+{
+public:
+   D3D9Texture(IDirect3DTexture9 *p_texture, D3DFORMAT p_format, UINT p_width, UINT p_height) :
+      m_texture(p_texture),m_format(p_format),m_width(p_width),m_height(p_height),
+      m_shadow((size_t)p_width * p_height) {}
+
+   virtual HRESULT Lock(void **p_data, UINT *p_pitch){
+      *p_data=&m_shadow[0];
+      *p_pitch=m_width;
+      return D3D_OK;
+   }
+   virtual HRESULT Unlock(void);
+   virtual UINT GetWidth(void) const { return m_width; }
+   virtual UINT GetHeight(void) const { return m_height; }
+   virtual void Release(void) { m_texture->Release(); delete this; }
+
+   IDirect3DTexture9 *GetTexture(void) const { return m_texture; }
+
+private:
+   IDirect3DTexture9 *m_texture;
+   D3DFORMAT m_format;
+   UINT m_width;
+   UINT m_height;
+   std::vector<BYTE> m_shadow;
+};
+
+class D3D9Device : public RenderDevice
+{
+public:
+   //Doesn't take a reference, the caller still owns p_device
+   D3D9Device(IDirect3DDevice9 *p_device);
+   virtual ~D3D9Device(void);
+
+   virtual const char *GetName(void) const { return "d3d9"; }
+   virtual bool CanQuantize(void) { return InitQuantized(); }
+   virtual HRESULT TestCooperativeLevel(void) { return m_device->TestCooperativeLevel(); }
+
+   virtual HRESULT CreateVertexBuffer(UINT p_length, DWORD p_usage, DWORD p_fvf, rd_pool p_pool,
+                                      RenderBuffer **p_buffer);
+   virtual HRESULT CreateIndexBuffer(UINT p_length, DWORD p_usage, rd_format p_format, rd_pool p_pool,
+                                     RenderBuffer **p_buffer);
+   virtual HRESULT CreateTexture(UINT p_width, UINT p_height, RenderTexture **p_texture);
+
+   virtual HRESULT Clear(DWORD p_colour){
+      return m_device->Clear(0,NULL,D3DCLEAR_TARGET,p_colour,1.0f,0);
+   }
+   virtual HRESULT BeginScene(void) { return m_device->BeginScene(); }
+   virtual HRESULT EndScene(void) { return m_device->EndScene(); }
+   virtual HRESULT Present(void) { return m_device->Present(NULL,NULL,NULL,NULL); }
+
+   virtual HRESULT SetTransform(rd_transform p_which, const float *p_matrix);
+   virtual HRESULT SetRenderState(rd_render_state p_state, DWORD p_value);
+   virtual HRESULT SetFVF(DWORD p_fvf);
+   virtual HRESULT SetQuantization(const rd_quantization *p_quant){
+      m_quant=p_quant;
+      m_quant_dirty=true;
+      return D3D_OK;
+   }
+   virtual HRESULT SetStreamSource(UINT p_stream, RenderBuffer *p_buffer, UINT p_offset, UINT p_stride);
+   virtual HRESULT DrawPrimitive(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count);
+   virtual HRESULT SetIndices(RenderBuffer *p_buffer){
+      m_bound_indices=p_buffer ? ((D3D9IndexBuffer *)p_buffer)->GetIB() : NULL;
+      return m_device->SetIndices(m_bound_indices);
+   }
+   virtual HRESULT DrawIndexedPrimitive(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                        UINT p_num_vertices, UINT p_start_index, UINT p_prim_count);
+   virtual HRESULT DrawInstanced(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count,
+                                 const rd_instance *p_instances, UINT p_instance_count);
+   virtual HRESULT DrawIndexedInstanced(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                        UINT p_num_vertices, UINT p_start_index, UINT p_prim_count,
+                                        const rd_instance *p_instances, UINT p_instance_count);
+   virtual HRESULT DrawGlyphs(RenderTexture *p_atlas, RenderBuffer *p_vertices, UINT p_start_vertex,
+                              UINT p_glyph_count);
+
+   //Event queries, in a ring of g_fence_queries.  Issuing one more than that while the
+   //oldest is still pending waits for it.
+   virtual rd_fence InsertFence(void);
+   virtual bool FenceDone(rd_fence p_fence);
+
+   //Releases the D3DPOOL_DEFAULT objects and the fence queries, call before
+   //IDirect3DDevice9::Reset.  They are recreated when next needed, and every fence
+   //issued before counts as done.
+   void OnLostDevice(void);
+   //After the Reset.  Puts the shadowed state back to what Reset left the device with
+   //(the quantization is kept, its constants are sent again with the next draw), and
+   //remakes the instance buffer now if instancing has been used, rather than in
+   //the first draw after.
+   HRESULT OnResetDevice(void);
+
+   //Lists the managed index buffers the device makes for itself in p_registry, now and
+   //as they are remade.  NULL takes them out again, do that before the registry's
+   //Release.
+   void SetRegistry(ResourceRegistry *p_registry);
+
+   IDirect3DDevice9 *GetD3DDevice(void) const { return m_device; }
+
+private:
+   bool InitInstancing(void);
+   bool InitQuantized(void);
+   HRESULT SetQuantizedConstants(const D3DMATRIX &p_world);
+   void RestoreVertexFormat(void);
+   HRESULT CreateInstanceBuffer(void);
+   HRESULT PrepareIndices(UINT p_vertex_count);
+   HRESULT PrepareGlyphIndices(void);
+   void ListIndices(IDirect3DIndexBuffer9 *p_buffer, const char *p_name, UINT p_bytes, rr_handle *p_handle);
+   bool CanInstance(rd_primitive p_type);
+   HRESULT DrawHardwareInstanced(int p_base_vertex, UINT p_min_index, UINT p_num_vertices, UINT p_start_index,
+                                 UINT p_prim_count, const rd_instance *p_instances, UINT p_instance_count);
+   HRESULT DrawInstancedLoop(bool p_indexed, rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                             UINT p_num_vertices, UINT p_start_index, UINT p_prim_count,
+                             const rd_instance *p_instances, UINT p_instance_count);
+
+   IDirect3DDevice9 *m_device;
+
+   //State we shadow so the instancing path can pick it up and restore it
+   DWORD m_fvf;
+   IDirect3DVertexBuffer9 *m_stream;
+   UINT m_stream_offset;
+   UINT m_stream_stride;
+   IDirect3DIndexBuffer9 *m_bound_indices;
+   D3DMATRIX m_transforms[3];   //World, view, projection
+   bool m_lighting;
+   bool m_fog_enable;
+   DWORD m_cull_mode;
+   DWORD m_fog_vertex_mode;
+   DWORD m_fog_colour;
+   float m_fog_start;
+   float m_fog_end;
+
+   //Hardware instancing, needs vs_3_0
+   bool m_instancing_tried;
+   bool m_instancing;
+   IDirect3DVertexDeclaration9 *m_decl;
+   IDirect3DVertexShader9 *m_vs;
+   IDirect3DPixelShader9 *m_ps;
+   IDirect3DIndexBuffer9 *m_indices;   //Managed, 0,1,2,... so DrawInstanced can draw indexed
+   UINT m_index_count;
+   IDirect3DVertexBuffer9 *m_instance_vb;   //Dynamic, default pool
+   UINT m_instance_pos;
+
+   //Quantized vertices, needs vs_2_0
+   bool m_quant_tried;
+   bool m_quant_ok;
+   IDirect3DVertexDeclaration9 *m_quant_decl;
+   IDirect3DVertexShader9 *m_quant_vs;
+   const rd_quantization *m_quant;
+   bool m_quant_dirty;          //Scale, bias and palette still to send
+
+   IDirect3DIndexBuffer9 *m_glyph_indices;   //Managed, two triangles per quad
+
+   ResourceRegistry *m_registry;
+   rr_handle m_indices_handle;
+   rr_handle m_glyph_handle;
+
+   //Fence n is in m_fence_queries[n % g_fence_queries]
+   IDirect3DQuery9 *m_fence_queries[g_fence_queries];
+   rd_fence m_fence_issued;
+   rd_fence m_fence_done;
+   bool m_fence_failed;         //No event queries on this device
+};
+
+#endif
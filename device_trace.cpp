@@ -0,0 +1,660 @@
+//
+// device_trace.cpp - Records the device call stream to a file, to replay offline
+//
+#include <stddef.h>
+#include <string.h>
+#include "device_trace.h"
+
+const char *dt_op_name(int p_op){
+static const char *names[DT_OP_COUNT]={
+   "none","create_vertex_buffer","create_index_buffer","create_texture","release_buffer","release_texture",
+   "buffer_data","texture_data","frames","clear","begin_scene","end_scene","present","set_transform",
+   "set_render_state","set_fvf","set_stream_source","set_indices","draw_primitive","draw_indexed_primitive",
+   "draw_instanced","draw_indexed_instanced","draw_glyphs","insert_fence","set_quantization"
+};
+
+   return p_op > 0 && p_op < DT_OP_COUNT ? names[p_op] : "unknown";
+}
+
+static RenderBuffer *inner_buffer(RenderBuffer *p_buffer){
+
+   return p_buffer ? ((CaptureBuffer *)p_buffer)->GetInner() : NULL;
+}
+
+static UINT buffer_id(RenderBuffer *p_buffer){
+
+   return p_buffer ? ((CaptureBuffer *)p_buffer)->GetId() : 0;
+}
+
+//World, view, projection
+static int transform_slot(rd_transform p_which){
+
+   return p_which == RD_TS_VIEW ? 1 : (p_which == RD_TS_PROJECTION ? 2 : 0);
+}
+
+CaptureBuffer::CaptureBuffer(CaptureDevice *p_owner, RenderBuffer *p_inner, UINT p_id, bool p_index, DWORD p_usage,
+                             DWORD p_fvf, UINT p_length) :
+   m_owner(p_owner),m_inner(p_inner),m_id(p_id),m_index(p_index),m_usage(p_usage),m_fvf(p_fvf),m_copy(p_length),
+   m_target(NULL),m_lock_offset(0),m_lock_size(0),m_lock_flags(0)
+{
+}
+
+HRESULT CaptureBuffer::Lock(UINT p_offset, UINT p_size, void **p_data, DWORD p_flags){
+const UINT length=(UINT)m_copy.size();
+HRESULT hr;
+
+   if(p_offset > length || p_size > length - p_offset)
+   {
+      return E_INVALIDARG;
+   }
+
+   hr=m_inner->Lock(p_offset,p_size,&m_target,p_flags);
+   if(FAILED(hr))
+   {
+      m_target=NULL;
+      return hr;
+   }
+
+   m_lock_offset=p_offset;
+   m_lock_size=p_size ? p_size : length - p_offset;
+   m_lock_flags=p_flags;
+   *p_data=length ? &m_copy[0] + p_offset : NULL;
+
+   return S_OK;
+}
+//******************************************************************************************
+// Function:Unlock
+// Whazzit:The caller wrote into our copy, the real buffer gets the locked range of it
+//******************************************************************************************
+HRESULT CaptureBuffer::Unlock(void){
+HRESULT hr;
+
+   if(m_target && m_lock_size)
+   {
+      memcpy(m_target,&m_copy[0] + m_lock_offset,m_lock_size);
+   }
+   m_target=NULL;
+
+   hr=m_inner->Unlock();
+   m_owner->WriteBufferData(this,m_lock_offset,m_lock_size,m_lock_flags);
+   m_lock_size=0;
+
+   return hr;
+}
+
+void CaptureBuffer::Release(void){
+
+   m_owner->Forget(this);
+   m_inner->Release();
+   delete this;
+
+}
+
+CaptureTexture::CaptureTexture(CaptureDevice *p_owner, RenderTexture *p_inner, UINT p_id) :
+   m_owner(p_owner),m_inner(p_inner),m_id(p_id),m_copy((size_t)p_inner->GetWidth() * p_inner->GetHeight())
+{
+}
+
+HRESULT CaptureTexture::Lock(void **p_data, UINT *p_pitch){
+
+   *p_data=m_copy.empty() ? NULL : &m_copy[0];
+   *p_pitch=m_inner->GetWidth();
+
+   return S_OK;
+}
+
+HRESULT CaptureTexture::Unlock(void){
+const UINT width=m_inner->GetWidth();
+const UINT height=m_inner->GetHeight();
+BYTE *target;
+UINT pitch;
+HRESULT hr;
+
+   hr=m_inner->Lock((void **)&target,&pitch);
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+   for(UINT y=0;y<height;y++)
+   {
+      memcpy(target + y * pitch,&m_copy[0] + (size_t)y * width,width);
+   }
+   hr=m_inner->Unlock();
+
+   m_owner->WriteTextureData(this);
+
+   return hr;
+}
+
+void CaptureTexture::Release(void){
+
+   m_owner->Forget(this);
+   m_inner->Release();
+   delete this;
+
+}
+
+CaptureDevice::CaptureDevice(RenderDevice *p_device, UINT p_width, UINT p_height) :
+   m_device(p_device),m_width(p_width),m_height(p_height),m_next_id(1),m_fvf_set(false),m_fvf(0),m_indices(NULL),
+   m_state_count(0),m_file(NULL),m_frames_wanted(0)
+{
+   memset(m_streams,0,sizeof(m_streams));
+   memset(m_stream_offsets,0,sizeof(m_stream_offsets));
+   memset(m_stream_strides,0,sizeof(m_stream_strides));
+   memset(m_transform_set,0,sizeof(m_transform_set));
+   memset(&m_quant,0,sizeof(m_quant));
+   memset(&m_stats,0,sizeof(m_stats));
+}
+
+CaptureDevice::~CaptureDevice(void){
+
+   Stop();
+
+}
+//******************************************************************************************
+// Function:Write
+// Whazzit:Appends a record to the write buffer, which goes to the file a MB at a time.
+//         The buffer has room for the biggest record on top of that, so a record is
+//         never split between writes.
+//******************************************************************************************
+void CaptureDevice::Write(dt_op p_op, const void *p_args, UINT p_args_size, const void *p_data, UINT p_data_size){
+static const BYTE padding[4]={ 0,0,0,0 };
+const UINT size=p_args_size + p_data_size;
+const UINT padded=(size + 3) & ~3u;
+const UINT header=(UINT)p_op | (size << 8);
+
+   if(m_file == NULL)
+   {
+      return;
+   }
+
+   if(m_out.size() + sizeof(header) + padded > g_dt_write_buffer)
+   {
+      Flush();
+   }
+
+   m_out.insert(m_out.end(),(const BYTE *)&header,(const BYTE *)&header + sizeof(header));
+   if(p_args_size)
+   {
+      m_out.insert(m_out.end(),(const BYTE *)p_args,(const BYTE *)p_args + p_args_size);
+   }
+   if(p_data_size)
+   {
+      m_out.insert(m_out.end(),(const BYTE *)p_data,(const BYTE *)p_data + p_data_size);
+   }
+   m_out.insert(m_out.end(),padding,padding + (padded - size));
+
+   m_stats.records++;
+   m_stats.bytes+=sizeof(header) + padded;
+
+}
+
+void CaptureDevice::Flush(void){
+
+   if(m_file && !m_out.empty())
+   {
+      fwrite(&m_out[0],1,m_out.size(),m_file);
+   }
+   m_out.clear();
+
+}
+//******************************************************************************************
+// Function:WriteBufferData
+// Whazzit:Split to fit the payload limit.  After a discarding first piece the rest must
+//         not discard again, or they'd throw the first away.
+//******************************************************************************************
+void CaptureDevice::WriteBufferData(const CaptureBuffer *p_buffer, UINT p_offset, UINT p_size, DWORD p_flags){
+const UINT chunk=g_dt_max_payload - sizeof(dt_buffer_data);
+dt_buffer_data args;
+
+   if(m_file == NULL)
+   {
+      return;
+   }
+
+   args.id=p_buffer->GetId();
+   args.flags=p_flags;
+   for(UINT done=0;done < p_size;done+=chunk)
+   {
+      const UINT size=p_size - done < chunk ? p_size - done : chunk;
+
+      args.offset=p_offset + done;
+      Write(DT_OP_BUFFER_DATA,&args,sizeof(args),&p_buffer->GetCopy()[0] + args.offset,size);
+      args.flags=(p_flags & RD_LOCK_DISCARD) ? RD_LOCK_NOOVERWRITE : p_flags;
+   }
+
+}
+
+void CaptureDevice::WriteTextureData(const CaptureTexture *p_texture){
+const UINT width=p_texture->GetWidth();
+const UINT height=p_texture->GetHeight();
+const UINT rows=width ? (g_dt_max_payload - sizeof(dt_texture_data)) / width : height;
+dt_texture_data args;
+
+   if(m_file == NULL || width == 0)
+   {
+      return;
+   }
+
+   args.id=p_texture->GetId();
+   for(args.row=0;args.row < height;args.row+=rows)
+   {
+      const UINT count=height - args.row < rows ? height - args.row : rows;
+
+      Write(DT_OP_TEXTURE_DATA,&args,sizeof(args),&p_texture->GetCopy()[0] + (size_t)args.row * width,count * width);
+   }
+
+}
+
+void CaptureDevice::WriteCreate(const CaptureBuffer *p_buffer){
+dt_create_buffer args;
+
+   args.id=p_buffer->GetId();
+   args.length=(UINT)p_buffer->GetCopy().size();
+   args.usage=p_buffer->GetUsage();
+   args.fvf=p_buffer->GetFVF();
+   args.pool=(UINT)p_buffer->GetPool();
+   Write(p_buffer->IsIndex() ? DT_OP_CREATE_INDEX_BUFFER : DT_OP_CREATE_VERTEX_BUFFER,&args,sizeof(args));
+
+}
+
+void CaptureDevice::WriteState(void){
+
+   if(m_fvf_set)
+   {
+      Write(DT_OP_SET_FVF,&m_fvf,sizeof(m_fvf));
+   }
+   for(UINT i=0;i<g_dt_max_streams;i++)
+   {
+      if(m_streams[i])
+      {
+         dt_set_stream_source args={ i,m_streams[i]->GetId(),m_stream_offsets[i],m_stream_strides[i] };
+
+         Write(DT_OP_SET_STREAM_SOURCE,&args,sizeof(args));
+      }
+   }
+   if(m_indices)
+   {
+      dt_set_indices args={ m_indices->GetId() };
+
+      Write(DT_OP_SET_INDICES,&args,sizeof(args));
+   }
+   for(int i=0;i<m_state_count;i++)
+   {
+      Write(DT_OP_SET_RENDER_STATE,&m_states[i],sizeof(m_states[i]));
+   }
+   for(int i=0;i<3;i++)
+   {
+      if(m_transform_set[i])
+      {
+         Write(DT_OP_SET_TRANSFORM,&m_transforms[i],sizeof(m_transforms[i]));
+      }
+   }
+   if(m_quant.set)
+   {
+      Write(DT_OP_SET_QUANTIZATION,&m_quant,sizeof(m_quant),m_palette.empty() ? NULL : &m_palette[0],
+            m_quant.palette_count * sizeof(DWORD));
+   }
+
+}
+//******************************************************************************************
+// Function:Start
+// Whazzit:The header goes in with no frame count, Stop fills it in.  Then everything
+//         live and the state, so the replay starts where we are.
+//******************************************************************************************
+bool CaptureDevice::Start(const char *p_filename, unsigned int p_frames){
+dt_header header;
+
+   Stop();
+
+   m_file=fopen(p_filename,"wb");
+   if(m_file == NULL)
+   {
+      return false;
+   }
+   m_out.reserve(g_dt_write_buffer + g_dt_max_payload + 16);
+   m_frames_wanted=p_frames;
+   m_stats.captures++;
+   m_stats.frames=0;
+   m_stats.records=0;
+   m_stats.bytes=sizeof(header);
+
+   memcpy(header.magic,g_dt_magic,sizeof(header.magic));
+   header.version=g_dt_version;
+   header.width=m_width;
+   header.height=m_height;
+   header.frames=0;
+   fwrite(&header,sizeof(header),1,m_file);
+
+   for(size_t i=0;i<m_buffers.size();i++)
+   {
+      WriteCreate(m_buffers[i]);
+      WriteBufferData(m_buffers[i],0,(UINT)m_buffers[i]->GetCopy().size(),0);
+   }
+   for(size_t i=0;i<m_textures.size();i++)
+   {
+      dt_create_texture args={ m_textures[i]->GetId(),m_textures[i]->GetWidth(),m_textures[i]->GetHeight() };
+
+      Write(DT_OP_CREATE_TEXTURE,&args,sizeof(args));
+      WriteTextureData(m_textures[i]);
+   }
+   WriteState();
+   Write(DT_OP_FRAMES,NULL,0);
+
+   return true;
+}
+
+void CaptureDevice::Stop(void){
+
+   if(m_file == NULL)
+   {
+      return;
+   }
+
+   Flush();
+   //Only now do we know how many frames there are
+   if(fseek(m_file,offsetof(dt_header,frames),SEEK_SET) == 0)
+   {
+      UINT frames=m_stats.frames;
+
+      fwrite(&frames,sizeof(frames),1,m_file);
+   }
+   fclose(m_file);
+   m_file=NULL;
+
+}
+
+void CaptureDevice::Forget(CaptureBuffer *p_buffer){
+dt_release args={ p_buffer->GetId() };
+
+   Write(DT_OP_RELEASE_BUFFER,&args,sizeof(args));
+
+   for(size_t i=0;i<m_buffers.size();i++)
+   {
+      if(m_buffers[i] == p_buffer)
+      {
+         m_buffers[i]=m_buffers.back();
+         m_buffers.pop_back();
+         break;
+      }
+   }
+   for(UINT i=0;i<g_dt_max_streams;i++)
+   {
+      m_streams[i]=m_streams[i] == p_buffer ? NULL : m_streams[i];
+   }
+   m_indices=m_indices == p_buffer ? NULL : m_indices;
+
+}
+
+void CaptureDevice::Forget(CaptureTexture *p_texture){
+dt_release args={ p_texture->GetId() };
+
+   Write(DT_OP_RELEASE_TEXTURE,&args,sizeof(args));
+
+   for(size_t i=0;i<m_textures.size();i++)
+   {
+      if(m_textures[i] == p_texture)
+      {
+         m_textures[i]=m_textures.back();
+         m_textures.pop_back();
+         break;
+      }
+   }
+
+}
+
+HRESULT CaptureDevice::CreateVertexBuffer(UINT p_length, DWORD p_usage, DWORD p_fvf, rd_pool p_pool,
+                                          RenderBuffer **p_buffer){
+RenderBuffer *inner;
+CaptureBuffer *buffer;
+HRESULT hr;
+
+   hr=m_device->CreateVertexBuffer(p_length,p_usage,p_fvf,p_pool,&inner);
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   buffer=new CaptureBuffer(this,inner,m_next_id++,false,p_usage,p_fvf,p_length);
+   m_buffers.push_back(buffer);
+   WriteCreate(buffer);
+   *p_buffer=buffer;
+
+   return hr;
+}
+
+HRESULT CaptureDevice::CreateIndexBuffer(UINT p_length, DWORD p_usage, rd_format p_format, rd_pool p_pool,
+                                         RenderBuffer **p_buffer){
+RenderBuffer *inner;
+CaptureBuffer *buffer;
+HRESULT hr;
+
+   hr=m_device->CreateIndexBuffer(p_length,p_usage,p_format,p_pool,&inner);
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   buffer=new CaptureBuffer(this,inner,m_next_id++,true,p_usage,(DWORD)p_format,p_length);
+   m_buffers.push_back(buffer);
+   WriteCreate(buffer);
+   *p_buffer=buffer;
+
+   return hr;
+}
+
+HRESULT CaptureDevice::CreateTexture(UINT p_width, UINT p_height, RenderTexture **p_texture){
+RenderTexture *inner;
+CaptureTexture *texture;
+dt_create_texture args;
+HRESULT hr;
+
+   hr=m_device->CreateTexture(p_width,p_height,&inner);
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   texture=new CaptureTexture(this,inner,m_next_id++);
+   m_textures.push_back(texture);
+   args.id=texture->GetId();
+   args.width=p_width;
+   args.height=p_height;
+   Write(DT_OP_CREATE_TEXTURE,&args,sizeof(args));
+   *p_texture=texture;
+
+   return hr;
+}
+
+HRESULT CaptureDevice::Clear(DWORD p_colour){
+dt_clear args={ p_colour };
+
+   Write(DT_OP_CLEAR,&args,sizeof(args));
+
+   return m_device->Clear(p_colour);
+}
+
+HRESULT CaptureDevice::BeginScene(void){
+
+   Write(DT_OP_BEGIN_SCENE,NULL,0);
+
+   return m_device->BeginScene();
+}
+
+HRESULT CaptureDevice::EndScene(void){
+
+   Write(DT_OP_END_SCENE,NULL,0);
+
+   return m_device->EndScene();
+}
+
+HRESULT CaptureDevice::Present(void){
+const HRESULT hr=m_device->Present();
+
+   if(m_file)
+   {
+      Write(DT_OP_PRESENT,NULL,0);
+      m_stats.frames++;
+      if(m_frames_wanted && m_stats.frames >= m_frames_wanted)
+      {
+         Stop();
+      }
+   }
+
+   return hr;
+}
+
+HRESULT CaptureDevice::SetTransform(rd_transform p_which, const float *p_matrix){
+dt_set_transform &args=m_transforms[transform_slot(p_which)];
+
+   args.which=(UINT)p_which;
+   memcpy(args.matrix,p_matrix,sizeof(args.matrix));
+   m_transform_set[transform_slot(p_which)]=true;
+   Write(DT_OP_SET_TRANSFORM,&args,sizeof(args));
+
+   return m_device->SetTransform(p_which,p_matrix);
+}
+
+HRESULT CaptureDevice::SetRenderState(rd_render_state p_state, DWORD p_value){
+dt_set_render_state args={ (UINT)p_state,p_value };
+int i;
+
+   for(i=0;i<m_state_count && m_states[i].state != args.state;i++)
+   {
+   }
+   if(i < g_dt_max_states)
+   {
+      m_states[i]=args;
+      m_state_count=i == m_state_count ? m_state_count + 1 : m_state_count;
+   }
+   Write(DT_OP_SET_RENDER_STATE,&args,sizeof(args));
+
+   return m_device->SetRenderState(p_state,p_value);
+}
+
+HRESULT CaptureDevice::SetFVF(DWORD p_fvf){
+dt_set_fvf args={ p_fvf };
+
+   m_fvf_set=true;
+   m_fvf=p_fvf;
+   Write(DT_OP_SET_FVF,&args,sizeof(args));
+
+   return m_device->SetFVF(p_fvf);
+}
+//******************************************************************************************
+// Function:SetQuantization
+// Whazzit:The palette goes in the record by value, the caller's pointer means nothing
+//         to the replay
+//******************************************************************************************
+HRESULT CaptureDevice::SetQuantization(const rd_quantization *p_quant){
+
+   memset(&m_quant,0,sizeof(m_quant));
+   m_palette.clear();
+   if(p_quant)
+   {
+      memcpy(m_quant.scale,p_quant->scale,sizeof(m_quant.scale));
+      memcpy(m_quant.bias,p_quant->bias,sizeof(m_quant.bias));
+      m_quant.palette_count=p_quant->palette ? p_quant->palette_count : 0;
+      m_quant.set=1;
+      m_palette.assign(p_quant->palette,p_quant->palette + m_quant.palette_count);
+   }
+   Write(DT_OP_SET_QUANTIZATION,&m_quant,sizeof(m_quant),m_palette.empty() ? NULL : &m_palette[0],
+         m_quant.palette_count * sizeof(DWORD));
+
+   return m_device->SetQuantization(p_quant);
+}
+
+HRESULT CaptureDevice::SetStreamSource(UINT p_stream, RenderBuffer *p_buffer, UINT p_offset, UINT p_stride){
+dt_set_stream_source args={ p_stream,buffer_id(p_buffer),p_offset,p_stride };
+
+   if(p_stream < g_dt_max_streams)
+   {
+      m_streams[p_stream]=(CaptureBuffer *)p_buffer;
+      m_stream_offsets[p_stream]=p_offset;
+      m_stream_strides[p_stream]=p_stride;
+   }
+   Write(DT_OP_SET_STREAM_SOURCE,&args,sizeof(args));
+
+   return m_device->SetStreamSource(p_stream,inner_buffer(p_buffer),p_offset,p_stride);
+}
+
+HRESULT CaptureDevice::DrawPrimitive(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count){
+dt_draw args={ (UINT)p_type,p_start_vertex,p_prim_count };
+
+   Write(DT_OP_DRAW_PRIMITIVE,&args,sizeof(args));
+
+   return m_device->DrawPrimitive(p_type,p_start_vertex,p_prim_count);
+}
+
+HRESULT CaptureDevice::SetIndices(RenderBuffer *p_buffer){
+dt_set_indices args={ buffer_id(p_buffer) };
+
+   m_indices=(CaptureBuffer *)p_buffer;
+   Write(DT_OP_SET_INDICES,&args,sizeof(args));
+
+   return m_device->SetIndices(inner_buffer(p_buffer));
+}
+
+HRESULT CaptureDevice::DrawIndexedPrimitive(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                            UINT p_num_vertices, UINT p_start_index, UINT p_prim_count){
+dt_draw_indexed args={ (UINT)p_type,p_base_vertex,p_min_index,p_num_vertices,p_start_index,p_prim_count };
+
+   Write(DT_OP_DRAW_INDEXED_PRIMITIVE,&args,sizeof(args));
+
+   return m_device->DrawIndexedPrimitive(p_type,p_base_vertex,p_min_index,p_num_vertices,p_start_index,
+                                         p_prim_count);
+}
+//******************************************************************************************
+// Function:DrawInstanced
+// Whazzit:A grid too big for one record is written as several draws of part of it,
+//         which draw the same thing
+//******************************************************************************************
+HRESULT CaptureDevice::DrawInstanced(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count,
+                                     const rd_instance *p_instances, UINT p_instance_count){
+const UINT chunk=(g_dt_max_payload - sizeof(dt_draw)) / sizeof(rd_instance);
+dt_draw args={ (UINT)p_type,p_start_vertex,p_prim_count };
+
+   for(UINT done=0;m_file && done < p_instance_count;done+=chunk)
+   {
+      const UINT count=p_instance_count - done < chunk ? p_instance_count - done : chunk;
+
+      Write(DT_OP_DRAW_INSTANCED,&args,sizeof(args),p_instances + done,count * sizeof(rd_instance));
+   }
+
+   return m_device->DrawInstanced(p_type,p_start_vertex,p_prim_count,p_instances,p_instance_count);
+}
+
+HRESULT CaptureDevice::DrawIndexedInstanced(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                            UINT p_num_vertices, UINT p_start_index, UINT p_prim_count,
+                                            const rd_instance *p_instances, UINT p_instance_count){
+const UINT chunk=(g_dt_max_payload - sizeof(dt_draw_indexed)) / sizeof(rd_instance);
+dt_draw_indexed args={ (UINT)p_type,p_base_vertex,p_min_index,p_num_vertices,p_start_index,p_prim_count };
+
+   for(UINT done=0;m_file && done < p_instance_count;done+=chunk)
+   {
+      const UINT count=p_instance_count - done < chunk ? p_instance_count - done : chunk;
+
+      Write(DT_OP_DRAW_INDEXED_INSTANCED,&args,sizeof(args),p_instances + done,count * sizeof(rd_instance));
+   }
+
+   return m_device->DrawIndexedInstanced(p_type,p_base_vertex,p_min_index,p_num_vertices,p_start_index,
+                                         p_prim_count,p_instances,p_instance_count);
+}
+
+HRESULT CaptureDevice::DrawGlyphs(RenderTexture *p_atlas, RenderBuffer *p_vertices, UINT p_start_vertex,
+                                  UINT p_glyph_count){
+dt_draw_glyphs args={ p_atlas ? ((CaptureTexture *)p_atlas)->GetId() : 0,buffer_id(p_vertices),p_start_vertex,
+                      p_glyph_count };
+
+   Write(DT_OP_DRAW_GLYPHS,&args,sizeof(args));
+
+   return m_device->DrawGlyphs(p_atlas ? ((CaptureTexture *)p_atlas)->GetInner() : NULL,inner_buffer(p_vertices),
+                               p_start_vertex,p_glyph_count);
+}
+
+rd_fence CaptureDevice::InsertFence(void){
+
+   Write(DT_OP_INSERT_FENCE,NULL,0);
+
+   return m_device->InsertFence();
+}
@@ -0,0 +1,354 @@
+//
+// device_trace.h - Records the device call stream to a file, to replay offline
+//
+// CaptureDevice sits between the scene and the real device.  Every call goes straight
+// through, and while a capture is running it is also written to a trace, along with
+// what each buffer and texture held when it was unlocked.  So the trace plays back
+// without the application, its assets or the platform it ran on (see trace_replay.h).
+//
+// A capture can start part way through a run, when a frame turns out to be slow.  For
+// that every buffer and texture keeps a system memory copy of what was written to it,
+// and the device remembers the state last set.  Start writes all of that first, so the
+// trace opens with the device as the first captured frame found it.  Lock hands out
+// the copy and Unlock sends it on, so nothing is ever read back from write-only
+// memory.  The copies double what the buffers take, which is why the device is only
+// put in the way when asked for.
+//
+// Text drawn through ID3DXFont (-d3dx_text) doesn't go through the device interface
+// and isn't in the trace, the glyph batches are.
+//
+// A trace is native endian: a dt_header, then records.  Each record is a UINT holding
+// the op in its low 8 bits and the payload size above them, then the payload padded to
+// a multiple of 4 bytes.  Payloads are the call's arguments as the dt_ structs below
+// followed by whatever data the call carries (buffer contents, instances).  Buffers
+// and textures are referred to by ids given out at creation, 0 is none.  DT_OP_FRAMES
+// is where the state dump stops and the captured frames begin; each frame ends at its
+// Present.
+//
+#ifndef DEVICE_TRACE_H
+#define DEVICE_TRACE_H
+
+#include <stdio.h>
+#include <vector>
+#include "render_device.h"
+
+const char g_dt_magic[4] = { 'D','H','T','R' };
+const UINT g_dt_version = 1;
+//Payloads are kept under the 24 bits the size has, bigger data is split up
+const UINT g_dt_max_payload = 1024 * 1024;
+const size_t g_dt_write_buffer = 1024 * 1024;
+//Streams and render states the state dump remembers
+const UINT g_dt_max_streams = 4;
+const int g_dt_max_states = 32;
+
+enum dt_op
+{
+   DT_OP_NONE,
+   DT_OP_CREATE_VERTEX_BUFFER,
+   DT_OP_CREATE_INDEX_BUFFER,
+   DT_OP_CREATE_TEXTURE,
+   DT_OP_RELEASE_BUFFER,
+   DT_OP_RELEASE_TEXTURE,
+   DT_OP_BUFFER_DATA,
+   DT_OP_TEXTURE_DATA,
+   DT_OP_FRAMES,
+   DT_OP_CLEAR,
+   DT_OP_BEGIN_SCENE,
+   DT_OP_END_SCENE,
+   DT_OP_PRESENT,
+   DT_OP_SET_TRANSFORM,
+   DT_OP_SET_RENDER_STATE,
+   DT_OP_SET_FVF,
+   DT_OP_SET_STREAM_SOURCE,
+   DT_OP_SET_INDICES,
+   DT_OP_DRAW_PRIMITIVE,
+   DT_OP_DRAW_INDEXED_PRIMITIVE,
+   DT_OP_DRAW_INSTANCED,
+   DT_OP_DRAW_INDEXED_INSTANCED,
+   DT_OP_DRAW_GLYPHS,
+   DT_OP_INSERT_FENCE,
+   DT_OP_SET_QUANTIZATION,
+   DT_OP_COUNT
+};
+
+struct dt_header
+{
+   char magic[4];
+   UINT version;
+   UINT width;          //Of the backbuffer the trace was drawn to
+   UINT height;
+   UINT frames;         //Presents after DT_OP_FRAMES
+};
+
+//DT_OP_CREATE_VERTEX_BUFFER and DT_OP_CREATE_INDEX_BUFFER
+struct dt_create_buffer
+{
+   UINT id;
+   UINT length;
+   DWORD usage;
+   DWORD fvf;          //Index buffers, the rd_format
+   UINT pool;
+};
+
+struct dt_create_texture
+{
+   UINT id;
+   UINT width;
+   UINT height;
+};
+
+//DT_OP_RELEASE_BUFFER and DT_OP_RELEASE_TEXTURE
+struct dt_release
+{
+   UINT id;
+};
+
+//Followed by the bytes written, locked with p_flags at p_offset
+struct dt_buffer_data
+{
+   UINT id;
+   UINT offset;
+   DWORD flags;
+};
+
+//Followed by whole rows of width bytes from row on
+struct dt_texture_data
+{
+   UINT id;
+   UINT row;
+};
+
+struct dt_clear
+{
+   DWORD colour;
+};
+
+struct dt_set_transform
+{
+   UINT which;
+   float matrix[16];
+};
+
+struct dt_set_render_state
+{
+   UINT state;
+   DWORD value;
+};
+
+struct dt_set_fvf
+{
+   DWORD fvf;
+};
+
+struct dt_set_stream_source
+{
+   UINT stream;
+   UINT id;
+   UINT offset;
+   UINT stride;
+};
+
+struct dt_set_indices
+{
+   UINT id;
+};
+
+//Followed by palette_count DWORDs.  set is 0 for SetQuantization(NULL).
+struct dt_set_quantization
+{
+   float scale[3];
+   float bias[3];
+   UINT palette_count;
+   UINT set;
+};
+
+//DT_OP_DRAW_PRIMITIVE, and DT_OP_DRAW_INSTANCED followed by its rd_instances
+struct dt_draw
+{
+   UINT type;
+   UINT start_vertex;
+   UINT prim_count;
+};
+
+//DT_OP_DRAW_INDEXED_PRIMITIVE, and DT_OP_DRAW_INDEXED_INSTANCED followed by its rd_instances
+struct dt_draw_indexed
+{
+   UINT type;
+   int base_vertex;
+   UINT min_index;
+   UINT num_vertices;
+   UINT start_index;
+   UINT prim_count;
+};
+
+struct dt_draw_glyphs
+{
+   UINT atlas;
+   UINT vertices;
+   UINT start_vertex;
+   UINT glyph_count;
+};
+
+const char *dt_op_name(int p_op);
+
+struct dt_capture_stats
+{
+   unsigned int captures;        //Started since the device was made
+   unsigned int frames;          //In the current or last capture
+   unsigned long long records;
+   unsigned long long bytes;     //Written to the trace
+};
+
+class CaptureDevice;
+
+//Wraps the real buffer.  Lock hands out the system memory copy, Unlock sends the
+//locked range on and records it.
+class CaptureBuffer : public RenderBuffer
+{
+public:
+   CaptureBuffer(CaptureDevice *p_owner, RenderBuffer *p_inner, UINT p_id, bool p_index, DWORD p_usage,
+                 DWORD p_fvf, UINT p_length);
+
+   virtual HRESULT Lock(UINT p_offset, UINT p_size, void **p_data, DWORD p_flags);
+   virtual HRESULT Unlock(void);
+   virtual UINT GetSize(void) const { return m_inner->GetSize(); }
+   virtual rd_pool GetPool(void) const { return m_inner->GetPool(); }
+   virtual void Release(void);
+
+   RenderBuffer *GetInner(void) const { return m_inner; }
+   UINT GetId(void) const { return m_id; }
+   bool IsIndex(void) const { return m_index; }
+   DWORD GetUsage(void) const { return m_usage; }
+   DWORD GetFVF(void) const { return m_fvf; }
+   const std::vector<BYTE> &GetCopy(void) const { return m_copy; }
+
+private:
+   CaptureDevice *m_owner;
+   RenderBuffer *m_inner;
+   UINT m_id;
+   bool m_index;
+   DWORD m_usage;
+   DWORD m_fvf;                  //Index buffers, the rd_format
+   std::vector<BYTE> m_copy;
+   void *m_target;               //The real lock, while locked
+   UINT m_lock_offset;
+   UINT m_lock_size;
+   DWORD m_lock_flags;
+};
+
+class CaptureTexture : public RenderTexture
+{
+public:
+   CaptureTexture(CaptureDevice *p_owner, RenderTexture *p_inner, UINT p_id);
+
+   virtual HRESULT Lock(void **p_data, UINT *p_pitch);
+   virtual HRESULT Unlock(void);
+   virtual UINT GetWidth(void) const { return m_inner->GetWidth(); }
+   virtual UINT GetHeight(void) const { return m_inner->GetHeight(); }
+   virtual void Release(void);
+
+   RenderTexture *GetInner(void) const { return m_inner; }
+   UINT GetId(void) const { return m_id; }
+   const std::vector<BYTE> &GetCopy(void) const { return m_copy; }
+
+private:
+   CaptureDevice *m_owner;
+   RenderTexture *m_inner;
+   UINT m_id;
+   std::vector<BYTE> m_copy;     //Pitch is the width
+};
+
+class CaptureDevice : public RenderDevice
+{
+public:
+   //Doesn't own p_device.  p_width and p_height go in the trace for the replay's sake.
+   CaptureDevice(RenderDevice *p_device, UINT p_width, UINT p_height);
+   virtual ~CaptureDevice(void);
+
+   //Writes the state dump to p_filename, then every call until p_frames frames have
+   //been presented (0 keeps going until Stop)
+   bool Start(const char *p_filename, unsigned int p_frames);
+   void Stop(void);
+   bool IsCapturing(void) const { return m_file != NULL; }
+   const dt_capture_stats &GetStats(void) const { return m_stats; }
+   RenderDevice *GetInner(void) const { return m_device; }
+
+   virtual const char *GetName(void) const { return m_device->GetName(); }
+   virtual bool CanQuantize(void) { return m_device->CanQuantize(); }
+   virtual HRESULT TestCooperativeLevel(void) { return m_device->TestCooperativeLevel(); }
+
+   virtual HRESULT CreateVertexBuffer(UINT p_length, DWORD p_usage, DWORD p_fvf, rd_pool p_pool,
+                                      RenderBuffer **p_buffer);
+   virtual HRESULT CreateIndexBuffer(UINT p_length, DWORD p_usage, rd_format p_format, rd_pool p_pool,
+                                     RenderBuffer **p_buffer);
+   virtual HRESULT CreateTexture(UINT p_width, UINT p_height, RenderTexture **p_texture);
+
+   virtual HRESULT Clear(DWORD p_colour);
+   virtual HRESULT BeginScene(void);
+   virtual HRESULT EndScene(void);
+   virtual HRESULT Present(void);
+
+   virtual HRESULT SetTransform(rd_transform p_which, const float *p_matrix);
+   virtual HRESULT SetRenderState(rd_render_state p_state, DWORD p_value);
+   virtual HRESULT SetFVF(DWORD p_fvf);
+   virtual HRESULT SetQuantization(const rd_quantization *p_quant);
+   virtual HRESULT SetStreamSource(UINT p_stream, RenderBuffer *p_buffer, UINT p_offset, UINT p_stride);
+   virtual HRESULT DrawPrimitive(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count);
+   virtual HRESULT SetIndices(RenderBuffer *p_buffer);
+   virtual HRESULT DrawIndexedPrimitive(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                        UINT p_num_vertices, UINT p_start_index, UINT p_prim_count);
+   virtual HRESULT DrawInstanced(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count,
+                                 const rd_instance *p_instances, UINT p_instance_count);
+   virtual HRESULT DrawIndexedInstanced(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                        UINT p_num_vertices, UINT p_start_index, UINT p_prim_count,
+                                        const rd_instance *p_instances, UINT p_instance_count);
+   virtual HRESULT DrawGlyphs(RenderTexture *p_atlas, RenderBuffer *p_vertices, UINT p_start_vertex,
+                              UINT p_glyph_count);
+
+   virtual rd_fence InsertFence(void);
+   virtual bool FenceDone(rd_fence p_fence) { return m_device->FenceDone(p_fence); }
+
+private:
+   friend class CaptureBuffer;
+   friend class CaptureTexture;
+
+   CaptureDevice(const CaptureDevice &);
+   CaptureDevice &operator=(const CaptureDevice &);
+
+   void Write(dt_op p_op, const void *p_args, UINT p_args_size, const void *p_data=NULL, UINT p_data_size=0);
+   void Flush(void);
+   void WriteBufferData(const CaptureBuffer *p_buffer, UINT p_offset, UINT p_size, DWORD p_flags);
+   void WriteTextureData(const CaptureTexture *p_texture);
+   void WriteCreate(const CaptureBuffer *p_buffer);
+   void WriteState(void);
+   void Forget(CaptureBuffer *p_buffer);
+   void Forget(CaptureTexture *p_texture);
+
+   RenderDevice *m_device;
+   UINT m_width;
+   UINT m_height;
+   UINT m_next_id;
+   std::vector<CaptureBuffer *> m_buffers;
+   std::vector<CaptureTexture *> m_textures;
+
+   //The state as last set, for the dump at the start of a capture
+   bool m_fvf_set;
+   DWORD m_fvf;
+   CaptureBuffer *m_streams[g_dt_max_streams];
+   UINT m_stream_offsets[g_dt_max_streams];
+   UINT m_stream_strides[g_dt_max_streams];
+   CaptureBuffer *m_indices;
+   dt_set_render_state m_states[g_dt_max_states];
+   int m_state_count;
+   bool m_transform_set[3];
+   dt_set_transform m_transforms[3];   //World, view, projection
+   dt_set_quantization m_quant;         //set is 0 until there is one
+   std::vector<DWORD> m_palette;
+
+   FILE *m_file;
+   std::vector<BYTE> m_out;
+   unsigned int m_frames_wanted;
+   dt_capture_stats m_stats;
+};
+
+#endif
@@ -0,0 +1,371 @@
+//
+// dump_decode.cpp - Parallel, checked decoding of a big-endian vertex dump
+//
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "dump_decode.h"
+#include "mapped_file.h"
+#include "hires_timer.h"
+#include "text_format.h"
+
+//What a window's threads find in one chunk
+struct dd_chunk_state
+{
+   dd_chunk chunk;
+   uint64_t errors[DD_ERROR_KINDS];
+   std::vector<dd_error> first_errors;    //Up to g_dd_max_errors
+};
+
+//One mapped window, shared by the threads decoding it
+struct dd_window
+{
+   const BYTE *data;             //The window's first record
+   size_t size;                  //Bytes mapped from there
+   uint64_t offset;              //Of data in the file
+   uint64_t first_record;
+   size_t records;
+   size_t chunk_records;
+   size_t chunk_count;
+   const be_vertex_layout *layout;
+   float limit;                  //Largest good coordinate
+   tri_vertex *out;              //The window's first record in the caller's vertices, or NULL
+   dd_chunk_state *chunks;
+   std::atomic<size_t> next_chunk;
+};
+
+const char *dd_error_name(dd_error_kind p_kind){
+
+   switch(p_kind)
+   {
+      case DD_NAN:            return "nan";
+      case DD_INFINITE:       return "infinite";
+      case DD_OUT_OF_RANGE:   return "out of range";
+      case DD_TRUNCATED:      return "truncated";
+      default:                break;
+   }
+
+   return "unknown";
+}
+
+static void empty_bounds(dd_bounds *p_bounds){
+
+   for(int k=0;k<3;k++)
+   {
+      p_bounds->min[k]=HUGE_VALF;
+      p_bounds->max[k]=-HUGE_VALF;
+   }
+
+}
+
+static void merge_bounds(dd_bounds *p_bounds, const dd_bounds &p_other){
+
+   for(int k=0;k<3;k++)
+   {
+      p_bounds->min[k]=p_other.min[k] < p_bounds->min[k] ? p_other.min[k] : p_bounds->min[k];
+      p_bounds->max[k]=p_other.max[k] > p_bounds->max[k] ? p_other.max[k] : p_bounds->max[k];
+   }
+
+}
+
+static void add_error(std::vector<dd_error> *p_errors, dd_error_kind p_kind, int p_field, uint64_t p_record,
+                      uint64_t p_offset){
+dd_error error;
+
+   if(p_errors->size() < g_dd_max_errors)
+   {
+      error.kind=p_kind;
+      error.field=p_field;
+      error.record=p_record;
+      error.offset=p_offset;
+      p_errors->push_back(error);
+   }
+
+}
+//******************************************************************************************
+// Function:check_chunk
+// Whazzit:A good record costs three compares, which NaN and infinity both fail along
+//         with anything past the limit.  Only the records that fail are looked at
+//         field by field to say why.
+//******************************************************************************************
+static void check_chunk(const dd_window &p_window, size_t p_chunk, const tri_vertex *p_vertices, size_t p_count){
+dd_chunk_state &state=p_window.chunks[p_chunk];
+const size_t first=p_chunk * p_window.chunk_records;
+const size_t stride=p_window.layout->stride;
+dd_bounds bounds;
+
+   empty_bounds(&bounds);
+
+   for(size_t i=0;i<p_count;i++)
+   {
+      const float pos[3]={ p_vertices[i].x,p_vertices[i].y,p_vertices[i].z };
+
+      if(fabsf(pos[0]) <= p_window.limit && fabsf(pos[1]) <= p_window.limit && fabsf(pos[2]) <= p_window.limit)
+      {
+         for(int k=0;k<3;k++)
+         {
+            bounds.min[k]=pos[k] < bounds.min[k] ? pos[k] : bounds.min[k];
+            bounds.max[k]=pos[k] > bounds.max[k] ? pos[k] : bounds.max[k];
+         }
+         continue;
+      }
+
+      state.chunk.bad_records++;
+      for(int k=0;k<3;k++)
+      {
+         uint32_t bits;
+         dd_error_kind kind;
+
+         if(fabsf(pos[k]) <= p_window.limit)
+         {
+            continue;
+         }
+
+         memcpy(&bits,&pos[k],sizeof(bits));
+         if((bits & 0x7F800000) == 0x7F800000)
+         {
+            kind=(bits & 0x007FFFFF) ? DD_NAN : DD_INFINITE;
+         }
+         else
+         {
+            kind=DD_OUT_OF_RANGE;
+         }
+         state.errors[kind]++;
+         add_error(&state.first_errors,kind,k,p_window.first_record + first + i,
+                   p_window.offset + (first + i) * stride + p_window.layout->pos_offset + k * 4);
+      }
+   }
+
+   state.chunk.bounds=bounds;
+
+}
+//******************************************************************************************
+// Function:decode_chunks
+// Whazzit:Takes chunks until the window runs out.  Without the caller's vertices to
+//         decode into, each thread reuses one chunk of its own.
+//******************************************************************************************
+static void decode_chunks(dd_window *p_window){
+std::vector<tri_vertex> scratch;
+
+   for(;;)
+   {
+      const size_t chunk=p_window->next_chunk.fetch_add(1);
+      size_t first;
+      size_t count;
+      tri_vertex *dst;
+
+      if(chunk >= p_window->chunk_count)
+      {
+         break;
+      }
+
+      first=chunk * p_window->chunk_records;
+      count=p_window->records - first < p_window->chunk_records ? p_window->records - first :
+                                                                  p_window->chunk_records;
+      if(p_window->out)
+      {
+         dst=p_window->out + first;
+      }
+      else
+      {
+         scratch.resize(p_window->chunk_records);
+         dst=&scratch[0];
+      }
+
+      //The window always holds its records whole, so this can't fail
+      decode_vertices_be(p_window->data,p_window->size,first * p_window->layout->stride,*p_window->layout,dst,count);
+      check_chunk(*p_window,chunk,dst,count);
+   }
+
+}
+//******************************************************************************************
+// Function:dd_decode
+// Whazzit:Maps a window, lets every thread at its chunks, then folds the chunks into the
+//         result in file order, so the errors kept are the first ones whichever thread
+//         found them.  A part record at the end is the last error there can be.
+//******************************************************************************************
+bool dd_decode(const char *p_source, const be_vertex_layout &p_layout, const dd_options &p_options,
+               dd_result *p_result, std::vector<tri_vertex> *p_vertices){
+MappedFile file;
+size_t record_size;
+size_t window_records;
+int threads;
+double start;
+dd_window window;
+std::vector<dd_chunk_state> states;
+std::vector<std::thread> workers;
+
+   p_result->file_size=0;
+   p_result->records=0;
+   p_result->bad_records=0;
+   memset(p_result->errors,0,sizeof(p_result->errors));
+   p_result->first_errors.clear();
+   p_result->chunks.clear();
+   empty_bounds(&p_result->bounds);
+   p_result->windows=0;
+   p_result->threads=0;
+   p_result->seconds=0.0;
+   p_result->gb_per_sec=0.0;
+   if(p_vertices)
+   {
+      p_vertices->clear();
+   }
+
+   if(p_layout.stride == 0 || !file.OpenUnmapped(p_source))
+   {
+      return false;
+   }
+
+   start=hires_seconds();
+
+   record_size=p_layout.pos_offset + 12;
+   if(p_layout.colour_offset >= 0 && (size_t)p_layout.colour_offset + 4 > record_size)
+   {
+      record_size=p_layout.colour_offset + 4;
+   }
+
+   p_result->file_size=file.GetFileSize();
+   if(p_result->file_size >= record_size)
+   {
+      p_result->records=(p_result->file_size - record_size) / p_layout.stride + 1;
+   }
+   if(p_vertices)
+   {
+      p_vertices->resize((size_t)p_result->records);
+   }
+
+   threads=p_options.threads;
+   if(threads <= 0)
+   {
+      threads=(int)std::thread::hardware_concurrency();
+      threads=threads > 0 ? threads : 1;
+   }
+   p_result->threads=threads;
+
+   window.chunk_records=p_options.chunk_records ? p_options.chunk_records : g_dd_chunk_records;
+   window_records=p_options.window_size / p_layout.stride / window.chunk_records * window.chunk_records;
+   window_records=window_records ? window_records : window.chunk_records;
+   window.layout=&p_layout;
+   window.limit=p_options.max_coordinate > 0.0f ? p_options.max_coordinate : FLT_MAX;
+
+   for(uint64_t first=0;first < p_result->records;first+=window_records)
+   {
+      window.first_record=first;
+      window.records=p_result->records - first < window_records ? (size_t)(p_result->records - first) :
+                                                                  window_records;
+      window.offset=first * p_layout.stride;
+      window.size=(window.records - 1) * p_layout.stride + record_size;
+      if(!file.MapView(window.offset,window.size))
+      {
+         return false;
+      }
+      file.Advise(MF_ADVISE_SEQUENTIAL);
+      window.data=file.GetData();
+      window.out=p_vertices ? &(*p_vertices)[(size_t)first] : NULL;
+
+      window.chunk_count=(window.records + window.chunk_records - 1) / window.chunk_records;
+      states.resize(window.chunk_count);
+      for(size_t i=0;i<window.chunk_count;i++)
+      {
+         states[i].chunk.first_record=first + i * window.chunk_records;
+         states[i].chunk.count=(uint32_t)(window.records - i * window.chunk_records < window.chunk_records ?
+                                          window.records - i * window.chunk_records : window.chunk_records);
+         states[i].chunk.bad_records=0;
+         memset(states[i].errors,0,sizeof(states[i].errors));
+         states[i].first_errors.clear();
+      }
+      window.chunks=&states[0];
+      window.next_chunk=0;
+
+      //This thread is one of them
+      for(int i=1;i < threads && (size_t)i < window.chunk_count;i++)
+      {
+         workers.push_back(std::thread(decode_chunks,&window));
+      }
+      decode_chunks(&window);
+      for(size_t i=0;i<workers.size();i++)
+      {
+         workers[i].join();
+      }
+      workers.clear();
+
+      for(size_t i=0;i<window.chunk_count;i++)
+      {
+         const dd_chunk_state &state=states[i];
+
+         p_result->chunks.push_back(state.chunk);
+         p_result->bad_records+=state.chunk.bad_records;
+         merge_bounds(&p_result->bounds,state.chunk.bounds);
+         for(int k=0;k<DD_ERROR_KINDS;k++)
+         {
+            p_result->errors[k]+=state.errors[k];
+         }
+         for(size_t e=0;e<state.first_errors.size();e++)
+         {
+            add_error(&p_result->first_errors,state.first_errors[e].kind,state.first_errors[e].field,
+                      state.first_errors[e].record,state.first_errors[e].offset);
+         }
+      }
+      p_result->windows++;
+   }
+
+   if(p_result->file_size > p_result->records * p_layout.stride)
+   {
+      p_result->bad_records++;
+      p_result->errors[DD_TRUNCATED]++;
+      add_error(&p_result->first_errors,DD_TRUNCATED,-1,p_result->records,p_result->records * p_layout.stride);
+   }
+
+   p_result->seconds=hires_seconds() - start;
+   if(p_result->seconds > 0.0)
+   {
+      p_result->gb_per_sec=p_result->file_size / p_result->seconds / 1e9;
+   }
+
+   return true;
+}
+
+size_t dd_format_report(const dd_result &p_result, char *p_buffer, size_t p_size){
+static const char axes[]="xyz";
+uint64_t errors=0;
+size_t length=0;
+
+   length+=tx_format(p_buffer + length,p_size - length,
+                     "%llu records (%.1f MB) in %.1f ms on %d threads, %.2f GB/s, %u windows, %llu bad records: "
+                     "%llu nan, %llu infinite, %llu out of range, %llu truncated\n",
+                     (unsigned long long)p_result.records,p_result.file_size / (1024.0 * 1024.0),
+                     p_result.seconds * 1000.0,p_result.threads,p_result.gb_per_sec,p_result.windows,
+                     (unsigned long long)p_result.bad_records,(unsigned long long)p_result.errors[DD_NAN],
+                     (unsigned long long)p_result.errors[DD_INFINITE],
+                     (unsigned long long)p_result.errors[DD_OUT_OF_RANGE],
+                     (unsigned long long)p_result.errors[DD_TRUNCATED]);
+
+   for(size_t i=0;i<p_result.first_errors.size();i++)
+   {
+      const dd_error &error=p_result.first_errors[i];
+
+      if(error.field < 0)
+      {
+         length+=tx_format(p_buffer + length,p_size - length,"   record %llu at byte %llu: %s\n",
+                           (unsigned long long)error.record,(unsigned long long)error.offset,dd_error_name(error.kind));
+      }
+      else
+      {
+         length+=tx_format(p_buffer + length,p_size - length,"   record %llu at byte %llu: %c is %s\n",
+                           (unsigned long long)error.record,(unsigned long long)error.offset,axes[error.field],
+                           dd_error_name(error.kind));
+      }
+   }
+   for(int k=0;k<DD_ERROR_KINDS;k++)
+   {
+      errors+=p_result.errors[k];
+   }
+   if(errors > p_result.first_errors.size())
+   {
+      length+=tx_format(p_buffer + length,p_size - length,"   and more\n");
+   }
+
+   return length;
+}
@@ -0,0 +1,103 @@
+//
+// dump_decode.h - Parallel, checked decoding of a big-endian vertex dump
+//
+// The dump is split into chunks of whole records and every core takes chunks off a
+// shared counter, decodes them with decode_vertices_be and then checks each record
+// while it is still in cache: NaN and infinite coordinates, coordinates past
+// max_coordinate, and a last record the file ends part way through.  The same pass
+// keeps the bounds of each chunk's good records.  So a bad dump is turned away when
+// it is loaded, with the records to blame, rather than halfway through drawing it.
+//
+// The dump is mapped a window at a time, each a whole number of chunks, so checking
+// it only ever needs one window of address space.  Asked for the vertices as well it
+// still streams, but the vertices themselves have to fit in memory.
+//
+// dd_decode runs on its own threads, started for each window, so it can be called
+// from any thread (the asset loader's worker included) without the job system.
+//
+#ifndef DUMP_DECODE_H
+#define DUMP_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "float_decode.h"
+
+//Bytes of the dump mapped at once
+const size_t g_dd_window_size = 256 * 1024 * 1024;
+//Records a thread takes at a time, and that a dd_chunk covers
+const size_t g_dd_chunk_records = 64 * 1024;
+//Coordinates further than this from the origin are counted as out of range
+const float g_dd_max_coordinate = 1.0e6f;
+//Errors kept with their locations, the rest are only counted
+const size_t g_dd_max_errors = 32;
+
+enum dd_error_kind
+{
+   DD_NAN,
+   DD_INFINITE,
+   DD_OUT_OF_RANGE,
+   DD_TRUNCATED,        //The file ends inside the record
+   DD_ERROR_KINDS
+};
+
+struct dd_error
+{
+   dd_error_kind kind;
+   int field;           //0-2 for x,y,z, -1 for a truncated record
+   uint64_t record;
+   uint64_t offset;     //Of the field, or the truncated record, in the file
+};
+
+struct dd_bounds
+{
+   float min[3];
+   float max[3];
+};
+
+struct dd_chunk
+{
+   uint64_t first_record;
+   uint32_t count;
+   uint32_t bad_records;
+   dd_bounds bounds;    //Of the good records, min above max when there are none
+};
+
+struct dd_options
+{
+   int threads;               //0 for one per hardware thread
+   size_t window_size;
+   size_t chunk_records;
+   float max_coordinate;      //0 for no limit
+};
+
+const dd_options g_dd_default_options = { 0,g_dd_window_size,g_dd_chunk_records,g_dd_max_coordinate };
+
+struct dd_result
+{
+   uint64_t file_size;
+   uint64_t records;                   //Whole ones
+   uint64_t bad_records;               //With at least one error, a truncated one included
+   uint64_t errors[DD_ERROR_KINDS];
+   std::vector<dd_error> first_errors; //The first g_dd_max_errors, in file order
+   std::vector<dd_chunk> chunks;
+   dd_bounds bounds;                   //Every good record
+   unsigned int windows;
+   int threads;
+   double seconds;
+   double gb_per_sec;                  //Of dump decoded and checked
+};
+
+const char *dd_error_name(dd_error_kind p_kind);
+
+//Decodes and checks every record of the dump at p_source.  p_vertices may be NULL to
+//only check it, which works for a dump of any size; otherwise it gets every whole
+//record, bad ones as they were.  False if the dump can't be opened or a window of it
+//can't be mapped.
+bool dd_decode(const char *p_source, const be_vertex_layout &p_layout, const dd_options &p_options,
+               dd_result *p_result, std::vector<tri_vertex> *p_vertices);
+
+//A line of totals and throughput, then a line for each error kept
+size_t dd_format_report(const dd_result &p_result, char *p_buffer, size_t p_size);
+
+#endif
@@ -0,0 +1,290 @@
+//
+// file_watch.cpp - Tells us when files we loaded from change on disk
+//
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "file_watch.h"
+#include "hires_timer.h"
+
+#ifdef __linux__
+   #include <sys/inotify.h>
+   #include <unistd.h>
+   #include <errno.h>
+#endif
+
+static bool file_info(const char *p_filename, uint64_t *p_size, uint64_t *p_time){
+#ifdef _WIN32
+struct _stat64 info;
+
+   if(_stat64(p_filename,&info) != 0)
+   {
+      return false;
+   }
+#else
+struct stat info;
+
+   if(stat(p_filename,&info) != 0)
+   {
+      return false;
+   }
+#endif
+
+   *p_size=(uint64_t)info.st_size;
+#if defined(__linux__)
+   //Two writes inside a second must still look different
+   *p_time=(uint64_t)info.st_mtim.tv_sec * 1000000000ULL + (uint64_t)info.st_mtim.tv_nsec;
+#else
+   *p_time=(uint64_t)info.st_mtime;
+#endif
+
+   return true;
+}
+
+static void split_path(const char *p_filename, std::string *p_dir, std::string *p_name){
+const char *slash=strrchr(p_filename,'/');
+#ifdef _WIN32
+const char *back=strrchr(p_filename,'\\');
+
+   if(back && (!slash || back > slash))
+   {
+      slash=back;
+   }
+#endif
+
+   if(slash == NULL)
+   {
+      *p_dir=".";
+      *p_name=p_filename;
+   }
+   else
+   {
+      p_dir->assign(p_filename,slash == p_filename ? 1 : slash - p_filename);
+      *p_name=slash + 1;
+   }
+
+}
+
+FileWatcher::FileWatcher(void) :
+   m_last_poll(0.0)
+#ifndef _WIN32
+   ,m_fd(-1)
+#endif
+{
+}
+
+FileWatcher::~FileWatcher(void){
+
+   Close();
+
+}
+
+int FileWatcher::Watch(const char *p_filename){
+watch item;
+size_t dir;
+
+   item.path=p_filename;
+   split_path(p_filename,&item.dir,&item.name);
+   item.size=0;
+   item.time=0;
+   item.pending=false;
+   item.last_event=0.0;
+   file_info(p_filename,&item.size,&item.time);
+
+   for(dir=0;dir<m_dirs.size();dir++)
+   {
+      if(m_dirs[dir].path == item.dir)
+      {
+         break;
+      }
+   }
+
+   if(dir == m_dirs.size())
+   {
+      directory entry;
+
+      entry.path=item.dir;
+#ifdef _WIN32
+      entry.notify=FindFirstChangeNotificationA(item.dir.c_str(),FALSE,
+                                                FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE |
+                                                FILE_NOTIFY_CHANGE_LAST_WRITE);
+      if(entry.notify == INVALID_HANDLE_VALUE)
+      {
+         return -1;
+      }
+#else
+      entry.wd=-1;
+   #ifdef __linux__
+      if(m_fd < 0)
+      {
+         m_fd=inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      }
+      if(m_fd >= 0)
+      {
+         entry.wd=inotify_add_watch(m_fd,item.dir.c_str(),IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+         if(entry.wd < 0 && errno == ENOENT)
+         {
+            return -1;
+         }
+      }
+   #endif
+#endif
+      m_dirs.push_back(entry);
+   }
+
+   item.dir_handle=(int)dir;
+   m_watches.push_back(item);
+
+   return (int)m_watches.size() - 1;
+}
+
+void FileWatcher::Touch(watch *p_watch, double p_now){
+
+   p_watch->pending=true;
+   p_watch->last_event=p_now;
+
+}
+//******************************************************************************************
+// Function:CheckStat
+// Whazzit:For the notification paths that can't tell us which file changed, and the
+//         polling fallback
+//******************************************************************************************
+void FileWatcher::CheckStat(watch *p_watch, double p_now){
+uint64_t size,time;
+
+   if(!file_info(p_watch->path.c_str(),&size,&time))
+   {
+      //Mid replace, it will be back
+      return;
+   }
+
+   if(size != p_watch->size || time != p_watch->time)
+   {
+      p_watch->size=size;
+      p_watch->time=time;
+      Touch(p_watch,p_now);
+   }
+
+}
+
+void FileWatcher::ReadEvents(double p_now){
+#ifdef __linux__
+//inotify_event is variable length, keep the buffer aligned for it
+alignas(struct inotify_event) char buffer[4096];
+ssize_t length;
+
+   if(m_fd < 0)
+   {
+      return;
+   }
+
+   while((length=read(m_fd,buffer,sizeof(buffer))) > 0)
+   {
+      for(char *ptr=buffer;ptr < buffer + length;)
+      {
+         const struct inotify_event *event=(const struct inotify_event *)ptr;
+
+         for(size_t i=0;event->len > 0 && i<m_watches.size();i++)
+         {
+            if(m_dirs[m_watches[i].dir_handle].wd == event->wd && m_watches[i].name == event->name)
+            {
+               file_info(m_watches[i].path.c_str(),&m_watches[i].size,&m_watches[i].time);
+               Touch(&m_watches[i],p_now);
+            }
+         }
+         ptr+=sizeof(struct inotify_event) + event->len;
+      }
+   }
+#else
+   (void)p_now;
+#endif
+}
+//******************************************************************************************
+// Function:Poll
+// Whazzit:Gathers whatever the OS has told us since last time, then reports the files
+//         that have been quiet for g_fw_settle
+//******************************************************************************************
+int FileWatcher::Poll(int *p_changed, int p_max){
+const double now=hires_seconds();
+bool stat_all=false;
+int count=0;
+
+   if(m_watches.empty())
+   {
+      return 0;
+   }
+
+#ifdef _WIN32
+   for(size_t dir=0;dir<m_dirs.size();dir++)
+   {
+      if(WaitForSingleObject(m_dirs[dir].notify,0) == WAIT_OBJECT_0)
+      {
+         FindNextChangeNotification(m_dirs[dir].notify);
+         for(size_t i=0;i<m_watches.size();i++)
+         {
+            if(m_watches[i].dir_handle == (int)dir)
+            {
+               CheckStat(&m_watches[i],now);
+            }
+         }
+      }
+   }
+#else
+   ReadEvents(now);
+   for(size_t dir=0;dir<m_dirs.size();dir++)
+   {
+      stat_all=stat_all || m_dirs[dir].wd < 0;
+   }
+#endif
+
+   if(stat_all && now - m_last_poll >= g_fw_poll_interval)
+   {
+      m_last_poll=now;
+      for(size_t i=0;i<m_watches.size();i++)
+      {
+   #ifndef _WIN32
+         if(m_dirs[m_watches[i].dir_handle].wd < 0)
+   #endif
+         {
+            CheckStat(&m_watches[i],now);
+         }
+      }
+   }
+
+   for(size_t i=0;i<m_watches.size() && count < p_max;i++)
+   {
+      if(m_watches[i].pending && now - m_watches[i].last_event >= g_fw_settle)
+      {
+         m_watches[i].pending=false;
+         p_changed[count++]=(int)i;
+      }
+   }
+
+   return count;
+}
+
+void FileWatcher::Close(void){
+
+   for(size_t dir=0;dir<m_dirs.size();dir++)
+   {
+#ifdef _WIN32
+      FindCloseChangeNotification(m_dirs[dir].notify);
+#elif defined(__linux__)
+      if(m_dirs[dir].wd >= 0)
+      {
+         inotify_rm_watch(m_fd,m_dirs[dir].wd);
+      }
+#endif
+   }
+#ifndef _WIN32
+   if(m_fd >= 0)
+   {
+      close(m_fd);
+      m_fd=-1;
+   }
+#endif
+
+   m_dirs.clear();
+   m_watches.clear();
+
+}
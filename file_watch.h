@@ -0,0 +1,82 @@
+//
+// file_watch.h - Tells us when files we loaded from change on disk
+//
+// Watch a file, then call Poll once a frame; it never blocks.  On Linux the directory
+// is watched with inotify, so a file that an exporter replaces by renaming a new one
+// over it is still seen.  On Windows a change notification on the directory wakes us
+// and the watched files in it are checked for a new size or write time.  Anywhere
+// else the files are stat'ed every g_fw_poll_interval seconds.
+//
+// Writers rarely finish in one go, so a file is only reported once it has been quiet
+// for g_fw_settle seconds.  That delay is part of what the user sees as reload time.
+//
+#ifndef FILE_WATCH_H
+#define FILE_WATCH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+   #ifndef WIN32_LEAN_AND_MEAN
+      #define WIN32_LEAN_AND_MEAN
+   #endif
+   #include <windows.h>
+#endif
+
+const double g_fw_settle = 0.05;
+const double g_fw_poll_interval = 0.25;
+
+class FileWatcher
+{
+public:
+   FileWatcher(void);
+   ~FileWatcher(void);
+
+   //Starts watching p_filename, returns its id or -1.  The file doesn't have to exist
+   //yet, but its directory does.
+   int Watch(const char *p_filename);
+   //Fills p_changed with up to p_max ids of files that changed and have settled, and
+   //returns how many
+   int Poll(int *p_changed, int p_max);
+   void Close(void);
+
+private:
+   FileWatcher(const FileWatcher &);
+   FileWatcher &operator=(const FileWatcher &);
+
+   struct watch
+   {
+      std::string path;
+      std::string dir;
+      std::string name;
+      uint64_t size;
+      uint64_t time;
+      bool pending;
+      double last_event;
+      int dir_handle;         //Index into m_dirs
+   };
+
+   struct directory
+   {
+      std::string path;
+#ifdef _WIN32
+      HANDLE notify;
+#else
+      int wd;                 //inotify watch descriptor, -1 when polling
+#endif
+   };
+
+   void Touch(watch *p_watch, double p_now);
+   void CheckStat(watch *p_watch, double p_now);
+   void ReadEvents(double p_now);
+
+   std::vector<watch> m_watches;
+   std::vector<directory> m_dirs;
+   double m_last_poll;
+#ifndef _WIN32
+   int m_fd;
+#endif
+};
+
+#endif
@@ -0,0 +1,66 @@
+//
+// fixed_deque.h - Double ended queue that never allocates once it has been sized
+//
+// std::deque allocates and frees a block every so often as items go in one end and
+// out the other, and with the Microsoft library a block holds a single item of more
+// than 16 bytes, so a queue that turns over every frame hits the heap every frame.
+// FixedDeque is a ring over one array sized by Init.  push_back fails when it is full
+// rather than growing; what to do then is up to the caller.
+//
+#ifndef FIXED_DEQUE_H
+#define FIXED_DEQUE_H
+
+#include <stddef.h>
+#include <vector>
+
+template<class T>
+class FixedDeque
+{
+public:
+   FixedDeque(void) : m_head(0),m_count(0) {}
+   explicit FixedDeque(size_t p_capacity) : m_items(p_capacity),m_head(0),m_count(0) {}
+
+   //Drops anything queued
+   void Init(size_t p_capacity){
+      std::vector<T>(p_capacity).swap(m_items);
+      m_head=0;
+      m_count=0;
+   }
+
+   bool push_back(const T &p_item){
+
+      if(m_count == m_items.size())
+      {
+         return false;
+      }
+
+      m_items[(m_head + m_count) % m_items.size()]=p_item;
+      m_count++;
+
+      return true;
+   }
+
+   void pop_front(void) { m_head=(m_head + 1) % m_items.size(); m_count--; }
+   void pop_back(void) { m_count--; }
+   void clear(void) { m_head=0; m_count=0; }
+
+   T &front(void) { return m_items[m_head]; }
+   const T &front(void) const { return m_items[m_head]; }
+   T &back(void) { return m_items[(m_head + m_count - 1) % m_items.size()]; }
+   const T &back(void) const { return m_items[(m_head + m_count - 1) % m_items.size()]; }
+   //0 is the front
+   T &operator[](size_t p_index) { return m_items[(m_head + p_index) % m_items.size()]; }
+   const T &operator[](size_t p_index) const { return m_items[(m_head + p_index) % m_items.size()]; }
+
+   size_t size(void) const { return m_count; }
+   size_t capacity(void) const { return m_items.size(); }
+   bool empty(void) const { return m_count == 0; }
+   bool full(void) const { return m_count == m_items.size(); }
+
+private:
+   std::vector<T> m_items;
+   size_t m_head;
+   size_t m_count;
+};
+
+#endif
@@ -0,0 +1,327 @@
+//
+// float_decode.cpp - Bulk decoding of big-endian vertex data
+//
+#include <string.h>
+#include <vector>
+#include "float_decode.h"
+#include "cpu_features.h"
+#include "hires_timer.h"
+
+#ifdef CPU_X86
+   #include <emmintrin.h>
+   #include <tmmintrin.h>
+   #include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+   #include <stdlib.h>
+#endif
+
+//******************************************************************************************
+// Function:bswap32
+// Whazzit:Reverses the bytes of a dword, compilers turn this into a single instruction
+//******************************************************************************************
+static inline DWORD bswap32(DWORD p_value){
+#if defined(_MSC_VER)
+   return _byteswap_ulong(p_value);
+#elif defined(__GNUC__)
+   return __builtin_bswap32(p_value);
+#else
+   return (p_value >> 24) | ((p_value >> 8) & 0xFF00) | ((p_value << 8) & 0xFF0000) | (p_value << 24);
+#endif
+}
+
+static inline DWORD load_be32(const BYTE *p_src){
+DWORD value;
+
+   memcpy(&value,p_src,4);
+
+   return bswap32(value);
+}
+
+static void decode_floats_scalar(const BYTE *p_src, float *p_dst, size_t p_count){
+
+   for(size_t i=0;i<p_count;i++)
+   {
+      DWORD value=load_be32(p_src + i * 4);
+      memcpy(p_dst + i,&value,4);
+   }
+
+}
+
+#ifdef CPU_X86
+//******************************************************************************************
+// Function:decode_floats_sse2
+// Whazzit:SSE2 has no byte shuffle, so swap the bytes in each word with shifts and then
+//         swap the words in each dword with shufflelo/hi.
+//******************************************************************************************
+TARGET_SSE2 static void decode_floats_sse2(const BYTE *p_src, float *p_dst, size_t p_count){
+size_t i=0;
+
+   for(;i + 4 <= p_count;i+=4)
+   {
+      __m128i v=_mm_loadu_si128((const __m128i *)(p_src + i * 4));
+      v=_mm_or_si128(_mm_slli_epi16(v,8),_mm_srli_epi16(v,8));
+      v=_mm_shufflelo_epi16(v,_MM_SHUFFLE(2,3,0,1));
+      v=_mm_shufflehi_epi16(v,_MM_SHUFFLE(2,3,0,1));
+      _mm_storeu_si128((__m128i *)(p_dst + i),v);
+   }
+
+   decode_floats_scalar(p_src + i * 4,p_dst + i,p_count - i);
+
+}
+
+TARGET_SSSE3 static void decode_floats_ssse3(const BYTE *p_src, float *p_dst, size_t p_count){
+const __m128i swap=_mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+size_t i=0;
+
+   //Two registers per iteration to hide the load latency
+   for(;i + 8 <= p_count;i+=8)
+   {
+      __m128i a=_mm_loadu_si128((const __m128i *)(p_src + i * 4));
+      __m128i b=_mm_loadu_si128((const __m128i *)(p_src + i * 4 + 16));
+      _mm_storeu_si128((__m128i *)(p_dst + i),_mm_shuffle_epi8(a,swap));
+      _mm_storeu_si128((__m128i *)(p_dst + i + 4),_mm_shuffle_epi8(b,swap));
+   }
+
+   decode_floats_scalar(p_src + i * 4,p_dst + i,p_count - i);
+
+}
+
+TARGET_AVX2 static void decode_floats_avx2(const BYTE *p_src, float *p_dst, size_t p_count){
+const __m256i swap=_mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+                                    3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+size_t i=0;
+
+   for(;i + 16 <= p_count;i+=16)
+   {
+      __m256i a=_mm256_loadu_si256((const __m256i *)(p_src + i * 4));
+      __m256i b=_mm256_loadu_si256((const __m256i *)(p_src + i * 4 + 32));
+      _mm256_storeu_si256((__m256i *)(p_dst + i),_mm256_shuffle_epi8(a,swap));
+      _mm256_storeu_si256((__m256i *)(p_dst + i + 8),_mm256_shuffle_epi8(b,swap));
+   }
+
+   decode_floats_scalar(p_src + i * 4,p_dst + i,p_count - i);
+
+}
+//******************************************************************************************
+// Function:decode_records_ssse3
+// Whazzit:Strided records.  Each x,y,z triple is pulled in with one 16 byte load and
+//         swapped with one shuffle, the 4th lane is replaced by the colour.  The caller
+//         guarantees every record has 16 readable bytes from pos_offset.
+//******************************************************************************************
+TARGET_SSSE3 static void decode_records_ssse3(const BYTE *p_src, const be_vertex_layout &p_layout,
+                                              tri_vertex *p_dst, size_t p_count){
+const __m128i swap=_mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,-1,-1,-1,-1);
+const BYTE *record=p_src;
+
+   for(size_t i=0;i<p_count;i++,record+=p_layout.stride)
+   {
+      DWORD colour=p_layout.colour_offset < 0 ? p_layout.default_colour :
+                                                load_be32(record + p_layout.colour_offset);
+      __m128i v=_mm_loadu_si128((const __m128i *)(record + p_layout.pos_offset));
+      v=_mm_or_si128(_mm_shuffle_epi8(v,swap),_mm_setr_epi32(0,0,0,(int)colour));
+      _mm_storeu_si128((__m128i *)(p_dst + i),v);
+   }
+
+}
+#endif
+
+static void decode_records_scalar(const BYTE *p_src, const be_vertex_layout &p_layout,
+                                  tri_vertex *p_dst, size_t p_count){
+const BYTE *record=p_src;
+
+   for(size_t i=0;i<p_count;i++,record+=p_layout.stride)
+   {
+      decode_floats_scalar(record + p_layout.pos_offset,&p_dst[i].x,3);
+      p_dst[i].colour=p_layout.colour_offset < 0 ? p_layout.default_colour :
+                                                   load_be32(record + p_layout.colour_offset);
+   }
+
+}
+//******************************************************************************************
+// Function:decode_floats_be
+// Whazzit:Picks the widest kernel the CPU supports
+//******************************************************************************************
+void decode_floats_be(const BYTE *p_src, float *p_dst, size_t p_count){
+
+#ifdef CPU_X86
+   switch(cpu_get_level())
+   {
+      case CPU_LEVEL_AVX2:
+         decode_floats_avx2(p_src,p_dst,p_count);
+         return;
+      case CPU_LEVEL_SSE41:
+      case CPU_LEVEL_SSSE3:
+         decode_floats_ssse3(p_src,p_dst,p_count);
+         return;
+      case CPU_LEVEL_SSE2:
+         decode_floats_sse2(p_src,p_dst,p_count);
+         return;
+      default:
+         break;
+   }
+#endif
+
+   decode_floats_scalar(p_src,p_dst,p_count);
+
+}
+//******************************************************************************************
+// Function:decode_vertices_be
+// Whazzit:One range check for the whole batch, then straight into the kernels.  Records
+//         laid out exactly like tri_vertex are just an array of dwords to swap.
+//******************************************************************************************
+bool decode_vertices_be(const BYTE *p_src, size_t p_src_size, size_t p_offset,
+                        const be_vertex_layout &p_layout, tri_vertex *p_dst, size_t p_count){
+size_t record_size;
+size_t needed;
+
+   if(p_count == 0)
+   {
+      return true;
+   }
+
+   record_size=p_layout.pos_offset + 12;
+   if(p_layout.colour_offset >= 0 && (size_t)p_layout.colour_offset + 4 > record_size)
+   {
+      record_size=p_layout.colour_offset + 4;
+   }
+
+   //The last record only needs record_size bytes, not a whole stride
+   needed=(p_count - 1) * p_layout.stride + record_size;
+   if(p_src == NULL || p_offset > p_src_size || needed > p_src_size - p_offset)
+   {
+      return false;
+   }
+
+   p_src+=p_offset;
+
+   if(p_layout.stride == sizeof(tri_vertex) && p_layout.pos_offset == 0 && p_layout.colour_offset == 12)
+   {
+      decode_floats_be(p_src,(float *)p_dst,p_count * 4);
+      return true;
+   }
+
+#ifdef CPU_X86
+   if(cpu_has_ssse3())
+   {
+      //Every record but the last is followed by at least stride bytes, but the 16 byte
+      //load can still run off the end of the buffer near the tail.  Count how many
+      //records are safe and finish the rest with the scalar path.
+      size_t safe=0;
+      size_t remaining=p_src_size - p_offset;
+      if(remaining >= p_layout.pos_offset + 16)
+      {
+         safe=(remaining - p_layout.pos_offset - 16) / p_layout.stride + 1;
+         if(safe > p_count)
+         {
+            safe=p_count;
+         }
+      }
+
+      decode_records_ssse3(p_src,p_layout,p_dst,safe);
+      decode_records_scalar(p_src + safe * p_layout.stride,p_layout,p_dst + safe,p_count - safe);
+      return true;
+   }
+#endif
+
+   decode_records_scalar(p_src,p_layout,p_dst,p_count);
+
+   return true;
+}
+//******************************************************************************************
+// Function:decode_per_call
+// Whazzit:What we used to do: one function call and four bounds checked byte reads for
+//         every float.  Kept here only so the benchmark has something to compare with.
+//******************************************************************************************
+static float decode_per_call(const std::vector<BYTE> &p_data, UINT p_loc){
+float output;
+
+   *((BYTE*)(&output) + 3) = p_data.at(p_loc);
+   *((BYTE*)(&output) + 2) = p_data.at(p_loc+1);
+   *((BYTE*)(&output) + 1) = p_data.at(p_loc+2);
+   *((BYTE*)(&output) + 0) = p_data.at(p_loc+3);
+
+   return output;
+}
+//******************************************************************************************
+// Function:bench_float_decode
+// Whazzit:Times each kernel for at least a quarter second and reports GB/s of source
+//         data consumed.
+//******************************************************************************************
+int bench_float_decode(size_t p_bytes, decode_bench_result *p_results, int p_max_results){
+static const struct
+{
+   const char *name;
+   cpu_level level;
+   int mode;   //0 per call, 1 flat floats, 2 strided records
+} runs[]={
+   { "per call (bytesToFloatB)", CPU_LEVEL_SCALAR, 0 },
+   { "floats scalar",            CPU_LEVEL_SCALAR, 1 },
+   { "floats sse2",              CPU_LEVEL_SSE2,   1 },
+   { "floats ssse3",             CPU_LEVEL_SSSE3,  1 },
+   { "floats avx2",              CPU_LEVEL_AVX2,   1 },
+   { "records scalar",           CPU_LEVEL_SCALAR, 2 },
+   { "records ssse3",            CPU_LEVEL_SSSE3,  2 },
+};
+const cpu_level native=cpu_get_level();
+std::vector<BYTE> src;
+std::vector<float> dst;
+volatile float sink=0.0f;
+int count=0;
+
+   p_bytes&=~(size_t)15;
+   src.resize(p_bytes);
+   dst.resize(p_bytes / 4);
+   for(size_t i=0;i<p_bytes;i++)
+   {
+      src[i]=(BYTE)(i * 131 + 7);
+   }
+
+   //Strided decode reads records with a 4 byte gap between them, like a dump that
+   //carries an extra attribute we don't use
+   be_vertex_layout strided={ 20, 4, 0, 0 };
+
+   for(size_t r=0;r<sizeof(runs) / sizeof(runs[0]) && count < p_max_results;r++)
+   {
+      if(runs[r].level > native)
+      {
+         continue;
+      }
+      cpu_set_max_level(runs[r].level);
+
+      double start=hires_seconds();
+      double elapsed=0.0;
+      size_t processed=0;
+
+      do
+      {
+         switch(runs[r].mode)
+         {
+            case 0:
+               for(UINT loc=0;loc + 4 <= p_bytes;loc+=4)
+               {
+                  dst[loc / 4]=decode_per_call(src,loc);
+               }
+               break;
+            case 1:
+               decode_floats_be(&src[0],&dst[0],p_bytes / 4);
+               break;
+            case 2:
+               decode_vertices_be(&src[0],p_bytes,0,strided,(tri_vertex *)&dst[0],
+                                  p_bytes / strided.stride);
+               break;
+         }
+         sink=sink + dst[processed % dst.size()];
+         processed+=p_bytes;
+         elapsed=hires_seconds() - start;
+      } while(elapsed < 0.25);
+
+      p_results[count].name=runs[r].name;
+      p_results[count].gb_per_sec=(double)processed / elapsed / 1e9;
+      count++;
+   }
+
+   cpu_set_max_level(CPU_LEVEL_AVX2);
+
+   return count;
+}
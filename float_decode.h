@@ -0,0 +1,43 @@
+//
+// float_decode.h - Bulk decoding of big-endian vertex data
+//
+// The verttest dumps are stored big-endian.  Rather than swapping one float at a
+// time, these routines check the range once per batch and swap whole arrays with
+// the widest SIMD path the CPU supports.
+//
+#ifndef FLOAT_DECODE_H
+#define FLOAT_DECODE_H
+
+#include <stddef.h>
+#include "vertex.h"
+
+//Describes where the fields of one vertex record live in a big-endian dump
+struct be_vertex_layout
+{
+   size_t stride;          //Bytes from the start of one record to the next
+   size_t pos_offset;      //Offset of the x,y,z floats within a record
+   int colour_offset;      //Offset of a big-endian ARGB dword, or -1 if there isn't one
+   DWORD default_colour;   //Used when colour_offset is -1
+};
+
+//The layout that matches tri_vertex exactly: x,y,z,colour, all big-endian
+const be_vertex_layout g_be_tri_vertex_layout = { 16, 0, 12, 0xFFFFFFFF };
+
+//Decodes p_count big-endian floats.  p_src and p_dst may be the same buffer.
+void decode_floats_be(const BYTE *p_src, float *p_dst, size_t p_count);
+
+//Decodes p_count records starting at p_offset in a p_src_size byte buffer.  The range
+//is checked once up front, returns false (and writes nothing) if it doesn't fit.
+bool decode_vertices_be(const BYTE *p_src, size_t p_src_size, size_t p_offset,
+                        const be_vertex_layout &p_layout, tri_vertex *p_dst, size_t p_count);
+
+//Runs the decode kernels over a synthetic buffer of p_bytes bytes and reports the
+//throughput of each path next to the old per-call, per-byte bounds checked decode.
+struct decode_bench_result
+{
+   const char *name;
+   double gb_per_sec;
+};
+int bench_float_decode(size_t p_bytes, decode_bench_result *p_results, int p_max_results);
+
+#endif
@@ -0,0 +1,82 @@
+//
+// frame_arena.cpp - Linear allocator for data that only lives for a frame
+//
+#include <string.h>
+#include "frame_arena.h"
+
+FrameArena::FrameArena(void) :
+   m_memory(NULL),m_current(0),m_allocs(0)
+{
+   m_blocks[0]=NULL;
+   m_blocks[1]=NULL;
+   memset(&m_stats,0,sizeof(m_stats));
+}
+
+FrameArena::~FrameArena(void){
+
+   Release();
+
+}
+//******************************************************************************************
+// Function:Init
+// Whazzit:Both blocks come out of one allocation, each starting on a g_fa_default_align
+//         boundary so the default alignment costs no padding at the front
+//******************************************************************************************
+void FrameArena::Init(size_t p_size){
+size_t size;
+
+   Release();
+
+   size=(p_size + g_fa_default_align - 1) & ~(g_fa_default_align - 1);
+   m_memory=new char[size * 2 + g_fa_default_align];
+   m_blocks[0]=m_memory + (g_fa_default_align - (size_t)m_memory % g_fa_default_align) % g_fa_default_align;
+   m_blocks[1]=m_blocks[0] + size;
+   m_current=0;
+   m_allocs=0;
+   m_stats.size=size;
+
+}
+
+void FrameArena::Release(void){
+
+   delete[] m_memory;
+   m_memory=NULL;
+   m_blocks[0]=NULL;
+   m_blocks[1]=NULL;
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+
+void *FrameArena::Alloc(size_t p_size, size_t p_align){
+const size_t base=(size_t)m_blocks[m_current];
+size_t start;
+
+   if(m_memory == NULL)
+   {
+      m_stats.overflows++;
+      return NULL;
+   }
+
+   start=(base + m_stats.used + p_align - 1) & ~(p_align - 1);
+   if(start - base > m_stats.size || p_size > m_stats.size - (start - base))
+   {
+      m_stats.overflows++;
+      return NULL;
+   }
+
+   m_stats.used=start - base + p_size;
+   m_allocs++;
+
+   return (void *)start;
+}
+
+void FrameArena::EndFrame(void){
+
+   m_stats.last_frame=m_stats.used;
+   m_stats.peak=m_stats.used > m_stats.peak ? m_stats.used : m_stats.peak;
+   m_stats.allocs=m_allocs;
+   m_stats.used=0;
+   m_allocs=0;
+   m_current^=1;
+
+}
@@ -0,0 +1,63 @@
+//
+// frame_arena.h - Linear allocator for data that only lives for a frame
+//
+// Two blocks, reserved by Init, used a frame each in turn.  Alloc bumps a pointer
+// through the current block; EndFrame (called once the frame's draws have gone to the
+// device) switches blocks and empties the new one.  So anything allocated stays put
+// for the frame after too, which is what a device still drawing the last frame, or a
+// job finishing late, needs.
+//
+// Nothing is ever freed individually and nothing is destructed: only put plain data
+// in it.  When the current block is full Alloc returns NULL and counts an overflow
+// rather than going to the heap, and the caller falls back to whatever it did
+// without.
+//
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <stddef.h>
+
+const size_t g_fa_default_size = 1024 * 1024;
+const size_t g_fa_default_align = 16;
+
+struct fa_stats
+{
+   size_t size;                 //Of each block
+   size_t used;                 //By the frame being built so far
+   size_t last_frame;           //By the last finished frame
+   size_t peak;                 //Most any frame has used
+   unsigned int allocs;         //In the last finished frame
+   unsigned int overflows;      //Allocs that didn't fit, since Init
+};
+
+class FrameArena
+{
+public:
+   FrameArena(void);
+   ~FrameArena(void);
+
+   void Init(size_t p_size=g_fa_default_size);
+   void Release(void);
+
+   //p_align must be a power of two
+   void *Alloc(size_t p_size, size_t p_align=g_fa_default_align);
+   template<class T> T *Alloc(size_t p_count){
+      return (T *)Alloc(p_count * sizeof(T),alignof(T) > g_fa_default_align ? alignof(T) : g_fa_default_align);
+   }
+   //The frame is done with, switches to the other block
+   void EndFrame(void);
+
+   const fa_stats &GetStats(void) const { return m_stats; }
+
+private:
+   FrameArena(const FrameArena &);
+   FrameArena &operator=(const FrameArena &);
+
+   char *m_memory;
+   char *m_blocks[2];
+   int m_current;
+   unsigned int m_allocs;
+   fa_stats m_stats;
+};
+
+#endif
@@ -0,0 +1,240 @@
+//
+// frame_pacer.cpp - Caps the frame rate and trades throughput for input latency
+//
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "frame_pacer.h"
+#include "hires_timer.h"
+
+//******************************************************************************************
+// Function:fp_sleep_until
+// Whazzit:A sleep can overshoot by a scheduler tick, so we only sleep while there is more
+//         than p_spin to go and yield round the loop for the rest
+//******************************************************************************************
+void fp_sleep_until(double p_seconds, double p_spin){
+
+   for(;;)
+   {
+      const double remaining=p_seconds - hires_seconds();
+
+      if(remaining <= 0.0)
+      {
+         return;
+      }
+
+      if(remaining > p_spin)
+      {
+         std::this_thread::sleep_for(std::chrono::duration<double>(remaining - p_spin));
+      }
+      else
+      {
+         std::this_thread::yield();
+      }
+   }
+
+}
+
+FramePacer::FramePacer(void) :
+   m_mode(FP_OFF),m_period(0.0),m_max_in_flight(0),m_spin(g_fp_default_spin),m_margin(g_fp_default_margin),
+   m_record(false),m_fences(g_fp_max_in_flight),m_base(0.0),m_deadline(0.0),m_last_present(0.0),
+   m_frame_start(0.0),m_input(0.0),m_history_next(0)
+{
+   memset(&m_frame,0,sizeof(m_frame));
+   memset(m_history,0,sizeof(m_history));
+   memset(&m_stats,0,sizeof(m_stats));
+}
+
+void FramePacer::Init(fp_mode p_mode, double p_fps, int p_max_in_flight){
+
+   m_mode=p_fps > 0.0 ? p_mode : FP_OFF;
+   m_period=m_mode != FP_OFF ? 1.0 / p_fps : 0.0;
+   m_max_in_flight=p_max_in_flight > 0 ? p_max_in_flight : 0;
+   m_max_in_flight=m_max_in_flight < g_fp_max_in_flight ? m_max_in_flight : g_fp_max_in_flight;
+
+   m_base=0.0;
+   m_deadline=0.0;
+   m_last_present=0.0;
+   m_history_next=0;
+   m_frames.clear();
+   m_fences.clear();
+   memset(&m_stats,0,sizeof(m_stats));
+   m_stats.target=m_period;
+
+}
+//******************************************************************************************
+// Function:WaitForDevice
+// Whazzit:Fences finish in order, so only the oldest ever needs waiting on
+//******************************************************************************************
+void FramePacer::WaitForDevice(RenderDevice *p_device){
+const double start=hires_seconds();
+
+   while(!m_fences.empty() && p_device->FenceDone(m_fences.front()))
+   {
+      m_fences.pop_front();
+   }
+   m_frame.in_flight=(int)m_fences.size();
+
+   while(m_max_in_flight > 0 && (int)m_fences.size() >= m_max_in_flight)
+   {
+      if(p_device->FenceDone(m_fences.front()))
+      {
+         m_fences.pop_front();
+      }
+      else if(hires_seconds() - start > g_fp_fence_timeout)
+      {
+         m_stats.timeouts++;
+         m_fences.pop_front();
+      }
+      else
+      {
+         std::this_thread::yield();
+      }
+   }
+
+   m_frame.stall=hires_seconds() - start;
+
+}
+//******************************************************************************************
+// Function:BeginFrame
+// Whazzit:A frame that overran its slot by less than a whole slot starts straight away
+//         and the cadence carries on from where it was.  One that missed a whole slot
+//         starts a fresh one, rather than every frame after it hurrying to catch up.
+//******************************************************************************************
+void FramePacer::BeginFrame(RenderDevice *p_device){
+double now;
+
+   WaitForDevice(p_device);
+
+   now=hires_seconds();
+   if(m_base == 0.0)
+   {
+      m_base=now;
+   }
+
+   m_frame.wait=0.0;
+   if(m_period > 0.0)
+   {
+      double start;
+
+      if(m_deadline == 0.0 || now >= m_deadline)
+      {
+         m_deadline=now + m_period;
+      }
+
+      start=m_mode == FP_JUST_IN_TIME ? m_deadline - m_stats.estimate - m_margin : m_deadline - m_period;
+      if(start > now)
+      {
+         fp_sleep_until(start,m_spin);
+         m_frame.wait=hires_seconds() - now;
+         now+=m_frame.wait;
+      }
+   }
+
+   m_frame_start=now;
+   m_frame.start=now - m_base;
+   m_input=0.0;
+
+}
+
+void FramePacer::MarkInput(void){
+
+   m_input=hires_seconds();
+
+}
+
+void FramePacer::EndFrame(RenderDevice *p_device){
+const double now=hires_seconds();
+const int count=m_stats.frames < (unsigned long long)g_fp_history ? (int)m_stats.frames + 1 : g_fp_history;
+double total_work=0.0;
+double total_time=0.0;
+double total_latency=0.0;
+double total_jitter=0.0;
+double estimate=0.0;
+double previous;
+
+   previous=m_stats.frames ? m_history[(m_history_next + g_fp_history - 1) % g_fp_history].interval : 0.0;
+
+   m_frame.work=now - m_frame_start;
+   m_frame.latency=now - (m_input != 0.0 ? m_input : m_frame_start);
+   m_frame.interval=m_last_present != 0.0 ? now - m_last_present : 0.0;
+   m_frame.jitter=m_period > 0.0 ? fabs(m_frame.interval - m_period) : fabs(m_frame.interval - previous);
+   if(m_last_present == 0.0)
+   {
+      m_frame.jitter=0.0;
+   }
+   m_last_present=now;
+
+   if(m_max_in_flight > 0)
+   {
+      m_fences.push_back(p_device->InsertFence());
+   }
+   if(m_period > 0.0)
+   {
+      m_deadline+=m_period;
+   }
+
+   m_history[m_history_next]=m_frame;
+   m_history_next=(m_history_next + 1) % g_fp_history;
+   if(m_record)
+   {
+      m_frames.push_back(m_frame);
+   }
+
+   m_stats.frames++;
+   m_stats.last_latency=m_frame.latency;
+   m_stats.max_latency=0.0;
+   m_stats.max_jitter=0.0;
+   for(int i=0;i<count;i++)
+   {
+      const fp_frame &frame=m_history[(m_history_next + g_fp_history - 1 - i) % g_fp_history];
+
+      total_work+=frame.work;
+      total_time+=frame.work + frame.wait + frame.stall;
+      total_latency+=frame.latency;
+      total_jitter+=frame.jitter;
+      m_stats.max_latency=frame.latency > m_stats.max_latency ? frame.latency : m_stats.max_latency;
+      m_stats.max_jitter=frame.jitter > m_stats.max_jitter ? frame.jitter : m_stats.max_jitter;
+      //The worst of the last few, a hitch ages out quickly
+      if(i < g_fp_estimate_frames)
+      {
+         estimate=frame.work > estimate ? frame.work : estimate;
+      }
+   }
+   m_stats.avg_latency=total_latency / count;
+   m_stats.avg_jitter=total_jitter / count;
+   m_stats.busy=total_time > 0.0 ? total_work / total_time : 0.0;
+   m_stats.estimate=estimate;
+
+}
+
+void FramePacer::Reset(void){
+
+   m_fences.clear();
+
+}
+
+bool FramePacer::WriteCsv(const char *p_filename) const{
+FILE *file;
+
+   file=fopen(p_filename,"w");
+   if(file == NULL)
+   {
+      return false;
+   }
+
+   fprintf(file,"frame,start_ms,wait_ms,stall_ms,work_ms,latency_ms,interval_ms,jitter_ms,in_flight\n");
+   for(size_t i=0;i<m_frames.size();i++)
+   {
+      const fp_frame &frame=m_frames[i];
+
+      fprintf(file,"%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d\n",(unsigned int)i,frame.start * 1000.0,
+              frame.wait * 1000.0,frame.stall * 1000.0,frame.work * 1000.0,frame.latency * 1000.0,
+              frame.interval * 1000.0,frame.jitter * 1000.0,frame.in_flight);
+   }
+
+   fclose(file);
+
+   return true;
+}
@@ -0,0 +1,135 @@
+//
+// frame_pacer.h - Caps the frame rate and trades throughput for input latency
+//
+// Left alone the loop renders as fast as it can and Present blocks however the driver
+// likes, so a window nobody is looking at burns a whole core.  The pacer gives each
+// frame a slot of 1/fps seconds and sleeps away whatever the frame didn't use.  Sleeps
+// are only as good as the scheduler tick, so the last g_fp_default_spin of a wait is
+// spun instead.
+//
+// FP_CAP starts each frame at the top of its slot: input is sampled, the frame is
+// built and then the rest of the slot is idle.  FP_JUST_IN_TIME moves the idle time
+// to the front instead, starting the frame as late as the slowest of the last few
+// frames says it can and still present by the end of the slot.  Same frame rate, same
+// CPU, but the input a frame shows is that much younger.
+//
+// The max frames in flight setting stops the CPU running ahead of the device: a frame
+// doesn't start until fewer than that many are still being worked on.  A device that
+// only pretends to have a GPU (the null device) can't go below its own pretend
+// latency, so a fence wait gives up after g_fp_fence_timeout and is counted.
+//
+// Latency here is from MarkInput to Present returning, the part of input to photon
+// the application controls.
+//
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <stdio.h>
+#include <vector>
+#include "fixed_deque.h"
+#include "render_device.h"
+
+enum fp_mode
+{
+   FP_OFF,              //As fast as possible, the old behaviour
+   FP_CAP,
+   FP_JUST_IN_TIME
+};
+
+//Frames the rolling statistics and the just in time estimate look back over
+const int g_fp_history = 120;
+const int g_fp_estimate_frames = 30;
+//Seconds at the end of a wait that are spun rather than slept
+const double g_fp_default_spin = 0.002;
+//Extra slack the just in time mode leaves before the end of the slot
+const double g_fp_default_margin = 0.001;
+const double g_fp_fence_timeout = 0.1;
+//Most frames in flight the limit can be set to
+const int g_fp_max_in_flight = 16;
+
+struct fp_frame
+{
+   double start;       //Seconds after the first frame, when the frame was let go
+   double wait;        //Slept or spun for the frame rate
+   double stall;       //Waited for the device to catch up
+   double work;        //Start to Present returning
+   double latency;     //MarkInput to Present returning
+   double interval;    //Since the previous Present returned
+   double jitter;      //How far interval was from the slot, or from the last interval uncapped
+   int in_flight;      //Frames the device was still working on at the start
+};
+
+struct fp_stats
+{
+   unsigned long long frames;
+   double target;          //Slot length, 0 uncapped
+   double estimate;        //Just in time's guess at the next frame's work
+   double last_latency;
+   double avg_latency;     //Over the last g_fp_history frames
+   double max_latency;
+   double avg_jitter;
+   double max_jitter;
+   double busy;            //Fraction of the time spent working rather than waiting
+   unsigned int timeouts;  //Fence waits given up on
+};
+
+//Sleeps most of the way to p_seconds (on the hires_seconds clock) and spins the last
+//p_spin of it
+void fp_sleep_until(double p_seconds, double p_spin=g_fp_default_spin);
+
+class FramePacer
+{
+public:
+   FramePacer(void);
+
+   //p_fps <= 0 leaves the rate uncapped, p_max_in_flight <= 0 doesn't limit it
+   void Init(fp_mode p_mode, double p_fps, int p_max_in_flight);
+   //Room for p_frames recorded frames, so recording them doesn't allocate
+   void Reserve(size_t p_frames) { m_frames.reserve(p_frames); }
+   void SetSpin(double p_seconds) { m_spin=p_seconds; }
+   void SetMargin(double p_seconds) { m_margin=p_seconds; }
+   //Keep every frame for WriteCsv and the summaries, not just the rolling window
+   void SetRecord(bool p_record) { m_record=p_record; }
+
+   //Before anything that goes into the frame, input included.  Waits for the device
+   //and then for the frame's start time.
+   void BeginFrame(RenderDevice *p_device);
+   //The frame took its input now
+   void MarkInput(void);
+   //Right after Present
+   void EndFrame(RenderDevice *p_device);
+   //Forget the fences, e.g. after the device was reset
+   void Reset(void);
+
+   fp_mode GetMode(void) const { return m_mode; }
+   int GetMaxInFlight(void) const { return m_max_in_flight; }
+   const fp_stats &GetStats(void) const { return m_stats; }
+   //Recorded frames only
+   const std::vector<fp_frame> &GetFrames(void) const { return m_frames; }
+   bool WriteCsv(const char *p_filename) const;
+
+private:
+   void WaitForDevice(RenderDevice *p_device);
+
+   fp_mode m_mode;
+   double m_period;
+   int m_max_in_flight;
+   double m_spin;
+   double m_margin;
+   bool m_record;
+
+   FixedDeque<rd_fence> m_fences;   //Oldest first
+   double m_base;                   //First frame's start, the CSV's zero
+   double m_deadline;               //When this frame's slot ends, 0 before the first
+   double m_last_present;
+   fp_frame m_frame;                //The one being built
+   double m_frame_start;
+   double m_input;                  //0 until MarkInput
+
+   fp_frame m_history[g_fp_history];
+   int m_history_next;
+   std::vector<fp_frame> m_frames;
+   fp_stats m_stats;
+};
+
+#endif
@@ -0,0 +1,52 @@
+//
+// frame_stats.cpp - Collects frame times and summarizes them
+//
+#include <algorithm>
+#include <string.h>
+#include "frame_stats.h"
+
+//******************************************************************************************
+// Function:percentile
+// Whazzit:Nearest rank percentile of an already sorted array
+//******************************************************************************************
+static double percentile(const std::vector<double> &p_sorted, double p_fraction){
+size_t rank;
+
+   rank=(size_t)(p_fraction * (double)p_sorted.size() + 0.999999);
+   if(rank < 1)
+   {
+      rank=1;
+   }
+   if(rank > p_sorted.size())
+   {
+      rank=p_sorted.size();
+   }
+
+   return p_sorted[rank - 1];
+}
+
+frame_summary FrameStats::Summarize(void) const{
+frame_summary summary;
+std::vector<double> sorted(m_samples);
+
+   memset(&summary,0,sizeof(summary));
+   if(sorted.empty())
+   {
+      return summary;
+   }
+
+   std::sort(sorted.begin(),sorted.end());
+
+   summary.count=sorted.size();
+   for(size_t i=0;i<sorted.size();i++)
+   {
+      summary.total+=sorted[i];
+   }
+   summary.min=sorted.front();
+   summary.max=sorted.back();
+   summary.avg=summary.total / (double)summary.count;
+   summary.p50=percentile(sorted,0.50);
+   summary.p99=percentile(sorted,0.99);
+
+   return summary;
+}
@@ -0,0 +1,53 @@
+//
+// frame_stats.h - Collects frame times and summarizes them
+//
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <vector>
+
+struct frame_summary
+{
+   size_t count;
+   double total;   //All times are in seconds
+   double min;
+   double avg;
+   double p50;
+   double p99;
+   double max;
+};
+
+class FrameStats
+{
+public:
+   FrameStats(void) : m_capacity((size_t)-1),m_dropped(0) {}
+
+   void Reserve(size_t p_count) { m_samples.reserve(p_count); }
+   //Room for p_count samples that never grows, for adding from inside the frame.  Add
+   //drops whatever doesn't fit and counts it.
+   void SetCapacity(size_t p_count) { m_samples.reserve(p_count); m_capacity=p_count; }
+   void Clear(void) { m_samples.clear(); m_dropped=0; }
+   void Add(double p_seconds){
+
+      if(m_samples.size() < m_capacity)
+      {
+         m_samples.push_back(p_seconds);
+      }
+      else
+      {
+         m_dropped++;
+      }
+   }
+   size_t GetCount(void) const { return m_samples.size(); }
+   //Samples Add had no room for since the last Clear
+   size_t GetDropped(void) const { return m_dropped; }
+
+   frame_summary Summarize(void) const;
+
+private:
+   std::vector<double> m_samples;
+   size_t m_capacity;
+   size_t m_dropped;
+};
+
+#endif
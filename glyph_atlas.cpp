@@ -0,0 +1,120 @@
+//
+// glyph_atlas.cpp - The HUD font, rasterized once into a coverage texture
+//
+#include <string.h>
+#include "glyph_atlas.h"
+
+//Five columns per glyph, left to right, bit 0 the top row
+static const unsigned char g_ga_font[g_ga_count][g_ga_glyph_width]=
+{
+   {0x00,0x00,0x00,0x00,0x00},{0x00,0x00,0x5F,0x00,0x00},{0x00,0x07,0x00,0x07,0x00},{0x14,0x7F,0x14,0x7F,0x14},
+   {0x24,0x2A,0x7F,0x2A,0x12},{0x23,0x13,0x08,0x64,0x62},{0x36,0x49,0x55,0x22,0x50},{0x00,0x05,0x03,0x00,0x00},
+   {0x00,0x1C,0x22,0x41,0x00},{0x00,0x41,0x22,0x1C,0x00},{0x14,0x08,0x3E,0x08,0x14},{0x08,0x08,0x3E,0x08,0x08},
+   {0x00,0x50,0x30,0x00,0x00},{0x08,0x08,0x08,0x08,0x08},{0x00,0x60,0x60,0x00,0x00},{0x20,0x10,0x08,0x04,0x02},
+   {0x3E,0x51,0x49,0x45,0x3E},{0x00,0x42,0x7F,0x40,0x00},{0x42,0x61,0x51,0x49,0x46},{0x21,0x41,0x45,0x4B,0x31},
+   {0x18,0x14,0x12,0x7F,0x10},{0x27,0x45,0x45,0x45,0x39},{0x3C,0x4A,0x49,0x49,0x30},{0x01,0x71,0x09,0x05,0x03},
+   {0x36,0x49,0x49,0x49,0x36},{0x06,0x49,0x49,0x29,0x1E},{0x00,0x36,0x36,0x00,0x00},{0x00,0x56,0x36,0x00,0x00},
+   {0x08,0x14,0x22,0x41,0x00},{0x14,0x14,0x14,0x14,0x14},{0x00,0x41,0x22,0x14,0x08},{0x02,0x01,0x51,0x09,0x06},
+   {0x32,0x49,0x79,0x41,0x3E},{0x7E,0x11,0x11,0x11,0x7E},{0x7F,0x49,0x49,0x49,0x36},{0x3E,0x41,0x41,0x41,0x22},
+   {0x7F,0x41,0x41,0x22,0x1C},{0x7F,0x49,0x49,0x49,0x41},{0x7F,0x09,0x09,0x09,0x01},{0x3E,0x41,0x49,0x49,0x7A},
+   {0x7F,0x08,0x08,0x08,0x7F},{0x00,0x41,0x7F,0x41,0x00},{0x20,0x40,0x41,0x3F,0x01},{0x7F,0x08,0x14,0x22,0x41},
+   {0x7F,0x40,0x40,0x40,0x40},{0x7F,0x02,0x0C,0x02,0x7F},{0x7F,0x04,0x08,0x10,0x7F},{0x3E,0x41,0x41,0x41,0x3E},
+   {0x7F,0x09,0x09,0x09,0x06},{0x3E,0x41,0x51,0x21,0x5E},{0x7F,0x09,0x19,0x29,0x46},{0x46,0x49,0x49,0x49,0x31},
+   {0x01,0x01,0x7F,0x01,0x01},{0x3F,0x40,0x40,0x40,0x3F},{0x1F,0x20,0x40,0x20,0x1F},{0x3F,0x40,0x38,0x40,0x3F},
+   {0x63,0x14,0x08,0x14,0x63},{0x07,0x08,0x70,0x08,0x07},{0x61,0x51,0x49,0x45,0x43},{0x00,0x7F,0x41,0x41,0x00},
+   {0x02,0x04,0x08,0x10,0x20},{0x00,0x41,0x41,0x7F,0x00},{0x04,0x02,0x01,0x02,0x04},{0x40,0x40,0x40,0x40,0x40},
+   {0x00,0x01,0x02,0x04,0x00},{0x20,0x54,0x54,0x54,0x78},{0x7F,0x48,0x44,0x44,0x38},{0x38,0x44,0x44,0x44,0x20},
+   {0x38,0x44,0x44,0x48,0x7F},{0x38,0x54,0x54,0x54,0x18},{0x08,0x7E,0x09,0x01,0x02},{0x0C,0x52,0x52,0x52,0x3E},
+   {0x7F,0x08,0x04,0x04,0x78},{0x00,0x44,0x7D,0x40,0x00},{0x20,0x40,0x44,0x3D,0x00},{0x7F,0x10,0x28,0x44,0x00},
+   {0x00,0x41,0x7F,0x40,0x00},{0x7C,0x04,0x18,0x04,0x78},{0x7C,0x08,0x04,0x04,0x78},{0x38,0x44,0x44,0x44,0x38},
+   {0x7C,0x14,0x14,0x14,0x08},{0x08,0x14,0x14,0x18,0x7C},{0x7C,0x08,0x04,0x04,0x08},{0x48,0x54,0x54,0x54,0x20},
+   {0x04,0x3F,0x44,0x40,0x20},{0x3C,0x40,0x40,0x20,0x7C},{0x1C,0x20,0x40,0x20,0x1C},{0x3C,0x40,0x30,0x40,0x3C},
+   {0x44,0x28,0x10,0x28,0x44},{0x0C,0x50,0x50,0x50,0x3C},{0x44,0x64,0x54,0x4C,0x44},{0x00,0x08,0x36,0x41,0x00},
+   {0x00,0x00,0x7F,0x00,0x00},{0x00,0x41,0x36,0x08,0x00},{0x08,0x04,0x08,0x10,0x08}
+};
+
+GlyphAtlas::GlyphAtlas(void) :
+   m_texture(NULL),m_bytes(0)
+{
+   memset(m_glyphs,0,sizeof(m_glyphs));
+}
+
+GlyphAtlas::~GlyphAtlas(void){
+
+   Release();
+
+}
+//******************************************************************************************
+// Function:Init
+// Whazzit:The texture is the smallest power of two holding every cell, and is left
+//         alone after this
+//******************************************************************************************
+HRESULT GlyphAtlas::Init(RenderDevice *p_device){
+const UINT width=g_ga_columns * g_ga_cell;
+const UINT rows=(g_ga_count + g_ga_columns - 1) / g_ga_columns;
+UINT height=1;
+BYTE *texels;
+UINT pitch;
+HRESULT hr;
+
+   Release();
+
+   while(height < rows * g_ga_cell)
+   {
+      height*=2;
+   }
+
+   hr=p_device->CreateTexture(width,height,&m_texture);
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   hr=m_texture->Lock((void **)&texels,&pitch);
+   if(FAILED(hr))
+   {
+      Release();
+      return hr;
+   }
+   m_bytes=pitch * height;
+
+   for(UINT y=0;y<height;y++)
+   {
+      memset(texels + y * pitch,0,width);
+   }
+
+   for(int i=0;i<g_ga_count;i++)
+   {
+      const int cell_x=(i % g_ga_columns) * g_ga_cell;
+      const int cell_y=(i / g_ga_columns) * g_ga_cell;
+
+      for(int x=0;x<g_ga_glyph_width;x++)
+      {
+         for(int y=0;y<g_ga_cell;y++)
+         {
+            if(g_ga_font[i][x] & (1 << y))
+            {
+               texels[(cell_y + y) * pitch + cell_x + x]=0xFF;
+            }
+         }
+      }
+
+      m_glyphs[i].u0=(float)cell_x / width;
+      m_glyphs[i].v0=(float)cell_y / height;
+      m_glyphs[i].u1=(float)(cell_x + g_ga_glyph_width) / width;
+      m_glyphs[i].v1=(float)(cell_y + g_ga_cell) / height;
+   }
+
+   return m_texture->Unlock();
+}
+
+void GlyphAtlas::Release(void){
+
+   if(m_texture)
+   {
+      m_texture->Release();
+      m_texture=NULL;
+   }
+   m_bytes=0;
+
+}
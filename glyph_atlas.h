@@ -0,0 +1,59 @@
+//
+// glyph_atlas.h - The HUD font, rasterized once into a coverage texture
+//
+// A fixed 5x7 bitmap font for printable ASCII, built into an 8 bit texture when the
+// atlas is created and never touched again.  Being a bitmap it needs no font files,
+// no GDI and no filtering: every glyph is drawn unscaled, so each texel lands on
+// exactly one pixel and the D3D9 and CPU backends show the same thing.
+//
+// Cells are g_ga_cell pixels square, 16 to a row.  A glyph's quad covers its
+// g_ga_glyph_width x g_ga_cell box in the cell; anything outside printable ASCII is
+// drawn as '?'.
+//
+#ifndef GLYPH_ATLAS_H
+#define GLYPH_ATLAS_H
+
+#include "render_device.h"
+
+const int g_ga_first = 32;
+const int g_ga_count = 95;
+const int g_ga_cell = 8;
+const int g_ga_columns = 16;
+const int g_ga_glyph_width = 5;
+//Pen movement per character and per line, in pixels
+const int g_ga_advance = 6;
+const int g_ga_line_height = 12;
+
+struct ga_glyph
+{
+   float u0,v0;
+   float u1,v1;
+};
+
+class GlyphAtlas
+{
+public:
+   GlyphAtlas(void);
+   ~GlyphAtlas(void);
+
+   HRESULT Init(RenderDevice *p_device);
+   void Release(void);
+
+   RenderTexture *GetTexture(void) const { return m_texture; }
+   //Bytes the atlas is written as, a device that fell back to 32 bits holds four times that
+   UINT GetBytes(void) const { return m_bytes; }
+   const ga_glyph &GetGlyph(unsigned char p_char) const{
+      return m_glyphs[p_char >= g_ga_first && p_char < g_ga_first + g_ga_count ? p_char - g_ga_first :
+                      '?' - g_ga_first];
+   }
+
+private:
+   GlyphAtlas(const GlyphAtlas &);
+   GlyphAtlas &operator=(const GlyphAtlas &);
+
+   RenderTexture *m_texture;
+   UINT m_bytes;
+   ga_glyph m_glyphs[g_ga_count];
+};
+
+#endif
@@ -0,0 +1,58 @@
+//
+// hires_timer.h - High resolution wall clock used for profiling and benchmarks
+//
+#ifndef HIRES_TIMER_H
+#define HIRES_TIMER_H
+
+#ifdef _WIN32
+   #ifndef WIN32_LEAN_AND_MEAN
+      #define WIN32_LEAN_AND_MEAN
+   #endif
+   #include <windows.h>
+#else
+   #include <time.h>
+#endif
+
+//Raw counter ticks, cheaper than hires_seconds when we only store the value.  Convert
+//with hires_tick_period.
+inline unsigned long long hires_ticks(void){
+#ifdef _WIN32
+LARGE_INTEGER count;
+
+   QueryPerformanceCounter(&count);
+
+   return (unsigned long long)count.QuadPart;
+#else
+struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+//Seconds per tick
+inline double hires_tick_period(void){
+#ifdef _WIN32
+static double period=0.0;
+
+   if(period == 0.0)
+   {
+      LARGE_INTEGER freq;
+      QueryPerformanceFrequency(&freq);
+      period=1.0 / (double)freq.QuadPart;
+   }
+
+   return period;
+#else
+   return 1e-9;
+#endif
+}
+
+//Seconds since some arbitrary fixed point, only differences are meaningful
+inline double hires_seconds(void){
+
+   return (double)hires_ticks() * hires_tick_period();
+}
+
+#endif
@@ -0,0 +1,72 @@
+//
+// input_latency.cpp - Times input events from when they happened to when they were shown
+//
+#include "input_latency.h"
+#include "hires_timer.h"
+
+LatencyTracker::LatencyTracker(void) :
+   m_ticks(g_il_max_events),m_frames(g_il_max_frames),m_applied(0),m_last_worst(0.0)
+{
+   m_latencies.SetCapacity(g_il_max_samples);
+}
+
+void LatencyTracker::Applied(unsigned long long p_ticks){
+
+   if(m_ticks.push_back(p_ticks))
+   {
+      m_applied++;
+   }
+
+}
+
+void LatencyTracker::EndFrame(RenderDevice *p_device){
+
+   if(m_applied == 0)
+   {
+      return;
+   }
+
+   frame entry={ p_device->InsertFence(),m_applied };
+   if(!m_frames.push_back(entry))
+   {
+      //Can't wait for this one, its events go untimed
+      for(size_t i=0;i<m_applied;i++)
+      {
+         m_ticks.pop_back();
+      }
+   }
+   m_applied=0;
+
+}
+
+void LatencyTracker::Poll(RenderDevice *p_device){
+const unsigned long long now=hires_ticks();
+const double period=hires_tick_period();
+
+   while(!m_frames.empty() && p_device->FenceDone(m_frames.front().fence))
+   {
+      double worst=0.0;
+
+      for(size_t i=0;i<m_frames.front().count;i++)
+      {
+         //Replayed events can be stamped a touch after the sample that found them
+         const double latency=now > m_ticks.front() ? (now - m_ticks.front()) * period : 0.0;
+
+         m_latencies.Add(latency);
+         worst=latency > worst ? latency : worst;
+         m_ticks.pop_front();
+      }
+
+      m_last_worst=worst;
+      m_frames.pop_front();
+   }
+
+}
+
+void LatencyTracker::Reset(void){
+
+   m_ticks.clear();
+   m_frames.clear();
+   m_applied=0;
+
+}
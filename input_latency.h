@@ -0,0 +1,68 @@
+//
+// input_latency.h - Times input events from when they happened to when they were shown
+//
+// The frame tells us the stamp of every event it applied, and after Present a fence is
+// put in behind the frame.  Once the device says the fence has passed, each of those
+// events is timed against now.  Nothing can see the display itself, so "shown" is the
+// device finishing the frame, and we only find out when Poll next looks, which
+// overstates the latency by at most the time between polls.
+//
+// Events and frames waiting on the device are kept in fixed queues.  Anything past
+// those limits (only likely if the device never finishes) goes untimed rather than
+// making the tracker allocate from inside the frame.  The latencies themselves have a
+// fixed g_il_max_samples too; once that many are in, later ones are only counted.
+//
+// input_latency_main.cpp drives it with a replay and the null device, for measuring
+// without a window or D3D.
+//
+#ifndef INPUT_LATENCY_H
+#define INPUT_LATENCY_H
+
+#include <stddef.h>
+#include "fixed_deque.h"
+#include "render_device.h"
+#include "frame_stats.h"
+
+//Events and frames that can be waiting on the device at once
+const size_t g_il_max_events = 4096;
+const size_t g_il_max_frames = 64;
+//Latencies kept until the next Clear, past that they are counted as dropped
+const size_t g_il_max_samples = 64 * 1024;
+
+class LatencyTracker
+{
+public:
+   LatencyTracker(void);
+
+   //An event with this hires_ticks stamp went into the frame being built
+   void Applied(unsigned long long p_ticks);
+   //After Present, fences the frame's events
+   void EndFrame(RenderDevice *p_device);
+   //Times the events whose frames the device has finished, call as often as is handy
+   void Poll(RenderDevice *p_device);
+   //Forget everything in flight, e.g. after the device was reset
+   void Reset(void);
+
+   //Every event timed since the last Clear, or the first g_il_max_samples of them
+   const FrameStats &GetLatencies(void) const { return m_latencies; }
+   void Clear(void) { m_latencies.Clear(); }
+   //Oldest event's latency in the last frame to finish, in seconds
+   double GetLastWorst(void) const { return m_last_worst; }
+   //Every event applied so far has been timed
+   bool IsIdle(void) const { return m_applied == 0 && m_frames.empty(); }
+
+private:
+   struct frame
+   {
+      rd_fence fence;
+      size_t count;
+   };
+
+   FixedDeque<unsigned long long> m_ticks;   //Oldest frame's first
+   FixedDeque<frame> m_frames;
+   size_t m_applied;                         //This frame's, not fenced yet
+   FrameStats m_latencies;
+   double m_last_worst;
+};
+
+#endif
@@ -0,0 +1,173 @@
+//
+// input_latency_main.cpp - Input to photon latency with no window, no D3D and no person
+//
+// input_latency [replay] [-synthetic seconds] [-rate hz] [-fps n] [-jit] [-max_in_flight n]
+//               [-work ms]
+//
+// Plays a file recorded with 3d_objects -record_input, or a generated sweep, through
+// the input thread into a frame loop on the null device, the same way 3d_objects does
+// with -replay_input and -synthetic_input, and prints the latency statistics.  -work
+// is how long each frame pretends to take between taking its input and Present.  The
+// null device finishes a frame g_null_frame_latency frames after it was presented,
+// fewer if -max_in_flight asks for it, and that stands in for the GPU.
+//
+// It isn't in the project, it's meant for the machines without D3D.  Build it with:
+//
+//    g++ -std=c++11 -O2 -pthread -o input_latency input_latency_main.cpp input_thread.cpp
+//        input_latency.cpp frame_pacer.cpp frame_stats.cpp null_device.cpp
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "input_thread.h"
+#include "input_latency.h"
+#include "frame_pacer.h"
+#include "null_device.h"
+#include "hires_timer.h"
+
+//Events taken out of the queue at a time, as 3d_objects does
+const int g_ilm_drain = 256;
+//Seconds of generated sweep when there is no replay file
+const double g_ilm_default_synthetic = 5.0;
+
+static void usage(void){
+
+   fprintf(stderr,"usage: input_latency [replay] [-synthetic seconds] [-rate hz] [-fps n] [-jit] "
+                  "[-max_in_flight n] [-work ms]\n");
+
+}
+
+int main(int argc, char **argv){
+const char *filename=NULL;
+double synthetic=0.0;
+double rate=g_in_default_rate;
+double fps=60.0;
+bool jit=false;
+int max_in_flight=0;
+double work=0.002;
+ReplaySource source;
+InputThread input;
+LatencyTracker tracker;
+FramePacer pacer;
+NullDevice device;
+in_event events[g_ilm_drain];
+in_stats stats;
+frame_summary latency;
+int count;
+
+   for(int i=1;i<argc;i++)
+   {
+      if(strcmp(argv[i],"-synthetic") == 0 && i + 1 < argc)
+      {
+         synthetic=atof(argv[++i]);
+      }
+      else if(strcmp(argv[i],"-rate") == 0 && i + 1 < argc)
+      {
+         rate=atof(argv[++i]);
+      }
+      else if(strcmp(argv[i],"-fps") == 0 && i + 1 < argc)
+      {
+         fps=atof(argv[++i]);
+      }
+      else if(strcmp(argv[i],"-jit") == 0)
+      {
+         jit=true;
+      }
+      else if(strcmp(argv[i],"-max_in_flight") == 0 && i + 1 < argc)
+      {
+         max_in_flight=atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i],"-work") == 0 && i + 1 < argc)
+      {
+         work=atof(argv[++i]) / 1000.0;
+      }
+      else if(argv[i][0] != '-' && filename == NULL)
+      {
+         filename=argv[i];
+      }
+      else
+      {
+         usage();
+         return 2;
+      }
+   }
+
+   if(rate <= 0.0 || work < 0.0 || (filename && synthetic > 0.0))
+   {
+      usage();
+      return 2;
+   }
+
+   if(filename)
+   {
+      if(!source.Load(filename))
+      {
+         fprintf(stderr,"input_latency: couldn't load %s\n",filename);
+         return 1;
+      }
+   }
+   else
+   {
+      source.Generate(synthetic > 0.0 ? synthetic : g_ilm_default_synthetic,1.0 / rate);
+   }
+
+   //The pretend GPU has to keep up with a tighter frames in flight limit, or the pacer
+   //would only ever time out waiting for it
+   if(max_in_flight > 0 && g_null_frame_latency > (UINT)max_in_flight - 1)
+   {
+      device.SetFrameLatency(max_in_flight - 1);
+   }
+   pacer.Init(fps > 0.0 ? (jit ? FP_JUST_IN_TIME : FP_CAP) : FP_OFF,fps,max_in_flight);
+
+   if(!input.Start(&source,rate))
+   {
+      fprintf(stderr,"input_latency: couldn't start the input thread\n");
+      return 1;
+   }
+
+   //Until the replay has run out and every event it gave us has been shown
+   for(;;)
+   {
+      //Read before the drain, the thread only says so after queueing its last event
+      const bool finished=input.IsFinished();
+      unsigned int applied=0;
+
+      pacer.BeginFrame(&device);
+      tracker.Poll(&device);
+      while((count=input.Drain(events,g_ilm_drain)) > 0)
+      {
+         for(int i=0;i<count;i++)
+         {
+            tracker.Applied(events[i].ticks);
+         }
+         applied+=count;
+      }
+      pacer.MarkInput();
+
+      fp_sleep_until(hires_seconds() + work);
+      device.Present();
+      pacer.EndFrame(&device);
+      tracker.EndFrame(&device);
+      tracker.Poll(&device);
+
+      if(finished && applied == 0 && tracker.IsIdle())
+      {
+         break;
+      }
+   }
+   input.Stop();
+
+   input.GetStats(&stats);
+   latency=tracker.GetLatencies().Summarize();
+   printf("%s: %llu events, %llu dropped by the queue, %lu untimed, %.0f Hz sampling, %s %.0f fps, "
+          "%.1f ms of work, %d in flight\n",filename ? filename : "synthetic",stats.events,stats.dropped,
+          (unsigned long)tracker.GetLatencies().GetDropped(),rate,jit ? "just in time" : "capped",fps,
+          work * 1000.0,max_in_flight);
+   printf("latency %lu timed: min %.3f ms, avg %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+          (unsigned long)latency.count,latency.min * 1000.0,latency.avg * 1000.0,latency.p50 * 1000.0,
+          latency.p99 * 1000.0,latency.max * 1000.0);
+   printf("frames %llu, pacer latency avg %.3f ms, %u fence timeouts\n",pacer.GetStats().frames,
+          pacer.GetStats().avg_latency * 1000.0,pacer.GetStats().timeouts);
+
+   return latency.count > 0 ? 0 : 1;
+}
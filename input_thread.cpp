@@ -0,0 +1,288 @@
+//
+// input_thread.cpp - Samples input on its own thread, independent of the frame rate
+//
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include "input_thread.h"
+#include "hires_timer.h"
+
+//Generated sweep: mouse counts across and up, and seconds per loop
+const double g_in_sweep_width = 400.0;
+const double g_in_sweep_height = 150.0;
+const double g_in_sweep_period = 4.0;
+
+ReplaySource::ReplaySource(void) :
+   m_next(0),m_start(0)
+{
+}
+
+void ReplaySource::Add(double p_time, const in_event &p_event){
+timed_event entry;
+
+   entry.time=p_time;
+   entry.event=p_event;
+   m_events.push_back(entry);
+
+}
+
+bool ReplaySource::Load(const char *p_filename){
+FILE *file=fopen(p_filename,"r");
+char line[128];
+char type[16];
+double ms;
+in_event event;
+
+   if(file == NULL)
+   {
+      return false;
+   }
+
+   m_events.clear();
+   m_next=0;
+   m_start=0;
+
+   while(fgets(line,sizeof(line),file))
+   {
+      memset(&event,0,sizeof(event));
+
+      if(sscanf(line,"%lf %15s",&ms,type) != 2)
+      {
+         continue;
+      }
+
+      if(strcmp(type,"move") == 0 && sscanf(line,"%*f %*s %d %d",&event.dx,&event.dy) == 2)
+      {
+         event.type=IN_MOVE;
+      }
+      else if(strcmp(type,"down") == 0 && sscanf(line,"%*f %*s %u",&event.key) == 1)
+      {
+         event.type=IN_KEY_DOWN;
+      }
+      else if(strcmp(type,"up") == 0 && sscanf(line,"%*f %*s %u",&event.key) == 1)
+      {
+         event.type=IN_KEY_UP;
+      }
+      else
+      {
+         continue;
+      }
+
+      Add(ms / 1000.0,event);
+   }
+
+   fclose(file);
+
+   return true;
+}
+//******************************************************************************************
+// Function:Generate
+// Whazzit:Each move is the whole count difference between where the sweep is now and
+//         where the moves so far have taken it, so rounding never drifts
+//******************************************************************************************
+void ReplaySource::Generate(double p_seconds, double p_interval){
+int at_x=0,at_y=0;
+in_event event;
+
+   m_events.clear();
+   m_next=0;
+   m_start=0;
+   memset(&event,0,sizeof(event));
+   event.type=IN_MOVE;
+
+   for(double t=p_interval;t <= p_seconds;t+=p_interval)
+   {
+      const double angle=t * 2.0 * 3.14159265358979 / g_in_sweep_period;
+      const int to_x=(int)floor(sin(angle) * g_in_sweep_width + 0.5);
+      const int to_y=(int)floor(sin(angle * 2.0) * g_in_sweep_height + 0.5);
+
+      event.dx=to_x - at_x;
+      event.dy=to_y - at_y;
+      if(event.dx || event.dy)
+      {
+         Add(t,event);
+         at_x=to_x;
+         at_y=to_y;
+      }
+   }
+
+}
+
+int ReplaySource::Sample(in_event *p_events, int p_max){
+const unsigned long long now=hires_ticks();
+const double period=hires_tick_period();
+int count=0;
+
+   if(m_start == 0)
+   {
+      m_start=now;
+   }
+
+   while(count < p_max && m_next < m_events.size() && m_events[m_next].time <= (now - m_start) * period)
+   {
+      p_events[count]=m_events[m_next].event;
+      //When it was due, not when we got to it
+      p_events[count].ticks=m_start + (unsigned long long)(m_events[m_next].time / period);
+      count++;
+      m_next++;
+   }
+
+   return count;
+}
+
+InputRecorder::InputRecorder(void) :
+   m_file(NULL),m_start(0)
+{
+}
+
+InputRecorder::~InputRecorder(void){
+
+   Close();
+
+}
+
+bool InputRecorder::Open(const char *p_filename){
+
+   Close();
+   m_file=fopen(p_filename,"w");
+   m_start=0;
+
+   return m_file != NULL;
+}
+
+void InputRecorder::Write(const in_event &p_event){
+double ms;
+
+   if(m_file == NULL)
+   {
+      return;
+   }
+
+   if(m_start == 0)
+   {
+      m_start=p_event.ticks;
+   }
+   ms=(double)(p_event.ticks - m_start) * hires_tick_period() * 1000.0;
+
+   switch(p_event.type)
+   {
+      case IN_MOVE:
+         fprintf(m_file,"%.3f move %d %d\n",ms,p_event.dx,p_event.dy);
+         break;
+      case IN_KEY_DOWN:
+         fprintf(m_file,"%.3f down %u\n",ms,p_event.key);
+         break;
+      case IN_KEY_UP:
+         fprintf(m_file,"%.3f up %u\n",ms,p_event.key);
+         break;
+   }
+
+}
+
+void InputRecorder::Close(void){
+
+   if(m_file)
+   {
+      fclose(m_file);
+      m_file=NULL;
+   }
+
+}
+
+InputThread::InputThread(void) :
+   m_source(NULL),m_rate(g_in_default_rate),m_quit(false),m_finished(false),m_samples(0),m_events(0),m_dropped(0)
+{
+}
+
+InputThread::~InputThread(void){
+
+   Stop();
+
+}
+
+bool InputThread::Start(InputSource *p_source, double p_rate){
+
+   Stop();
+
+   if(p_source == NULL || p_rate <= 0.0)
+   {
+      return false;
+   }
+
+   m_source=p_source;
+   m_rate=p_rate;
+   m_quit=false;
+   m_finished=false;
+   m_thread=std::thread(ThreadMain,this);
+
+   return true;
+}
+
+void InputThread::Stop(void){
+
+   if(m_thread.joinable())
+   {
+      m_quit=true;
+      m_thread.join();
+   }
+   m_source=NULL;
+
+}
+//******************************************************************************************
+// Function:ThreadMain
+// Whazzit:Samples on a fixed schedule rather than sleeping a fixed time after each
+//         sample, so a slow sample doesn't push every later one back
+//******************************************************************************************
+void InputThread::ThreadMain(InputThread *p_self){
+const std::chrono::duration<double> period(1.0 / p_self->m_rate);
+std::chrono::steady_clock::time_point next=std::chrono::steady_clock::now();
+in_event events[g_in_max_sample];
+
+   while(!p_self->m_quit)
+   {
+      const int count=p_self->m_source->Sample(events,g_in_max_sample);
+
+      for(int i=0;i<count;i++)
+      {
+         if(!p_self->m_queue.Push(events[i]))
+         {
+            p_self->m_dropped++;
+         }
+      }
+      p_self->m_samples++;
+      p_self->m_events+=count;
+
+      if(p_self->m_source->IsFinished())
+      {
+         p_self->m_finished=true;
+      }
+
+      next+=std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+      //Too far behind to catch up, start the schedule again from now
+      if(next < std::chrono::steady_clock::now())
+      {
+         next=std::chrono::steady_clock::now();
+      }
+      std::this_thread::sleep_until(next);
+   }
+
+}
+
+int InputThread::Drain(in_event *p_events, int p_max){
+int count=0;
+
+   while(count < p_max && m_queue.Pop(&p_events[count]))
+   {
+      count++;
+   }
+
+   return count;
+}
+
+void InputThread::GetStats(in_stats *p_stats) const{
+
+   p_stats->samples=m_samples;
+   p_stats->events=m_events;
+   p_stats->dropped=m_dropped;
+
+}
@@ -0,0 +1,148 @@
+//
+// input_thread.h - Samples input on its own thread, independent of the frame rate
+//
+// An InputSource is polled g_in_default_rate times a second on a thread of its own and
+// everything it reports goes into an SpscQueue as timestamped in_events.  The frame
+// drains the queue just before it builds the view matrix, so it sees every event that
+// happened up to that moment however long the last frame took, and nothing is lost
+// to a slow frame (only to a full queue, which is counted).
+//
+// ReplaySource plays back a recorded or generated event list on the same schedule it
+// was recorded with, stamping each event with the time it was due rather than the
+// time it was sampled.  Measuring from that stamp to the end of the frame that showed
+// the event gives input to photon latency, sampling delay included, without a window
+// or a person at the keyboard.
+//
+#ifndef INPUT_THREAD_H
+#define INPUT_THREAD_H
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "spsc_queue.h"
+
+//Samples per second
+const double g_in_default_rate = 1000.0;
+const unsigned int g_in_queue_size = 4096;
+//Most events one Sample call may report
+const int g_in_max_sample = 64;
+
+enum in_event_type
+{
+   IN_MOVE,          //Relative mouse motion, dx/dy
+   IN_KEY_DOWN,      //key
+   IN_KEY_UP
+};
+
+struct in_event
+{
+   unsigned long long ticks;  //hires_ticks when it happened
+   int type;
+   int dx;
+   int dy;
+   unsigned int key;
+};
+
+class InputSource
+{
+public:
+   virtual ~InputSource(void) {}
+
+   //Called on the input thread.  Writes the events since the last call, up to p_max,
+   //and returns how many.
+   virtual int Sample(in_event *p_events, int p_max) = 0;
+   //A replay that has run out
+   virtual bool IsFinished(void) const { return false; }
+};
+
+//Plays back events from a text file, one per line:
+//
+//    <ms> move <dx> <dy>
+//    <ms> down <key>
+//    <ms> up <key>
+//
+//with times counted from the first Sample.  Keys are whatever the application uses.
+class ReplaySource : public InputSource
+{
+public:
+   ReplaySource(void);
+
+   bool Load(const char *p_filename);
+   //A steady figure of eight sweep, a move every p_interval seconds for p_seconds
+   void Generate(double p_seconds, double p_interval);
+   void Add(double p_time, const in_event &p_event);
+
+   virtual int Sample(in_event *p_events, int p_max);
+   virtual bool IsFinished(void) const { return m_next >= m_events.size(); }
+
+private:
+   struct timed_event
+   {
+      double time;
+      in_event event;
+   };
+
+   std::vector<timed_event> m_events;
+   size_t m_next;
+   unsigned long long m_start;
+};
+
+//Writes events in the format ReplaySource reads, times relative to the first one
+class InputRecorder
+{
+public:
+   InputRecorder(void);
+   ~InputRecorder(void);
+
+   bool Open(const char *p_filename);
+   void Write(const in_event &p_event);
+   void Close(void);
+
+private:
+   FILE *m_file;
+   unsigned long long m_start;
+};
+
+struct in_stats
+{
+   unsigned long long samples;
+   unsigned long long events;
+   unsigned long long dropped;    //The queue was full
+};
+
+class InputThread
+{
+public:
+   InputThread(void);
+   ~InputThread(void);
+
+   //p_source is polled on the new thread from now until Stop
+   bool Start(InputSource *p_source, double p_rate=g_in_default_rate);
+   void Stop(void);
+
+   //Consumer side, returns how many events were copied out
+   int Drain(in_event *p_events, int p_max);
+   bool IsFinished(void) const { return m_finished; }
+   bool IsRunning(void) const { return m_thread.joinable(); }
+
+   void GetStats(in_stats *p_stats) const;
+
+private:
+   InputThread(const InputThread &);
+   InputThread &operator=(const InputThread &);
+
+   static void ThreadMain(InputThread *p_self);
+
+   InputSource *m_source;
+   double m_rate;
+   std::thread m_thread;
+   std::atomic<bool> m_quit;
+   std::atomic<bool> m_finished;
+   SpscQueue<in_event,g_in_queue_size> m_queue;
+   std::atomic<unsigned long long> m_samples;
+   std::atomic<unsigned long long> m_events;
+   std::atomic<unsigned long long> m_dropped;
+};
+
+#endif
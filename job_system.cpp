@@ -0,0 +1,371 @@
+//
+// job_system.cpp - Work stealing job scheduler
+//
+#include "job_system.h"
+
+static thread_local int g_js_thread_index=0;
+
+JobSystem::JobSystem(void) :
+   m_thread_count(0),m_queues(NULL),m_queued(0),m_sleeping(0),m_quit(false),m_sleeps(0),m_overflows(0)
+{
+}
+
+JobSystem::~JobSystem(void){
+
+   Shutdown();
+
+}
+
+void JobSystem::Init(int p_threads){
+
+   Shutdown();
+
+   if(p_threads <= 0)
+   {
+      p_threads=(int)std::thread::hardware_concurrency();
+      p_threads=p_threads > 0 ? p_threads : 1;
+   }
+   m_thread_count=p_threads < g_js_max_threads ? p_threads : g_js_max_threads;
+
+   m_queues=new thread_queue[m_thread_count];
+   for(int i=0;i<m_thread_count;i++)
+   {
+      m_queues[i].jobs.Init(g_js_queue_size);
+   }
+   m_held.reserve(g_js_held_size);
+   ResetStats();
+   m_quit=false;
+
+   g_js_thread_index=0;
+   for(int i=1;i<m_thread_count;i++)
+   {
+      m_workers.push_back(std::thread(WorkerMain,this,i));
+   }
+
+}
+
+void JobSystem::Shutdown(void){
+
+   if(m_queues == NULL)
+   {
+      return;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(m_sleep_lock);
+      m_quit=true;
+   }
+   m_wake.notify_all();
+
+   for(size_t i=0;i<m_workers.size();i++)
+   {
+      m_workers[i].join();
+   }
+   m_workers.clear();
+
+   delete[] m_queues;
+   m_queues=NULL;
+   m_thread_count=0;
+   m_held.clear();
+
+}
+
+int JobSystem::ThreadIndex(void){
+
+   return g_js_thread_index;
+}
+//******************************************************************************************
+// Function:Push
+// Whazzit:Onto the back of this thread's deque.  The sleep count is read after the queue
+//         count goes up and a sleeper bumps it before checking the queue count, so either
+//         the sleeper sees the job or we see the sleeper and take the lock to wake it.
+//         A full deque means there is plenty to keep everyone busy, so the job is just
+//         run here.
+//******************************************************************************************
+void JobSystem::Push(const job &p_job){
+thread_queue &queue=m_queues[g_js_thread_index];
+bool queued;
+
+   {
+      std::lock_guard<std::mutex> lock(queue.lock);
+      queued=queue.jobs.push_back(p_job);
+   }
+   if(!queued)
+   {
+      m_overflows++;
+      Execute(p_job);
+      return;
+   }
+   m_queued++;
+
+   if(m_sleeping > 0)
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_sleep_lock);
+      }
+      m_wake.notify_one();
+   }
+
+}
+
+bool JobSystem::Pop(int p_index, job *p_job){
+thread_queue &queue=m_queues[p_index];
+std::lock_guard<std::mutex> lock(queue.lock);
+
+   if(queue.jobs.empty())
+   {
+      return false;
+   }
+
+   *p_job=queue.jobs.back();
+   queue.jobs.pop_back();
+   m_queued--;
+
+   return true;
+}
+//******************************************************************************************
+// Function:Steal
+// Whazzit:Tries the other deques' fronts, starting after our own so the thieves spread
+//         out over their victims instead of all hitting thread 0 first
+//******************************************************************************************
+bool JobSystem::Steal(int p_index, job *p_job){
+
+   for(int i=1;i<m_thread_count;i++)
+   {
+      thread_queue &queue=m_queues[(p_index + i) % m_thread_count];
+
+      //Not worth the lock
+      if(m_queued <= 0)
+      {
+         return false;
+      }
+
+      std::lock_guard<std::mutex> lock(queue.lock);
+      if(!queue.jobs.empty())
+      {
+         *p_job=queue.jobs.front();
+         queue.jobs.pop_front();
+         m_queued--;
+         m_queues[p_index].stolen++;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+void JobSystem::Execute(const job &p_job){
+
+   if(p_job.range)
+   {
+      p_job.range(p_job.data,p_job.begin,p_job.end);
+   }
+   else
+   {
+      p_job.func(p_job.data);
+   }
+
+   m_queues[g_js_thread_index].run++;
+   if(p_job.done)
+   {
+      Finished(p_job.done);
+   }
+
+}
+//******************************************************************************************
+// Function:Finished
+// Whazzit:Counts a job off, and when that empties the counter releases whatever was
+//         held back on it.  The held list is small, a few stage jobs per frame; they
+//         are taken off it a handful at a time so nothing needs allocating.
+//******************************************************************************************
+void JobSystem::Finished(js_counter *p_counter){
+job ready[16];
+size_t count;
+
+   if(--p_counter->count != 0)
+   {
+      return;
+   }
+
+   do
+   {
+      std::unique_lock<std::mutex> lock(m_held_lock);
+
+      count=0;
+      for(size_t i=0;i<m_held.size() && count < sizeof(ready) / sizeof(ready[0]);)
+      {
+         if(m_held[i].after == p_counter)
+         {
+            ready[count++]=m_held[i];
+            m_held[i]=m_held.back();
+            m_held.pop_back();
+         }
+         else
+         {
+            i++;
+         }
+      }
+      lock.unlock();
+
+      for(size_t i=0;i<count;i++)
+      {
+         Push(ready[i]);
+      }
+   } while(count == sizeof(ready) / sizeof(ready[0]));
+
+}
+
+bool JobSystem::RunOne(int p_index){
+job next;
+
+   if(Pop(p_index,&next) || Steal(p_index,&next))
+   {
+      Execute(next);
+      return true;
+   }
+
+   return false;
+}
+
+void JobSystem::WorkerMain(JobSystem *p_self, int p_index){
+int idle=0;
+
+   g_js_thread_index=p_index;
+
+   while(!p_self->m_quit)
+   {
+      if(p_self->RunOne(p_index))
+      {
+         idle=0;
+         continue;
+      }
+
+      if(++idle < g_js_spin_count)
+      {
+         std::this_thread::yield();
+         continue;
+      }
+
+      std::unique_lock<std::mutex> lock(p_self->m_sleep_lock);
+      p_self->m_sleeping++;
+      if(p_self->m_queued <= 0 && !p_self->m_quit)
+      {
+         p_self->m_sleeps++;
+         p_self->m_wake.wait(lock,[p_self]{ return p_self->m_queued > 0 || p_self->m_quit; });
+      }
+      p_self->m_sleeping--;
+      idle=0;
+   }
+
+}
+
+void JobSystem::Run(js_func p_func, void *p_data, js_counter *p_done, js_counter *p_after){
+job item={ p_func,NULL,p_data,0,0,p_done,p_after };
+
+   if(p_done)
+   {
+      p_done->count++;
+   }
+
+   if(p_after)
+   {
+      //Checked under the lock Finished takes after emptying a counter, so we either
+      //see it empty or it sees us held
+      std::lock_guard<std::mutex> lock(m_held_lock);
+
+      if(p_after->count != 0)
+      {
+         m_held.push_back(item);
+         return;
+      }
+   }
+
+   Push(item);
+
+}
+
+void JobSystem::Wait(js_counter *p_counter){
+
+   while(p_counter->count != 0)
+   {
+      if(!RunOne(g_js_thread_index))
+      {
+         std::this_thread::yield();
+      }
+   }
+
+}
+
+size_t JobSystem::AutoGrain(size_t p_count, size_t p_min_grain) const{
+const size_t pieces=(size_t)(m_thread_count > 1 ? m_thread_count * 4 : 1);
+size_t grain=(p_count + pieces - 1) / pieces;
+
+   return grain > p_min_grain ? grain : (p_min_grain ? p_min_grain : 1);
+}
+//******************************************************************************************
+// Function:ParallelFor
+// Whazzit:Queues the pieces last first, so the owner pops them from the back in order
+//         while thieves take the far end of the range from the front
+//******************************************************************************************
+void JobSystem::ParallelFor(size_t p_count, size_t p_grain, js_range_func p_func, void *p_data){
+js_counter done;
+size_t pieces;
+
+   if(p_count == 0)
+   {
+      return;
+   }
+
+   p_grain=p_grain ? p_grain : 1;
+   pieces=(p_count + p_grain - 1) / p_grain;
+
+   //Nothing to share, or nobody to share it with
+   if(pieces == 1 || m_thread_count <= 1)
+   {
+      for(size_t begin=0;begin<p_count;begin+=p_grain)
+      {
+         p_func(p_data,begin,begin + p_grain < p_count ? begin + p_grain : p_count);
+      }
+      return;
+   }
+
+   done.count+=(int)(pieces - 1);
+   for(size_t i=pieces - 1;i > 0;i--)
+   {
+      const size_t begin=i * p_grain;
+      job item={ NULL,p_func,p_data,begin,begin + p_grain < p_count ? begin + p_grain : p_count,&done,NULL };
+
+      Push(item);
+   }
+
+   //The first piece is ours
+   p_func(p_data,0,p_grain);
+   m_queues[g_js_thread_index].run++;
+
+   Wait(&done);
+
+}
+
+void JobSystem::GetStats(js_stats *p_stats) const{
+
+   for(int i=0;i<g_js_max_threads;i++)
+   {
+      p_stats->jobs[i]=i < m_thread_count ? m_queues[i].run.load() : 0;
+      p_stats->steals[i]=i < m_thread_count ? m_queues[i].stolen.load() : 0;
+   }
+   p_stats->sleeps=m_sleeps;
+   p_stats->overflows=m_overflows;
+
+}
+
+void JobSystem::ResetStats(void){
+
+   for(int i=0;i<m_thread_count;i++)
+   {
+      m_queues[i].run=0;
+      m_queues[i].stolen=0;
+   }
+   m_sleeps=0;
+   m_overflows=0;
+
+}
@@ -0,0 +1,154 @@
+//
+// job_system.h - Work stealing job scheduler
+//
+// A job is a function pointer and a data pointer.  Every thread taking part (the
+// workers, plus the thread that called Init as thread 0) has its own deque: jobs a
+// thread queues go on the back of its own, it takes its next job off the back too, so
+// it keeps working on what it just split off while the data is still in its cache.  A
+// thread whose deque runs dry steals from the front of someone else's, which is where
+// the oldest and usually biggest pieces of work are.  Workers with nothing to do spin
+// for a moment and then sleep until more work is queued.
+//
+// Completion is tracked with js_counters.  Run bumps the counter it's given and the
+// job drops it again when it finishes; Wait runs other jobs until it reaches zero,
+// so waiting never leaves a thread idle while there is work.  A job can also be given
+// a counter to run after, it is held back until that counter reaches zero, which is
+// how one stage of a frame is made to depend on another without a Wait between them.
+//
+// Each deque is a fixed ring of g_js_queue_size jobs, so queueing never allocates.  A
+// job queued on a full one is run there and then by the thread queueing it.
+//
+// Run and Wait may be called from thread 0 and from inside jobs.  Other threads (the
+// asset loader's worker) must not use the scheduler.
+//
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "fixed_deque.h"
+
+//Most threads Init will start, including thread 0
+const int g_js_max_threads = 64;
+
+//Jobs each thread's deque holds, and jobs that can be held back on counters at once
+//before Run has to grow the list
+const size_t g_js_queue_size = 4096;
+const size_t g_js_held_size = 256;
+
+//Times a thread with nothing to run looks for work before it goes to sleep
+const int g_js_spin_count = 200;
+
+typedef void (*js_func)(void *p_data);
+//Handles the items p_begin..p_end of a ParallelFor
+typedef void (*js_range_func)(void *p_data, size_t p_begin, size_t p_end);
+
+struct js_counter
+{
+   js_counter(void) : count(0) {}
+
+   std::atomic<int> count;
+
+private:
+   js_counter(const js_counter &);
+   js_counter &operator=(const js_counter &);
+};
+
+struct js_stats
+{
+   //Since Init or the last ResetStats
+   unsigned long long jobs[g_js_max_threads];     //Run by each thread
+   unsigned long long steals[g_js_max_threads];   //Of those, taken from another thread
+   unsigned long long sleeps;
+   unsigned long long overflows;                  //Run inline because the deque was full
+};
+
+class JobSystem
+{
+public:
+   JobSystem(void);
+   ~JobSystem(void);
+
+   //Starts p_threads - 1 workers alongside the calling thread.  0 picks one per
+   //hardware thread, 1 runs every job on the caller inside Wait.
+   void Init(int p_threads=0);
+   void Shutdown(void);
+
+   int GetThreadCount(void) const { return m_thread_count; }
+   //0 on the thread that called Init, 1 up on the workers
+   static int ThreadIndex(void);
+
+   //Queues a job on this thread's deque.  p_done, if given, is counted up now and down
+   //when the job finishes.  p_after, if given, holds the job back until it reaches 0;
+   //queue the jobs it counts first, a counter that's already 0 holds nothing back.
+   void Run(js_func p_func, void *p_data, js_counter *p_done, js_counter *p_after=NULL);
+   //Runs jobs until p_counter reaches 0
+   void Wait(js_counter *p_counter);
+
+   //Calls p_func over 0..p_count in pieces of p_grain items (the last may be short) and
+   //returns when they're all done.  Piece i starts at i * p_grain, so callers can keep
+   //per piece results that come out the same whichever thread ran them.
+   void ParallelFor(size_t p_count, size_t p_grain, js_range_func p_func, void *p_data);
+   //A grain that gives each thread a few pieces to balance with, but no smaller than
+   //p_min_grain
+   size_t AutoGrain(size_t p_count, size_t p_min_grain) const;
+
+   void GetStats(js_stats *p_stats) const;
+   void ResetStats(void);
+
+private:
+   JobSystem(const JobSystem &);
+   JobSystem &operator=(const JobSystem &);
+
+   struct job
+   {
+      js_func func;
+      js_range_func range;
+      void *data;
+      size_t begin;
+      size_t end;
+      js_counter *done;
+      js_counter *after;
+   };
+
+   struct thread_queue
+   {
+      std::mutex lock;
+      FixedDeque<job> jobs;
+      std::atomic<unsigned long long> run;
+      std::atomic<unsigned long long> stolen;
+      //Keeps neighbouring threads' deques off each other's cache lines
+      char pad[64];
+   };
+
+   static void WorkerMain(JobSystem *p_self, int p_index);
+   void Push(const job &p_job);
+   bool Pop(int p_index, job *p_job);
+   bool Steal(int p_index, job *p_job);
+   bool RunOne(int p_index);
+   void Execute(const job &p_job);
+   void Finished(js_counter *p_counter);
+
+   int m_thread_count;
+   thread_queue *m_queues;
+   std::vector<std::thread> m_workers;
+
+   //Jobs in the deques, so sleepers know when to wake
+   std::atomic<int> m_queued;
+   std::atomic<int> m_sleeping;
+   std::atomic<bool> m_quit;
+   std::atomic<unsigned long long> m_sleeps;
+   std::atomic<unsigned long long> m_overflows;
+   std::mutex m_sleep_lock;
+   std::condition_variable m_wake;
+
+   //Jobs waiting on a p_after counter
+   std::mutex m_held_lock;
+   std::vector<job> m_held;
+};
+
+#endif
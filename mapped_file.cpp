@@ -0,0 +1,311 @@
+//
+// mapped_file.cpp - Read-only memory mapped file access
+//
+#include "mapped_file.h"
+
+#ifndef _WIN32
+   #include <fcntl.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+   #include <unistd.h>
+#endif
+
+MappedFile::MappedFile(void) :
+   m_data(NULL),m_base(NULL),m_base_size(0),m_view_size(0),m_view_offset(0),
+   m_file_size(0),m_is_open(false)
+#ifdef _WIN32
+   ,m_file(INVALID_HANDLE_VALUE),m_mapping(NULL)
+#else
+   ,m_fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile(void){
+
+   Close();
+
+}
+//******************************************************************************************
+// Function:GetGranularity
+// Whazzit:Returns the alignment required for the file offset of a view.  Windows wants
+//         the allocation granularity (64k), everyone else wants the page size.
+//******************************************************************************************
+size_t MappedFile::GetGranularity(void){
+static size_t granularity=0;
+
+   if(granularity == 0)
+   {
+#ifdef _WIN32
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      granularity=info.dwAllocationGranularity;
+#else
+      granularity=(size_t)sysconf(_SC_PAGESIZE);
+#endif
+   }
+
+   return granularity;
+}
+//******************************************************************************************
+// Function:Open
+// Whazzit:Opens the file and maps all of it.  Nothing is read here, pages are faulted in
+//         on first touch.
+//******************************************************************************************
+bool MappedFile::Open(const char *p_filename){
+
+   if(!OpenUnmapped(p_filename))
+   {
+      return false;
+   }
+
+   if(!MapView(0,0))
+   {
+      Close();
+      return false;
+   }
+
+   return true;
+}
+//******************************************************************************************
+// Function:OpenUnmapped
+// Whazzit:Opens the file and records its size, no view is created yet.
+//******************************************************************************************
+bool MappedFile::OpenUnmapped(const char *p_filename){
+
+   Close();
+
+#ifdef _WIN32
+   m_file=CreateFileA(p_filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
+                      FILE_ATTRIBUTE_NORMAL,NULL);
+   if(m_file == INVALID_HANDLE_VALUE)
+   {
+      return false;
+   }
+
+   LARGE_INTEGER size;
+   if(!GetFileSizeEx(m_file,&size))
+   {
+      Close();
+      return false;
+   }
+   m_file_size=(uint64_t)size.QuadPart;
+
+   //A zero length file can't be mapped, but it is still a valid (empty) file
+   if(m_file_size > 0)
+   {
+      m_mapping=CreateFileMappingA(m_file,NULL,PAGE_READONLY,0,0,NULL);
+      if(m_mapping == NULL)
+      {
+         Close();
+         return false;
+      }
+   }
+#else
+   m_fd=open(p_filename,O_RDONLY);
+   if(m_fd < 0)
+   {
+      return false;
+   }
+
+   struct stat st;
+   if(fstat(m_fd,&st) != 0)
+   {
+      Close();
+      return false;
+   }
+   m_file_size=(uint64_t)st.st_size;
+#endif
+
+   m_is_open=true;
+
+   return true;
+}
+//******************************************************************************************
+// Function:MapView
+// Whazzit:Maps a window of the file.  The OS requires the file offset to be aligned, so
+//         we map from the aligned offset below p_offset and hand back a pointer into it.
+//******************************************************************************************
+bool MappedFile::MapView(uint64_t p_offset, size_t p_length){
+uint64_t aligned;
+size_t lead;
+size_t length;
+
+   if(!m_is_open || p_offset > m_file_size)
+   {
+      return false;
+   }
+
+   UnmapView();
+
+   if(p_length == 0 || p_offset + p_length > m_file_size)
+   {
+      length=(size_t)(m_file_size - p_offset);
+   }
+   else
+   {
+      length=p_length;
+   }
+
+   m_view_offset=p_offset;
+
+   if(length == 0)
+   {
+      return true;
+   }
+
+   aligned=p_offset - (p_offset % GetGranularity());
+   lead=(size_t)(p_offset - aligned);
+
+#ifdef _WIN32
+   m_base=MapViewOfFile(m_mapping,FILE_MAP_READ,(DWORD)(aligned >> 32),
+                        (DWORD)(aligned & 0xFFFFFFFF),lead + length);
+   if(m_base == NULL)
+   {
+      return false;
+   }
+#else
+   m_base=mmap(NULL,lead + length,PROT_READ,MAP_SHARED,m_fd,(off_t)aligned);
+   if(m_base == MAP_FAILED)
+   {
+      m_base=NULL;
+      return false;
+   }
+#endif
+
+   m_base_size=lead + length;
+   m_data=(const unsigned char *)m_base + lead;
+   m_view_size=length;
+
+   return true;
+}
+//******************************************************************************************
+// Function:UnmapView
+// Whazzit:Drops the current view, the file stays open.
+//******************************************************************************************
+void MappedFile::UnmapView(void){
+
+   if(m_base)
+   {
+#ifdef _WIN32
+      UnmapViewOfFile(m_base);
+#else
+      munmap(m_base,m_base_size);
+#endif
+   }
+
+   m_base=NULL;
+   m_base_size=0;
+   m_data=NULL;
+   m_view_size=0;
+   m_view_offset=0;
+
+}
+//******************************************************************************************
+// Function:Close
+// Whazzit:Unmaps the view and closes the file
+//******************************************************************************************
+void MappedFile::Close(void){
+
+   UnmapView();
+
+#ifdef _WIN32
+   if(m_mapping)
+   {
+      CloseHandle(m_mapping);
+      m_mapping=NULL;
+   }
+   if(m_file != INVALID_HANDLE_VALUE)
+   {
+      CloseHandle(m_file);
+      m_file=INVALID_HANDLE_VALUE;
+   }
+#else
+   if(m_fd >= 0)
+   {
+      close(m_fd);
+      m_fd=-1;
+   }
+#endif
+
+   m_file_size=0;
+   m_is_open=false;
+
+}
+//******************************************************************************************
+// Function:Advise
+// Whazzit:Passes an access pattern hint to the OS.  Windows has no equivalent of the
+//         sequential/random hints for an existing view, so only WILLNEED does anything
+//         there.
+//******************************************************************************************
+void MappedFile::Advise(mf_advice p_advice) const{
+
+   if(m_base == NULL)
+   {
+      return;
+   }
+
+#ifdef _WIN32
+   if(p_advice == MF_ADVISE_WILLNEED)
+   {
+      Prefetch(0,m_view_size);
+   }
+#else
+int advice;
+
+   switch(p_advice)
+   {
+      case MF_ADVISE_SEQUENTIAL: advice=MADV_SEQUENTIAL; break;
+      case MF_ADVISE_RANDOM:     advice=MADV_RANDOM;     break;
+      case MF_ADVISE_WILLNEED:   advice=MADV_WILLNEED;   break;
+      default:                   advice=MADV_NORMAL;     break;
+   }
+
+   madvise(m_base,m_base_size,advice);
+#endif
+
+}
+//******************************************************************************************
+// Function:Prefetch
+// Whazzit:Starts paging in part of the view.  PrefetchVirtualMemory only exists on
+//         Windows 8 and later so we look it up at runtime and quietly do nothing if it
+//         isn't there.
+//******************************************************************************************
+void MappedFile::Prefetch(size_t p_offset, size_t p_length) const{
+size_t page;
+size_t start;
+size_t end;
+
+   if(m_base == NULL || p_offset >= m_view_size)
+   {
+      return;
+   }
+
+   if(p_length == 0 || p_offset + p_length > m_view_size)
+   {
+      p_length=m_view_size - p_offset;
+   }
+
+   //Work in offsets from the aligned base so the range starts on a page boundary
+   page=GetGranularity();
+   start=(size_t)(m_data - (const unsigned char *)m_base) + p_offset;
+   end=start + p_length;
+   start-=start % page;
+
+#ifdef _WIN32
+   typedef struct { PVOID VirtualAddress; SIZE_T NumberOfBytes; } prefetch_range;
+   typedef BOOL (WINAPI *prefetch_func)(HANDLE,ULONG_PTR,prefetch_range *,ULONG);
+   static prefetch_func prefetch=(prefetch_func)GetProcAddress(GetModuleHandleA("kernel32.dll"),
+                                                               "PrefetchVirtualMemory");
+   if(prefetch)
+   {
+      prefetch_range range;
+      range.VirtualAddress=(char *)m_base + start;
+      range.NumberOfBytes=end - start;
+      prefetch(GetCurrentProcess(),1,&range,0);
+   }
+#else
+   madvise((char *)m_base + start,end - start,MADV_WILLNEED);
+#endif
+
+}
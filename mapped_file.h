@@ -0,0 +1,81 @@
+//
+// mapped_file.h - Read-only memory mapped file access
+//
+// Maps a file (or a window of it) straight into our address space so asset data
+// can be read in place instead of being copied into a heap buffer first.
+//
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+   #ifndef WIN32_LEAN_AND_MEAN
+      #define WIN32_LEAN_AND_MEAN
+   #endif
+   #include <windows.h>
+#endif
+
+//Access pattern hints, passed on to madvise/PrefetchVirtualMemory where available
+enum mf_advice
+{
+   MF_ADVISE_NORMAL,
+   MF_ADVISE_SEQUENTIAL,
+   MF_ADVISE_RANDOM,
+   MF_ADVISE_WILLNEED
+};
+
+class MappedFile
+{
+public:
+   MappedFile(void);
+   ~MappedFile(void);
+
+   //Opens p_filename and maps the whole file
+   bool Open(const char *p_filename);
+   //Opens p_filename without mapping anything, use MapView to pick the window
+   bool OpenUnmapped(const char *p_filename);
+   //Maps [p_offset, p_offset+p_length) of the open file, replacing any previous view.
+   //The offset does not need to be aligned, the view is widened to the allocation
+   //granularity internally.  A length of 0 maps to the end of the file.
+   bool MapView(uint64_t p_offset, size_t p_length);
+   void Close(void);
+
+   bool IsOpen(void) const { return m_is_open; }
+   const unsigned char *GetData(void) const { return m_data; }
+   size_t GetSize(void) const { return m_view_size; }
+   uint64_t GetViewOffset(void) const { return m_view_offset; }
+   uint64_t GetFileSize(void) const { return m_file_size; }
+
+   //Access pattern hint for the current view
+   void Advise(mf_advice p_advice) const;
+   //Asks the OS to start paging in [p_offset, p_offset+p_length) of the current view
+   void Prefetch(size_t p_offset, size_t p_length) const;
+
+   //Granularity that view offsets are rounded down to
+   static size_t GetGranularity(void);
+
+private:
+   MappedFile(const MappedFile &);
+   MappedFile &operator=(const MappedFile &);
+
+   void UnmapView(void);
+
+   const unsigned char *m_data;     //First byte of the requested view
+   void *m_base;                    //Start of the aligned mapping
+   size_t m_base_size;              //Size of the aligned mapping
+   size_t m_view_size;
+   uint64_t m_view_offset;
+   uint64_t m_file_size;
+   bool m_is_open;
+
+#ifdef _WIN32
+   HANDLE m_file;
+   HANDLE m_mapping;
+#else
+   int m_fd;
+#endif
+};
+
+#endif
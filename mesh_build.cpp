@@ -0,0 +1,403 @@
+//
+// mesh_build.cpp - Turns expanded triangle lists into optimized indexed meshes
+//
+#include <math.h>
+#include <string.h>
+#include <unordered_map>
+#include "mesh_build.h"
+
+//Forsyth's tuning, modelled as an LRU cache of this many entries
+const int g_forsyth_cache_size = 32;
+const float g_forsyth_decay_power = 1.5f;
+const float g_forsyth_last_tri_score = 0.75f;
+const float g_forsyth_valence_scale = 2.0f;
+const float g_forsyth_valence_power = 0.5f;
+
+//A tri_vertex compared by its bits, so -0.0 and 0.0 stay apart and NaNs still match
+struct weld_key
+{
+   DWORD bits[4];
+
+   bool operator==(const weld_key &p_other) const { return memcmp(bits,p_other.bits,sizeof(bits)) == 0; }
+};
+
+struct weld_hash
+{
+   size_t operator()(const weld_key &p_key) const{
+   unsigned int hash=2166136261u;
+
+      for(int i=0;i<4;i++)
+      {
+         hash=(hash ^ p_key.bits[i]) * 16777619u;
+      }
+
+      return hash;
+   }
+};
+
+void mesh_weld(const tri_vertex *p_vertices, size_t p_count, std::vector<tri_vertex> *p_out_vertices,
+               std::vector<unsigned int> *p_out_indices){
+std::unordered_map<weld_key,unsigned int,weld_hash> seen;
+weld_key key;
+
+   static_assert(sizeof(tri_vertex) == sizeof(weld_key),"tri_vertex must be 16 bytes");
+
+   p_out_vertices->clear();
+   p_out_indices->resize(p_count);
+   seen.reserve(p_count);
+
+   for(size_t i=0;i<p_count;i++)
+   {
+      memcpy(key.bits,&p_vertices[i],sizeof(key.bits));
+
+      std::pair<std::unordered_map<weld_key,unsigned int,weld_hash>::iterator,bool> result=
+         seen.insert(std::make_pair(key,(unsigned int)p_out_vertices->size()));
+      if(result.second)
+      {
+         p_out_vertices->push_back(p_vertices[i]);
+      }
+      (*p_out_indices)[i]=result.first->second;
+   }
+
+}
+
+static float forsyth_vertex_score(int p_cache_pos, unsigned int p_remaining){
+float score=0.0f;
+
+   if(p_remaining == 0)
+   {
+      return -1.0f;
+   }
+
+   if(p_cache_pos >= 0)
+   {
+      //The last triangle's vertices get a fixed score so we don't just fan around them
+      if(p_cache_pos < 3)
+      {
+         score=g_forsyth_last_tri_score;
+      }
+      else
+      {
+         score=powf(1.0f - (float)(p_cache_pos - 3) / (float)(g_forsyth_cache_size - 3),g_forsyth_decay_power);
+      }
+   }
+
+   //Favour vertices with few triangles left, to finish them off and free the slot
+   return score + g_forsyth_valence_scale * powf((float)p_remaining,-g_forsyth_valence_power);
+}
+//******************************************************************************************
+// Function:mesh_optimize_vertex_cache
+// Whazzit:Greedy: always emit the triangle with the best score, where a vertex scores
+//         higher the more recently it was used and the fewer triangles it has left.
+//         Only the triangles around the cached vertices are rescored after each step,
+//         which keeps it close to linear time.
+//******************************************************************************************
+void mesh_optimize_vertex_cache(unsigned int *p_indices, size_t p_index_count, size_t p_vertex_count){
+const size_t tri_count=p_index_count / 3;
+std::vector<unsigned int> remaining(p_vertex_count,0);
+std::vector<unsigned int> adjacency_start(p_vertex_count + 1,0);
+std::vector<unsigned int> adjacency(tri_count * 3);
+std::vector<int> cache_pos(p_vertex_count,-1);
+std::vector<float> vertex_score(p_vertex_count);
+std::vector<float> tri_score(tri_count);
+std::vector<char> emitted(tri_count,0);
+std::vector<unsigned int> output;
+int cache[g_forsyth_cache_size + 3];
+int new_cache[g_forsyth_cache_size + 3];
+int cache_count=0;
+size_t best_tri;
+float best_score;
+
+   if(tri_count == 0)
+   {
+      return;
+   }
+
+   //Triangle lists per vertex
+   for(size_t i=0;i<tri_count * 3;i++)
+   {
+      remaining[p_indices[i]]++;
+   }
+   for(size_t v=0;v<p_vertex_count;v++)
+   {
+      adjacency_start[v + 1]=adjacency_start[v] + remaining[v];
+      remaining[v]=0;
+   }
+   for(size_t i=0;i<tri_count * 3;i++)
+   {
+      unsigned int v=p_indices[i];
+      adjacency[adjacency_start[v] + remaining[v]++]=(unsigned int)(i / 3);
+   }
+
+   for(size_t v=0;v<p_vertex_count;v++)
+   {
+      vertex_score[v]=forsyth_vertex_score(-1,remaining[v]);
+   }
+
+   best_tri=0;
+   best_score=-1.0f;
+   for(size_t t=0;t<tri_count;t++)
+   {
+      tri_score[t]=vertex_score[p_indices[t * 3]] + vertex_score[p_indices[t * 3 + 1]] +
+                   vertex_score[p_indices[t * 3 + 2]];
+      if(tri_score[t] > best_score)
+      {
+         best_score=tri_score[t];
+         best_tri=t;
+      }
+   }
+
+   output.reserve(tri_count * 3);
+
+   while(output.size() < tri_count * 3)
+   {
+      //Nothing around the cache is left, take the best of the rest
+      if(best_score < 0.0f)
+      {
+         for(size_t t=0;t<tri_count;t++)
+         {
+            if(!emitted[t] && tri_score[t] > best_score)
+            {
+               best_score=tri_score[t];
+               best_tri=t;
+            }
+         }
+      }
+
+      const unsigned int *tri=&p_indices[best_tri * 3];
+      int new_count=0;
+
+      emitted[best_tri]=1;
+      for(int i=0;i<3;i++)
+      {
+         unsigned int v=tri[i];
+         unsigned int *list=&adjacency[adjacency_start[v]];
+
+         output.push_back(v);
+
+         //Drop the triangle from the vertex's list by swapping it with the last live one
+         for(unsigned int j=0;j<remaining[v];j++)
+         {
+            if(list[j] == best_tri)
+            {
+               list[j]=list[remaining[v] - 1];
+               list[remaining[v] - 1]=(unsigned int)best_tri;
+               break;
+            }
+         }
+         remaining[v]--;
+
+         new_cache[new_count++]=(int)v;
+      }
+
+      //The triangle's vertices move to the front, everything else shuffles back
+      for(int i=0;i<cache_count;i++)
+      {
+         int v=cache[i];
+
+         if(v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2])
+         {
+            new_cache[new_count++]=v;
+         }
+      }
+
+      cache_count=0;
+      for(int i=0;i<new_count;i++)
+      {
+         int v=new_cache[i];
+
+         cache_pos[v]=i < g_forsyth_cache_size ? i : -1;
+         vertex_score[v]=forsyth_vertex_score(cache_pos[v],remaining[v]);
+
+         if(i < g_forsyth_cache_size)
+         {
+            cache[cache_count++]=v;
+         }
+      }
+
+      //Rescore the triangles around the cache and pick the next one from them
+      best_score=-1.0f;
+      for(int i=0;i<cache_count;i++)
+      {
+         int v=cache[i];
+
+         for(unsigned int j=0;j<remaining[v];j++)
+         {
+            unsigned int t=adjacency[adjacency_start[v] + j];
+
+            tri_score[t]=vertex_score[p_indices[t * 3]] + vertex_score[p_indices[t * 3 + 1]] +
+                         vertex_score[p_indices[t * 3 + 2]];
+            if(tri_score[t] > best_score)
+            {
+               best_score=tri_score[t];
+               best_tri=t;
+            }
+         }
+      }
+   }
+
+   memcpy(p_indices,&output[0],tri_count * 3 * sizeof(unsigned int));
+
+}
+
+size_t mesh_optimize_vertex_fetch(tri_vertex *p_vertices, size_t p_vertex_count, unsigned int *p_indices,
+                                  size_t p_index_count){
+std::vector<unsigned int> remap(p_vertex_count,~0u);
+std::vector<tri_vertex> reordered;
+
+   reordered.reserve(p_vertex_count);
+
+   for(size_t i=0;i<p_index_count;i++)
+   {
+      unsigned int &slot=remap[p_indices[i]];
+
+      if(slot == ~0u)
+      {
+         slot=(unsigned int)reordered.size();
+         reordered.push_back(p_vertices[p_indices[i]]);
+      }
+      p_indices[i]=slot;
+   }
+
+   if(!reordered.empty())
+   {
+      memcpy(p_vertices,&reordered[0],reordered.size() * sizeof(tri_vertex));
+   }
+
+   return reordered.size();
+}
+//******************************************************************************************
+// Function:fifo_misses
+// Whazzit:Counts the vertices a FIFO post-transform cache would have to transform.  A
+//         vertex is cached if fewer than p_cache_size misses happened since it went in.
+//******************************************************************************************
+static size_t fifo_misses(const unsigned int *p_indices, size_t p_index_count, int p_cache_size){
+std::vector<size_t> stamp;
+size_t misses=0;
+
+   for(size_t i=0;i<p_index_count;i++)
+   {
+      unsigned int v=p_indices[i];
+
+      if(v >= stamp.size())
+      {
+         stamp.resize(v + 1,0);
+      }
+
+      if(stamp[v] == 0 || misses - stamp[v] >= (size_t)p_cache_size)
+      {
+         misses++;
+         stamp[v]=misses;
+      }
+   }
+
+   return misses;
+}
+
+float mesh_acmr(const unsigned int *p_indices, size_t p_index_count, int p_cache_size){
+
+   if(p_index_count < 3)
+   {
+      return 0.0f;
+   }
+
+   return (float)fifo_misses(p_indices,p_index_count,p_cache_size) / (float)(p_index_count / 3);
+}
+
+void mesh_build(const tri_vertex *p_vertices, const UINT *p_submesh_prims, int p_submesh_count,
+                mesh_data *p_out, mesh_build_stats *p_stats){
+size_t total=0;
+size_t misses_welded=0;
+size_t misses_after=0;
+UINT start=0;
+
+   for(int i=0;i<p_submesh_count;i++)
+   {
+      total+=p_submesh_prims[i] * 3;
+   }
+
+   mesh_weld(p_vertices,total,&p_out->vertices,&p_out->indices);
+
+   //Each submesh is its own draw, so its triangles are only reordered among themselves
+   //and the cache is assumed cold at the start of each
+   for(int i=0;i<p_submesh_count;i++)
+   {
+      unsigned int *indices=&p_out->indices[start];
+      const size_t count=p_submesh_prims[i] * 3;
+
+      misses_welded+=fifo_misses(indices,count,g_mesh_fifo_size);
+      mesh_optimize_vertex_cache(indices,count,p_out->vertices.size());
+      misses_after+=fifo_misses(indices,count,g_mesh_fifo_size);
+      start+=(UINT)count;
+   }
+
+   p_out->vertices.resize(mesh_optimize_vertex_fetch(&p_out->vertices[0],p_out->vertices.size(),
+                                                     &p_out->indices[0],p_out->indices.size()));
+
+   p_out->submeshes.resize(p_submesh_count);
+   start=0;
+   for(int i=0;i<p_submesh_count;i++)
+   {
+      mesh_submesh &submesh=p_out->submeshes[i];
+      unsigned int low=~0u;
+      unsigned int high=0;
+
+      for(int k=0;k<3;k++)
+      {
+         submesh.bounds_min[k]=p_submesh_prims[i] ? HUGE_VALF : 0.0f;
+         submesh.bounds_max[k]=p_submesh_prims[i] ? -HUGE_VALF : 0.0f;
+      }
+
+      for(UINT j=0;j<p_submesh_prims[i] * 3;j++)
+      {
+         unsigned int v=p_out->indices[start + j];
+         const tri_vertex &vertex=p_out->vertices[v];
+         const float pos[3]={ vertex.x,vertex.y,vertex.z };
+
+         low=v < low ? v : low;
+         high=v > high ? v : high;
+
+         for(int k=0;k<3;k++)
+         {
+            submesh.bounds_min[k]=pos[k] < submesh.bounds_min[k] ? pos[k] : submesh.bounds_min[k];
+            submesh.bounds_max[k]=pos[k] > submesh.bounds_max[k] ? pos[k] : submesh.bounds_max[k];
+         }
+      }
+
+      submesh.start_index=start;
+      submesh.prim_count=p_submesh_prims[i];
+      submesh.min_vertex=p_submesh_prims[i] ? low : 0;
+      submesh.num_vertices=p_submesh_prims[i] ? high - low + 1 : 0;
+      start+=p_submesh_prims[i] * 3;
+   }
+
+   if(p_stats)
+   {
+      p_stats->vertices_in=total;
+      p_stats->vertices_out=p_out->vertices.size();
+      p_stats->acmr_before=total ? 3.0f : 0.0f;
+      p_stats->acmr_welded=total ? (float)misses_welded / (float)(total / 3) : 0.0f;
+      p_stats->acmr_after=total ? (float)misses_after / (float)(total / 3) : 0.0f;
+   }
+
+}
+
+int mesh_index_size(size_t p_vertex_count){
+
+   return p_vertex_count <= 0x10000 ? 2 : 4;
+}
+
+void mesh_pack_indices(const unsigned int *p_indices, size_t p_index_count, int p_index_size, void *p_out){
+
+   if(p_index_size == 4)
+   {
+      memcpy(p_out,p_indices,p_index_count * sizeof(unsigned int));
+      return;
+   }
+
+   for(size_t i=0;i<p_index_count;i++)
+   {
+      ((unsigned short *)p_out)[i]=(unsigned short)p_indices[i];
+   }
+
+}
@@ -0,0 +1,849 @@
+//
+// mesh_bvh.cpp - Triangle BVH over one mesh, for ray queries such as picking
+//
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "mesh_bvh.h"
+#include "vec_math.h"
+#include "hires_timer.h"
+
+//Nodes waiting on the traversal stack, each level visited leaves at most one behind
+const int g_mb_stack_size = g_mb_max_depth + 2;
+
+static inline UINT get_index(const void *p_indices, int p_index_size, size_t p_index){
+
+   if(p_index_size == 2)
+   {
+      return ((const uint16_t *)p_indices)[p_index];
+   }
+
+   return ((const uint32_t *)p_indices)[p_index];
+}
+
+static inline UINT groups(UINT p_count){
+
+   return (p_count + 3) / 4;
+}
+
+static float surface_area(const float *p_min, const float *p_max){
+float dx=p_max[0] - p_min[0];
+float dy=p_max[1] - p_min[1];
+float dz=p_max[2] - p_min[2];
+
+   return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+//******************************************************************************************
+// Function:hit_box
+// Whazzit:Slab test, clipped to the part of the ray from its origin up to p_best
+//******************************************************************************************
+static inline bool hit_box(const float *p_min, const float *p_max, const float *p_origin, const float *p_inv_dir,
+                           float p_best){
+float near_t=0.0f;
+float far_t=p_best;
+
+   for(int k=0;k<3;k++)
+   {
+      float t0=(p_min[k] - p_origin[k]) * p_inv_dir[k];
+      float t1=(p_max[k] - p_origin[k]) * p_inv_dir[k];
+
+      if(t0 > t1)
+      {
+         std::swap(t0,t1);
+      }
+      near_t=t0 > near_t ? t0 : near_t;
+      far_t=t1 < far_t ? t1 : far_t;
+   }
+
+   return near_t <= far_t;
+}
+//******************************************************************************************
+// Function:hit_triangle
+// Whazzit:Moller-Trumbore against one triangle given as a vertex and two edges.  A
+//         degenerate triangle has a zero determinant and never hits.
+//******************************************************************************************
+static inline bool hit_triangle(const float *p_origin, const float *p_dir, const float *p_v0, const float *p_e1,
+                                const float *p_e2, float p_best, float *p_t, float *p_u, float *p_v){
+const float p[3]={ p_dir[1] * p_e2[2] - p_dir[2] * p_e2[1],p_dir[2] * p_e2[0] - p_dir[0] * p_e2[2],
+                   p_dir[0] * p_e2[1] - p_dir[1] * p_e2[0] };
+const float det=p_e1[0] * p[0] + p_e1[1] * p[1] + p_e1[2] * p[2];
+const float inv_det=1.0f / det;
+const float s[3]={ p_origin[0] - p_v0[0],p_origin[1] - p_v0[1],p_origin[2] - p_v0[2] };
+const float q[3]={ s[1] * p_e1[2] - s[2] * p_e1[1],s[2] * p_e1[0] - s[0] * p_e1[2],
+                   s[0] * p_e1[1] - s[1] * p_e1[0] };
+const float u=(s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+const float v=(p_dir[0] * q[0] + p_dir[1] * q[1] + p_dir[2] * q[2]) * inv_det;
+const float t=(p_e2[0] * q[0] + p_e2[1] * q[1] + p_e2[2] * q[2]) * inv_det;
+
+   if(det != 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < p_best)
+   {
+      *p_t=t;
+      *p_u=u;
+      *p_v=v;
+      return true;
+   }
+
+   return false;
+}
+
+MeshBVH::MeshBVH(void){
+
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+
+void MeshBVH::Clear(void){
+
+   m_nodes.clear();
+   m_tris.clear();
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+
+void MeshBVH::Swap(MeshBVH &p_other){
+
+   m_nodes.swap(p_other.m_nodes);
+   m_tris.swap(p_other.m_tris);
+   std::swap(m_stats,p_other.m_stats);
+
+}
+//******************************************************************************************
+// Function:Build
+// Whazzit:Each triangle's box and centre are worked out once up front, BuildNode only
+//         reorders m_order.  The expected cost in the stats is the heuristic summed
+//         over the finished tree.
+//******************************************************************************************
+void MeshBVH::Build(const tri_vertex *p_vertices, const void *p_indices, int p_index_size, UINT p_prim_count){
+const double start=hires_seconds();
+float root_area;
+
+   Clear();
+   m_stats.triangles=p_prim_count;
+
+   if(p_prim_count > 0)
+   {
+      m_build.resize(p_prim_count);
+      m_order.resize(p_prim_count);
+      for(UINT i=0;i<p_prim_count;i++)
+      {
+         build_tri &tri=m_build[i];
+
+         for(int k=0;k<3;k++)
+         {
+            tri.min[k]=HUGE_VALF;
+            tri.max[k]=-HUGE_VALF;
+         }
+         for(int c=0;c<3;c++)
+         {
+            const tri_vertex &vertex=p_vertices[get_index(p_indices,p_index_size,(size_t)i * 3 + c)];
+            const float pos[3]={ vertex.x,vertex.y,vertex.z };
+
+            for(int k=0;k<3;k++)
+            {
+               tri.min[k]=pos[k] < tri.min[k] ? pos[k] : tri.min[k];
+               tri.max[k]=pos[k] > tri.max[k] ? pos[k] : tri.max[k];
+            }
+         }
+         for(int k=0;k<3;k++)
+         {
+            tri.centre[k]=(tri.min[k] + tri.max[k]) * 0.5f;
+         }
+         m_order[i]=i;
+      }
+
+      m_nodes.reserve(p_prim_count / 2 + 1);
+      m_tris.reserve(p_prim_count / 2 + 1);
+      m_nodes.resize(1);
+      BuildNode(0,0,p_prim_count,0,p_vertices,p_indices,p_index_size);
+
+      std::vector<build_tri>().swap(m_build);
+      std::vector<UINT>().swap(m_order);
+
+      root_area=surface_area(m_nodes[0].min,m_nodes[0].max);
+      for(size_t i=0;i<m_nodes.size();i++)
+      {
+         const node &n=m_nodes[i];
+         const float share=root_area > 0.0f ? surface_area(n.min,n.max) / root_area : 1.0f;
+
+         m_stats.sah_cost+=share * (n.count > 0 ? (float)groups(n.count) : g_mb_traversal_cost);
+         m_stats.leaves+=n.count > 0;
+      }
+   }
+
+   m_stats.nodes=(UINT)m_nodes.size();
+   m_stats.bytes=m_nodes.size() * sizeof(node) + m_tris.size() * sizeof(tri4);
+   m_stats.build_ms=(hires_seconds() - start) * 1000.0;
+
+}
+//******************************************************************************************
+// Function:BuildNode
+// Whazzit:Fills node p_index with m_order[p_first..p_first + p_count).  Every axis the
+//         centres spread along is binned, then swept from each end so the area and
+//         count on either side of every bin boundary are known, and the cheapest
+//         boundary wins.  Costs are left multiplied by the node's area, which makes a
+//         flat node cost nothing rather than dividing by zero.  Children are allocated
+//         in pairs, as in SceneBVH.
+//******************************************************************************************
+void MeshBVH::BuildNode(int p_index, UINT p_first, UINT p_count, int p_depth, const tri_vertex *p_vertices,
+                        const void *p_indices, int p_index_size){
+float low[3]={ HUGE_VALF,HUGE_VALF,HUGE_VALF };
+float high[3]={ -HUGE_VALF,-HUGE_VALF,-HUGE_VALF };
+float centre_low[3]={ HUGE_VALF,HUGE_VALF,HUGE_VALF };
+float centre_high[3]={ -HUGE_VALF,-HUGE_VALF,-HUGE_VALF };
+float best_cost=HUGE_VALF;
+int best_axis=-1;
+int best_split=0;
+float area;
+UINT middle;
+int child;
+
+   for(UINT i=p_first;i<p_first + p_count;i++)
+   {
+      const build_tri &tri=m_build[m_order[i]];
+
+      for(int k=0;k<3;k++)
+      {
+         low[k]=tri.min[k] < low[k] ? tri.min[k] : low[k];
+         high[k]=tri.max[k] > high[k] ? tri.max[k] : high[k];
+         centre_low[k]=tri.centre[k] < centre_low[k] ? tri.centre[k] : centre_low[k];
+         centre_high[k]=tri.centre[k] > centre_high[k] ? tri.centre[k] : centre_high[k];
+      }
+   }
+   memcpy(m_nodes[p_index].min,low,sizeof(low));
+   memcpy(m_nodes[p_index].max,high,sizeof(high));
+   m_stats.depth=p_depth > m_stats.depth ? p_depth : m_stats.depth;
+
+   if(p_count <= g_mb_leaf_size || p_depth >= g_mb_max_depth)
+   {
+      MakeLeaf(p_index,p_first,p_count,p_vertices,p_indices,p_index_size);
+      return;
+   }
+
+   for(int axis=0;axis<3;axis++)
+   {
+      const float extent=centre_high[axis] - centre_low[axis];
+      const float scale=extent > 0.0f ? (float)g_mb_bins / extent : 0.0f;
+      UINT bin_count[g_mb_bins];
+      float bin_min[g_mb_bins][3];
+      float bin_max[g_mb_bins][3];
+      float right_cost[g_mb_bins];
+      float box_min[3];
+      float box_max[3];
+      UINT count;
+
+      if(!(extent > 0.0f))
+      {
+         continue;
+      }
+
+      for(int b=0;b<g_mb_bins;b++)
+      {
+         bin_count[b]=0;
+         for(int k=0;k<3;k++)
+         {
+            bin_min[b][k]=HUGE_VALF;
+            bin_max[b][k]=-HUGE_VALF;
+         }
+      }
+
+      for(UINT i=p_first;i<p_first + p_count;i++)
+      {
+         const build_tri &tri=m_build[m_order[i]];
+         const int b=std::min((int)((tri.centre[axis] - centre_low[axis]) * scale),g_mb_bins - 1);
+
+         bin_count[b]++;
+         for(int k=0;k<3;k++)
+         {
+            bin_min[b][k]=tri.min[k] < bin_min[b][k] ? tri.min[k] : bin_min[b][k];
+            bin_max[b][k]=tri.max[k] > bin_max[b][k] ? tri.max[k] : bin_max[b][k];
+         }
+      }
+
+      //right_cost[b] is everything from bin b up
+      count=0;
+      for(int k=0;k<3;k++)
+      {
+         box_min[k]=HUGE_VALF;
+         box_max[k]=-HUGE_VALF;
+      }
+      for(int b=g_mb_bins - 1;b > 0;b--)
+      {
+         count+=bin_count[b];
+         for(int k=0;k<3;k++)
+         {
+            box_min[k]=bin_min[b][k] < box_min[k] ? bin_min[b][k] : box_min[k];
+            box_max[k]=bin_max[b][k] > box_max[k] ? bin_max[b][k] : box_max[k];
+         }
+         right_cost[b]=count ? surface_area(box_min,box_max) * (float)groups(count) : 0.0f;
+      }
+
+      //Splitting after bin b, both sides must have something in them
+      count=0;
+      for(int k=0;k<3;k++)
+      {
+         box_min[k]=HUGE_VALF;
+         box_max[k]=-HUGE_VALF;
+      }
+      for(int b=0;b < g_mb_bins - 1;b++)
+      {
+         float cost;
+
+         count+=bin_count[b];
+         for(int k=0;k<3;k++)
+         {
+            box_min[k]=bin_min[b][k] < box_min[k] ? bin_min[b][k] : box_min[k];
+            box_max[k]=bin_max[b][k] > box_max[k] ? bin_max[b][k] : box_max[k];
+         }
+         if(count == 0 || count == p_count)
+         {
+            continue;
+         }
+
+         cost=surface_area(box_min,box_max) * (float)groups(count) + right_cost[b + 1];
+         if(cost < best_cost)
+         {
+            best_cost=cost;
+            best_axis=axis;
+            best_split=b;
+         }
+      }
+   }
+
+   area=surface_area(low,high);
+   if(p_count <= g_mb_max_leaf &&
+      (best_axis < 0 || g_mb_traversal_cost * area + best_cost >= (float)groups(p_count) * area))
+   {
+      MakeLeaf(p_index,p_first,p_count,p_vertices,p_indices,p_index_size);
+      return;
+   }
+
+   if(best_axis < 0)
+   {
+      //Every centre in one place, any split is as good as another
+      middle=p_count / 2;
+   }
+   else
+   {
+      const std::vector<build_tri> &build=m_build;
+      const float split_low=centre_low[best_axis];
+      const float split_scale=(float)g_mb_bins / (centre_high[best_axis] - centre_low[best_axis]);
+      const int axis=best_axis;
+      const int split=best_split;
+
+      middle=(UINT)(std::partition(m_order.begin() + p_first,m_order.begin() + p_first + p_count,
+                                   [&build,split_low,split_scale,axis,split](UINT p_tri){
+                                      return std::min((int)((build[p_tri].centre[axis] - split_low) * split_scale),
+                                                      g_mb_bins - 1) <= split;
+                                   }) - (m_order.begin() + p_first));
+   }
+
+   child=(int)m_nodes.size();
+   m_nodes.resize(m_nodes.size() + 2);
+   m_nodes[p_index].first=child;
+   m_nodes[p_index].count=0;
+
+   BuildNode(child,p_first,middle,p_depth + 1,p_vertices,p_indices,p_index_size);
+   BuildNode(child + 1,p_first + middle,p_count - middle,p_depth + 1,p_vertices,p_indices,p_index_size);
+
+}
+
+void MeshBVH::MakeLeaf(int p_index, UINT p_first, UINT p_count, const tri_vertex *p_vertices,
+                       const void *p_indices, int p_index_size){
+
+   m_nodes[p_index].first=(int)m_tris.size();
+   m_nodes[p_index].count=(int)p_count;
+
+   for(UINT i=0;i<p_count;i+=4)
+   {
+      tri4 tris;
+
+      memset(&tris,0,sizeof(tris));
+      for(UINT lane=0;lane<4;lane++)
+      {
+         const UINT id=i + lane < p_count ? m_order[p_first + i + lane] : 0;
+         const tri_vertex *v[3];
+
+         if(i + lane >= p_count)
+         {
+            tris.id[lane]=-1;
+            continue;
+         }
+
+         for(int c=0;c<3;c++)
+         {
+            v[c]=&p_vertices[get_index(p_indices,p_index_size,(size_t)id * 3 + c)];
+         }
+         tris.v0x[lane]=v[0]->x;
+         tris.v0y[lane]=v[0]->y;
+         tris.v0z[lane]=v[0]->z;
+         tris.e1x[lane]=v[1]->x - v[0]->x;
+         tris.e1y[lane]=v[1]->y - v[0]->y;
+         tris.e1z[lane]=v[1]->z - v[0]->z;
+         tris.e2x[lane]=v[2]->x - v[0]->x;
+         tris.e2y[lane]=v[2]->y - v[0]->y;
+         tris.e2z[lane]=v[2]->z - v[0]->z;
+         tris.id[lane]=(int)id;
+      }
+      m_tris.push_back(tris);
+   }
+
+}
+//******************************************************************************************
+// Function:Intersect
+// Whazzit:Each node's box is tested when it comes off the stack, against the best hit
+//         so far, so a far child pushed early is dropped cheaply once something nearer
+//         has turned up.  The child whose centre is further along the ray goes on the
+//         stack first.
+//******************************************************************************************
+bool MeshBVH::Intersect(const mb_ray &p_ray, mb_hit *p_hit) const{
+int stack[g_mb_stack_size];
+int top=0;
+float inv_dir[3];
+float best=p_hit->t;
+int best_tri=-1;
+float best_u=0.0f;
+float best_v=0.0f;
+
+   if(m_nodes.empty())
+   {
+      return false;
+   }
+
+   for(int k=0;k<3;k++)
+   {
+      inv_dir[k]=1.0f / p_ray.dir[k];
+   }
+
+#ifdef VM_SSE2
+   const __m128 ox=_mm_set1_ps(p_ray.origin[0]);
+   const __m128 oy=_mm_set1_ps(p_ray.origin[1]);
+   const __m128 oz=_mm_set1_ps(p_ray.origin[2]);
+   const __m128 dx=_mm_set1_ps(p_ray.dir[0]);
+   const __m128 dy=_mm_set1_ps(p_ray.dir[1]);
+   const __m128 dz=_mm_set1_ps(p_ray.dir[2]);
+   const __m128 zero=_mm_setzero_ps();
+   const __m128 one=_mm_set1_ps(1.0f);
+#endif
+
+   stack[top++]=0;
+   while(top > 0)
+   {
+      const node &n=m_nodes[stack[--top]];
+
+      if(!hit_box(n.min,n.max,p_ray.origin,inv_dir,best))
+      {
+         continue;
+      }
+
+      if(n.count == 0)
+      {
+         const node &left=m_nodes[n.first];
+         const node &right=m_nodes[n.first + 1];
+         float along=0.0f;
+
+         for(int k=0;k<3;k++)
+         {
+            along+=(left.min[k] + left.max[k] - right.min[k] - right.max[k]) * p_ray.dir[k];
+         }
+         stack[top++]=along > 0.0f ? n.first : n.first + 1;
+         stack[top++]=along > 0.0f ? n.first + 1 : n.first;
+         continue;
+      }
+
+      for(int g=n.first;g < n.first + (int)groups(n.count);g++)
+      {
+         const tri4 &tris=m_tris[g];
+#ifdef VM_SSE2
+         const __m128 e1x=_mm_loadu_ps(tris.e1x);
+         const __m128 e1y=_mm_loadu_ps(tris.e1y);
+         const __m128 e1z=_mm_loadu_ps(tris.e1z);
+         const __m128 e2x=_mm_loadu_ps(tris.e2x);
+         const __m128 e2y=_mm_loadu_ps(tris.e2y);
+         const __m128 e2z=_mm_loadu_ps(tris.e2z);
+         const __m128 px=_mm_sub_ps(_mm_mul_ps(dy,e2z),_mm_mul_ps(dz,e2y));
+         const __m128 py=_mm_sub_ps(_mm_mul_ps(dz,e2x),_mm_mul_ps(dx,e2z));
+         const __m128 pz=_mm_sub_ps(_mm_mul_ps(dx,e2y),_mm_mul_ps(dy,e2x));
+         const __m128 det=_mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x,px),_mm_mul_ps(e1y,py)),_mm_mul_ps(e1z,pz));
+         const __m128 inv_det=_mm_div_ps(one,det);
+         const __m128 sx=_mm_sub_ps(ox,_mm_loadu_ps(tris.v0x));
+         const __m128 sy=_mm_sub_ps(oy,_mm_loadu_ps(tris.v0y));
+         const __m128 sz=_mm_sub_ps(oz,_mm_loadu_ps(tris.v0z));
+         const __m128 qx=_mm_sub_ps(_mm_mul_ps(sy,e1z),_mm_mul_ps(sz,e1y));
+         const __m128 qy=_mm_sub_ps(_mm_mul_ps(sz,e1x),_mm_mul_ps(sx,e1z));
+         const __m128 qz=_mm_sub_ps(_mm_mul_ps(sx,e1y),_mm_mul_ps(sy,e1x));
+         const __m128 u=_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx,px),_mm_mul_ps(sy,py)),_mm_mul_ps(sz,pz)),
+                                   inv_det);
+         const __m128 v=_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,qx),_mm_mul_ps(dy,qy)),_mm_mul_ps(dz,qz)),
+                                   inv_det);
+         const __m128 t=_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x,qx),_mm_mul_ps(e2y,qy)),_mm_mul_ps(e2z,qz)),
+                                   inv_det);
+         __m128 mask=_mm_and_ps(_mm_cmpneq_ps(det,zero),_mm_cmpge_ps(u,zero));
+         int hits;
+
+         mask=_mm_and_ps(mask,_mm_and_ps(_mm_cmpge_ps(v,zero),_mm_cmple_ps(_mm_add_ps(u,v),one)));
+         mask=_mm_and_ps(mask,_mm_and_ps(_mm_cmpgt_ps(t,zero),_mm_cmplt_ps(t,_mm_set1_ps(best))));
+         hits=_mm_movemask_ps(mask);
+
+         if(hits)
+         {
+            float lane_t[4];
+            float lane_u[4];
+            float lane_v[4];
+
+            _mm_storeu_ps(lane_t,t);
+            _mm_storeu_ps(lane_u,u);
+            _mm_storeu_ps(lane_v,v);
+            for(int lane=0;lane<4;lane++)
+            {
+               if((hits & (1 << lane)) && lane_t[lane] < best)
+               {
+                  best=lane_t[lane];
+                  best_tri=tris.id[lane];
+                  best_u=lane_u[lane];
+                  best_v=lane_v[lane];
+               }
+            }
+         }
+#else
+         for(int lane=0;lane<4;lane++)
+         {
+            const float v0[3]={ tris.v0x[lane],tris.v0y[lane],tris.v0z[lane] };
+            const float e1[3]={ tris.e1x[lane],tris.e1y[lane],tris.e1z[lane] };
+            const float e2[3]={ tris.e2x[lane],tris.e2y[lane],tris.e2z[lane] };
+
+            if(hit_triangle(p_ray.origin,p_ray.dir,v0,e1,e2,best,&best,&best_u,&best_v))
+            {
+               best_tri=tris.id[lane];
+            }
+         }
+#endif
+      }
+   }
+
+   if(best_tri < 0)
+   {
+      return false;
+   }
+
+   p_hit->t=best;
+   p_hit->triangle=best_tri;
+   p_hit->u=best_u;
+   p_hit->v=best_v;
+
+   return true;
+}
+//******************************************************************************************
+// Function:Intersect4
+// Whazzit:The packet goes into a node if any of its rays does, and each triangle is
+//         tested against all four rays at once.  Rays that missed the node can't hit
+//         its triangles, so they need no masking out.  The first ray decides which
+//         child is nearer.
+//******************************************************************************************
+void MeshBVH::Intersect4(const mb_ray4 &p_rays, mb_hit *p_hits) const{
+#ifdef VM_SSE2
+int stack[g_mb_stack_size];
+int top=0;
+float best[4];
+int best_tri[4]={ -1,-1,-1,-1 };
+float best_u[4];
+float best_v[4];
+
+   if(m_nodes.empty())
+   {
+      return;
+   }
+
+   for(int i=0;i<4;i++)
+   {
+      best[i]=p_hits[i].t;
+   }
+
+   const __m128 ox=_mm_loadu_ps(p_rays.ox);
+   const __m128 oy=_mm_loadu_ps(p_rays.oy);
+   const __m128 oz=_mm_loadu_ps(p_rays.oz);
+   const __m128 dx=_mm_loadu_ps(p_rays.dx);
+   const __m128 dy=_mm_loadu_ps(p_rays.dy);
+   const __m128 dz=_mm_loadu_ps(p_rays.dz);
+   const __m128 zero=_mm_setzero_ps();
+   const __m128 one=_mm_set1_ps(1.0f);
+   const __m128 inv_x=_mm_div_ps(one,dx);
+   const __m128 inv_y=_mm_div_ps(one,dy);
+   const __m128 inv_z=_mm_div_ps(one,dz);
+   __m128 best_t=_mm_loadu_ps(best);
+
+   stack[top++]=0;
+   while(top > 0)
+   {
+      const node &n=m_nodes[stack[--top]];
+      const __m128 tx0=_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min[0]),ox),inv_x);
+      const __m128 tx1=_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max[0]),ox),inv_x);
+      const __m128 ty0=_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min[1]),oy),inv_y);
+      const __m128 ty1=_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max[1]),oy),inv_y);
+      const __m128 tz0=_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min[2]),oz),inv_z);
+      const __m128 tz1=_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max[2]),oz),inv_z);
+      __m128 near_t=_mm_max_ps(zero,_mm_min_ps(tx0,tx1));
+      __m128 far_t=_mm_min_ps(best_t,_mm_max_ps(tx0,tx1));
+
+      near_t=_mm_max_ps(near_t,_mm_max_ps(_mm_min_ps(ty0,ty1),_mm_min_ps(tz0,tz1)));
+      far_t=_mm_min_ps(far_t,_mm_min_ps(_mm_max_ps(ty0,ty1),_mm_max_ps(tz0,tz1)));
+      if(_mm_movemask_ps(_mm_cmple_ps(near_t,far_t)) == 0)
+      {
+         continue;
+      }
+
+      if(n.count == 0)
+      {
+         const node &left=m_nodes[n.first];
+         const node &right=m_nodes[n.first + 1];
+         float along=0.0f;
+
+         for(int k=0;k<3;k++)
+         {
+            const float dir=k == 0 ? p_rays.dx[0] : (k == 1 ? p_rays.dy[0] : p_rays.dz[0]);
+
+            along+=(left.min[k] + left.max[k] - right.min[k] - right.max[k]) * dir;
+         }
+         stack[top++]=along > 0.0f ? n.first : n.first + 1;
+         stack[top++]=along > 0.0f ? n.first + 1 : n.first;
+         continue;
+      }
+
+      for(int g=n.first;g < n.first + (int)groups(n.count);g++)
+      {
+         const tri4 &tris=m_tris[g];
+
+         for(int lane=0;lane<4 && tris.id[lane] >= 0;lane++)
+         {
+            const __m128 e1x=_mm_set1_ps(tris.e1x[lane]);
+            const __m128 e1y=_mm_set1_ps(tris.e1y[lane]);
+            const __m128 e1z=_mm_set1_ps(tris.e1z[lane]);
+            const __m128 e2x=_mm_set1_ps(tris.e2x[lane]);
+            const __m128 e2y=_mm_set1_ps(tris.e2y[lane]);
+            const __m128 e2z=_mm_set1_ps(tris.e2z[lane]);
+            const __m128 px=_mm_sub_ps(_mm_mul_ps(dy,e2z),_mm_mul_ps(dz,e2y));
+            const __m128 py=_mm_sub_ps(_mm_mul_ps(dz,e2x),_mm_mul_ps(dx,e2z));
+            const __m128 pz=_mm_sub_ps(_mm_mul_ps(dx,e2y),_mm_mul_ps(dy,e2x));
+            const __m128 det=_mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x,px),_mm_mul_ps(e1y,py)),_mm_mul_ps(e1z,pz));
+            const __m128 inv_det=_mm_div_ps(one,det);
+            const __m128 sx=_mm_sub_ps(ox,_mm_set1_ps(tris.v0x[lane]));
+            const __m128 sy=_mm_sub_ps(oy,_mm_set1_ps(tris.v0y[lane]));
+            const __m128 sz=_mm_sub_ps(oz,_mm_set1_ps(tris.v0z[lane]));
+            const __m128 qx=_mm_sub_ps(_mm_mul_ps(sy,e1z),_mm_mul_ps(sz,e1y));
+            const __m128 qy=_mm_sub_ps(_mm_mul_ps(sz,e1x),_mm_mul_ps(sx,e1z));
+            const __m128 qz=_mm_sub_ps(_mm_mul_ps(sx,e1y),_mm_mul_ps(sy,e1x));
+            const __m128 u=_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx,px),_mm_mul_ps(sy,py)),
+                                                 _mm_mul_ps(sz,pz)),inv_det);
+            const __m128 v=_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,qx),_mm_mul_ps(dy,qy)),
+                                                 _mm_mul_ps(dz,qz)),inv_det);
+            const __m128 t=_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x,qx),_mm_mul_ps(e2y,qy)),
+                                                 _mm_mul_ps(e2z,qz)),inv_det);
+            __m128 mask=_mm_and_ps(_mm_cmpneq_ps(det,zero),_mm_cmpge_ps(u,zero));
+            int hits;
+
+            mask=_mm_and_ps(mask,_mm_and_ps(_mm_cmpge_ps(v,zero),_mm_cmple_ps(_mm_add_ps(u,v),one)));
+            mask=_mm_and_ps(mask,_mm_and_ps(_mm_cmpgt_ps(t,zero),_mm_cmplt_ps(t,best_t)));
+            hits=_mm_movemask_ps(mask);
+
+            if(hits)
+            {
+               float ray_u[4];
+               float ray_v[4];
+
+               best_t=_mm_or_ps(_mm_and_ps(mask,t),_mm_andnot_ps(mask,best_t));
+               _mm_storeu_ps(best,best_t);
+               _mm_storeu_ps(ray_u,u);
+               _mm_storeu_ps(ray_v,v);
+               for(int i=0;i<4;i++)
+               {
+                  if(hits & (1 << i))
+                  {
+                     best_tri[i]=tris.id[lane];
+                     best_u[i]=ray_u[i];
+                     best_v[i]=ray_v[i];
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   for(int i=0;i<4;i++)
+   {
+      if(best_tri[i] >= 0)
+      {
+         p_hits[i].t=best[i];
+         p_hits[i].triangle=best_tri[i];
+         p_hits[i].u=best_u[i];
+         p_hits[i].v=best_v[i];
+      }
+   }
+#else
+   for(int i=0;i<4;i++)
+   {
+      const mb_ray ray={ { p_rays.ox[i],p_rays.oy[i],p_rays.oz[i] },{ p_rays.dx[i],p_rays.dy[i],p_rays.dz[i] } };
+
+      Intersect(ray,&p_hits[i]);
+   }
+#endif
+
+}
+
+bool mb_intersect_brute(const tri_vertex *p_vertices, const void *p_indices, int p_index_size, UINT p_prim_count,
+                        const mb_ray &p_ray, mb_hit *p_hit){
+bool hit=false;
+
+   for(UINT i=0;i<p_prim_count;i++)
+   {
+      const tri_vertex &a=p_vertices[get_index(p_indices,p_index_size,(size_t)i * 3)];
+      const tri_vertex &b=p_vertices[get_index(p_indices,p_index_size,(size_t)i * 3 + 1)];
+      const tri_vertex &c=p_vertices[get_index(p_indices,p_index_size,(size_t)i * 3 + 2)];
+      const float v0[3]={ a.x,a.y,a.z };
+      const float e1[3]={ b.x - a.x,b.y - a.y,b.z - a.z };
+      const float e2[3]={ c.x - a.x,c.y - a.y,c.z - a.z };
+
+      if(hit_triangle(p_ray.origin,p_ray.dir,v0,e1,e2,p_hit->t,&p_hit->t,&p_hit->u,&p_hit->v))
+      {
+         p_hit->triangle=(int)i;
+         hit=true;
+      }
+   }
+
+   return hit;
+}
+
+//Whether two casts of the same ray found the same thing.  Where triangles share an edge
+//either may be reported, so only the distance has to agree.
+static bool same_hit(const mb_hit &p_a, const mb_hit &p_b){
+
+   if(p_a.triangle < 0 || p_b.triangle < 0)
+   {
+      return p_a.triangle < 0 && p_b.triangle < 0;
+   }
+
+   return fabsf(p_a.t - p_b.t) <= 1.0e-4f * p_a.t;
+}
+
+//Uniform in [0,1), the same sequence every run
+static float bench_random(uint32_t *p_state){
+
+   *p_state=*p_state * 1664525u + 1013904223u;
+
+   return (float)(*p_state >> 8) * (1.0f / 16777216.0f);
+}
+//******************************************************************************************
+// Function:mb_bench
+// Whazzit:Each packet starts at a random point on a sphere round the mesh, twice its
+//         box's diagonal out, and aims at a random point in the box.  Its four rays are
+//         spread over a 2x2 block a few thousandths of the diagonal across there, as
+//         neighbouring pixels' rays would be.
+//******************************************************************************************
+void mb_bench(const tri_vertex *p_vertices, const void *p_indices, int p_index_size, UINT p_prim_count,
+              UINT p_rays, mb_bench_result *p_result){
+MeshBVH bvh;
+std::vector<mb_ray4> packets((p_rays + 3) / 4);
+std::vector<mb_hit> single(packets.size() * 4);
+std::vector<mb_hit> packet(packets.size() * 4);
+mb_hit brute;
+uint32_t state=1;
+vm_vec3 low;
+vm_vec3 size;
+float diagonal;
+double start;
+UINT brute_rays;
+
+   memset(p_result,0,sizeof(*p_result));
+   bvh.Build(p_vertices,p_indices,p_index_size,p_prim_count);
+   p_result->stats=bvh.GetStats();
+   p_result->rays=(UINT)single.size();
+   if(bvh.IsEmpty() || single.empty())
+   {
+      return;
+   }
+
+   low=vm_vec3(bvh.GetMin()[0],bvh.GetMin()[1],bvh.GetMin()[2]);
+   size=vm_vec3_sub(vm_vec3(bvh.GetMax()[0],bvh.GetMax()[1],bvh.GetMax()[2]),low);
+   diagonal=sqrtf(vm_vec3_dot(size,size));
+   diagonal=diagonal > 0.0f ? diagonal : 1.0f;
+
+   for(size_t p=0;p<packets.size();p++)
+   {
+      mb_ray4 &rays=packets[p];
+      vm_vec3 out(bench_random(&state) * 2.0f - 1.0f,bench_random(&state) * 2.0f - 1.0f,
+                  bench_random(&state) * 2.0f - 1.0f);
+      const vm_vec3 target(low.x + size.x * bench_random(&state),low.y + size.y * bench_random(&state),
+                           low.z + size.z * bench_random(&state));
+      vm_vec3 eye;
+      vm_vec3 across;
+      vm_vec3 up;
+
+      out=vm_vec3_dot(out,out) > 1.0e-6f ? vm_vec3_normalize(out) : vm_vec3(0.0f,0.0f,-1.0f);
+      eye=vm_vec3(target.x + out.x * diagonal * 2.0f,target.y + out.y * diagonal * 2.0f,
+                  target.z + out.z * diagonal * 2.0f);
+      across=vm_vec3_normalize(vm_vec3_cross(out,fabsf(out.y) < 0.9f ? vm_vec3(0.0f,1.0f,0.0f) :
+                                                                       vm_vec3(1.0f,0.0f,0.0f)));
+      up=vm_vec3_cross(out,across);
+
+      for(int i=0;i<4;i++)
+      {
+         const float a=(float)(i & 1) * diagonal * 0.002f;
+         const float b=(float)(i >> 1) * diagonal * 0.002f;
+         const vm_vec3 dir=vm_vec3_normalize(vm_vec3(target.x + across.x * a + up.x * b - eye.x,
+                                                     target.y + across.y * a + up.y * b - eye.y,
+                                                     target.z + across.z * a + up.z * b - eye.z));
+
+         rays.ox[i]=eye.x;
+         rays.oy[i]=eye.y;
+         rays.oz[i]=eye.z;
+         rays.dx[i]=dir.x;
+         rays.dy[i]=dir.y;
+         rays.dz[i]=dir.z;
+      }
+   }
+
+   for(size_t i=0;i<single.size();i++)
+   {
+      single[i].t=HUGE_VALF;
+      single[i].triangle=-1;
+      packet[i]=single[i];
+   }
+
+   start=hires_seconds();
+   for(size_t i=0;i<single.size();i++)
+   {
+      const mb_ray4 &rays=packets[i / 4];
+      const int lane=(int)(i % 4);
+      const mb_ray ray={ { rays.ox[lane],rays.oy[lane],rays.oz[lane] },{ rays.dx[lane],rays.dy[lane],rays.dz[lane] } };
+
+      bvh.Intersect(ray,&single[i]);
+   }
+   p_result->single_rays_per_sec=single.size() / (hires_seconds() - start);
+
+   start=hires_seconds();
+   for(size_t p=0;p<packets.size();p++)
+   {
+      bvh.Intersect4(packets[p],&packet[p * 4]);
+   }
+   p_result->packet_rays_per_sec=single.size() / (hires_seconds() - start);
+
+   brute_rays=(UINT)std::min(single.size(),(size_t)g_mb_bench_brute);
+   start=hires_seconds();
+   for(UINT i=0;i<brute_rays;i++)
+   {
+      const mb_ray4 &rays=packets[i / 4];
+      const int lane=(int)(i % 4);
+      const mb_ray ray={ { rays.ox[lane],rays.oy[lane],rays.oz[lane] },{ rays.dx[lane],rays.dy[lane],rays.dz[lane] } };
+
+      brute.t=HUGE_VALF;
+      brute.triangle=-1;
+      mb_intersect_brute(p_vertices,p_indices,p_index_size,p_prim_count,ray,&brute);
+      p_result->mismatches+=!same_hit(single[i],brute);
+   }
+   p_result->brute_rays_per_sec=brute_rays / (hires_seconds() - start);
+
+   for(size_t i=0;i<single.size();i++)
+   {
+      p_result->hits+=single[i].triangle >= 0;
+      p_result->mismatches+=!same_hit(single[i],packet[i]);
+   }
+
+}
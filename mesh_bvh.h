@@ -0,0 +1,157 @@
+//
+// mesh_bvh.h - Triangle BVH over one mesh, for ray queries such as picking
+//
+// SceneBVH narrows a ray down to the objects whose boxes it passes through; MeshBVH
+// finds the triangle of one object's mesh that it actually hits.  The tree is built
+// top down with the surface area heuristic: each node's triangles are binned by their
+// centres into g_mb_bins slabs per axis, and the node is split at the slab boundary
+// where the children's triangle tests, each weighted by its box's share of the
+// parent's surface area (the chance a ray through the parent enters it), cost least.
+// A node is left as a leaf when no split is cheaper than testing its triangles.
+//
+// Leaf triangles are copied out of the mesh in tree order, four at a time as a
+// vertex and two edges a component per array, so Intersect tests one ray against
+// four triangles at once with SSE2 (Moller-Trumbore).  Intersect4 takes a packet of
+// four rays through the tree together instead, one set of node visits for all four,
+// which pays off when they are close together like the pixels of a 2x2 block.  Both
+// have plain loop versions for when vec_math.h has no SSE2.
+//
+// Rays are in the mesh's object space.  A world space ray taken into object space by
+// the inverse world matrix, and not normalised again, keeps its world space distances.
+//
+#ifndef MESH_BVH_H
+#define MESH_BVH_H
+
+#include <stddef.h>
+#include <vector>
+#include "vertex.h"
+
+//Slabs per axis the build bins triangle centres into
+const int g_mb_bins = 16;
+//Triangles in a node that is never split, the four tested at once
+const UINT g_mb_leaf_size = 4;
+//Most triangles the heuristic may leave in a leaf rather than split
+const UINT g_mb_max_leaf = 16;
+//Nodes this deep are leaves whatever their size, which also bounds the traversal stack
+const int g_mb_max_depth = 48;
+//Cost of visiting a node, against 1 for testing a ray against four triangles
+const float g_mb_traversal_cost = 1.0f;
+
+struct mb_ray
+{
+   float origin[3];
+   float dir[3];
+};
+
+//Four rays, a component per array
+struct mb_ray4
+{
+   float ox[4], oy[4], oz[4];
+   float dx[4], dy[4], dz[4];
+};
+
+struct mb_hit
+{
+   float t;          //Going in, only hits nearer than this count.  Coming out, the nearest.
+   int triangle;     //-1 for none
+   float u, v;       //Where on it, along its first and second edges
+};
+
+struct mb_stats
+{
+   UINT triangles;
+   UINT nodes;
+   UINT leaves;
+   int depth;
+   float sah_cost;   //Expected cost of a ray through the root, in tests of four triangles
+   size_t bytes;
+   double build_ms;
+};
+
+class MeshBVH
+{
+public:
+   MeshBVH(void);
+
+   //Triangle i is p_indices[3i..3i+2], each p_index_size (2 or 4) bytes, of p_vertices.
+   //Degenerate triangles are kept but never hit.
+   void Build(const tri_vertex *p_vertices, const void *p_indices, int p_index_size, UINT p_prim_count);
+   void Clear(void);
+   void Swap(MeshBVH &p_other);
+
+   bool IsEmpty(void) const { return m_nodes.empty(); }
+   //The box round every triangle, empty trees have none
+   const float *GetMin(void) const { return m_nodes[0].min; }
+   const float *GetMax(void) const { return m_nodes[0].max; }
+   const mb_stats &GetStats(void) const { return m_stats; }
+
+   //The nearest triangle the ray hits closer than p_hit->t.  Returns whether there is
+   //one; p_hit is only written when there is.
+   bool Intersect(const mb_ray &p_ray, mb_hit *p_hit) const;
+   //The same for four rays, p_hits[i] for ray i
+   void Intersect4(const mb_ray4 &p_rays, mb_hit *p_hits) const;
+
+private:
+   //A leaf's count triangles start at m_tris[first], four to an entry.  An inner node
+   //has a count of 0 and its children are first and first + 1.
+   struct node
+   {
+      float min[3];
+      int first;
+      float max[3];
+      int count;
+   };
+
+   //Four triangles, a component per array.  Unused slots have zero edges and id -1.
+   struct tri4
+   {
+      float v0x[4], v0y[4], v0z[4];
+      float e1x[4], e1y[4], e1z[4];
+      float e2x[4], e2y[4], e2z[4];
+      int id[4];
+   };
+
+   struct build_tri
+   {
+      float min[3];
+      float max[3];
+      float centre[3];
+   };
+
+   void BuildNode(int p_index, UINT p_first, UINT p_count, int p_depth, const tri_vertex *p_vertices,
+                  const void *p_indices, int p_index_size);
+   void MakeLeaf(int p_index, UINT p_first, UINT p_count, const tri_vertex *p_vertices, const void *p_indices,
+                 int p_index_size);
+
+   std::vector<node> m_nodes;
+   std::vector<tri4> m_tris;
+   std::vector<build_tri> m_build;         //Only while building
+   std::vector<UINT> m_order;              //Likewise
+   mb_stats m_stats;
+};
+
+//Every triangle against the ray, no tree.  For checking MeshBVH and for comparison.
+bool mb_intersect_brute(const tri_vertex *p_vertices, const void *p_indices, int p_index_size, UINT p_prim_count,
+                        const mb_ray &p_ray, mb_hit *p_hit);
+
+struct mb_bench_result
+{
+   mb_stats stats;
+   UINT rays;
+   double single_rays_per_sec;
+   double packet_rays_per_sec;
+   double brute_rays_per_sec;    //Over the first g_mb_bench_brute rays only
+   UINT hits;                    //Of the single rays
+   UINT mismatches;              //Packet or brute force results that disagree with them
+};
+
+//Rays brute force is timed over, it is far too slow for all of them on a big mesh
+const UINT g_mb_bench_brute = 256;
+
+//Builds a MeshBVH over the mesh and times p_rays rays at it, from all round its box
+//towards points in it, in packets of four close together.  Each ray is cast singly and
+//as part of its packet, and the first g_mb_bench_brute brute force as well.
+void mb_bench(const tri_vertex *p_vertices, const void *p_indices, int p_index_size, UINT p_prim_count,
+              UINT p_rays, mb_bench_result *p_result);
+
+#endif
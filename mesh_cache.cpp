@@ -0,0 +1,400 @@
+//
+// mesh_cache.cpp - Native-endian binary cache of a big-endian vertex dump
+//
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "mesh_cache.h"
+#include "mesh_build.h"
+
+static_assert(sizeof(mc_header) == 192,"mc_header must stay 192 bytes");
+static_assert(sizeof(mc_header) % g_mc_alignment == 0,"mc_header must keep the sections aligned");
+static_assert(sizeof(mc_vertex_layout) == 40,"mc_vertex_layout must stay 40 bytes");
+
+//The layout every cache we write uses, tri_vertex
+static const mc_vertex_layout g_tri_vertex_layout=
+{
+   sizeof(tri_vertex),2,
+   {
+      { 0,MC_TYPE_FLOAT3,MC_USAGE_POSITION },
+      { 12,MC_TYPE_COLOUR,MC_USAGE_COLOUR }
+   }
+};
+
+static uint64_t align_up(uint64_t p_value){
+
+   return (p_value + g_mc_alignment - 1) & ~(uint64_t)(g_mc_alignment - 1);
+}
+
+static bool source_info(const char *p_filename, uint64_t *p_size, uint64_t *p_time){
+#ifdef _WIN32
+struct _stat64 info;
+
+   if(_stat64(p_filename,&info) != 0)
+   {
+      return false;
+   }
+#else
+struct stat info;
+
+   if(stat(p_filename,&info) != 0)
+   {
+      return false;
+   }
+#endif
+
+   *p_size=(uint64_t)info.st_size;
+   *p_time=(uint64_t)info.st_mtime;
+
+   return true;
+}
+
+const char *mc_status_name(mc_status p_status){
+
+   switch(p_status)
+   {
+      case MC_OK:             return "ok";
+      case MC_MISSING:        return "missing";
+      case MC_BAD_HEADER:     return "bad header";
+      case MC_STALE:          return "stale";
+      case MC_CORRUPT:        return "corrupt";
+      case MC_NO_SOURCE:      return "no source";
+      case MC_BAD_DATA:       return "bad data";
+      case MC_WRITE_FAILED:   return "write failed";
+   }
+
+   return "unknown";
+}
+
+uint32_t mc_checksum(const void *p_data, size_t p_size){
+const uint32_t *words=(const uint32_t *)p_data;
+uint32_t hash=2166136261u;
+
+   for(size_t i=0;i < p_size / 4;i++)
+   {
+      hash=(hash ^ words[i]) * 16777619u;
+   }
+
+   return hash;
+}
+//******************************************************************************************
+// Function:write_section
+// Whazzit:Writes p_size bytes at the current (aligned) position and pads up to the next
+//         boundary.  Fills in p_section and advances p_offset.
+//******************************************************************************************
+static bool write_section(FILE *p_file, const void *p_data, size_t p_size, uint64_t *p_offset,
+                          mc_section *p_section){
+static const char padding[g_mc_alignment]={ 0 };
+const uint64_t padded=align_up(p_size);
+
+   p_section->offset=*p_offset;
+   p_section->size=p_size;
+
+   if(p_size && fwrite(p_data,1,p_size,p_file) != p_size)
+   {
+      return false;
+   }
+   if(padded != p_size && fwrite(padding,1,(size_t)(padded - p_size),p_file) != padded - p_size)
+   {
+      return false;
+   }
+
+   *p_offset+=padded;
+
+   return true;
+}
+
+static void grow_bounds(mc_bounds *p_bounds, const tri_vertex &p_vertex){
+const float pos[3]={ p_vertex.x,p_vertex.y,p_vertex.z };
+
+   for(int k=0;k<3;k++)
+   {
+      p_bounds->min[k]=pos[k] < p_bounds->min[k] ? pos[k] : p_bounds->min[k];
+      p_bounds->max[k]=pos[k] > p_bounds->max[k] ? pos[k] : p_bounds->max[k];
+   }
+
+}
+//******************************************************************************************
+// Function:mc_decode_source
+// Whazzit:Every whole record in the dump, in dump order, decoded on every core
+//******************************************************************************************
+bool mc_decode_source(const char *p_source, const be_vertex_layout &p_layout,
+                      std::vector<tri_vertex> *p_vertices, dd_result *p_scan){
+dd_result scan;
+dd_result &result=p_scan ? *p_scan : scan;
+
+   if(!dd_decode(p_source,p_layout,g_dd_default_options,&result,p_vertices) || result.bad_records > 0)
+   {
+      p_vertices->clear();
+      return false;
+   }
+
+   return true;
+}
+//******************************************************************************************
+// Function:mc_convert
+// Whazzit:Decodes every whole record in the dump, welds them, and writes the sections
+//         out.  The checksum covers the file as written, so it is taken from a mapping
+//         of the finished temporary file and patched into the header before the rename.
+//******************************************************************************************
+mc_status mc_convert(const char *p_source, const char *p_cache, const be_vertex_layout &p_layout,
+                     dd_result *p_scan){
+const std::string temp_name=std::string(p_cache) + ".tmp";
+dd_result scan;
+dd_result &result=p_scan ? *p_scan : scan;
+mc_header header;
+std::vector<tri_vertex> decoded;
+std::vector<tri_vertex> vertices;
+std::vector<unsigned int> indices;
+std::vector<unsigned char> packed;
+std::vector<mc_bounds> bounds;
+uint64_t offset;
+bool written;
+FILE *file;
+
+   memset(&header,0,sizeof(header));
+
+   if(!source_info(p_source,&header.source_size,&header.source_time))
+   {
+      return MC_NO_SOURCE;
+   }
+   if(!mc_decode_source(p_source,p_layout,&decoded,&result))
+   {
+      return result.bad_records > 0 ? MC_BAD_DATA : MC_NO_SOURCE;
+   }
+
+   mesh_weld(decoded.empty() ? NULL : &decoded[0],decoded.size(),&vertices,&indices);
+   std::vector<tri_vertex>().swap(decoded);
+
+   header.index_size=(uint32_t)mesh_index_size(vertices.size());
+   packed.resize(indices.size() * header.index_size);
+   if(!indices.empty())
+   {
+      mesh_pack_indices(&indices[0],indices.size(),header.index_size,&packed[0]);
+   }
+
+   bounds.resize(1 + (indices.size() + g_mc_bounds_chunk - 1) / g_mc_bounds_chunk);
+   for(size_t i=0;i<bounds.size();i++)
+   {
+      for(int k=0;k<3;k++)
+      {
+         bounds[i].min[k]=indices.empty() ? 0.0f : HUGE_VALF;
+         bounds[i].max[k]=indices.empty() ? 0.0f : -HUGE_VALF;
+      }
+   }
+   //Every record is indexed, so the whole mesh's box is the one the check found
+   if(!indices.empty())
+   {
+      memcpy(bounds[0].min,result.bounds.min,sizeof(bounds[0].min));
+      memcpy(bounds[0].max,result.bounds.max,sizeof(bounds[0].max));
+   }
+   for(size_t i=0;i<indices.size();i++)
+   {
+      grow_bounds(&bounds[1 + i / g_mc_bounds_chunk],vertices[indices[i]]);
+   }
+
+   memcpy(header.magic,"DHMC",4);
+   header.version=g_mc_version;
+   header.byte_order=g_mc_byte_order;
+   header.header_size=sizeof(mc_header);
+   header.source_stride=(uint32_t)p_layout.stride;
+   header.source_pos_offset=(uint32_t)p_layout.pos_offset;
+   header.source_colour_offset=p_layout.colour_offset;
+   header.source_default_colour=p_layout.default_colour;
+   header.vertex_count=(uint32_t)vertices.size();
+   header.index_count=(uint32_t)indices.size();
+   header.bounds_count=(uint32_t)bounds.size();
+
+   file=fopen(temp_name.c_str(),"wb");
+   if(file == NULL)
+   {
+      return MC_WRITE_FAILED;
+   }
+
+   //The header goes in twice, first as a placeholder until the offsets are known
+   offset=sizeof(mc_header);
+   written=fwrite(&header,sizeof(header),1,file) == 1 &&
+           write_section(file,&g_tri_vertex_layout,sizeof(g_tri_vertex_layout),&offset,&header.layout) &&
+           write_section(file,vertices.empty() ? NULL : &vertices[0],vertices.size() * sizeof(tri_vertex),
+                         &offset,&header.vertices) &&
+           write_section(file,packed.empty() ? NULL : &packed[0],packed.size(),&offset,&header.indices) &&
+           write_section(file,&bounds[0],bounds.size() * sizeof(mc_bounds),&offset,&header.bounds);
+   header.file_size=offset;
+   written=written && fseek(file,0,SEEK_SET) == 0 && fwrite(&header,sizeof(header),1,file) == 1;
+   written=fclose(file) == 0 && written;
+
+   if(written)
+   {
+      MappedFile check;
+
+      written=check.Open(temp_name.c_str()) && check.GetSize() == header.file_size;
+      if(written)
+      {
+         header.checksum=mc_checksum(check.GetData() + sizeof(mc_header),
+                                     (size_t)(header.file_size - sizeof(mc_header)));
+      }
+   }
+
+   if(written)
+   {
+      file=fopen(temp_name.c_str(),"r+b");
+      written=file != NULL && fwrite(&header,sizeof(header),1,file) == 1;
+      written=file != NULL && fclose(file) == 0 && written;
+   }
+
+#ifdef _WIN32
+   //rename won't replace an existing file here
+   if(written)
+   {
+      remove(p_cache);
+   }
+#endif
+
+   if(!written || rename(temp_name.c_str(),p_cache) != 0)
+   {
+      remove(temp_name.c_str());
+      return MC_WRITE_FAILED;
+   }
+
+   return MC_OK;
+}
+
+MeshCache::MeshCache(void) :
+   m_header(NULL),m_vertices(NULL),m_indices(NULL),m_bounds(NULL)
+{
+}
+
+void MeshCache::Close(void){
+
+   m_file.Close();
+   m_header=NULL;
+   m_vertices=NULL;
+   m_indices=NULL;
+   m_bounds=NULL;
+
+}
+
+static bool section_ok(const mc_section &p_section, uint64_t p_file_size){
+
+   return p_section.offset % g_mc_alignment == 0 && p_section.offset >= sizeof(mc_header) &&
+          p_section.offset <= p_file_size && p_section.size <= p_file_size - p_section.offset;
+}
+//******************************************************************************************
+// Function:Open
+// Whazzit:Everything checked here comes from the header, so a normal open only touches
+//         the first page.  A cache whose dump has gone missing is still used, there is
+//         nothing to compare it against or rebuild it from.
+//******************************************************************************************
+mc_status MeshCache::Open(const char *p_cache, const char *p_source, const be_vertex_layout &p_layout,
+                          bool p_verify){
+const mc_header *header;
+const mc_vertex_layout *layout;
+const unsigned char *data;
+uint64_t source_size;
+uint64_t source_time;
+
+   Close();
+
+   if(!m_file.Open(p_cache))
+   {
+      return MC_MISSING;
+   }
+
+   data=m_file.GetData();
+   header=(const mc_header *)data;
+
+   if(m_file.GetSize() < sizeof(mc_header) || memcmp(header->magic,"DHMC",4) != 0 ||
+      header->version != g_mc_version || header->byte_order != g_mc_byte_order ||
+      header->header_size != sizeof(mc_header))
+   {
+      Close();
+      return MC_BAD_HEADER;
+   }
+
+   if(p_source && source_info(p_source,&source_size,&source_time) &&
+      (header->source_size != source_size || header->source_time != source_time ||
+       header->source_stride != p_layout.stride || header->source_pos_offset != p_layout.pos_offset ||
+       header->source_colour_offset != p_layout.colour_offset ||
+       header->source_default_colour != p_layout.default_colour))
+   {
+      Close();
+      return MC_STALE;
+   }
+
+   layout=(const mc_vertex_layout *)(data + header->layout.offset);
+   if(header->file_size != m_file.GetSize() || !section_ok(header->layout,header->file_size) ||
+      !section_ok(header->vertices,header->file_size) || !section_ok(header->indices,header->file_size) ||
+      !section_ok(header->bounds,header->file_size) || header->layout.size < sizeof(mc_vertex_layout) ||
+      layout->stride == 0 || layout->element_count > 8 ||
+      (header->index_size != 2 && header->index_size != 4) ||
+      header->vertices.size != (uint64_t)header->vertex_count * layout->stride ||
+      header->indices.size != (uint64_t)header->index_count * header->index_size ||
+      header->bounds.size != (uint64_t)header->bounds_count * sizeof(mc_bounds))
+   {
+      Close();
+      return MC_CORRUPT;
+   }
+
+   m_header=header;
+   m_indices=data + header->indices.offset;
+   m_bounds=(const mc_bounds *)(data + header->bounds.offset);
+   if(memcmp(layout,&g_tri_vertex_layout,sizeof(g_tri_vertex_layout)) == 0)
+   {
+      m_vertices=(const tri_vertex *)(data + header->vertices.offset);
+   }
+
+   if(p_verify)
+   {
+      bool ok=mc_checksum(data + sizeof(mc_header),(size_t)(header->file_size - sizeof(mc_header))) ==
+              header->checksum;
+
+      for(UINT i=0;ok && i<header->index_count;i++)
+      {
+         ok=GetIndex(i) < header->vertex_count;
+      }
+
+      if(!ok)
+      {
+         Close();
+         return MC_CORRUPT;
+      }
+   }
+
+   return MC_OK;
+}
+
+mc_status MeshCache::OpenOrBuild(const char *p_cache, const char *p_source, const be_vertex_layout &p_layout,
+                                 dd_result *p_scan){
+mc_status status;
+
+   status=Open(p_cache,p_source,p_layout);
+   if(status == MC_OK)
+   {
+      return status;
+   }
+
+   //Unmapped first, Windows won't replace a file that is still mapped
+   Close();
+
+   status=mc_convert(p_source,p_cache,p_layout,p_scan);
+   if(status != MC_OK)
+   {
+      return status;
+   }
+
+   return Open(p_cache,p_source,p_layout,true);
+}
+
+UINT MeshCache::GetIndex(UINT p_index) const{
+
+   if(m_header->index_size == 2)
+   {
+      return ((const uint16_t *)m_indices)[p_index];
+   }
+
+   return ((const uint32_t *)m_indices)[p_index];
+}
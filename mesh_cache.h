@@ -0,0 +1,178 @@
+//
+// mesh_cache.h - Native-endian binary cache of a big-endian vertex dump
+//
+// The verttest dumps are raw big-endian vertex records with no header, so every run
+// had to decode them.  mc_convert does that once and writes a cache file the loader
+// can map and use in place:
+//
+//    mc_header          192 bytes, magic "DHMC", version, what it was built from
+//    mc_vertex_layout   how a vertex record is laid out
+//    vertices           vertex_count records, native-endian tri_vertex
+//    indices            index_count 16 or 32 bit indices
+//    bounds             bounds_count mc_bounds
+//
+// Every section starts on a 64 byte boundary, so with the file mapped the vertex and
+// index pointers can go straight to Lock/memcpy or the software rasterizer.  The
+// vertices are the dump's with duplicates welded out, in the order the dump first
+// uses them, and index i is the dump's vertex i.  Bounds entry 0 covers the whole
+// mesh, then one per g_mc_bounds_chunk indices.
+//
+// The header records the dump's size, modification time and layout.  If any of them
+// no longer match, or the file is damaged or from another version, Open reports why
+// and OpenOrBuild rebuilds it.  A dump with NaN, infinite, out of range or truncated
+// records is never cached; the build stops with MC_BAD_DATA and the check says where.
+//
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "vertex.h"
+#include "float_decode.h"
+#include "mapped_file.h"
+#include "dump_decode.h"
+
+const uint32_t g_mc_version = 1;
+const size_t g_mc_alignment = 64;
+const uint32_t g_mc_byte_order = 0x01020304;
+//Indices per bounds entry after the first, 1024 triangles
+const uint32_t g_mc_bounds_chunk = 3 * 1024;
+
+enum mc_element_type
+{
+   MC_TYPE_FLOAT3=1,
+   MC_TYPE_COLOUR=2     //ARGB dword
+};
+
+enum mc_element_usage
+{
+   MC_USAGE_POSITION=1,
+   MC_USAGE_COLOUR=2
+};
+
+struct mc_vertex_element
+{
+   uint16_t offset;
+   uint8_t type;        //mc_element_type
+   uint8_t usage;       //mc_element_usage
+};
+
+struct mc_vertex_layout
+{
+   uint32_t stride;
+   uint32_t element_count;
+   mc_vertex_element elements[8];
+};
+
+struct mc_section
+{
+   uint64_t offset;     //From the start of the file, a multiple of g_mc_alignment
+   uint64_t size;
+};
+
+struct mc_bounds
+{
+   float min[3];
+   float max[3];
+};
+
+struct mc_header
+{
+   char magic[4];                //"DHMC"
+   uint32_t version;
+   uint32_t byte_order;          //g_mc_byte_order as the writer saw it
+   uint32_t header_size;
+   uint64_t file_size;
+
+   //The dump this was built from, and how it was read
+   uint64_t source_size;
+   uint64_t source_time;
+   uint32_t source_stride;
+   uint32_t source_pos_offset;
+   int32_t source_colour_offset;
+   uint32_t source_default_colour;
+
+   uint32_t checksum;            //mc_checksum of everything after the header
+   uint32_t vertex_count;
+   uint32_t index_count;
+   uint32_t index_size;          //2 or 4
+   uint32_t bounds_count;
+   uint32_t reserved0;
+
+   mc_section layout;
+   mc_section vertices;
+   mc_section indices;
+   mc_section bounds;
+
+   uint8_t reserved1[48];
+};
+
+enum mc_status
+{
+   MC_OK,
+   MC_MISSING,          //No cache file
+   MC_BAD_HEADER,       //Not a cache, another version or another byte order
+   MC_STALE,            //Built from a different dump or with a different layout
+   MC_CORRUPT,          //Sections out of range or the checksum doesn't match
+   MC_NO_SOURCE,        //The dump to build from can't be read
+   MC_BAD_DATA,         //The dump has NaN, infinite, out of range or truncated records
+   MC_WRITE_FAILED
+};
+
+const char *mc_status_name(mc_status p_status);
+
+//FNV-1a over 32 bit words, p_size must be a multiple of 4
+uint32_t mc_checksum(const void *p_data, size_t p_size);
+
+//Decodes and checks every whole record of the dump at p_source (see dump_decode.h),
+//false if it can't be read or any record is bad.  p_scan, when given, gets the check.
+bool mc_decode_source(const char *p_source, const be_vertex_layout &p_layout,
+                      std::vector<tri_vertex> *p_vertices, dd_result *p_scan=NULL);
+
+//Decodes the dump at p_source and writes the cache to p_cache (via a temporary file,
+//so a reader never sees half of one).  p_scan as for mc_decode_source.
+mc_status mc_convert(const char *p_source, const char *p_cache,
+                     const be_vertex_layout &p_layout=g_be_tri_vertex_layout, dd_result *p_scan=NULL);
+
+class MeshCache
+{
+public:
+   MeshCache(void);
+
+   //Maps p_cache and checks its header and sections.  When p_source is given the cache
+   //must have been built from it with p_layout.  p_verify also checks the checksum and
+   //indices, which touches every page.
+   mc_status Open(const char *p_cache, const char *p_source,
+                  const be_vertex_layout &p_layout=g_be_tri_vertex_layout, bool p_verify=false);
+   //Open, and when that fails for any reason but a missing dump, rebuild and try again.
+   //p_scan gets the dump's check when it was rebuilt and is left alone when it wasn't.
+   mc_status OpenOrBuild(const char *p_cache, const char *p_source,
+                         const be_vertex_layout &p_layout=g_be_tri_vertex_layout, dd_result *p_scan=NULL);
+   void Close(void);
+
+   bool IsOpen(void) const { return m_header != NULL; }
+   const mc_header &GetHeader(void) const { return *m_header; }
+   //NULL unless the records are laid out exactly like tri_vertex
+   const tri_vertex *GetVertices(void) const { return m_vertices; }
+   UINT GetVertexCount(void) const { return m_header ? m_header->vertex_count : 0; }
+   const void *GetIndices(void) const { return m_indices; }
+   UINT GetIndexCount(void) const { return m_header ? m_header->index_count : 0; }
+   int GetIndexSize(void) const { return m_header ? (int)m_header->index_size : 0; }
+   UINT GetIndex(UINT p_index) const;
+   const mc_bounds *GetBounds(void) const { return m_bounds; }
+   UINT GetBoundsCount(void) const { return m_header ? m_header->bounds_count : 0; }
+   const MappedFile &GetFile(void) const { return m_file; }
+
+private:
+   MeshCache(const MeshCache &);
+   MeshCache &operator=(const MeshCache &);
+
+   MappedFile m_file;
+   const mc_header *m_header;
+   const tri_vertex *m_vertices;
+   const void *m_indices;
+   const mc_bounds *m_bounds;
+};
+
+#endif
@@ -0,0 +1,83 @@
+//
+// null_device.cpp - A device that draws nothing and counts everything
+//
+#include <string.h>
+#include "null_device.h"
+#include "sysmem_buffer.h"
+
+NullDevice::NullDevice(void) :
+   m_stride(0),
+   m_index_size(0),
+   m_frame(0),
+   m_frame_latency(g_null_frame_latency),
+   m_fence_frames(g_null_max_fences),
+   m_fence_issued(0),
+   m_fence_done(0)
+{
+
+   ResetStats();
+
+}
+
+void NullDevice::ResetStats(void){
+
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+
+HRESULT NullDevice::CreateVertexBuffer(UINT p_length, DWORD, DWORD, rd_pool p_pool,
+                                       RenderBuffer **p_buffer){
+
+   *p_buffer=new SysMemBuffer(p_length,p_pool,&m_stats.lock_bytes);
+   m_stats.buffers_created++;
+
+   return S_OK;
+}
+
+HRESULT NullDevice::CreateIndexBuffer(UINT p_length, DWORD, rd_format p_format, rd_pool p_pool,
+                                      RenderBuffer **p_buffer){
+
+   *p_buffer=new SysMemBuffer(p_length,p_pool,&m_stats.lock_bytes,p_format);
+   m_stats.buffers_created++;
+
+   return S_OK;
+}
+
+HRESULT NullDevice::CreateTexture(UINT p_width, UINT p_height, RenderTexture **p_texture){
+
+   *p_texture=new SysMemTexture(p_width,p_height);
+
+   return S_OK;
+}
+
+HRESULT NullDevice::SetIndices(RenderBuffer *p_buffer){
+
+   m_stats.set_indices++;
+   m_index_size=p_buffer ? ((SysMemBuffer *)p_buffer)->GetIndexSize() : 0;
+
+   return S_OK;
+}
+
+rd_fence NullDevice::InsertFence(void){
+
+   m_stats.fences++;
+   if(m_fence_frames.full())
+   {
+      m_fence_frames.pop_front();
+      m_fence_done++;
+   }
+   m_fence_frames.push_back(m_frame);
+
+   return ++m_fence_issued;
+}
+
+bool NullDevice::FenceDone(rd_fence p_fence){
+
+   while(!m_fence_frames.empty() && m_frame - m_fence_frames.front() >= m_frame_latency)
+   {
+      m_fence_frames.pop_front();
+      m_fence_done++;
+   }
+
+   return p_fence <= m_fence_done;
+}
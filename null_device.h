@@ -0,0 +1,136 @@
+//
+// null_device.h - A device that draws nothing and counts everything
+//
+// Lets the scene logic run and be timed with the driver taken out of the picture.
+// Every call is a counter increment, vertex buffers live in system memory.  Fences
+// pretend there is a GPU running a fixed number of frames behind: one is done once that
+// many Presents have followed it, so code that streams against fences sees the same
+// recycling it would on real hardware.
+//
+#ifndef NULL_DEVICE_H
+#define NULL_DEVICE_H
+
+#include "fixed_deque.h"
+#include "render_device.h"
+
+//Frames the pretend GPU runs behind, the usual D3D9 driver queue
+const UINT g_null_frame_latency = 2;
+//Pending fences remembered, past that the oldest is taken as done
+const size_t g_null_max_fences = 256;
+
+struct null_device_stats
+{
+   unsigned int clears;
+   unsigned int begin_scenes;
+   unsigned int end_scenes;
+   unsigned int presents;
+   unsigned int set_transforms;
+   unsigned int set_render_states;
+   unsigned int set_fvfs;
+   unsigned int set_quantizations;
+   unsigned int set_stream_sources;
+   unsigned int draw_primitives;
+   unsigned int draw_instanced;
+   unsigned int set_indices;
+   unsigned int draw_indexed;
+   unsigned int buffers_created;
+   unsigned long long primitives;
+   unsigned long long instances;
+   unsigned long long vertex_bytes;   //Vertex data the draws would have fetched
+   unsigned long long index_bytes;    //Index data the indexed draws would have fetched
+   unsigned long long lock_bytes;     //Vertex data written through Lock
+   unsigned int fences;
+   unsigned int glyph_draws;
+   unsigned long long glyphs;
+};
+
+class NullDevice : public RenderDevice
+{
+public:
+   NullDevice(void);
+
+   virtual const char *GetName(void) const { return "null"; }
+   virtual bool CanQuantize(void) { return true; }
+   virtual HRESULT TestCooperativeLevel(void) { return S_OK; }
+
+   virtual HRESULT CreateVertexBuffer(UINT p_length, DWORD p_usage, DWORD p_fvf, rd_pool p_pool,
+                                      RenderBuffer **p_buffer);
+   virtual HRESULT CreateIndexBuffer(UINT p_length, DWORD p_usage, rd_format p_format, rd_pool p_pool,
+                                     RenderBuffer **p_buffer);
+   virtual HRESULT CreateTexture(UINT p_width, UINT p_height, RenderTexture **p_texture);
+
+   virtual HRESULT Clear(DWORD)      { m_stats.clears++; return S_OK; }
+   virtual HRESULT BeginScene(void)  { m_stats.begin_scenes++; return S_OK; }
+   virtual HRESULT EndScene(void)    { m_stats.end_scenes++; return S_OK; }
+   virtual HRESULT Present(void)     { m_stats.presents++; m_frame++; return S_OK; }
+
+   virtual HRESULT SetTransform(rd_transform, const float *)       { m_stats.set_transforms++; return S_OK; }
+   virtual HRESULT SetRenderState(rd_render_state, DWORD)          { m_stats.set_render_states++; return S_OK; }
+   virtual HRESULT SetFVF(DWORD)                                   { m_stats.set_fvfs++; return S_OK; }
+   virtual HRESULT SetQuantization(const rd_quantization *)        { m_stats.set_quantizations++; return S_OK; }
+   virtual HRESULT SetStreamSource(UINT, RenderBuffer *, UINT, UINT p_stride){
+      m_stats.set_stream_sources++;
+      m_stride=p_stride;
+      return S_OK;
+   }
+   virtual HRESULT DrawPrimitive(rd_primitive, UINT, UINT p_prim_count){
+      m_stats.draw_primitives++;
+      m_stats.primitives+=p_prim_count;
+      m_stats.vertex_bytes+=(unsigned long long)p_prim_count * 3 * m_stride;
+      return S_OK;
+   }
+   virtual HRESULT SetIndices(RenderBuffer *p_buffer);
+   virtual HRESULT DrawIndexedPrimitive(rd_primitive, int, UINT, UINT p_num_vertices, UINT, UINT p_prim_count){
+      m_stats.draw_indexed++;
+      m_stats.primitives+=p_prim_count;
+      m_stats.vertex_bytes+=(unsigned long long)p_num_vertices * m_stride;
+      m_stats.index_bytes+=(unsigned long long)p_prim_count * 3 * m_index_size;
+      return S_OK;
+   }
+   virtual HRESULT DrawInstanced(rd_primitive, UINT, UINT p_prim_count, const rd_instance *, UINT p_instance_count){
+      m_stats.draw_instanced++;
+      m_stats.instances+=p_instance_count;
+      m_stats.primitives+=(unsigned long long)p_prim_count * p_instance_count;
+      m_stats.vertex_bytes+=(unsigned long long)p_prim_count * 3 * m_stride +
+                            (unsigned long long)p_instance_count * sizeof(rd_instance);
+      return S_OK;
+   }
+   virtual HRESULT DrawIndexedInstanced(rd_primitive, int, UINT, UINT p_num_vertices, UINT, UINT p_prim_count,
+                                        const rd_instance *, UINT p_instance_count){
+      m_stats.draw_instanced++;
+      m_stats.instances+=p_instance_count;
+      m_stats.primitives+=(unsigned long long)p_prim_count * p_instance_count;
+      m_stats.vertex_bytes+=(unsigned long long)p_num_vertices * m_stride +
+                            (unsigned long long)p_instance_count * sizeof(rd_instance);
+      m_stats.index_bytes+=(unsigned long long)p_prim_count * 3 * m_index_size;
+      return S_OK;
+   }
+   virtual HRESULT DrawGlyphs(RenderTexture *, RenderBuffer *, UINT, UINT p_glyph_count){
+      m_stats.glyph_draws++;
+      m_stats.glyphs+=p_glyph_count;
+      m_stats.primitives+=(unsigned long long)p_glyph_count * 2;
+      m_stats.vertex_bytes+=(unsigned long long)p_glyph_count * RD_GLYPH_CORNERS * sizeof(rd_glyph_vertex);
+      return S_OK;
+   }
+
+   virtual rd_fence InsertFence(void);
+   virtual bool FenceDone(rd_fence p_fence);
+
+   const null_device_stats &GetStats(void) const { return m_stats; }
+   void ResetStats(void);
+   void SetFrameLatency(UINT p_frames) { m_frame_latency=p_frames; }
+
+private:
+   null_device_stats m_stats;
+   UINT m_stride;
+   UINT m_index_size;
+
+   //Presents so far, and the value it had when each fence still pending went in
+   unsigned int m_frame;
+   UINT m_frame_latency;
+   FixedDeque<unsigned int> m_fence_frames;
+   rd_fence m_fence_issued;
+   rd_fence m_fence_done;
+};
+
+#endif
@@ -0,0 +1,31 @@
+//
+// platform_types.h - The handful of Win32 types the portable code uses
+//
+// On Windows these come from windows.h, everywhere else we define compatible ones so
+// the renderer, asset and benchmark code can build without the platform SDK.
+//
+#ifndef PLATFORM_TYPES_H
+#define PLATFORM_TYPES_H
+
+#ifdef _WIN32
+   #ifndef WIN32_LEAN_AND_MEAN
+      #define WIN32_LEAN_AND_MEAN
+   #endif
+   #include <windows.h>
+#else
+   #include <stdint.h>
+
+   typedef uint32_t DWORD;
+   typedef unsigned char BYTE;
+   typedef unsigned int UINT;
+   typedef int32_t HRESULT;
+
+   #define S_OK            ((HRESULT)0)
+   #define E_FAIL          ((HRESULT)0x80004005)
+   #define E_OUTOFMEMORY   ((HRESULT)0x8007000E)
+   #define E_INVALIDARG    ((HRESULT)0x80070057)
+   #define SUCCEEDED(hr)   (((HRESULT)(hr)) >= 0)
+   #define FAILED(hr)      (((HRESULT)(hr)) < 0)
+#endif
+
+#endif
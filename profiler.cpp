@@ -0,0 +1,323 @@
+//
+// profiler.cpp - Low overhead scoped timers for the frame loop
+//
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include "profiler.h"
+#include "text_format.h"
+
+const int g_prof_max_stages = 64;
+const unsigned int g_prof_ring_size = 1 << 16;   //Must be a power of two
+
+struct prof_event
+{
+   std::atomic<unsigned int> seq;   //Index + 1 of the event in this slot, 0 while being written
+   unsigned long long start;
+   unsigned long long end;
+   unsigned int frame;
+   unsigned short id;
+   unsigned short thread;
+};
+
+struct prof_stage
+{
+   const char *name;
+   double history[g_prof_history];   //ms per frame
+   unsigned int calls;
+   double frame_ms;                  //Accumulating for the current frame
+   unsigned int frame_calls;
+};
+
+static prof_event g_ring[g_prof_ring_size];
+static std::atomic<unsigned int> g_write_index(0);
+static unsigned int g_read_index=0;
+
+static prof_stage g_stages[g_prof_max_stages];
+static std::atomic<int> g_stage_count(0);
+static std::mutex g_register_lock;
+
+static std::atomic<unsigned int> g_frame(0);
+static double g_frame_history[g_prof_history];
+static unsigned long long g_frame_start=0;
+static std::atomic<unsigned short> g_next_thread(0);
+
+//******************************************************************************************
+// Function:thread_index
+// Whazzit:Small per thread number for the trace, handed out on first use
+//******************************************************************************************
+static unsigned short thread_index(void){
+static thread_local int index=-1;
+
+   if(index < 0)
+   {
+      index=g_next_thread.fetch_add(1);
+   }
+
+   return (unsigned short)index;
+}
+
+int prof_register(const char *p_name){
+std::lock_guard<std::mutex> guard(g_register_lock);
+int count=g_stage_count.load();
+
+   for(int i=0;i<count;i++)
+   {
+      if(strcmp(g_stages[i].name,p_name) == 0)
+      {
+         return i;
+      }
+   }
+
+   if(count == g_prof_max_stages)
+   {
+      return count - 1;
+   }
+
+   memset(&g_stages[count],0,sizeof(g_stages[count]));
+   g_stages[count].name=p_name;
+   g_stage_count.store(count + 1);
+
+   return count;
+}
+//******************************************************************************************
+// Function:prof_record
+// Whazzit:Claims a slot with one atomic add and publishes it through the slot's sequence
+//         number.  Safe from any thread, never blocks.
+//******************************************************************************************
+void prof_record(int p_id, unsigned long long p_start, unsigned long long p_end){
+unsigned int index=g_write_index.fetch_add(1,std::memory_order_relaxed);
+prof_event &event=g_ring[index & (g_prof_ring_size - 1)];
+
+   event.seq.store(0,std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+   event.start=p_start;
+   event.end=p_end;
+   event.frame=g_frame.load(std::memory_order_relaxed);
+   event.id=(unsigned short)p_id;
+   event.thread=thread_index();
+   event.seq.store(index + 1,std::memory_order_release);
+
+}
+//******************************************************************************************
+// Function:read_event
+// Whazzit:Copies the event with the given index out of the ring.  Fails if it hasn't been
+//         published yet or was overwritten while we were copying it.
+//******************************************************************************************
+static bool read_event(unsigned int p_index, prof_event *p_out){
+const prof_event &event=g_ring[p_index & (g_prof_ring_size - 1)];
+
+   if(event.seq.load(std::memory_order_acquire) != p_index + 1)
+   {
+      return false;
+   }
+
+   p_out->start=event.start;
+   p_out->end=event.end;
+   p_out->frame=event.frame;
+   p_out->id=event.id;
+   p_out->thread=event.thread;
+
+   std::atomic_thread_fence(std::memory_order_acquire);
+
+   return event.seq.load(std::memory_order_relaxed) == p_index + 1;
+}
+
+unsigned int prof_get_frame(void){
+
+   return g_frame.load();
+}
+//******************************************************************************************
+// Function:prof_end_frame
+// Whazzit:Folds every event recorded since the last call into the per stage totals and
+//         pushes them onto the rolling history.
+//******************************************************************************************
+void prof_end_frame(void){
+const double ms_per_tick=hires_tick_period() * 1000.0;
+const unsigned long long now=hires_ticks();
+const unsigned int write=g_write_index.load(std::memory_order_acquire);
+const unsigned int slot=g_frame.load() % g_prof_history;
+const int count=g_stage_count.load();
+prof_event event;
+
+   //If we fell more than a whole ring behind, the oldest events are gone
+   if(write - g_read_index > g_prof_ring_size)
+   {
+      g_read_index=write - g_prof_ring_size;
+   }
+
+   for(;g_read_index != write;g_read_index++)
+   {
+      if(read_event(g_read_index,&event) && event.id < count)
+      {
+         g_stages[event.id].frame_ms+=(double)(event.end - event.start) * ms_per_tick;
+         g_stages[event.id].frame_calls++;
+      }
+   }
+
+   for(int i=0;i<count;i++)
+   {
+      g_stages[i].history[slot]=g_stages[i].frame_ms;
+      g_stages[i].calls=g_stages[i].frame_calls;
+      g_stages[i].frame_ms=0.0;
+      g_stages[i].frame_calls=0;
+   }
+
+   g_frame_history[slot]=g_frame_start ? (double)(now - g_frame_start) * ms_per_tick : 0.0;
+   g_frame_start=now;
+
+   g_frame.fetch_add(1);
+
+}
+//******************************************************************************************
+// Function:summarize
+// Whazzit:Last, average and max over the frames of history we actually have
+//******************************************************************************************
+static void summarize(const double *p_history, double *p_last, double *p_avg, double *p_max){
+const unsigned int frames=g_frame.load();
+const unsigned int valid=frames < (unsigned int)g_prof_history ? frames : g_prof_history;
+double total=0.0;
+double worst=0.0;
+
+   for(unsigned int i=0;i<valid;i++)
+   {
+      total+=p_history[i];
+      if(p_history[i] > worst)
+      {
+         worst=p_history[i];
+      }
+   }
+
+   *p_last=frames ? p_history[(frames - 1) % g_prof_history] : 0.0;
+   *p_avg=valid ? total / valid : 0.0;
+   *p_max=worst;
+
+}
+
+int prof_get_stage_count(void){
+
+   return g_stage_count.load();
+}
+
+void prof_get_stage(int p_id, prof_stage_stats *p_stats){
+const prof_stage &stage=g_stages[p_id];
+
+   p_stats->name=stage.name;
+   p_stats->calls=stage.calls;
+   summarize(stage.history,&p_stats->last_ms,&p_stats->avg_ms,&p_stats->max_ms);
+
+}
+
+void prof_get_frame_stats(double *p_last_ms, double *p_avg_ms, double *p_max_ms){
+
+   summarize(g_frame_history,p_last_ms,p_avg_ms,p_max_ms);
+
+}
+
+int prof_format_hud(char *p_buffer, size_t p_size){
+prof_stage_stats stats;
+double last,avg,worst;
+size_t used;
+int lines=1;
+
+   if(p_size == 0)
+   {
+      return 0;
+   }
+
+   prof_get_frame_stats(&last,&avg,&worst);
+   used=tx_format(p_buffer,p_size,"%-12s %7.3f avg %7.3f max %7.3f ms (%.0f fps)\n","frame",
+                  last,avg,worst,avg > 0.0 ? 1000.0 / avg : 0.0);
+
+   //tx_format stops at the end of the buffer, so used never passes the terminator
+   for(int i=0;i<prof_get_stage_count() && used + 1 < p_size;i++)
+   {
+      prof_get_stage(i,&stats);
+      used+=tx_format(p_buffer + used,p_size - used,"%-12s %7.3f avg %7.3f max %7.3f ms x%u\n",
+                      stats.name,stats.last_ms,stats.avg_ms,stats.max_ms,stats.calls);
+      lines++;
+   }
+
+   return lines;
+}
+//******************************************************************************************
+// Function:for_each_event
+// Whazzit:Walks the events still held in the ring, oldest first
+//******************************************************************************************
+template <class F> static void for_each_event(F p_func){
+const unsigned int write=g_write_index.load(std::memory_order_acquire);
+unsigned int index=write > g_prof_ring_size ? write - g_prof_ring_size : 0;
+prof_event event;
+
+   for(;index != write;index++)
+   {
+      if(read_event(index,&event))
+      {
+         p_func(event);
+      }
+   }
+
+}
+
+bool prof_write_csv(const char *p_filename){
+const double us_per_tick=hires_tick_period() * 1e6;
+unsigned long long base=0;
+FILE *file;
+
+   file=fopen(p_filename,"w");
+   if(file == NULL)
+   {
+      return false;
+   }
+
+   fprintf(file,"frame,stage,thread,start_us,duration_us\n");
+   for_each_event([&](const prof_event &p_event){
+      if(base == 0)
+      {
+         base=p_event.start;
+      }
+      fprintf(file,"%u,%s,%u,%.3f,%.3f\n",p_event.frame,g_stages[p_event.id].name,p_event.thread,
+              (double)(long long)(p_event.start - base) * us_per_tick,
+              (double)(p_event.end - p_event.start) * us_per_tick);
+   });
+
+   fclose(file);
+
+   return true;
+}
+//******************************************************************************************
+// Function:prof_write_trace
+// Whazzit:Chrome trace event format, one complete ("X") event per timing
+//******************************************************************************************
+bool prof_write_trace(const char *p_filename){
+const double us_per_tick=hires_tick_period() * 1e6;
+unsigned long long base=0;
+bool first=true;
+FILE *file;
+
+   file=fopen(p_filename,"w");
+   if(file == NULL)
+   {
+      return false;
+   }
+
+   fprintf(file,"{\"traceEvents\":[\n");
+   for_each_event([&](const prof_event &p_event){
+      if(base == 0)
+      {
+         base=p_event.start;
+      }
+      fprintf(file,"%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"args\":{\"frame\":%u}}",
+              first ? "" : ",\n",g_stages[p_event.id].name,p_event.thread,
+              (double)(long long)(p_event.start - base) * us_per_tick,
+              (double)(p_event.end - p_event.start) * us_per_tick,p_event.frame);
+      first=false;
+   });
+   fprintf(file,"\n],\"displayTimeUnit\":\"ms\"}\n");
+
+   fclose(file);
+
+   return true;
+}
@@ -0,0 +1,65 @@
+//
+// profiler.h - Low overhead scoped timers for the frame loop
+//
+// PROF_SCOPE("name") times the rest of the enclosing block.  Each timing is a pair of
+// raw counter reads and one slot in a lock-free ring buffer, so it is cheap enough to
+// leave in the hot path.  prof_end_frame rolls the events of the frame into per stage
+// statistics for the HUD, and the ring can be written out as CSV or as a Chrome
+// trace (load it in chrome://tracing or Perfetto).
+//
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h>
+#include "hires_timer.h"
+
+//Number of frames the rolling statistics cover
+const int g_prof_history = 120;
+
+struct prof_stage_stats
+{
+   const char *name;
+   double last_ms;   //Total time in this stage during the last frame
+   double avg_ms;    //Rolling average per frame
+   double max_ms;    //Worst frame in the rolling window
+   unsigned int calls;   //Calls during the last frame
+};
+
+//Returns the id for a stage name, registering it the first time
+int prof_register(const char *p_name);
+void prof_record(int p_id, unsigned long long p_start, unsigned long long p_end);
+
+//Marks the end of a frame and updates the rolling statistics.  Main thread only.
+void prof_end_frame(void);
+unsigned int prof_get_frame(void);
+
+int prof_get_stage_count(void);
+void prof_get_stage(int p_id, prof_stage_stats *p_stats);
+//Rolling frame time, measured between prof_end_frame calls
+void prof_get_frame_stats(double *p_last_ms, double *p_avg_ms, double *p_max_ms);
+
+//Writes a line per stage into p_buffer, separated by '\n'.  Returns the line count.
+int prof_format_hud(char *p_buffer, size_t p_size);
+
+//Dump the events still in the ring buffer
+bool prof_write_csv(const char *p_filename);
+bool prof_write_trace(const char *p_filename);
+
+class ProfScope
+{
+public:
+   explicit ProfScope(int p_id) : m_id(p_id),m_start(hires_ticks()) {}
+   ~ProfScope(void) { prof_record(m_id,m_start,hires_ticks()); }
+
+private:
+   int m_id;
+   unsigned long long m_start;
+};
+
+#define PROF_CONCAT2(a,b) a##b
+#define PROF_CONCAT(a,b) PROF_CONCAT2(a,b)
+#define PROF_SCOPE(name) \
+   static const int PROF_CONCAT(prof_id_,__LINE__)=prof_register(name); \
+   ProfScope PROF_CONCAT(prof_scope_,__LINE__)(PROF_CONCAT(prof_id_,__LINE__))
+
+#endif
@@ -0,0 +1,233 @@
+//
+// render_device.h - The device interface our scene code draws through
+//
+// Covers just what the scene uses of IDirect3DDevice9: transforms, render states, the
+// FVF and stream source, indexed and non-indexed triangle lists, Clear/Begin/End/Present
+// and vertex/index buffers with Lock/Unlock.  The enum values match their D3D9
+// counterparts so the D3D9 backend can pass them straight through.  Text is the one
+// thing drawn in screen space: DrawGlyphs takes a whole frame's glyph quads against an
+// 8 bit coverage texture.  Fences (D3D9 event queries) tell a caller streaming into a
+// dynamic buffer when the device is done reading it.
+//
+// Meshes can also come as our own 8 byte quantized vertices (vertex_quant.h), which
+// each backend decodes its own way.
+//
+// Backends:
+//    D3D9Device  - the real thing (d3d9_device.h, Windows only)
+//    NullDevice  - does nothing but count calls and bytes (null_device.h)
+//    SoftDevice  - the tile based software rasterizer (soft_device.h)
+//
+#ifndef RENDER_DEVICE_H
+#define RENDER_DEVICE_H
+
+#include "platform_types.h"
+
+enum rd_transform
+{
+   RD_TS_VIEW       = 2,
+   RD_TS_PROJECTION = 3,
+   RD_TS_WORLD      = 256
+};
+
+enum rd_render_state
+{
+   RD_RS_FILLMODE       = 8,
+   RD_RS_CULLMODE       = 22,
+   RD_RS_FOGENABLE      = 28,
+   RD_RS_FOGCOLOR       = 34,
+   RD_RS_FOGSTART       = 36,
+   RD_RS_FOGEND         = 37,
+   RD_RS_LIGHTING       = 137,
+   RD_RS_FOGVERTEXMODE  = 140
+};
+
+enum rd_primitive
+{
+   RD_PT_TRIANGLELIST = 4
+};
+
+enum rd_format
+{
+   RD_FMT_UNKNOWN = 0,
+   RD_FMT_INDEX16 = 101,
+   RD_FMT_INDEX32 = 102
+};
+
+enum rd_pool
+{
+   RD_POOL_DEFAULT   = 0,
+   RD_POOL_MANAGED   = 1,
+   RD_POOL_SYSTEMMEM = 2
+};
+
+//Render state values
+const DWORD RD_CULL_NONE      = 1;
+const DWORD RD_CULL_CW        = 2;
+const DWORD RD_CULL_CCW       = 3;
+const DWORD RD_FILL_WIREFRAME = 2;
+const DWORD RD_FILL_SOLID     = 3;
+const DWORD RD_FOG_NONE       = 0;
+const DWORD RD_FOG_LINEAR     = 3;
+
+//Vertex formats
+const DWORD RD_FVF_XYZ     = 0x002;
+const DWORD RD_FVF_XYZRHW  = 0x004;
+const DWORD RD_FVF_DIFFUSE = 0x040;
+const DWORD RD_FVF_TEX1    = 0x100;
+//tri_qvertex records, decoded with the draw's rd_quantization.  A reserved bit of D3D's,
+//never passed on to it.
+const DWORD RD_FVF_QUANTIZED = 0x4000;
+
+//Buffer usage and lock flags
+const DWORD RD_USAGE_WRITEONLY   = 0x0008;
+const DWORD RD_USAGE_DYNAMIC     = 0x0200;
+const DWORD RD_LOCK_NOOVERWRITE  = 0x1000;
+const DWORD RD_LOCK_DISCARD      = 0x2000;
+
+//Fences count up from 1 in submission order, 0 is never issued
+typedef unsigned long long rd_fence;
+
+//One copy of a mesh in an instanced draw
+struct rd_instance
+{
+   float world[4][4];   //Row-major world matrix, same layout as SetTransform takes
+   DWORD tint;          //ARGB, multiplied with the vertex colour
+};
+
+//How RD_FVF_QUANTIZED vertices decode (see vertex_quant.h): each coordinate is its
+//stored value times scale plus bias, and the colour is palette[index], or the index
+//read as R5G6B5 when palette_count is 0
+struct rd_quantization
+{
+   float scale[3];
+   float bias[3];
+   const DWORD *palette;
+   UINT palette_count;
+};
+
+//A corner of a glyph quad for DrawGlyphs, RD_FVF_XYZRHW | RD_FVF_DIFFUSE | RD_FVF_TEX1.
+//Positions are D3D9 screen space, pixel centres on whole numbers, so a quad covering
+//pixels x0..x1-1 runs from x0 - 0.5 to x1 - 0.5.
+struct rd_glyph_vertex
+{
+   float x, y, z, rhw;
+   DWORD colour;     //ARGB, the alpha is multiplied by the coverage
+   float u, v;
+};
+
+//Corners of each quad in this order
+enum rd_glyph_corner
+{
+   RD_GLYPH_TOP_LEFT,
+   RD_GLYPH_TOP_RIGHT,
+   RD_GLYPH_BOTTOM_LEFT,
+   RD_GLYPH_BOTTOM_RIGHT,
+   RD_GLYPH_CORNERS
+};
+
+class RenderBuffer
+{
+public:
+   virtual ~RenderBuffer(void) {}
+
+   virtual HRESULT Lock(UINT p_offset, UINT p_size, void **p_data, DWORD p_flags)=0;
+   virtual HRESULT Unlock(void)=0;
+   virtual UINT GetSize(void) const=0;
+   virtual rd_pool GetPool(void) const=0;
+   //Frees the buffer, the pointer is invalid afterwards
+   virtual void Release(void)=0;
+};
+
+//One byte of coverage per texel, managed so it survives a device reset
+class RenderTexture
+{
+public:
+   virtual ~RenderTexture(void) {}
+
+   //p_pitch is bytes per row.  The whole texture, write only.
+   virtual HRESULT Lock(void **p_data, UINT *p_pitch)=0;
+   virtual HRESULT Unlock(void)=0;
+   virtual UINT GetWidth(void) const=0;
+   virtual UINT GetHeight(void) const=0;
+   //Frees the texture, the pointer is invalid afterwards
+   virtual void Release(void)=0;
+};
+
+class RenderDevice
+{
+public:
+   virtual ~RenderDevice(void) {}
+
+   virtual const char *GetName(void) const=0;
+   //Whether draws can take RD_FVF_QUANTIZED vertices
+   virtual bool CanQuantize(void)=0;
+
+   //S_OK when we can draw, anything else is handed to the lost device handling
+   virtual HRESULT TestCooperativeLevel(void)=0;
+
+   virtual HRESULT CreateVertexBuffer(UINT p_length, DWORD p_usage, DWORD p_fvf, rd_pool p_pool,
+                                      RenderBuffer **p_buffer)=0;
+   //p_format is RD_FMT_INDEX16 or RD_FMT_INDEX32
+   virtual HRESULT CreateIndexBuffer(UINT p_length, DWORD p_usage, rd_format p_format, rd_pool p_pool,
+                                     RenderBuffer **p_buffer)=0;
+   virtual HRESULT CreateTexture(UINT p_width, UINT p_height, RenderTexture **p_texture)=0;
+
+   virtual HRESULT Clear(DWORD p_colour)=0;
+   virtual HRESULT BeginScene(void)=0;
+   virtual HRESULT EndScene(void)=0;
+   virtual HRESULT Present(void)=0;
+
+   //p_matrix is 16 floats, row-major with row vectors (D3DXMATRIX layout)
+   virtual HRESULT SetTransform(rd_transform p_which, const float *p_matrix)=0;
+   virtual HRESULT SetRenderState(rd_render_state p_state, DWORD p_value)=0;
+   virtual HRESULT SetFVF(DWORD p_fvf)=0;
+   //For RD_FVF_QUANTIZED draws.  The device keeps the pointers, not copies, so they
+   //have to stay valid until it is given others.
+   virtual HRESULT SetQuantization(const rd_quantization *p_quant)=0;
+   virtual HRESULT SetStreamSource(UINT p_stream, RenderBuffer *p_buffer, UINT p_offset, UINT p_stride)=0;
+   virtual HRESULT DrawPrimitive(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count)=0;
+   virtual HRESULT SetIndices(RenderBuffer *p_buffer)=0;
+   //Same arguments as IDirect3DDevice9::DrawIndexedPrimitive.  Every index read, plus
+   //p_base_vertex, must fall in [p_min_index,p_min_index + p_num_vertices).
+   virtual HRESULT DrawIndexedPrimitive(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                        UINT p_num_vertices, UINT p_start_index, UINT p_prim_count)=0;
+
+   //Draws p_instance_count copies of the same vertex range from stream 0 in one call,
+   //each with its own world matrix and tint.  Ignores (and may change) the current
+   //world transform.
+   virtual HRESULT DrawInstanced(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count,
+                                 const rd_instance *p_instances, UINT p_instance_count)=0;
+   virtual HRESULT DrawIndexedInstanced(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                        UINT p_num_vertices, UINT p_start_index, UINT p_prim_count,
+                                        const rd_instance *p_instances, UINT p_instance_count)=0;
+
+   //p_glyph_count quads of rd_glyph_vertex from p_vertices, starting p_start_vertex in,
+   //blended over what's there with p_atlas's coverage.  Quads are axis aligned and
+   //unscaled, one texel to a pixel.  Leaves the 3D state as it found it.
+   virtual HRESULT DrawGlyphs(RenderTexture *p_atlas, RenderBuffer *p_vertices, UINT p_start_vertex,
+                              UINT p_glyph_count)=0;
+
+   //Marks everything submitted so far.  FenceDone is true once the device has finished
+   //with all of it; it never blocks, and a backend that can't tell says false.
+   virtual rd_fence InsertFence(void)=0;
+   virtual bool FenceDone(rd_fence p_fence)=0;
+};
+
+//Render states carry floats as their bit pattern, like D3D
+inline DWORD rd_float_bits(float p_value){
+union { float f; DWORD d; } bits;
+
+   bits.f=p_value;
+
+   return bits.d;
+}
+
+inline float rd_bits_float(DWORD p_value){
+union { float f; DWORD d; } bits;
+
+   bits.d=p_value;
+
+   return bits.f;
+}
+
+#endif
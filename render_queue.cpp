@@ -0,0 +1,406 @@
+//
+// render_queue.cpp - Sorted draw submission with redundant state filtering
+//
+#include <string.h>
+#include "render_queue.h"
+#include "hires_timer.h"
+
+//Buffers past this many in a frame share the last id, which only costs some grouping
+const unsigned int g_rq_max_buffers = 4095;
+
+//******************************************************************************************
+// Function:depth_bits
+// Whazzit:The top 24 bits of a non-negative float order the same way the float does,
+//         so depth needs no range to be quantized into
+//******************************************************************************************
+static unsigned long long depth_bits(float p_depth){
+union { float f; uint32_t u; } bits;
+
+   bits.f=p_depth > 0.0f ? p_depth : 0.0f;
+
+   return bits.u >> 8;
+}
+
+unsigned long long rq_make_key(rq_pass p_pass, unsigned int p_material, unsigned int p_buffer, float p_depth){
+const unsigned long long pass=(unsigned long long)(p_pass & 0xF) << 60;
+const unsigned long long material=p_material & 0xFFF;
+const unsigned long long buffer=p_buffer & 0xFFF;
+
+   switch(p_pass)
+   {
+      case RQ_PASS_SORTED:
+         return pass | ((0xFFFFFF - depth_bits(p_depth)) << 36) | (material << 24) | (buffer << 12);
+      case RQ_PASS_OVERLAY:
+         return pass;
+      default:
+         return pass | (material << 48) | (buffer << 36) | (depth_bits(p_depth) << 12);
+   }
+
+}
+
+rq_sort_entry *rq_radix_sort(rq_sort_entry *p_entries, rq_sort_entry *p_scratch, size_t p_count){
+size_t counts[8][256];
+rq_sort_entry *src=p_entries;
+rq_sort_entry *dst=p_scratch;
+
+   memset(counts,0,sizeof(counts));
+   for(size_t i=0;i<p_count;i++)
+   {
+      for(int b=0;b<8;b++)
+      {
+         counts[b][(p_entries[i].key >> (b * 8)) & 0xFF]++;
+      }
+   }
+
+   for(int b=0;b<8;b++)
+   {
+      size_t offsets[256];
+      size_t total=0;
+      bool trivial=false;
+
+      for(int v=0;v<256;v++)
+      {
+         trivial=trivial || counts[b][v] == p_count;
+         offsets[v]=total;
+         total+=counts[b][v];
+      }
+      //Every key has the same byte here, this pass wouldn't move anything
+      if(trivial)
+      {
+         continue;
+      }
+
+      for(size_t i=0;i<p_count;i++)
+      {
+         dst[offsets[(src[i].key >> (b * 8)) & 0xFF]++]=src[i];
+      }
+
+      rq_sort_entry *swap=src;
+      src=dst;
+      dst=swap;
+   }
+
+   return src;
+}
+
+rq_state_cache::rq_state_cache(void) :
+   m_enabled(true)
+{
+
+   ResetStats();
+   Invalidate();
+
+}
+
+void rq_state_cache::Invalidate(void){
+
+   m_fvf_valid=false;
+   m_quant_valid=false;
+   m_stream_valid=false;
+   m_indices_valid=false;
+   m_world_valid=false;
+   m_state_count=0;
+
+}
+
+bool rq_state_cache::Changed(bool p_same){
+
+   if(m_enabled && p_same)
+   {
+      m_stats.skipped++;
+      return false;
+   }
+
+   m_stats.issued++;
+
+   return true;
+}
+
+void rq_state_cache::SetFVF(RenderDevice *p_device, DWORD p_fvf){
+
+   if(Changed(m_fvf_valid && m_fvf == p_fvf))
+   {
+      p_device->SetFVF(p_fvf);
+      m_fvf=p_fvf;
+      m_fvf_valid=true;
+   }
+
+}
+
+//By pointer, so a mesh reloaded in place has to be set again after the next Flush
+void rq_state_cache::SetQuantization(RenderDevice *p_device, const rd_quantization *p_quant){
+
+   if(Changed(m_quant_valid && m_quant == p_quant))
+   {
+      p_device->SetQuantization(p_quant);
+      m_quant=p_quant;
+      m_quant_valid=true;
+   }
+
+}
+
+void rq_state_cache::SetStreamSource(RenderDevice *p_device, RenderBuffer *p_buffer, UINT p_stride){
+
+   if(Changed(m_stream_valid && m_stream == p_buffer && m_stride == p_stride))
+   {
+      p_device->SetStreamSource(0,p_buffer,0,p_stride);
+      m_stream=p_buffer;
+      m_stride=p_stride;
+      m_stream_valid=true;
+   }
+
+}
+
+void rq_state_cache::SetIndices(RenderDevice *p_device, RenderBuffer *p_buffer){
+
+   if(Changed(m_indices_valid && m_indices == p_buffer))
+   {
+      p_device->SetIndices(p_buffer);
+      m_indices=p_buffer;
+      m_indices_valid=true;
+   }
+
+}
+//******************************************************************************************
+// Function:SetRenderState
+// Whazzit:Materials only touch a handful of states, so a short list is all the shadow
+//         we need.  Past STATE_SLOTS distinct states the extra ones just aren't cached.
+//******************************************************************************************
+void rq_state_cache::SetRenderState(RenderDevice *p_device, rd_render_state p_state, DWORD p_value){
+int slot;
+
+   for(slot=0;slot<m_state_count && m_state_ids[slot] != p_state;slot++)
+   {
+   }
+
+   if(!Changed(slot < m_state_count && m_state_values[slot] == p_value))
+   {
+      return;
+   }
+
+   p_device->SetRenderState(p_state,p_value);
+   if(slot == m_state_count && slot < STATE_SLOTS)
+   {
+      m_state_ids[slot]=p_state;
+      m_state_count++;
+   }
+   if(slot < STATE_SLOTS)
+   {
+      m_state_values[slot]=p_value;
+   }
+
+}
+
+void rq_state_cache::SetWorld(RenderDevice *p_device, const float *p_matrix){
+
+   if(Changed(m_world_valid && memcmp(m_world,p_matrix,sizeof(m_world)) == 0))
+   {
+      p_device->SetTransform(RD_TS_WORLD,p_matrix);
+      memcpy(m_world,p_matrix,sizeof(m_world));
+      m_world_valid=true;
+   }
+
+}
+
+RenderQueue::RenderQueue(void) :
+   m_sort(true),m_merge(true)
+{
+
+   memset(&m_stats,0,sizeof(m_stats));
+   Reserve(g_rq_reserve_items);
+   m_buffers.reserve(g_rq_reserve_buffers);
+
+}
+
+void RenderQueue::Reserve(size_t p_items){
+
+   m_items.reserve(p_items);
+   m_entries.reserve(p_items);
+   m_scratch.reserve(p_items);
+
+}
+
+unsigned int RenderQueue::BufferId(RenderBuffer *p_buffer){
+
+   //Most frames have a handful, and runs of items share one
+   for(size_t i=m_buffers.size();i > 0;i--)
+   {
+      if(m_buffers[i - 1] == p_buffer)
+      {
+         return (unsigned int)(i - 1);
+      }
+   }
+
+   if(m_buffers.size() < g_rq_max_buffers)
+   {
+      m_buffers.push_back(p_buffer);
+   }
+
+   return (unsigned int)m_buffers.size() - 1;
+}
+
+void RenderQueue::Submit(rq_pass p_pass, float p_depth, const rq_item &p_item){
+rq_sort_entry entry;
+
+   entry.key=rq_make_key(p_pass,p_item.material->id,BufferId(p_item.vb),p_depth);
+   entry.index=(uint32_t)m_items.size();
+
+   m_items.push_back(p_item);
+   m_entries.push_back(entry);
+
+}
+void RenderQueue::Append(const RenderList &p_list){
+
+   for(size_t i=0;i<p_list.m_items.size();i++)
+   {
+      Submit(p_list.m_entries[i].pass,p_list.m_entries[i].depth,p_list.m_items[i]);
+   }
+
+}
+
+void RenderQueue::Clear(void){
+
+   m_items.clear();
+   m_entries.clear();
+   m_buffers.clear();
+
+}
+
+void RenderList::Submit(rq_pass p_pass, float p_depth, const rq_item &p_item){
+entry item={ p_pass,p_depth };
+
+   m_items.push_back(p_item);
+   m_entries.push_back(item);
+
+}
+//******************************************************************************************
+// Function:CanMerge
+// Whazzit:Only plain indexed draws, from the same buffers with the same state and
+//         world, whose index ranges follow on from each other and which together stay
+//         under the primitive limit
+//******************************************************************************************
+bool RenderQueue::CanMerge(const rq_item &p_prev, const rq_item &p_item) const{
+
+   return p_prev.draw == RQ_DRAW_INDEXED && p_item.draw == RQ_DRAW_INDEXED &&
+          p_prev.material == p_item.material && p_prev.vb == p_item.vb && p_prev.stride == p_item.stride &&
+          p_prev.ib == p_item.ib && p_prev.base_vertex == p_item.base_vertex &&
+          p_prev.start_index + p_prev.prim_count * 3 == p_item.start_index &&
+          p_prev.prim_count + p_item.prim_count <= g_rq_max_merged_prims &&
+          memcmp(p_prev.world,p_item.world,sizeof(p_prev.world)) == 0;
+}
+
+void RenderQueue::Draw(RenderDevice *p_device, const rq_item &p_item){
+const rq_material &material=*p_item.material;
+
+   m_cache.SetFVF(p_device,material.fvf);
+   if(material.fvf & RD_FVF_QUANTIZED)
+   {
+      m_cache.SetQuantization(p_device,material.quant);
+   }
+   for(unsigned int i=0;i<material.state_count;i++)
+   {
+      m_cache.SetRenderState(p_device,material.states[i].state,material.states[i].value);
+   }
+   m_cache.SetStreamSource(p_device,p_item.vb,p_item.stride);
+   if(p_item.draw == RQ_DRAW_INDEXED || p_item.draw == RQ_DRAW_INDEXED_INSTANCED)
+   {
+      m_cache.SetIndices(p_device,p_item.ib);
+   }
+
+   switch(p_item.draw)
+   {
+      case RQ_DRAW:
+         m_cache.SetWorld(p_device,p_item.world);
+         p_device->DrawPrimitive(RD_PT_TRIANGLELIST,p_item.min_index,p_item.prim_count);
+         break;
+      case RQ_DRAW_INDEXED:
+         m_cache.SetWorld(p_device,p_item.world);
+         p_device->DrawIndexedPrimitive(RD_PT_TRIANGLELIST,p_item.base_vertex,p_item.min_index,
+                                        p_item.num_vertices,p_item.start_index,p_item.prim_count);
+         break;
+      case RQ_DRAW_INSTANCED:
+         p_device->DrawInstanced(RD_PT_TRIANGLELIST,p_item.min_index,p_item.prim_count,p_item.instances,
+                                 p_item.instance_count);
+         m_cache.InvalidateWorld();
+         break;
+      case RQ_DRAW_INDEXED_INSTANCED:
+         p_device->DrawIndexedInstanced(RD_PT_TRIANGLELIST,p_item.base_vertex,p_item.min_index,
+                                        p_item.num_vertices,p_item.start_index,p_item.prim_count,
+                                        p_item.instances,p_item.instance_count);
+         m_cache.InvalidateWorld();
+         break;
+   }
+
+   m_stats.draws++;
+
+}
+//******************************************************************************************
+// Function:Flush
+// Whazzit:Sorts, then walks the items in key order holding back one pending draw so the
+//         next item can be merged into it.  The cache starts each flush empty since the
+//         font and anything else outside the queue may have changed the device.
+//******************************************************************************************
+void RenderQueue::Flush(RenderDevice *p_device){
+const rq_sort_entry *order;
+rq_item pending;
+bool have_pending=false;
+double start;
+
+   m_stats.items=(unsigned int)m_items.size();
+   m_stats.draws=0;
+   m_stats.merged=0;
+   m_stats.empty=0;
+   m_cache.Invalidate();
+   m_cache.ResetStats();
+
+   start=hires_seconds();
+   order=m_entries.empty() ? NULL : &m_entries[0];
+   if(m_sort && m_entries.size() > 1)
+   {
+      m_scratch.resize(m_entries.size());
+      order=rq_radix_sort(&m_entries[0],&m_scratch[0],m_entries.size());
+   }
+   m_stats.sort_ms=(hires_seconds() - start) * 1000.0;
+
+   for(size_t i=0;i<m_entries.size();i++)
+   {
+      const rq_item &item=m_items[order[i].index];
+
+      if(item.prim_count == 0 || ((item.draw == RQ_DRAW_INSTANCED || item.draw == RQ_DRAW_INDEXED_INSTANCED) &&
+                                  item.instance_count == 0))
+      {
+         m_stats.empty++;
+         continue;
+      }
+
+      if(have_pending && m_merge && CanMerge(pending,item))
+      {
+         //Grow the vertex range to cover both
+         const UINT end=pending.min_index + pending.num_vertices > item.min_index + item.num_vertices ?
+                        pending.min_index + pending.num_vertices : item.min_index + item.num_vertices;
+
+         pending.min_index=pending.min_index < item.min_index ? pending.min_index : item.min_index;
+         pending.num_vertices=end - pending.min_index;
+         pending.prim_count+=item.prim_count;
+         m_stats.merged++;
+         continue;
+      }
+
+      if(have_pending)
+      {
+         Draw(p_device,pending);
+      }
+      pending=item;
+      have_pending=true;
+   }
+   if(have_pending)
+   {
+      Draw(p_device,pending);
+   }
+
+   m_stats.states_issued=m_cache.GetStats().issued;
+   m_stats.states_skipped=m_cache.GetStats().skipped;
+
+   Clear();
+
+}
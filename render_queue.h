@@ -0,0 +1,226 @@
+//
+// render_queue.h - Sorted draw submission with redundant state filtering
+//
+// The scene code Submits draw items instead of calling the device.  Each item carries
+// everything its draw needs (material, buffers, world matrix, ranges) and gets a 64
+// bit sort key when it goes in; Flush radix sorts the keys and replays the items
+// through an rq_state_cache, which drops any Set call that wouldn't change what the
+// device already has.  Adjacent items that end up drawing consecutive index ranges
+// with the same state are merged into one draw.
+//
+// Key layout, most significant first:
+//
+//    pass      4 bits   rq_pass
+//    then for RQ_PASS_SORTED
+//       depth     24 bits  far first
+//       material  12 bits
+//       buffer    12 bits  vertex buffer, numbered in the order the frame first uses them
+//    and for the other passes
+//       material  12 bits
+//       buffer    12 bits
+//       depth     24 bits  near first (not used by RQ_PASS_OVERLAY)
+//
+// The sort is stable, so items with equal keys keep their submission order.
+//
+// Jobs record into RenderLists instead, one each, and the render thread Appends the
+// lists to the queue.  The keys are made there, since that is where the frame's buffer
+// ids are handed out, and appending the lists in a fixed order keeps the frame the
+// same however the jobs were scheduled.
+//
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "render_device.h"
+
+enum rq_pass
+{
+   RQ_PASS_BACKGROUND,  //First, by material
+   RQ_PASS_OPAQUE,      //By material, then front to back.  Needs a depth buffer.
+   RQ_PASS_SORTED,      //Back to front, what a scene without a depth buffer needs
+   RQ_PASS_OVERLAY      //Last, in submission order
+};
+
+const int g_rq_max_states = 4;
+//Merging stops short of the least MaxPrimitiveCount any D3D9 part reports
+const UINT g_rq_max_merged_prims = 65535;
+//Items and vertex buffers a frame has room for before the queue's arrays grow
+const size_t g_rq_reserve_items = 1024;
+const size_t g_rq_reserve_buffers = 64;
+
+//The fixed state an item draws with.  Materials are compared by pointer.
+struct rq_material
+{
+   unsigned int id;              //Sort order, 0 to 4095
+   DWORD fvf;
+   unsigned int state_count;
+   struct
+   {
+      rd_render_state state;
+      DWORD value;
+   } states[g_rq_max_states];
+   const rd_quantization *quant;  //RD_FVF_QUANTIZED only, must stay valid until Flush
+};
+
+enum rq_draw
+{
+   RQ_DRAW,                      //DrawPrimitive
+   RQ_DRAW_INDEXED,              //DrawIndexedPrimitive
+   RQ_DRAW_INSTANCED,
+   RQ_DRAW_INDEXED_INSTANCED
+};
+
+struct rq_item
+{
+   rq_draw draw;
+   const rq_material *material;
+   RenderBuffer *vb;
+   UINT stride;
+   RenderBuffer *ib;             //Indexed draws only
+   float world[16];              //Ignored by the instanced draws
+   int base_vertex;
+   UINT min_index;               //Or the start vertex for the non-indexed draws
+   UINT num_vertices;
+   UINT start_index;
+   UINT prim_count;
+   const rd_instance *instances; //Must stay valid until Flush
+   UINT instance_count;
+};
+
+struct rq_sort_entry
+{
+   unsigned long long key;
+   uint32_t index;
+};
+
+//Builds a sort key, p_depth is view space z
+unsigned long long rq_make_key(rq_pass p_pass, unsigned int p_material, unsigned int p_buffer, float p_depth);
+//LSD radix sort on key, one pass per byte that isn't the same in every key.  Returns
+//whichever of the two arrays ended up holding the result.
+rq_sort_entry *rq_radix_sort(rq_sort_entry *p_entries, rq_sort_entry *p_scratch, size_t p_count);
+
+struct rq_cache_stats
+{
+   unsigned int issued;
+   unsigned int skipped;
+};
+
+//Shadows what the device has been given and passes on only real changes
+class rq_state_cache
+{
+public:
+   rq_state_cache(void);
+
+   //Forget everything, for after someone else has been at the device
+   void Invalidate(void);
+   //The instanced draws may leave the world transform changed
+   void InvalidateWorld(void) { m_world_valid=false; }
+   void SetEnabled(bool p_enabled) { m_enabled=p_enabled; Invalidate(); }
+
+   void SetFVF(RenderDevice *p_device, DWORD p_fvf);
+   void SetQuantization(RenderDevice *p_device, const rd_quantization *p_quant);
+   void SetStreamSource(RenderDevice *p_device, RenderBuffer *p_buffer, UINT p_stride);
+   void SetIndices(RenderDevice *p_device, RenderBuffer *p_buffer);
+   void SetRenderState(RenderDevice *p_device, rd_render_state p_state, DWORD p_value);
+   void SetWorld(RenderDevice *p_device, const float *p_matrix);
+
+   const rq_cache_stats &GetStats(void) const { return m_stats; }
+   void ResetStats(void) { m_stats.issued=0; m_stats.skipped=0; }
+
+private:
+   bool Changed(bool p_same);
+
+   enum { STATE_SLOTS=8 };
+
+   bool m_enabled;
+   rq_cache_stats m_stats;
+   bool m_fvf_valid;
+   DWORD m_fvf;
+   bool m_quant_valid;
+   const rd_quantization *m_quant;
+   bool m_stream_valid;
+   RenderBuffer *m_stream;
+   UINT m_stride;
+   bool m_indices_valid;
+   RenderBuffer *m_indices;
+   bool m_world_valid;
+   float m_world[16];
+   rd_render_state m_state_ids[STATE_SLOTS];
+   DWORD m_state_values[STATE_SLOTS];
+   int m_state_count;
+};
+
+struct rq_stats
+{
+   //From the last Flush
+   unsigned int items;
+   unsigned int draws;           //Issued to the device
+   unsigned int merged;          //Items folded into the draw before them
+   unsigned int empty;           //Items with nothing to draw
+   unsigned int states_issued;   //Set calls that reached the device
+   unsigned int states_skipped;  //and that the cache dropped
+   double sort_ms;
+};
+
+//Items recorded away from the render thread, see RenderQueue::Append
+class RenderList
+{
+public:
+   void Submit(rq_pass p_pass, float p_depth, const rq_item &p_item);
+   void Clear(void) { m_items.clear(); m_entries.clear(); }
+   void Reserve(size_t p_items) { m_items.reserve(p_items); m_entries.reserve(p_items); }
+   size_t GetCount(void) const { return m_items.size(); }
+
+private:
+   friend class RenderQueue;
+
+   struct entry
+   {
+      rq_pass pass;
+      float depth;
+   };
+
+   std::vector<rq_item> m_items;
+   std::vector<entry> m_entries;
+};
+
+class RenderQueue
+{
+public:
+   RenderQueue(void);
+
+   //Off submits in the order items came in
+   void SetSorting(bool p_sort) { m_sort=p_sort; }
+   void SetStateCache(bool p_cache) { m_cache.SetEnabled(p_cache); }
+   void SetMerging(bool p_merge) { m_merge=p_merge; }
+   //Room for p_items a frame, so a frame that size submits without allocating
+   void Reserve(size_t p_items);
+
+   void Submit(rq_pass p_pass, float p_depth, const rq_item &p_item);
+   //Submits everything in p_list, in the order it was recorded
+   void Append(const RenderList &p_list);
+   //Sorts and draws everything submitted since the last Flush
+   void Flush(RenderDevice *p_device);
+   //Drops everything submitted since the last Flush without drawing it
+   void Clear(void);
+
+   const rq_stats &GetStats(void) const { return m_stats; }
+
+private:
+   unsigned int BufferId(RenderBuffer *p_buffer);
+   bool CanMerge(const rq_item &p_prev, const rq_item &p_item) const;
+   void Draw(RenderDevice *p_device, const rq_item &p_item);
+
+   std::vector<rq_item> m_items;
+   std::vector<rq_sort_entry> m_entries;
+   std::vector<rq_sort_entry> m_scratch;
+   std::vector<RenderBuffer *> m_buffers;   //This frame's, index is the id
+   rq_state_cache m_cache;
+   rq_stats m_stats;
+   bool m_sort;
+   bool m_merge;
+};
+
+#endif
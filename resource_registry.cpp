@@ -0,0 +1,373 @@
+//
+// resource_registry.cpp - Every GPU resource and its pool, so a device reset only redoes what it lost
+//
+#include <string.h>
+#include "resource_registry.h"
+#include "hires_timer.h"
+
+ResourceRegistry::ResourceRegistry(void){
+
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+
+ResourceRegistry::~ResourceRegistry(void){
+
+   Release();
+
+}
+
+rr_handle ResourceRegistry::Add(entry &p_entry){
+std::vector<BYTE> copy;
+size_t i;
+
+   p_entry.used=true;
+   m_stats.count[p_entry.pool]++;
+   m_stats.bytes[p_entry.pool]+=p_entry.bytes;
+   m_stats.copy_bytes+=p_entry.copy.size();
+
+   for(i=0;i<m_entries.size() && m_entries[i].used;i++)
+   {
+   }
+   if(i == m_entries.size())
+   {
+      m_entries.push_back(entry());
+   }
+
+   //Moved rather than copied, it can be the size of a mesh
+   copy.swap(p_entry.copy);
+   m_entries[i]=p_entry;
+   m_entries[i].copy.swap(copy);
+
+   return (rr_handle)i;
+}
+
+void ResourceRegistry::Remove(entry &p_entry){
+
+   if(!p_entry.used)
+   {
+      return;
+   }
+
+   m_stats.count[p_entry.pool]--;
+   m_stats.bytes[p_entry.pool]-=p_entry.bytes;
+   m_stats.copy_bytes-=p_entry.copy.size();
+
+   p_entry.used=false;
+   p_entry.slot=NULL;
+   std::vector<BYTE>().swap(p_entry.copy);
+
+}
+
+rr_handle ResourceRegistry::Register(const char *p_name, rd_pool p_pool, UINT p_bytes, rr_lost_func p_lost,
+                                     rr_reset_func p_reset, void *p_data){
+entry item;
+
+   item.name=p_name;
+   item.pool=p_pool;
+   item.bytes=p_bytes;
+   item.lost=p_lost;
+   item.reset=p_reset;
+   item.data=p_data;
+   item.slot=NULL;
+   item.usage=0;
+   item.fvf=0;
+   item.format=RD_FMT_UNKNOWN;
+
+   return Add(item);
+}
+
+void ResourceRegistry::Unregister(rr_handle p_handle){
+
+   if(p_handle >= 0 && (size_t)p_handle < m_entries.size())
+   {
+      Remove(m_entries[p_handle]);
+   }
+
+}
+//******************************************************************************************
+// Function:FillBuffer
+// Whazzit:Makes p_entry's buffer and copies p_data into it, only setting the slot once
+//         the whole thing worked
+//******************************************************************************************
+HRESULT ResourceRegistry::FillBuffer(RenderDevice *p_device, const entry &p_entry, const void *p_data){
+RenderBuffer *buffer=NULL;
+void *data;
+HRESULT hr;
+
+   if(p_entry.format == RD_FMT_UNKNOWN)
+   {
+      hr=p_device->CreateVertexBuffer(p_entry.bytes,p_entry.usage,p_entry.fvf,p_entry.pool,&buffer);
+   }
+   else
+   {
+      hr=p_device->CreateIndexBuffer(p_entry.bytes,p_entry.usage,p_entry.format,p_entry.pool,&buffer);
+   }
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   hr=buffer->Lock(0,0,&data,0);
+   if(FAILED(hr))
+   {
+      buffer->Release();
+      return hr;
+   }
+   if(p_entry.bytes > 0)
+   {
+      memcpy(data,p_data,p_entry.bytes);
+   }
+   buffer->Unlock();
+
+   *p_entry.slot=buffer;
+
+   return S_OK;
+}
+
+HRESULT ResourceRegistry::CreateBuffer(RenderDevice *p_device, const char *p_name, const void *p_data, UINT p_size,
+                                       DWORD p_usage, DWORD p_fvf, rd_format p_format, rd_pool p_pool,
+                                       RenderBuffer **p_slot){
+entry item;
+HRESULT hr;
+
+   item.name=p_name;
+   item.pool=p_pool;
+   item.bytes=p_size;
+   item.lost=NULL;
+   item.reset=NULL;
+   item.data=NULL;
+   item.slot=p_slot;
+   item.usage=p_usage;
+   item.fvf=p_fvf;
+   item.format=p_format;
+
+   *p_slot=NULL;
+   hr=FillBuffer(p_device,item,p_data);
+   if(FAILED(hr))
+   {
+      return hr;
+   }
+
+   if(p_pool == RD_POOL_DEFAULT)
+   {
+      item.copy.assign((const BYTE *)p_data,(const BYTE *)p_data + p_size);
+   }
+   Add(item);
+
+   return S_OK;
+}
+
+HRESULT ResourceRegistry::CreateVertexBuffer(RenderDevice *p_device, const char *p_name, const void *p_data,
+                                             UINT p_size, DWORD p_usage, DWORD p_fvf, rd_pool p_pool,
+                                             RenderBuffer **p_slot){
+
+   return CreateBuffer(p_device,p_name,p_data,p_size,p_usage,p_fvf,RD_FMT_UNKNOWN,p_pool,p_slot);
+}
+
+HRESULT ResourceRegistry::CreateIndexBuffer(RenderDevice *p_device, const char *p_name, const void *p_data,
+                                            UINT p_size, DWORD p_usage, rd_format p_format, rd_pool p_pool,
+                                            RenderBuffer **p_slot){
+
+   return CreateBuffer(p_device,p_name,p_data,p_size,p_usage,0,p_format,p_pool,p_slot);
+}
+
+void ResourceRegistry::ReleaseBuffer(RenderBuffer **p_slot){
+
+   for(size_t i=0;i<m_entries.size();i++)
+   {
+      if(m_entries[i].used && m_entries[i].slot == p_slot)
+      {
+         Remove(m_entries[i]);
+         break;
+      }
+   }
+
+   if(*p_slot)
+   {
+      (*p_slot)->Release();
+      *p_slot=NULL;
+   }
+
+}
+//******************************************************************************************
+// Function:OnLostDevice
+// Whazzit:Only the default pool, the Reset leaves everything else where it is
+//******************************************************************************************
+void ResourceRegistry::OnLostDevice(void){
+const double start=hires_seconds();
+
+   for(size_t i=0;i<m_entries.size();i++)
+   {
+      entry &item=m_entries[i];
+
+      if(!item.used || item.pool != RD_POOL_DEFAULT)
+      {
+         continue;
+      }
+
+      if(item.slot)
+      {
+         if(*item.slot)
+         {
+            (*item.slot)->Release();
+            *item.slot=NULL;
+         }
+      }
+      else if(item.lost)
+      {
+         item.lost(item.data);
+      }
+   }
+
+   m_stats.lost_ms=(hires_seconds() - start) * 1000.0;
+
+}
+
+HRESULT ResourceRegistry::OnResetDevice(RenderDevice *p_device){
+const double start=hires_seconds();
+HRESULT result=S_OK;
+
+   m_stats.resets++;
+   m_stats.rebuilt=0;
+
+   for(size_t i=0;i<m_entries.size();i++)
+   {
+      entry &item=m_entries[i];
+      HRESULT hr=S_OK;
+
+      if(!item.used || item.pool != RD_POOL_DEFAULT)
+      {
+         continue;
+      }
+
+      if(item.slot)
+      {
+         hr=*item.slot ? S_OK : FillBuffer(p_device,item,item.copy.empty() ? NULL : &item.copy[0]);
+      }
+      else if(item.reset)
+      {
+         hr=item.reset(p_device,item.data);
+      }
+      else
+      {
+         continue;
+      }
+
+      m_stats.rebuilt++;
+      if(FAILED(hr))
+      {
+         m_stats.failures++;
+         m_stats.failed=item.name;
+         result=SUCCEEDED(result) ? hr : result;
+      }
+   }
+
+   m_stats.reset_ms=(hires_seconds() - start) * 1000.0;
+
+   return result;
+}
+
+void ResourceRegistry::Release(void){
+
+   for(size_t i=0;i<m_entries.size();i++)
+   {
+      if(m_entries[i].used && m_entries[i].slot && *m_entries[i].slot)
+      {
+         (*m_entries[i].slot)->Release();
+         *m_entries[i].slot=NULL;
+      }
+   }
+
+   m_entries.clear();
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+
+rr_state_block::rr_state_block(void){
+
+   Clear();
+
+}
+
+int rr_state_block::TransformSlot(rd_transform p_which){
+
+   switch(p_which)
+   {
+      case RD_TS_VIEW:
+         return 1;
+      case RD_TS_PROJECTION:
+         return 2;
+      default:
+         return 0;
+   }
+
+}
+
+void rr_state_block::SetRenderState(RenderDevice *p_device, rd_render_state p_state, DWORD p_value){
+int i;
+
+   p_device->SetRenderState(p_state,p_value);
+
+   for(i=0;i<m_state_count && m_state_ids[i] != p_state;i++)
+   {
+   }
+   if(i == m_state_count)
+   {
+      if(m_state_count == STATE_SLOTS)
+      {
+         m_overflows++;
+         return;
+      }
+      m_state_ids[m_state_count++]=p_state;
+   }
+   m_state_values[i]=p_value;
+
+}
+
+void rr_state_block::SetTransform(RenderDevice *p_device, rd_transform p_which, const float *p_matrix){
+const int slot=TransformSlot(p_which);
+
+   p_device->SetTransform(p_which,p_matrix);
+
+   memcpy(m_transforms[slot],p_matrix,sizeof(m_transforms[slot]));
+   m_transform_set[slot]=true;
+
+}
+
+void rr_state_block::Apply(RenderDevice *p_device) const{
+static const rd_transform which[TRANSFORM_SLOTS]={ RD_TS_WORLD,RD_TS_VIEW,RD_TS_PROJECTION };
+
+   for(int i=0;i<m_state_count;i++)
+   {
+      p_device->SetRenderState(m_state_ids[i],m_state_values[i]);
+   }
+
+   for(int i=0;i<TRANSFORM_SLOTS;i++)
+   {
+      if(m_transform_set[i])
+      {
+         p_device->SetTransform(which[i],m_transforms[i]);
+      }
+   }
+
+}
+
+void rr_state_block::Clear(void){
+
+   m_state_count=0;
+   m_overflows=0;
+   memset(m_transform_set,0,sizeof(m_transform_set));
+
+}
+
+int rr_state_block::GetCount(void) const{
+int count=m_state_count;
+
+   for(int i=0;i<TRANSFORM_SLOTS;i++)
+   {
+      count+=m_transform_set[i];
+   }
+
+   return count;
+}
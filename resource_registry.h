@@ -0,0 +1,158 @@
+//
+// resource_registry.h - Every GPU resource and its pool, so a device reset only redoes what it lost
+//
+// A D3D9 Reset throws away whatever lives in the default pool and puts every render
+// state back to its default.  The managed and system memory pools come through it
+// untouched, so rebuilding those too is wasted time in the middle of an alt-tab.
+//
+// Each owner registers its resources with the pool they're in and a pair of callbacks:
+// lost releases them, reset makes them again.  OnLostDevice and OnResetDevice only go
+// through the default pool entries.  The others are listed so the HUD can say what
+// is where, and so nothing has to be remembered by hand when one is added.
+//
+// Static buffers can be handed to the registry instead, with the data to fill them.
+// In the default pool it keeps a copy of that data and refills a new buffer after a
+// reset, writing it to the owner's pointer.  In the managed pool the runtime keeps the
+// copy, so the registry doesn't.
+//
+// rr_state_block holds the render states and transforms as last set through it.  A
+// reset replays the block rather than running the code that worked the values out.
+//
+#ifndef RESOURCE_REGISTRY_H
+#define RESOURCE_REGISTRY_H
+
+#include <vector>
+#include "render_device.h"
+
+typedef int rr_handle;
+
+//Release the resource, it may be called again before the reset
+typedef void (*rr_lost_func)(void *p_data);
+//Make it again on p_device
+typedef HRESULT (*rr_reset_func)(RenderDevice *p_device, void *p_data);
+
+//For anything with OnLostDevice and OnResetDevice of its own
+template<class T> void rr_lost_thunk(void *p_data){
+
+   ((T *)p_data)->OnLostDevice();
+
+}
+
+template<class T> HRESULT rr_reset_thunk(RenderDevice *p_device, void *p_data){
+
+   //They already know their device
+   (void)p_device;
+
+   return ((T *)p_data)->OnResetDevice();
+}
+
+const int g_rr_pools = 3;
+
+struct rr_stats
+{
+   unsigned int count[g_rr_pools];          //Registered, by rd_pool
+   unsigned long long bytes[g_rr_pools];    //As far as their owners said
+   size_t copy_bytes;                       //Kept to refill default pool buffers
+   unsigned int resets;
+   unsigned int rebuilt;                    //By the last reset
+   unsigned int failures;                   //Rebuilds that failed, over every reset
+   const char *failed;                      //Name of the last one that did
+   double lost_ms;                          //Last OnLostDevice
+   double reset_ms;                         //Last OnResetDevice
+};
+
+class ResourceRegistry
+{
+public:
+   ResourceRegistry(void);
+   ~ResourceRegistry(void);
+
+   //Either callback may be NULL, a resource that needs neither is only being counted
+   rr_handle Register(const char *p_name, rd_pool p_pool, UINT p_bytes, rr_lost_func p_lost,
+                      rr_reset_func p_reset, void *p_data);
+   template<class T> rr_handle Register(const char *p_name, rd_pool p_pool, UINT p_bytes, T *p_object){
+      return Register(p_name,p_pool,p_bytes,rr_lost_thunk<T>,rr_reset_thunk<T>,p_object);
+   }
+   void Unregister(rr_handle p_handle);
+
+   //Makes a buffer of p_size bytes filled from p_data and puts it in *p_slot, where the
+   //registry puts its replacement after a reset
+   HRESULT CreateVertexBuffer(RenderDevice *p_device, const char *p_name, const void *p_data, UINT p_size,
+                              DWORD p_usage, DWORD p_fvf, rd_pool p_pool, RenderBuffer **p_slot);
+   HRESULT CreateIndexBuffer(RenderDevice *p_device, const char *p_name, const void *p_data, UINT p_size,
+                             DWORD p_usage, rd_format p_format, rd_pool p_pool, RenderBuffer **p_slot);
+   //Frees a buffer from Create*Buffer and sets *p_slot to NULL
+   void ReleaseBuffer(RenderBuffer **p_slot);
+
+   //Before IDirect3DDevice9::Reset
+   void OnLostDevice(void);
+   //After it succeeds.  Carries on past a failure and returns the first one.
+   HRESULT OnResetDevice(RenderDevice *p_device);
+
+   //Frees every buffer the registry made and forgets everything
+   void Release(void);
+
+   const rr_stats &GetStats(void) const { return m_stats; }
+
+private:
+   ResourceRegistry(const ResourceRegistry &);
+   ResourceRegistry &operator=(const ResourceRegistry &);
+
+   struct entry
+   {
+      const char *name;
+      rd_pool pool;
+      UINT bytes;
+      rr_lost_func lost;
+      rr_reset_func reset;
+      void *data;
+      bool used;
+      //Buffers the registry made
+      RenderBuffer **slot;
+      DWORD usage;
+      DWORD fvf;
+      rd_format format;              //RD_FMT_UNKNOWN for a vertex buffer
+      std::vector<BYTE> copy;        //Default pool only
+   };
+
+   HRESULT CreateBuffer(RenderDevice *p_device, const char *p_name, const void *p_data, UINT p_size,
+                        DWORD p_usage, DWORD p_fvf, rd_format p_format, rd_pool p_pool, RenderBuffer **p_slot);
+   static HRESULT FillBuffer(RenderDevice *p_device, const entry &p_entry, const void *p_data);
+   rr_handle Add(entry &p_entry);
+   void Remove(entry &p_entry);
+
+   std::vector<entry> m_entries;    //Unregistered ones are reused
+   rr_stats m_stats;
+};
+
+//Render states and transforms to put back after a reset
+class rr_state_block
+{
+public:
+   rr_state_block(void);
+
+   //Sets it on p_device and remembers it
+   void SetRenderState(RenderDevice *p_device, rd_render_state p_state, DWORD p_value);
+   void SetTransform(RenderDevice *p_device, rd_transform p_which, const float *p_matrix);
+
+   //Everything remembered, states in the order they were first set
+   void Apply(RenderDevice *p_device) const;
+   void Clear(void);
+
+   int GetCount(void) const;
+   unsigned int GetOverflows(void) const { return m_overflows; }
+
+private:
+   enum { STATE_SLOTS=16, TRANSFORM_SLOTS=3 };
+
+   static int TransformSlot(rd_transform p_which);
+
+   rd_render_state m_state_ids[STATE_SLOTS];
+   DWORD m_state_values[STATE_SLOTS];
+   int m_state_count;
+   bool m_transform_set[TRANSFORM_SLOTS];
+   float m_transforms[TRANSFORM_SLOTS][16];   //World, view, projection
+   unsigned int m_overflows;                  //States past STATE_SLOTS, set but not kept
+};
+
+#endif
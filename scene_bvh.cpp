@@ -0,0 +1,770 @@
+//
+// scene_bvh.cpp - Bounding volume hierarchy over the scene's objects, for frustum culling
+//
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "scene_bvh.h"
+#include "job_system.h"
+
+//Deep enough for a median split tree over any number of objects an int can count
+const int g_sb_stack_size = 64;
+
+//Sets plane p_index to p_a*x + p_b*y + p_c*z + p_d >= 0, scaled to a unit normal
+static void set_plane(sb_frustum *p_frustum, int p_index, float p_a, float p_b, float p_c, float p_d){
+float length=sqrtf(p_a * p_a + p_b * p_b + p_c * p_c);
+float scale=length > 0.0f ? 1.0f / length : 0.0f;
+
+   p_frustum->nx[p_index]=p_a * scale;
+   p_frustum->ny[p_index]=p_b * scale;
+   p_frustum->nz[p_index]=p_c * scale;
+   p_frustum->d[p_index]=p_d * scale;
+   p_frustum->ax[p_index]=fabsf(p_frustum->nx[p_index]);
+   p_frustum->ay[p_index]=fabsf(p_frustum->ny[p_index]);
+   p_frustum->az[p_index]=fabsf(p_frustum->nz[p_index]);
+
+}
+//******************************************************************************************
+// Function:sb_frustum_from_matrices
+// Whazzit:With row vectors a world space point p lands at p * view * projection, so
+//         each clip coordinate is p dotted with a column of the combined matrix.  The
+//         view volume is -w <= x <= w, -w <= y <= w and 0 <= z <= w, so the planes are
+//         sums and differences of those columns (Gribb and Hartmann).
+//******************************************************************************************
+void sb_frustum_from_matrices(sb_frustum *p_out, const vm_matrix &p_view, const vm_matrix &p_projection){
+vm_matrix view_proj;
+float col[4][4];
+
+   vm_matrix_multiply(&view_proj,&p_view,&p_projection);
+
+   for(int i=0;i<4;i++)
+   {
+      for(int j=0;j<4;j++)
+      {
+         col[j][i]=view_proj.m[i][j];
+      }
+   }
+
+   set_plane(p_out,0,col[3][0] + col[0][0],col[3][1] + col[0][1],col[3][2] + col[0][2],col[3][3] + col[0][3]);
+   set_plane(p_out,1,col[3][0] - col[0][0],col[3][1] - col[0][1],col[3][2] - col[0][2],col[3][3] - col[0][3]);
+   set_plane(p_out,2,col[3][0] + col[1][0],col[3][1] + col[1][1],col[3][2] + col[1][2],col[3][3] + col[1][3]);
+   set_plane(p_out,3,col[3][0] - col[1][0],col[3][1] - col[1][1],col[3][2] - col[1][2],col[3][3] - col[1][3]);
+   set_plane(p_out,4,col[2][0],col[2][1],col[2][2],col[2][3]);
+   set_plane(p_out,5,col[3][0] - col[2][0],col[3][1] - col[2][1],col[3][2] - col[2][2],col[3][3] - col[2][3]);
+
+   //The spare slots can't cull anything, so the SIMD test can always do all eight
+   for(int i=6;i<8;i++)
+   {
+      set_plane(p_out,i,0.0f,0.0f,0.0f,0.0f);
+      p_out->d[i]=1.0f;
+   }
+
+   p_out->count=6;
+
+}
+
+void sb_frustum_add_far_plane(sb_frustum *p_frustum, const vm_matrix &p_view, float p_distance){
+
+   if(p_frustum->count >= 8)
+   {
+      return;
+   }
+
+   //View space z is p dotted with the view matrix's third column, keep z <= p_distance
+   set_plane(p_frustum,p_frustum->count,-p_view.m[0][2],-p_view.m[1][2],-p_view.m[2][2],
+             p_distance - p_view.m[3][2]);
+   p_frustum->count++;
+
+}
+//******************************************************************************************
+// Function:sb_frustum_test
+// Whazzit:For each plane, the box's centre distance d and its projected half size r
+//         along the normal.  d + r < 0 is completely outside, d - r >= 0 completely
+//         inside.  Planes outside p_mask are computed anyway (it's no slower four at a
+//         time) and then ignored.
+//******************************************************************************************
+int sb_frustum_test(const sb_frustum &p_frustum, const float *p_min, const float *p_max, int p_mask){
+float centre[3];
+float extent[3];
+int outside=0;
+int crossing=0;
+
+   for(int k=0;k<3;k++)
+   {
+      centre[k]=(p_min[k] + p_max[k]) * 0.5f;
+      extent[k]=(p_max[k] - p_min[k]) * 0.5f;
+   }
+
+#ifdef VM_SSE2
+   const __m128 cx=_mm_set1_ps(centre[0]);
+   const __m128 cy=_mm_set1_ps(centre[1]);
+   const __m128 cz=_mm_set1_ps(centre[2]);
+   const __m128 ex=_mm_set1_ps(extent[0]);
+   const __m128 ey=_mm_set1_ps(extent[1]);
+   const __m128 ez=_mm_set1_ps(extent[2]);
+   const __m128 zero=_mm_setzero_ps();
+
+   for(int i=0;i<8;i+=4)
+   {
+      __m128 dist=_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p_frustum.nx + i),cx),
+                                        _mm_mul_ps(_mm_loadu_ps(p_frustum.ny + i),cy)),
+                             _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p_frustum.nz + i),cz),
+                                        _mm_loadu_ps(p_frustum.d + i)));
+      __m128 radius=_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p_frustum.ax + i),ex),
+                                          _mm_mul_ps(_mm_loadu_ps(p_frustum.ay + i),ey)),
+                               _mm_mul_ps(_mm_loadu_ps(p_frustum.az + i),ez));
+
+      outside|=_mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist,radius),zero)) << i;
+      crossing|=_mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dist,radius),zero)) << i;
+   }
+#else
+   for(int i=0;i<8;i++)
+   {
+      float dist=(p_frustum.nx[i] * centre[0] + p_frustum.ny[i] * centre[1]) +
+                 (p_frustum.nz[i] * centre[2] + p_frustum.d[i]);
+      float radius=(p_frustum.ax[i] * extent[0] + p_frustum.ay[i] * extent[1]) + p_frustum.az[i] * extent[2];
+
+      outside|=(dist + radius < 0.0f) << i;
+      crossing|=(dist - radius < 0.0f) << i;
+   }
+#endif
+
+   if(outside & p_mask)
+   {
+      return -1;
+   }
+
+   return crossing & p_mask;
+}
+
+SceneBVH::SceneBVH(void) :
+   m_cull_frustum(NULL),m_build_area(0.0f),m_split_depth(g_sb_split_depth),m_needs_build(false)
+{
+
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+
+int SceneBVH::AddObject(const float *p_min, const float *p_max){
+object obj;
+
+   for(int k=0;k<3;k++)
+   {
+      obj.local_min[k]=obj.world_min[k]=p_min[k];
+      obj.local_max[k]=obj.world_max[k]=p_max[k];
+   }
+   obj.leaf=-1;
+
+   m_objects.push_back(obj);
+   m_moved.push_back(0);
+   m_visible.push_back(1);
+   m_needs_build=true;
+
+   return (int)m_objects.size() - 1;
+}
+
+void SceneBVH::Clear(void){
+
+   m_objects.clear();
+   m_moved.clear();
+   m_order.clear();
+   m_nodes.clear();
+   m_node_dirty.clear();
+   m_visible.clear();
+   m_subtrees.clear();
+   m_top.clear();
+   m_node_subtree.clear();
+   m_cull_list.clear();
+   m_needs_build=false;
+
+}
+//******************************************************************************************
+// Function:SetTransform
+// Whazzit:The world box is the transformed object box's centre, with each half size the
+//         sum of the object half sizes scaled by the absolute matrix terms (Arvo).  The
+//         leaf finds out it moved from m_moved during Refit, so nothing shared is written.
+//******************************************************************************************
+void SceneBVH::SetTransform(int p_id, const vm_matrix &p_world){
+object &obj=m_objects[p_id];
+float centre[3];
+float extent[3];
+
+   for(int k=0;k<3;k++)
+   {
+      centre[k]=(obj.local_min[k] + obj.local_max[k]) * 0.5f;
+      extent[k]=(obj.local_max[k] - obj.local_min[k]) * 0.5f;
+   }
+
+   for(int j=0;j<3;j++)
+   {
+      float c=p_world.m[3][j];
+      float e=0.0f;
+
+      for(int i=0;i<3;i++)
+      {
+         c+=centre[i] * p_world.m[i][j];
+         e+=extent[i] * fabsf(p_world.m[i][j]);
+      }
+
+      obj.world_min[j]=c - e;
+      obj.world_max[j]=c + e;
+   }
+
+   m_moved[p_id]=1;
+
+}
+//******************************************************************************************
+// Function:UpdateBounds
+// Whazzit:Recomputes a node's box from its objects or from its two children
+//******************************************************************************************
+void SceneBVH::UpdateBounds(int p_index){
+node &n=m_nodes[p_index];
+
+   if(n.count > 0)
+   {
+      for(int k=0;k<3;k++)
+      {
+         n.min[k]=HUGE_VALF;
+         n.max[k]=-HUGE_VALF;
+      }
+
+      for(int i=n.first;i<n.first + n.count;i++)
+      {
+         const object &obj=m_objects[m_order[i]];
+
+         for(int k=0;k<3;k++)
+         {
+            n.min[k]=obj.world_min[k] < n.min[k] ? obj.world_min[k] : n.min[k];
+            n.max[k]=obj.world_max[k] > n.max[k] ? obj.world_max[k] : n.max[k];
+         }
+      }
+   }
+   else
+   {
+      const node &left=m_nodes[n.first];
+      const node &right=m_nodes[n.first + 1];
+
+      for(int k=0;k<3;k++)
+      {
+         n.min[k]=left.min[k] < right.min[k] ? left.min[k] : right.min[k];
+         n.max[k]=left.max[k] > right.max[k] ? left.max[k] : right.max[k];
+      }
+   }
+
+}
+
+static float surface_area(const float *p_min, const float *p_max){
+float dx=p_max[0] - p_min[0];
+float dy=p_max[1] - p_min[1];
+float dz=p_max[2] - p_min[2];
+
+   return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+//******************************************************************************************
+// Function:BuildNode
+// Whazzit:Fills node p_index with m_order[p_first..p_first + p_count).  Larger ranges
+//         are split in half about the median object centre along the widest axis, and
+//         both children are allocated together so they sit next to each other.  The
+//         nodes a node's children go on to allocate come straight after that pair, so
+//         everything below a node is one run of indices.
+//******************************************************************************************
+void SceneBVH::BuildNode(int p_index, int p_first, int p_count, int p_depth){
+float low[3]={ HUGE_VALF,HUGE_VALF,HUGE_VALF };
+float high[3]={ -HUGE_VALF,-HUGE_VALF,-HUGE_VALF };
+int axis=0;
+int child;
+
+   if(p_depth <= m_split_depth)
+   {
+      m_top.push_back(p_index);
+   }
+
+   if(p_count <= g_sb_leaf_size)
+   {
+      m_nodes[p_index].first=p_first;
+      m_nodes[p_index].count=p_count;
+      for(int i=p_first;i<p_first + p_count;i++)
+      {
+         m_objects[m_order[i]].leaf=p_index;
+      }
+      UpdateBounds(p_index);
+      return;
+   }
+
+   //Centres doubled, only their order matters
+   for(int i=p_first;i<p_first + p_count;i++)
+   {
+      const object &obj=m_objects[m_order[i]];
+
+      for(int k=0;k<3;k++)
+      {
+         float c=obj.world_min[k] + obj.world_max[k];
+         low[k]=c < low[k] ? c : low[k];
+         high[k]=c > high[k] ? c : high[k];
+      }
+   }
+
+   for(int k=1;k<3;k++)
+   {
+      if(high[k] - low[k] > high[axis] - low[axis])
+      {
+         axis=k;
+      }
+   }
+
+   const std::vector<object> &objects=m_objects;
+   std::nth_element(m_order.begin() + p_first,m_order.begin() + p_first + p_count / 2,
+                    m_order.begin() + p_first + p_count,
+                    [&objects,axis](int p_a, int p_b){
+                       return objects[p_a].world_min[axis] + objects[p_a].world_max[axis] <
+                              objects[p_b].world_min[axis] + objects[p_b].world_max[axis];
+                    });
+
+   child=(int)m_nodes.size();
+   m_nodes.resize(m_nodes.size() + 2);
+   m_nodes[p_index].first=child;
+   m_nodes[p_index].count=0;
+
+   BuildNode(child,p_first,p_count / 2,p_depth + 1);
+   BuildNode(child + 1,p_first + p_count / 2,p_count - p_count / 2,p_depth + 1);
+   UpdateBounds(p_index);
+
+   if(p_depth == m_split_depth)
+   {
+      subtree below;
+
+      memset(&below,0,sizeof(below));
+      below.root=p_index;
+      below.first=child;
+      below.end=(int)m_nodes.size();
+      m_subtrees.push_back(below);
+   }
+
+}
+
+void SceneBVH::Build(void){
+const int count=(int)m_objects.size();
+
+   m_order.resize(count);
+   for(int i=0;i<count;i++)
+   {
+      m_order[i]=i;
+   }
+
+   m_nodes.clear();
+   m_nodes.reserve(count > 0 ? count * 2 : 1);
+   m_subtrees.clear();
+   m_top.clear();
+   m_moved.assign(count,0);
+   m_build_area=0.0f;
+   m_needs_build=false;
+   m_stats.rebuilds++;
+
+   if(count == 0)
+   {
+      m_node_dirty.clear();
+      m_node_subtree.clear();
+      return;
+   }
+
+   m_nodes.resize(1);
+   BuildNode(0,0,count,0);
+
+   //Parents before children, RefitNode walks it backwards
+   std::sort(m_top.begin(),m_top.end());
+   m_node_subtree.assign(m_nodes.size(),-1);
+   for(size_t i=0;i<m_subtrees.size();i++)
+   {
+      m_node_subtree[m_subtrees[i].root]=(int)i;
+   }
+
+   m_node_dirty.assign(m_nodes.size(),0);
+   for(size_t i=0;i<m_nodes.size();i++)
+   {
+      m_build_area+=surface_area(m_nodes[i].min,m_nodes[i].max);
+   }
+
+}
+//******************************************************************************************
+// Function:RefitNode
+// Whazzit:A leaf is refit when an object in it moved, an inner node when either child
+//         was.  Returns whether it was.
+//******************************************************************************************
+bool SceneBVH::RefitNode(int p_index){
+const node &n=m_nodes[p_index];
+bool dirty=false;
+
+   if(n.count > 0)
+   {
+      for(int i=n.first;i<n.first + n.count;i++)
+      {
+         if(m_moved[m_order[i]])
+         {
+            m_moved[m_order[i]]=0;
+            dirty=true;
+         }
+      }
+   }
+   else
+   {
+      dirty=m_node_dirty[n.first] || m_node_dirty[n.first + 1];
+   }
+
+   if(dirty)
+   {
+      m_node_dirty[p_index]=1;
+      UpdateBounds(p_index);
+   }
+
+   return dirty;
+}
+//******************************************************************************************
+// Function:RefitRange
+// Whazzit:Children come after their parents, so one backwards pass sees every child
+//         before its parent
+//******************************************************************************************
+void SceneBVH::RefitRange(int p_first, int p_end, float *p_area, unsigned int *p_refit){
+
+   for(int i=p_end - 1;i >= p_first;i--)
+   {
+      *p_refit+=RefitNode(i);
+      *p_area+=surface_area(m_nodes[i].min,m_nodes[i].max);
+   }
+
+}
+
+void SceneBVH::RefitJob(void *p_data, size_t p_begin, size_t p_end){
+SceneBVH *self=(SceneBVH *)p_data;
+
+   for(size_t i=p_begin;i<p_end;i++)
+   {
+      subtree &below=self->m_subtrees[i];
+
+      below.area=0.0f;
+      below.refit=0;
+      self->RefitRange(below.first,below.end,&below.area,&below.refit);
+   }
+
+}
+//******************************************************************************************
+// Function:Refit
+// Whazzit:Only the nodes with something under them that moved are refit, everything else
+//         is left alone.  With jobs the subtrees below the split go first, in parallel,
+//         then the nodes above them.  If the tree has grown too loose it's rebuilt.
+//******************************************************************************************
+void SceneBVH::Refit(JobSystem *p_jobs){
+float area=0.0f;
+int depth=g_sb_split_depth;
+
+   m_stats.nodes_refit=0;
+
+   //Deep enough for every thread to have its share of subtrees, on one thread the
+   //split isn't used and the tree stays as it is
+   if(p_jobs && p_jobs->GetThreadCount() > 1)
+   {
+      while(depth < g_sb_max_split_depth && (1 << depth) < p_jobs->GetThreadCount() * g_sb_subtrees_per_thread)
+      {
+         depth++;
+      }
+      if(depth != m_split_depth)
+      {
+         m_split_depth=depth;
+         m_needs_build=true;
+      }
+   }
+
+   if(m_needs_build)
+   {
+      Build();
+      return;
+   }
+
+   if(p_jobs && p_jobs->GetThreadCount() > 1 && !m_subtrees.empty())
+   {
+      p_jobs->ParallelFor(m_subtrees.size(),1,RefitJob,this);
+      for(size_t i=0;i<m_subtrees.size();i++)
+      {
+         area+=m_subtrees[i].area;
+         m_stats.nodes_refit+=m_subtrees[i].refit;
+      }
+
+      for(size_t i=m_top.size();i > 0;i--)
+      {
+         const int index=m_top[i - 1];
+
+         m_stats.nodes_refit+=RefitNode(index);
+         area+=surface_area(m_nodes[index].min,m_nodes[index].max);
+      }
+   }
+   else
+   {
+      RefitRange(0,(int)m_nodes.size(),&area,&m_stats.nodes_refit);
+   }
+
+   if(m_stats.nodes_refit)
+   {
+      memset(&m_node_dirty[0],0,m_node_dirty.size());
+   }
+
+   if(area > m_build_area * g_sb_rebuild_ratio)
+   {
+      Build();
+   }
+
+}
+
+void SceneBVH::MarkSubtree(int p_index, sb_stats *p_stats){
+const node &n=m_nodes[p_index];
+
+   if(n.count > 0)
+   {
+      for(int i=n.first;i<n.first + n.count;i++)
+      {
+         m_visible[m_order[i]]=1;
+         p_stats->objects_drawn++;
+      }
+   }
+   else
+   {
+      MarkSubtree(n.first,p_stats);
+      MarkSubtree(n.first + 1,p_stats);
+   }
+
+}
+//******************************************************************************************
+// Function:CullSubtree
+// Whazzit:Walks the tree from p_root with an explicit stack, each entry carrying the
+//         planes its box still straddles.  Leaves that straddle a plane test their
+//         objects one by one.  With p_split the subtrees at the split are listed in
+//         m_cull_list for the jobs instead of being walked.
+//******************************************************************************************
+void SceneBVH::CullSubtree(const sb_frustum &p_frustum, int p_root, int p_mask, bool p_split, sb_stats *p_stats){
+int stack_node[g_sb_stack_size];
+int stack_mask[g_sb_stack_size];
+int depth=1;
+
+   stack_node[0]=p_root;
+   stack_mask[0]=p_mask;
+
+   while(depth > 0)
+   {
+      depth--;
+      const int index=stack_node[depth];
+      const node &n=m_nodes[index];
+
+      if(p_split && m_node_subtree[index] >= 0)
+      {
+         m_subtrees[m_node_subtree[index]].mask=stack_mask[depth];
+         m_cull_list.push_back(m_node_subtree[index]);
+         continue;
+      }
+
+      const int mask=sb_frustum_test(p_frustum,n.min,n.max,stack_mask[depth]);
+
+      p_stats->nodes_visited++;
+
+      if(mask < 0)
+      {
+         p_stats->nodes_culled++;
+      }
+      else if(mask == 0)
+      {
+         p_stats->nodes_inside++;
+         MarkSubtree(index,p_stats);
+      }
+      else if(n.count > 0)
+      {
+         for(int i=n.first;i<n.first + n.count;i++)
+         {
+            const object &obj=m_objects[m_order[i]];
+
+            if(sb_frustum_test(p_frustum,obj.world_min,obj.world_max,mask) >= 0)
+            {
+               m_visible[m_order[i]]=1;
+               p_stats->objects_drawn++;
+            }
+         }
+      }
+      else
+      {
+         stack_node[depth]=n.first + 1;
+         stack_mask[depth]=mask;
+         stack_node[depth + 1]=n.first;
+         stack_mask[depth + 1]=mask;
+         depth+=2;
+      }
+   }
+
+}
+
+void SceneBVH::CullJob(void *p_data, size_t p_begin, size_t p_end){
+SceneBVH *self=(SceneBVH *)p_data;
+
+   for(size_t i=p_begin;i<p_end;i++)
+   {
+      subtree &below=self->m_subtrees[self->m_cull_list[i]];
+
+      memset(&below.cull,0,sizeof(below.cull));
+      self->CullSubtree(*self->m_cull_frustum,below.root,below.mask,false,&below.cull);
+   }
+
+}
+//******************************************************************************************
+// Function:Cull
+// Whazzit:Each object is in exactly one leaf, so the jobs' visible flags never collide.
+//         Their counts are kept per subtree and added up afterwards.
+//******************************************************************************************
+void SceneBVH::Cull(const sb_frustum &p_frustum, JobSystem *p_jobs){
+const bool split=p_jobs && p_jobs->GetThreadCount() > 1 && !m_subtrees.empty();
+
+   m_stats.nodes_visited=0;
+   m_stats.nodes_culled=0;
+   m_stats.nodes_inside=0;
+   m_stats.objects_drawn=0;
+
+   if(!m_visible.empty())
+   {
+      memset(&m_visible[0],0,m_visible.size());
+   }
+
+   m_cull_list.clear();
+   if(!m_nodes.empty())
+   {
+      CullSubtree(p_frustum,0,(1 << p_frustum.count) - 1,split,&m_stats);
+   }
+
+   if(!m_cull_list.empty())
+   {
+      m_cull_frustum=&p_frustum;
+      p_jobs->ParallelFor(m_cull_list.size(),1,CullJob,this);
+      m_cull_frustum=NULL;
+
+      for(size_t i=0;i<m_cull_list.size();i++)
+      {
+         const sb_stats &below=m_subtrees[m_cull_list[i]].cull;
+
+         m_stats.nodes_visited+=below.nodes_visited;
+         m_stats.nodes_culled+=below.nodes_culled;
+         m_stats.nodes_inside+=below.nodes_inside;
+         m_stats.objects_drawn+=below.objects_drawn;
+      }
+   }
+
+   m_stats.objects_culled=(unsigned int)m_objects.size() - m_stats.objects_drawn;
+
+}
+
+void SceneBVH::ShowAll(void){
+
+   if(!m_visible.empty())
+   {
+      memset(&m_visible[0],1,m_visible.size());
+   }
+   m_stats.nodes_visited=0;
+   m_stats.nodes_culled=0;
+   m_stats.nodes_inside=0;
+   m_stats.objects_drawn=(unsigned int)m_objects.size();
+   m_stats.objects_culled=0;
+
+}
+//******************************************************************************************
+// Function:ray_box
+// Whazzit:Slab test, true when the ray passes through the box somewhere between its
+//         origin and p_max_t
+//******************************************************************************************
+static bool ray_box(const float *p_min, const float *p_max, const float *p_origin, const float *p_inv_dir,
+                    float p_max_t){
+float near_t=0.0f;
+float far_t=p_max_t;
+
+   for(int k=0;k<3;k++)
+   {
+      float t0=(p_min[k] - p_origin[k]) * p_inv_dir[k];
+      float t1=(p_max[k] - p_origin[k]) * p_inv_dir[k];
+
+      if(t0 > t1)
+      {
+         std::swap(t0,t1);
+      }
+      near_t=t0 > near_t ? t0 : near_t;
+      far_t=t1 < far_t ? t1 : far_t;
+   }
+
+   return near_t <= far_t;
+}
+//******************************************************************************************
+// Function:Raycast
+// Whazzit:Boxes are tested as they come off the stack, against the nearest hit so far,
+//         so the further child of a node is usually skipped once the nearer one has
+//         hit.  Which child is nearer goes by their centres along the ray.
+//******************************************************************************************
+int SceneBVH::Raycast(const float *p_origin, const float *p_dir, float p_max_t, sb_ray_test p_test, void *p_data,
+                      float *p_t) const{
+int stack[g_sb_stack_size];
+int depth=0;
+float inv_dir[3];
+float best=p_max_t;
+int best_id=-1;
+
+   if(m_nodes.empty() || m_needs_build)
+   {
+      return -1;
+   }
+
+   for(int k=0;k<3;k++)
+   {
+      inv_dir[k]=1.0f / p_dir[k];
+   }
+
+   stack[depth++]=0;
+   while(depth > 0)
+   {
+      const node &n=m_nodes[stack[--depth]];
+
+      if(!ray_box(n.min,n.max,p_origin,inv_dir,best))
+      {
+         continue;
+      }
+
+      if(n.count > 0)
+      {
+         for(int i=n.first;i<n.first + n.count;i++)
+         {
+            const object &obj=m_objects[m_order[i]];
+            float t;
+
+            if(!ray_box(obj.world_min,obj.world_max,p_origin,inv_dir,best))
+            {
+               continue;
+            }
+
+            t=p_test(p_data,m_order[i],p_origin,p_dir,best);
+            if(t < best)
+            {
+               best=t;
+               best_id=m_order[i];
+            }
+         }
+      }
+      else
+      {
+         const node &left=m_nodes[n.first];
+         const node &right=m_nodes[n.first + 1];
+         float along=0.0f;
+
+         for(int k=0;k<3;k++)
+         {
+            along+=(left.min[k] + left.max[k] - right.min[k] - right.max[k]) * p_dir[k];
+         }
+         stack[depth++]=along > 0.0f ? n.first : n.first + 1;
+         stack[depth++]=along > 0.0f ? n.first + 1 : n.first;
+      }
+   }
+
+   if(best_id >= 0)
+   {
+      *p_t=best;
+   }
+
+   return best_id;
+}
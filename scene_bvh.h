@@ -0,0 +1,179 @@
+//
+// scene_bvh.h - Bounding volume hierarchy over the scene's objects, for frustum culling
+//
+// Each object has an object space bounding box and a world matrix.  SetTransform keeps
+// a world space box per object (the transformed box's own axis aligned bounds), and
+// the objects are grouped into a binary tree of boxes, a few objects per leaf.  When
+// objects move, Refit only recomputes the boxes on the path from a moved object to the
+// root and keeps the tree's shape; if the refit boxes have grown too loose the tree is
+// rebuilt from scratch.
+//
+// Cull walks the tree against an sb_frustum.  A node outside any plane is skipped with
+// everything under it, and a node inside a plane doesn't test its children against
+// that plane again, so a subtree completely in view is accepted without any further
+// tests.  Each box is tested against four planes at a time with SSE2 where vec_math.h
+// has it, and with plain loops otherwise.
+//
+// Raycast walks the same tree along a ray, nearer child first, and hands each object
+// whose world box the ray passes through to a callback that does the exact test, for
+// picking.  Boxes further away than the nearest hit so far are skipped.
+//
+// Given a JobSystem, Refit and Cull split the tree at a fixed depth and hand the
+// subtrees below it out as jobs; the few nodes above are done on the calling thread.
+// The depth is g_sb_split_depth, or deeper with enough threads that each still has
+// g_sb_subtrees_per_thread subtrees to take, since a Cull only hands out the ones in
+// view.  Refit rebuilds the tree when the thread count calls for another depth.
+// SetTransform only writes the object's own data, so it may be called from several
+// threads at once for different objects.
+//
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <vector>
+#include "vec_math.h"
+
+class JobSystem;
+
+//Objects per leaf, the most a leaf is built with
+const int g_sb_leaf_size = 4;
+
+//Refit boxes may grow to this multiple of their total surface area when the tree was
+//built before Refit rebuilds it
+const float g_sb_rebuild_ratio = 2.0f;
+
+//Least depth the tree is split into subtrees for the jobs at, up to 2^depth of them,
+//and the most it goes to for many threads
+const int g_sb_split_depth = 6;
+const int g_sb_max_split_depth = 12;
+//Subtrees wanted per thread, the same spare as JobSystem::AutoGrain leaves
+const int g_sb_subtrees_per_thread = 4;
+
+//Up to 8 planes, stored a component per array so four can be tested at once.  A point
+//p is inside plane i when nx[i]*p.x + ny[i]*p.y + nz[i]*p.z + d[i] >= 0.
+struct sb_frustum
+{
+   float nx[8], ny[8], nz[8], d[8];
+   float ax[8], ay[8], az[8];   //|nx|,|ny|,|nz|
+   int count;
+};
+
+//The six planes of the view volume, from the same view and projection matrices the
+//device is given (row vectors, D3D's 0 <= z <= w clip space)
+void sb_frustum_from_matrices(sb_frustum *p_out, const vm_matrix &p_view, const vm_matrix &p_projection);
+//Adds a plane at view space z = p_distance, e.g. the fog end
+void sb_frustum_add_far_plane(sb_frustum *p_frustum, const vm_matrix &p_view, float p_distance);
+
+//Returns -1 when the box is outside one of the planes in p_mask (bit i for plane i),
+//otherwise p_mask less the planes the box is completely inside
+int sb_frustum_test(const sb_frustum &p_frustum, const float *p_min, const float *p_max, int p_mask);
+
+//Exact test of object p_id against the ray p_origin + t * p_dir, world space.  Returns
+//the t it hits at, or anything not less than p_max_t for a miss.
+typedef float (*sb_ray_test)(void *p_data, int p_id, const float *p_origin, const float *p_dir, float p_max_t);
+
+struct sb_stats
+{
+   //From the last Cull
+   unsigned int nodes_visited;
+   unsigned int nodes_culled;     //Outside a plane, skipped along with everything below
+   unsigned int nodes_inside;     //Inside every plane, everything below accepted untested
+   unsigned int objects_drawn;
+   unsigned int objects_culled;
+   //From the last Refit
+   unsigned int nodes_refit;
+   //Since the scene was created
+   unsigned int rebuilds;
+};
+
+class SceneBVH
+{
+public:
+   SceneBVH(void);
+
+   //Returns the new object's id, ids count up from 0.  The tree is rebuilt on the next
+   //Refit.  p_min/p_max is the object space bounding box.
+   int AddObject(const float *p_min, const float *p_max);
+   void Clear(void);
+   int GetObjectCount(void) const { return (int)m_objects.size(); }
+
+   //Moves an object, its box in the tree is updated by the next Refit
+   void SetTransform(int p_id, const vm_matrix &p_world);
+   const float *GetWorldMin(int p_id) const { return m_objects[p_id].world_min; }
+   const float *GetWorldMax(int p_id) const { return m_objects[p_id].world_max; }
+
+   //Brings the tree up to date with the SetTransform calls since the last Refit
+   void Refit(JobSystem *p_jobs=NULL);
+   void Build(void);
+
+   //Marks the objects at least partly inside the frustum, call Refit first
+   void Cull(const sb_frustum &p_frustum, JobSystem *p_jobs=NULL);
+   bool IsVisible(int p_id) const { return m_visible[p_id] != 0; }
+   //Marks every object visible, for drawing with culling off
+   void ShowAll(void);
+
+   //The object p_test finds the nearest hit on, before p_max_t, or -1 for none.  Its t
+   //goes in *p_t.  Call Refit first.
+   int Raycast(const float *p_origin, const float *p_dir, float p_max_t, sb_ray_test p_test, void *p_data,
+               float *p_t) const;
+
+   const sb_stats &GetStats(void) const { return m_stats; }
+
+private:
+   struct object
+   {
+      float local_min[3], local_max[3];
+      float world_min[3], world_max[3];
+      int leaf;
+   };
+
+   //A leaf holds m_order[first..first + count), an inner node's children are first
+   //and first + 1.  Children always come after their parent.
+   struct node
+   {
+      float min[3];
+      int first;
+      float max[3];
+      int count;
+   };
+
+   //What's below a node at m_split_depth: its descendants are the nodes first..end
+   struct subtree
+   {
+      int root;
+      int first;
+      int end;
+      //Results of the last job over it
+      int mask;
+      float area;
+      unsigned int refit;
+      sb_stats cull;
+   };
+
+   void BuildNode(int p_index, int p_first, int p_count, int p_depth);
+   void UpdateBounds(int p_index);
+   bool RefitNode(int p_index);
+   void RefitRange(int p_first, int p_end, float *p_area, unsigned int *p_refit);
+   void MarkSubtree(int p_index, sb_stats *p_stats);
+   void CullSubtree(const sb_frustum &p_frustum, int p_root, int p_mask, bool p_split, sb_stats *p_stats);
+
+   static void RefitJob(void *p_data, size_t p_begin, size_t p_end);
+   static void CullJob(void *p_data, size_t p_begin, size_t p_end);
+
+   std::vector<object> m_objects;
+   std::vector<unsigned char> m_moved;
+   std::vector<int> m_order;
+   std::vector<node> m_nodes;
+   std::vector<unsigned char> m_node_dirty;
+   std::vector<unsigned char> m_visible;
+   std::vector<subtree> m_subtrees;
+   std::vector<int> m_top;                 //Nodes above and at the split, by index
+   std::vector<int> m_node_subtree;        //Or -1 for nodes not at the split
+   std::vector<int> m_cull_list;           //Subtrees the last Cull reached
+   const sb_frustum *m_cull_frustum;
+   float m_build_area;
+   int m_split_depth;
+   bool m_needs_build;
+   sb_stats m_stats;
+};
+
+#endif
@@ -0,0 +1,101 @@
+//
+// scene_sim.cpp - Fixed timestep simulation of the scene's animation
+//
+#include <math.h>
+#include "scene_sim.h"
+
+const float g_two_pi = 6.28318530718f;
+
+//Per step rates, these are the old per frame increments so motion at 60fps is unchanged
+const float g_rot_triangle_rate = 0.007f;
+const float g_rot_cube_rate = 0.006f;
+
+static float wrap_angle(float p_angle){
+
+   if(p_angle > g_two_pi)
+   {
+      p_angle-=g_two_pi;
+   }
+
+   return p_angle;
+}
+//******************************************************************************************
+// Function:lerp_angle
+// Whazzit:Interpolates between two angles that may sit either side of the wrap point.
+//******************************************************************************************
+static float lerp_angle(float p_from, float p_to, float p_t){
+float delta=p_to - p_from;
+
+   if(delta < -g_two_pi * 0.5f)
+   {
+      delta+=g_two_pi;
+   }
+
+   return wrap_angle(p_from + delta * p_t);
+}
+
+SceneSim::SceneSim(void){
+
+   Reset();
+
+}
+
+void SceneSim::Reset(void){
+
+   m_curr.rot_triangle=0.0f;
+   m_curr.rot_cube=0.0f;
+   m_prev=m_curr;
+   m_accumulator=0.0;
+   m_tick=0;
+
+}
+
+void SceneSim::Step(void){
+
+   m_prev=m_curr;
+
+   m_curr.rot_triangle=wrap_angle(m_curr.rot_triangle + g_rot_triangle_rate);
+   m_curr.rot_cube=wrap_angle(m_curr.rot_cube + g_rot_cube_rate);
+
+   m_tick++;
+
+}
+
+int SceneSim::Advance(double p_seconds){
+int steps=0;
+
+   m_accumulator+=p_seconds;
+
+   while(m_accumulator >= g_sim_step)
+   {
+      if(steps == g_sim_max_steps)
+      {
+         m_accumulator=0.0;
+         break;
+      }
+
+      Step();
+      m_accumulator-=g_sim_step;
+      steps++;
+   }
+
+   return steps;
+}
+
+sim_state SceneSim::GetState(void) const{
+const float t=(float)(m_accumulator / g_sim_step);
+sim_state state;
+
+   state.rot_triangle=lerp_angle(m_prev.rot_triangle,m_curr.rot_triangle,t);
+   state.rot_cube=lerp_angle(m_prev.rot_cube,m_curr.rot_cube,t);
+
+   return state;
+}
+
+void SceneSim::BenchCamera(unsigned long p_tick, float *p_x, float *p_y){
+const float t=(float)p_tick * (float)g_sim_step;
+
+   *p_x=6.0f * sinf(t * 0.5f);
+   *p_y=3.0f * sinf(t);
+
+}
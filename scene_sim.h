@@ -0,0 +1,49 @@
+//
+// scene_sim.h - Fixed timestep simulation of the scene's animation
+//
+// Animation used to advance by a constant every rendered frame, so it ran at whatever
+// speed the frame rate allowed.  Now the state only changes in fixed 1/60s steps and
+// rendering interpolates between the last two steps.
+//
+#ifndef SCENE_SIM_H
+#define SCENE_SIM_H
+
+//Length of one simulation step, in seconds
+const double g_sim_step = 1.0 / 60.0;
+
+//If we fall further behind than this we drop time rather than trying to catch up
+const int g_sim_max_steps = 8;
+
+struct sim_state
+{
+   float rot_triangle;   //Pyramid rotation about Y
+   float rot_cube;       //Cube pitch/roll
+};
+
+class SceneSim
+{
+public:
+   SceneSim(void);
+
+   void Reset(void);
+   //Adds p_seconds of real time and runs however many whole steps that covers
+   int Advance(double p_seconds);
+   //Runs exactly one step, used by the benchmark so every run does the same work
+   void Step(void);
+
+   //The state to draw, interpolated between the last two steps
+   sim_state GetState(void) const;
+   unsigned long GetTick(void) const { return m_tick; }
+
+   //Deterministic look-at target for benchmark runs, a slow figure eight that sweeps
+   //the objects in and out of view
+   static void BenchCamera(unsigned long p_tick, float *p_x, float *p_y);
+
+private:
+   sim_state m_prev;
+   sim_state m_curr;
+   double m_accumulator;
+   unsigned long m_tick;
+};
+
+#endif
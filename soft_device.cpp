@@ -0,0 +1,337 @@
+//
+// soft_device.cpp - RenderDevice backed by the software rasterizer
+//
+#include <math.h>
+#include <string.h>
+#include "soft_device.h"
+#include "sysmem_buffer.h"
+#include "vertex_quant.h"
+
+//Glyphs DrawGlyphs has room for before its scratch grows
+const size_t g_soft_reserve_glyphs = 8192;
+
+SoftDevice::SoftDevice(int p_width, int p_height, int p_threads) :
+   m_raster(p_width,p_height,p_threads),m_fog_vertex_mode(RD_FOG_NONE),m_fog_enable(false),
+   m_fvf(0),m_quantized(false),m_stream(NULL),m_stream_offset(0),m_stream_stride(0),m_indices(NULL),
+   m_fence(0)
+#ifdef _WIN32
+   ,m_window(NULL)
+#endif
+{
+
+   m_state=m_raster.GetState();
+   m_glyphs.reserve(g_soft_reserve_glyphs);
+   memset(&m_quant,0,sizeof(m_quant));
+
+}
+
+HRESULT SoftDevice::CreateVertexBuffer(UINT p_length, DWORD, DWORD, rd_pool p_pool,
+                                       RenderBuffer **p_buffer){
+
+   *p_buffer=new SysMemBuffer(p_length,p_pool);
+
+   return S_OK;
+}
+
+HRESULT SoftDevice::CreateIndexBuffer(UINT p_length, DWORD, rd_format p_format, rd_pool p_pool,
+                                      RenderBuffer **p_buffer){
+
+   if(p_format != RD_FMT_INDEX16 && p_format != RD_FMT_INDEX32)
+   {
+      *p_buffer=NULL;
+      return E_INVALIDARG;
+   }
+
+   *p_buffer=new SysMemBuffer(p_length,p_pool,NULL,p_format);
+
+   return S_OK;
+}
+
+HRESULT SoftDevice::CreateTexture(UINT p_width, UINT p_height, RenderTexture **p_texture){
+
+   *p_texture=new SysMemTexture(p_width,p_height);
+
+   return S_OK;
+}
+
+HRESULT SoftDevice::Clear(DWORD p_colour){
+
+   m_raster.Clear(p_colour);
+
+   return S_OK;
+}
+//******************************************************************************************
+// Function:Present
+// Whazzit:Rasterizes the frame and, if we have a window, copies it across with GDI.
+//******************************************************************************************
+HRESULT SoftDevice::Present(void){
+
+   m_raster.Flush();
+
+#ifdef _WIN32
+   if(m_window)
+   {
+      BITMAPINFO info;
+      memset(&info,0,sizeof(info));
+      info.bmiHeader.biSize=sizeof(info.bmiHeader);
+      info.bmiHeader.biWidth=m_raster.GetWidth();
+      info.bmiHeader.biHeight=-m_raster.GetHeight();   //Top down
+      info.bmiHeader.biPlanes=1;
+      info.bmiHeader.biBitCount=32;
+      info.bmiHeader.biCompression=BI_RGB;
+
+      HDC dc=GetDC(m_window);
+      SetDIBitsToDevice(dc,0,0,m_raster.GetWidth(),m_raster.GetHeight(),0,0,0,m_raster.GetHeight(),
+                        m_raster.GetFramebuffer(),&info,DIB_RGB_COLORS);
+      ReleaseDC(m_window,dc);
+   }
+#endif
+
+   return S_OK;
+}
+
+HRESULT SoftDevice::SetTransform(rd_transform p_which, const float *p_matrix){
+sr_matrix matrix;
+
+   memcpy(matrix.m,p_matrix,sizeof(matrix.m));
+
+   switch(p_which)
+   {
+      case RD_TS_WORLD:      m_raster.SetTransform(SR_WORLD,matrix);      break;
+      case RD_TS_VIEW:       m_raster.SetTransform(SR_VIEW,matrix);       break;
+      case RD_TS_PROJECTION: m_raster.SetTransform(SR_PROJECTION,matrix); break;
+      default:               return E_INVALIDARG;
+   }
+
+   return S_OK;
+}
+//******************************************************************************************
+// Function:SetRenderState
+// Whazzit:Maps the states we emulate onto the rasterizer, the rest are accepted and
+//         ignored (wireframe fill isn't supported).
+//******************************************************************************************
+HRESULT SoftDevice::SetRenderState(rd_render_state p_state, DWORD p_value){
+
+   switch(p_state)
+   {
+      case RD_RS_LIGHTING:      m_state.lighting=p_value != 0;              break;
+      case RD_RS_FOGENABLE:     m_fog_enable=p_value != 0;                  break;
+      case RD_RS_FOGVERTEXMODE: m_fog_vertex_mode=p_value;                  break;
+      case RD_RS_FOGCOLOR:      m_state.fog_colour=p_value;                 break;
+      case RD_RS_FOGSTART:      m_state.fog_start=rd_bits_float(p_value);   break;
+      case RD_RS_FOGEND:        m_state.fog_end=rd_bits_float(p_value);     break;
+      case RD_RS_CULLMODE:
+         m_state.cull=p_value == RD_CULL_CW ? SR_CULL_CW : (p_value == RD_CULL_CCW ? SR_CULL_CCW : SR_CULL_NONE);
+         break;
+      default:
+         break;
+   }
+
+   //We only do vertex fog
+   m_state.fog_enable=m_fog_enable && m_fog_vertex_mode == RD_FOG_LINEAR;
+   m_raster.SetState(m_state);
+
+   return S_OK;
+}
+
+HRESULT SoftDevice::SetQuantization(const rd_quantization *p_quant){
+
+   m_quantized=p_quant != NULL;
+   if(p_quant)
+   {
+      m_quant=*p_quant;
+   }
+
+   return S_OK;
+}
+
+HRESULT SoftDevice::SetStreamSource(UINT p_stream, RenderBuffer *p_buffer, UINT p_offset, UINT p_stride){
+
+   if(p_stream != 0)
+   {
+      return E_INVALIDARG;
+   }
+
+   m_stream=(SysMemBuffer *)p_buffer;
+   m_stream_offset=p_offset;
+   m_stream_stride=p_stride;
+
+   return S_OK;
+}
+
+//******************************************************************************************
+// Function:CheckDraw
+// Whazzit:Both draw calls need a triangle list on stream 0 that covers the requested
+//         range, of tri_vertex records or of tri_qvertex ones with a quantization set.
+//******************************************************************************************
+bool SoftDevice::CheckDraw(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count) const{
+const bool plain=m_fvf == (RD_FVF_XYZ | RD_FVF_DIFFUSE) && m_stream_stride == sizeof(tri_vertex);
+const bool quantized=m_fvf == RD_FVF_QUANTIZED && m_stream_stride == sizeof(tri_qvertex) && m_quantized;
+unsigned long long end;
+
+   if(p_type != RD_PT_TRIANGLELIST || m_stream == NULL || !(plain || quantized))
+   {
+      return false;
+   }
+
+   end=m_stream_offset + ((unsigned long long)p_start_vertex + (unsigned long long)p_prim_count * 3) * m_stream_stride;
+
+   return end <= m_stream->GetSize();
+}
+
+HRESULT SoftDevice::DrawPrimitive(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count){
+
+   if(!CheckDraw(p_type,p_start_vertex,p_prim_count))
+   {
+      return E_INVALIDARG;
+   }
+
+   m_raster.DrawTriangleList(GetVertices(0,p_start_vertex,p_prim_count * 3),p_start_vertex,p_prim_count);
+
+   return S_OK;
+}
+
+HRESULT SoftDevice::DrawInstanced(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count,
+                                  const rd_instance *p_instances, UINT p_instance_count){
+
+   static_assert(sizeof(rd_instance) == sizeof(sr_instance),"rd_instance and sr_instance must match");
+
+   if(!CheckDraw(p_type,p_start_vertex,p_prim_count) || (p_instances == NULL && p_instance_count))
+   {
+      return E_INVALIDARG;
+   }
+
+   m_raster.DrawTriangleListInstanced(GetVertices(0,p_start_vertex,p_prim_count * 3),
+                                      p_start_vertex,p_prim_count,(const sr_instance *)p_instances,
+                                      p_instance_count);
+
+   return S_OK;
+}
+//******************************************************************************************
+// Function:CheckIndexedDraw
+// Whazzit:Like CheckDraw, plus the index range has to be inside the index buffer and the
+//         vertex range inside the vertex buffer.  Individual indices are checked by the
+//         rasterizer as it reads them.
+//******************************************************************************************
+bool SoftDevice::CheckIndexedDraw(rd_primitive p_type, int p_base_vertex, UINT p_min_index, UINT p_num_vertices,
+                                  UINT p_start_index, UINT p_prim_count) const{
+long long first;
+unsigned long long end;
+
+   if(!CheckDraw(p_type,0,0) || m_indices == NULL || m_indices->GetIndexSize() == 0)
+   {
+      return false;
+   }
+
+   end=((unsigned long long)p_start_index + (unsigned long long)p_prim_count * 3) * m_indices->GetIndexSize();
+   if(end > m_indices->GetSize())
+   {
+      return false;
+   }
+
+   first=(long long)p_base_vertex + p_min_index;
+   if(first < 0)
+   {
+      return false;
+   }
+
+   end=m_stream_offset + ((unsigned long long)first + p_num_vertices) * m_stream_stride;
+
+   return end <= m_stream->GetSize();
+}
+
+//******************************************************************************************
+// Function:GetVertices
+// Whazzit:Stream 0 offset by the base vertex, which may point before the buffer when it
+//         is negative.  Quantized vertices p_first to p_first + p_count are unpacked into
+//         the same places in m_decoded first, so the rasterizer reads them the same way.
+//******************************************************************************************
+const tri_vertex *SoftDevice::GetVertices(int p_base_vertex, UINT p_first, UINT p_count){
+
+   if(m_fvf != RD_FVF_QUANTIZED)
+   {
+      return (const tri_vertex *)(m_stream->GetData() + m_stream_offset) + p_base_vertex;
+   }
+
+   if(m_decoded.size() < (size_t)p_first + p_count)
+   {
+      m_decoded.resize((size_t)p_first + p_count);
+   }
+   vq_decode((const tri_qvertex *)(m_stream->GetData() + m_stream_offset) + p_base_vertex + p_first,p_count,
+             m_quant,&m_decoded[p_first]);
+
+   return &m_decoded[0];
+}
+
+HRESULT SoftDevice::DrawIndexedPrimitive(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                         UINT p_num_vertices, UINT p_start_index, UINT p_prim_count){
+
+   if(!CheckIndexedDraw(p_type,p_base_vertex,p_min_index,p_num_vertices,p_start_index,p_prim_count))
+   {
+      return E_INVALIDARG;
+   }
+
+   m_raster.DrawIndexedTriangleList(GetVertices(p_base_vertex,p_min_index,p_num_vertices),m_indices->GetData(),
+                                    (int)m_indices->GetIndexSize(),p_min_index,p_num_vertices,p_start_index,
+                                    p_prim_count);
+
+   return S_OK;
+}
+
+HRESULT SoftDevice::DrawIndexedInstanced(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                         UINT p_num_vertices, UINT p_start_index, UINT p_prim_count,
+                                         const rd_instance *p_instances, UINT p_instance_count){
+
+   if(!CheckIndexedDraw(p_type,p_base_vertex,p_min_index,p_num_vertices,p_start_index,p_prim_count) ||
+      (p_instances == NULL && p_instance_count))
+   {
+      return E_INVALIDARG;
+   }
+
+   m_raster.DrawIndexedTriangleListInstanced(GetVertices(p_base_vertex,p_min_index,p_num_vertices),
+                                             m_indices->GetData(),(int)m_indices->GetIndexSize(),p_min_index,
+                                             p_num_vertices,p_start_index,p_prim_count,
+                                             (const sr_instance *)p_instances,p_instance_count);
+
+   return S_OK;
+}
+//******************************************************************************************
+// Function:DrawGlyphs
+// Whazzit:Turns the quads back into pixel rectangles.  Their edges sit half a pixel off
+//         the centres, so rounding up gives the first pixel in and the first one out.
+//******************************************************************************************
+HRESULT SoftDevice::DrawGlyphs(RenderTexture *p_atlas, RenderBuffer *p_vertices, UINT p_start_vertex,
+                               UINT p_glyph_count){
+const SysMemTexture *atlas=(const SysMemTexture *)p_atlas;
+const SysMemBuffer *buffer=(const SysMemBuffer *)p_vertices;
+const rd_glyph_vertex *quad;
+
+   if(atlas == NULL || buffer == NULL ||
+      (unsigned long long)(p_start_vertex + (unsigned long long)p_glyph_count * RD_GLYPH_CORNERS) *
+      sizeof(rd_glyph_vertex) > buffer->GetSize())
+   {
+      return E_INVALIDARG;
+   }
+
+   m_glyphs.resize(p_glyph_count);
+   quad=(const rd_glyph_vertex *)buffer->GetData() + p_start_vertex;
+   for(UINT i=0;i<p_glyph_count;i++,quad+=RD_GLYPH_CORNERS)
+   {
+      sr_glyph &glyph=m_glyphs[i];
+
+      glyph.x0=(int)ceilf(quad[RD_GLYPH_TOP_LEFT].x);
+      glyph.y0=(int)ceilf(quad[RD_GLYPH_TOP_LEFT].y);
+      glyph.x1=(int)ceilf(quad[RD_GLYPH_BOTTOM_RIGHT].x);
+      glyph.y1=(int)ceilf(quad[RD_GLYPH_BOTTOM_RIGHT].y);
+      glyph.u=(int)(quad[RD_GLYPH_TOP_LEFT].u * atlas->GetWidth() + 0.5f);
+      glyph.v=(int)(quad[RD_GLYPH_TOP_LEFT].v * atlas->GetHeight() + 0.5f);
+      glyph.colour=quad[RD_GLYPH_TOP_LEFT].colour;
+   }
+
+   if(p_glyph_count)
+   {
+      m_raster.DrawGlyphs(&m_glyphs[0],p_glyph_count,atlas->GetData(),(int)atlas->GetWidth());
+   }
+
+   return S_OK;
+}
@@ -0,0 +1,90 @@
+//
+// soft_device.h - RenderDevice backed by the software rasterizer
+//
+// Runs anywhere, no GPU or D3D runtime needed.  On Windows Present can copy the
+// framebuffer to a window, otherwise it just finishes the frame in memory.
+//
+#ifndef SOFT_DEVICE_H
+#define SOFT_DEVICE_H
+
+#include "render_device.h"
+#include "soft_raster.h"
+
+class SysMemBuffer;
+
+class SoftDevice : public RenderDevice
+{
+public:
+   //p_threads of 0 uses one thread per core
+   SoftDevice(int p_width, int p_height, int p_threads=0);
+
+#ifdef _WIN32
+   void SetPresentWindow(HWND p_window) { m_window=p_window; }
+#endif
+
+   virtual const char *GetName(void) const { return "soft"; }
+   virtual bool CanQuantize(void) { return true; }
+   virtual HRESULT TestCooperativeLevel(void) { return S_OK; }
+
+   virtual HRESULT CreateVertexBuffer(UINT p_length, DWORD p_usage, DWORD p_fvf, rd_pool p_pool,
+                                      RenderBuffer **p_buffer);
+   virtual HRESULT CreateIndexBuffer(UINT p_length, DWORD p_usage, rd_format p_format, rd_pool p_pool,
+                                     RenderBuffer **p_buffer);
+   virtual HRESULT CreateTexture(UINT p_width, UINT p_height, RenderTexture **p_texture);
+
+   virtual HRESULT Clear(DWORD p_colour);
+   virtual HRESULT BeginScene(void) { return S_OK; }
+   virtual HRESULT EndScene(void) { return S_OK; }
+   virtual HRESULT Present(void);
+
+   virtual HRESULT SetTransform(rd_transform p_which, const float *p_matrix);
+   virtual HRESULT SetRenderState(rd_render_state p_state, DWORD p_value);
+   virtual HRESULT SetFVF(DWORD p_fvf) { m_fvf=p_fvf; return S_OK; }
+   virtual HRESULT SetQuantization(const rd_quantization *p_quant);
+   virtual HRESULT SetStreamSource(UINT p_stream, RenderBuffer *p_buffer, UINT p_offset, UINT p_stride);
+   virtual HRESULT DrawPrimitive(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count);
+   virtual HRESULT DrawInstanced(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count,
+                                 const rd_instance *p_instances, UINT p_instance_count);
+   virtual HRESULT SetIndices(RenderBuffer *p_buffer) { m_indices=(SysMemBuffer *)p_buffer; return S_OK; }
+   virtual HRESULT DrawIndexedPrimitive(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                        UINT p_num_vertices, UINT p_start_index, UINT p_prim_count);
+   virtual HRESULT DrawIndexedInstanced(rd_primitive p_type, int p_base_vertex, UINT p_min_index,
+                                        UINT p_num_vertices, UINT p_start_index, UINT p_prim_count,
+                                        const rd_instance *p_instances, UINT p_instance_count);
+   virtual HRESULT DrawGlyphs(RenderTexture *p_atlas, RenderBuffer *p_vertices, UINT p_start_vertex,
+                              UINT p_glyph_count);
+
+   //Draws are transformed and binned at the call, so the buffers are free again as
+   //soon as it returns
+   virtual rd_fence InsertFence(void) { return ++m_fence; }
+   virtual bool FenceDone(rd_fence) { return true; }
+
+   SoftRaster &GetRaster(void) { return m_raster; }
+
+private:
+   bool CheckDraw(rd_primitive p_type, UINT p_start_vertex, UINT p_prim_count) const;
+   bool CheckIndexedDraw(rd_primitive p_type, int p_base_vertex, UINT p_min_index, UINT p_num_vertices,
+                         UINT p_start_index, UINT p_prim_count) const;
+   const tri_vertex *GetVertices(int p_base_vertex, UINT p_first, UINT p_count);
+
+   SoftRaster m_raster;
+   sr_state m_state;
+   DWORD m_fog_vertex_mode;
+   bool m_fog_enable;
+   DWORD m_fvf;
+   bool m_quantized;                 //m_quant has been set
+   rd_quantization m_quant;
+   std::vector<tri_vertex> m_decoded;   //Quantized draws' vertices, unpacked
+   SysMemBuffer *m_stream;
+   UINT m_stream_offset;
+   UINT m_stream_stride;
+   SysMemBuffer *m_indices;
+   rd_fence m_fence;
+   std::vector<sr_glyph> m_glyphs;   //Scratch for DrawGlyphs
+
+#ifdef _WIN32
+   HWND m_window;
+#endif
+};
+
+#endif
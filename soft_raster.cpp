@@ -0,0 +1,904 @@
+//
+// soft_raster.cpp - Multithreaded tile based software rasterizer
+//
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "soft_raster.h"
+#include "vec_math.h"
+
+const int g_tile_size = 64;
+const int g_subpixel_bits = 4;
+const int g_subpixel = 1 << g_subpixel_bits;
+
+//Triangles are clipped against |x|,|y| <= guard_band * w rather than the viewport,
+//that keeps fixed point coordinates small without clipping every edge triangle
+const float g_guard_band = 8.0f;
+
+//Marks a bin entry as a glyph
+const unsigned int g_sr_glyph_bit = 0x80000000u;
+
+//Reserved per frame up front
+const size_t g_sr_reserve_triangles = 16384;
+const size_t g_sr_reserve_glyphs = 8192;
+const size_t g_sr_reserve_bin = 2048;
+
+//******************************************************************************************
+// worker_pool
+// Persistent threads that sleep until Flush hands them a batch of tiles.  Tiles are
+// handed out through an atomic counter, the calling thread works on them too.
+//******************************************************************************************
+struct SoftRaster::worker_pool
+{
+   std::vector<std::thread> threads;
+   std::mutex lock;
+   std::condition_variable wake;
+   std::condition_variable done;
+   unsigned int generation;
+   int busy;
+   bool quit;
+   std::atomic<int> next_tile;
+   std::atomic<unsigned long long> pixels;
+};
+
+//Same evaluation order as the scene's own matrices, see vec_math.h
+static void matrix_multiply(sr_matrix *p_out, const sr_matrix &p_a, const sr_matrix &p_b){
+
+   vm_matrix_multiply((vm_matrix *)p_out,(const vm_matrix *)&p_a,(const vm_matrix *)&p_b);
+
+}
+
+static void matrix_identity(sr_matrix *p_out){
+
+   memset(p_out,0,sizeof(*p_out));
+   p_out->m[0][0]=p_out->m[1][1]=p_out->m[2][2]=p_out->m[3][3]=1.0f;
+
+}
+
+SoftRaster::SoftRaster(int p_width, int p_height, int p_threads) :
+   m_width(p_width),m_height(p_height),m_clear_colour(0),m_matrices_dirty(true)
+{
+
+   m_tiles_x=(m_width + g_tile_size - 1) / g_tile_size;
+   m_tiles_y=(m_height + g_tile_size - 1) / g_tile_size;
+   m_colour.resize((size_t)m_width * m_height,0);
+   m_bins.resize(m_tiles_x * m_tiles_y);
+   m_tile_clear.resize(m_tiles_x * m_tiles_y,0);
+
+   //Room for a typical frame up front, so a frame only allocates when it's the
+   //biggest yet
+   m_triangles.reserve(g_sr_reserve_triangles);
+   m_glyphs.reserve(g_sr_reserve_glyphs);
+   for(size_t i=0;i<m_bins.size();i++)
+   {
+      m_bins[i].reserve(g_sr_reserve_bin);
+   }
+
+   for(int i=0;i<3;i++)
+   {
+      matrix_identity(&m_transforms[i]);
+   }
+
+   //Same defaults as a freshly created D3D device
+   m_state.lighting=true;
+   m_state.fog_enable=false;
+   m_state.fog_colour=0;
+   m_state.fog_start=0.0f;
+   m_state.fog_end=1.0f;
+   m_state.cull=SR_CULL_CCW;
+
+   ResetStats();
+
+   if(p_threads <= 0)
+   {
+      p_threads=(int)std::thread::hardware_concurrency();
+      if(p_threads <= 0)
+      {
+         p_threads=1;
+      }
+   }
+   m_thread_count=p_threads;
+
+   m_pool=new worker_pool;
+   m_pool->generation=0;
+   m_pool->busy=0;
+   m_pool->quit=false;
+   m_pool->next_tile=0;
+   m_pool->pixels=0;
+
+   //The calling thread is one of the workers
+   for(int i=1;i<m_thread_count;i++)
+   {
+      m_pool->threads.push_back(std::thread(WorkerMain,this,i));
+   }
+
+}
+
+SoftRaster::~SoftRaster(void){
+
+   {
+      std::lock_guard<std::mutex> guard(m_pool->lock);
+      m_pool->quit=true;
+   }
+   m_pool->wake.notify_all();
+
+   for(size_t i=0;i<m_pool->threads.size();i++)
+   {
+      m_pool->threads[i].join();
+   }
+
+   delete m_pool;
+
+}
+
+void SoftRaster::ResetStats(void){
+
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+
+void SoftRaster::SetTransform(sr_transform p_which, const sr_matrix &p_matrix){
+
+   m_transforms[p_which]=p_matrix;
+   m_matrices_dirty=true;
+
+}
+
+void SoftRaster::UpdateMatrices(void){
+
+   if(m_matrices_dirty)
+   {
+      matrix_multiply(&m_world_view,m_transforms[SR_WORLD],m_transforms[SR_VIEW]);
+      matrix_multiply(&m_world_view_proj,m_world_view,m_transforms[SR_PROJECTION]);
+      m_matrices_dirty=false;
+   }
+
+}
+//******************************************************************************************
+// Function:Clear
+// Whazzit:The clear itself is deferred to the tiles so it runs in parallel and only
+//         touches each tile's memory once per frame.
+//******************************************************************************************
+void SoftRaster::Clear(DWORD p_colour){
+
+   if(!m_triangles.empty() || !m_glyphs.empty())
+   {
+      Flush();
+   }
+
+   m_clear_colour=p_colour;
+   memset(&m_tile_clear[0],1,m_tile_clear.size());
+
+}
+void SoftRaster::DrawTriangleList(const tri_vertex *p_vertices, size_t p_start_vertex,
+                                  size_t p_prim_count){
+shade_params shade;
+
+   UpdateMatrices();
+   InitShade(&shade,m_world_view_proj,m_world_view,0xFFFFFFFF);
+
+   TransformBatch(shade,p_vertices + p_start_vertex,p_prim_count);
+
+}
+
+void SoftRaster::DrawIndexedTriangleList(const tri_vertex *p_vertices, const void *p_indices, int p_index_size,
+                                         size_t p_min_index, size_t p_num_vertices, size_t p_start_index,
+                                         size_t p_prim_count){
+shade_params shade;
+
+   UpdateMatrices();
+   InitShade(&shade,m_world_view_proj,m_world_view,0xFFFFFFFF);
+
+   TransformIndexed(shade,p_vertices,p_indices,p_index_size,p_min_index,p_num_vertices,p_start_index,p_prim_count);
+
+}
+//******************************************************************************************
+// Function:InstanceMatrices
+// Whazzit:world*view*proj and the z column of world*view for one instance, given
+//         view*proj.  Fog only needs the camera space depth, so that is all of world*view
+//         we build.
+//******************************************************************************************
+void SoftRaster::InstanceMatrices(const sr_matrix &p_world, const sr_matrix &p_view_proj, sr_matrix *p_wvp,
+                                  sr_matrix *p_wv) const{
+const sr_matrix &view=m_transforms[SR_VIEW];
+
+   matrix_multiply(p_wvp,p_world,p_view_proj);
+
+   for(int r=0;r<4;r++)
+   {
+      p_wv->m[r][2]=p_world.m[r][0] * view.m[0][2] + p_world.m[r][1] * view.m[1][2] +
+                    p_world.m[r][2] * view.m[2][2] + p_world.m[r][3] * view.m[3][2];
+   }
+
+}
+//******************************************************************************************
+// Function:DrawTriangleListInstanced
+// Whazzit:One pass over all the instances.  View*projection is built once, then each
+//         instance only costs a world*viewproj multiply before its vertices go through
+//         the same transform/fog/clip/bin path as a normal draw.
+//******************************************************************************************
+void SoftRaster::DrawTriangleListInstanced(const tri_vertex *p_vertices, size_t p_start_vertex,
+                                           size_t p_prim_count, const sr_instance *p_instances,
+                                           size_t p_instance_count){
+sr_matrix view_proj;
+sr_matrix wvp;
+sr_matrix wv;
+shade_params shade;
+
+   matrix_multiply(&view_proj,m_transforms[SR_VIEW],m_transforms[SR_PROJECTION]);
+
+   for(size_t i=0;i<p_instance_count;i++)
+   {
+      InstanceMatrices(p_instances[i].world,view_proj,&wvp,&wv);
+      InitShade(&shade,wvp,wv,p_instances[i].tint);
+      TransformBatch(shade,p_vertices + p_start_vertex,p_prim_count);
+   }
+
+}
+
+void SoftRaster::DrawIndexedTriangleListInstanced(const tri_vertex *p_vertices, const void *p_indices,
+                                                  int p_index_size, size_t p_min_index, size_t p_num_vertices,
+                                                  size_t p_start_index, size_t p_prim_count,
+                                                  const sr_instance *p_instances, size_t p_instance_count){
+sr_matrix view_proj;
+sr_matrix wvp;
+sr_matrix wv;
+shade_params shade;
+
+   matrix_multiply(&view_proj,m_transforms[SR_VIEW],m_transforms[SR_PROJECTION]);
+
+   for(size_t i=0;i<p_instance_count;i++)
+   {
+      InstanceMatrices(p_instances[i].world,view_proj,&wvp,&wv);
+      InitShade(&shade,wvp,wv,p_instances[i].tint);
+      TransformIndexed(shade,p_vertices,p_indices,p_index_size,p_min_index,p_num_vertices,p_start_index,
+                       p_prim_count);
+   }
+
+}
+//******************************************************************************************
+// Function:InitShade
+// Whazzit:Everything ShadeVertex needs that is the same for the whole draw
+//******************************************************************************************
+void SoftRaster::InitShade(shade_params *p_shade, const sr_matrix &p_wvp, const sr_matrix &p_wv,
+                           DWORD p_tint) const{
+
+   p_shade->wvp=&p_wvp;
+   p_shade->wv=&p_wv;
+
+   p_shade->tinted=p_tint != 0xFFFFFFFF;
+   p_shade->tint[0]=(float)((p_tint >> 16) & 0xFF) / 255.0f;
+   p_shade->tint[1]=(float)((p_tint >> 8) & 0xFF) / 255.0f;
+   p_shade->tint[2]=(float)(p_tint & 0xFF) / 255.0f;
+   p_shade->tint[3]=(float)((p_tint >> 24) & 0xFF) / 255.0f;
+
+   p_shade->fog_colour[0]=(float)((m_state.fog_colour >> 16) & 0xFF);
+   p_shade->fog_colour[1]=(float)((m_state.fog_colour >> 8) & 0xFF);
+   p_shade->fog_colour[2]=(float)(m_state.fog_colour & 0xFF);
+   p_shade->fog_colour[3]=(float)((m_state.fog_colour >> 24) & 0xFF);
+   p_shade->fog_scale=m_state.fog_end != m_state.fog_start ? 1.0f / (m_state.fog_end - m_state.fog_start) : 0.0f;
+
+}
+//******************************************************************************************
+// Function:ShadeVertex
+// Whazzit:Vertex stage.  Transforms to clip space and applies the tint and vertex fog to
+//         the colour.  Returns false if the vertex is outside the near/far planes or the
+//         guard band, so the triangle needs clipping.  Only the z column of wv is used.
+//******************************************************************************************
+inline bool SoftRaster::ShadeVertex(const shade_params &p_shade, const tri_vertex &p_src, clip_vertex *p_out){
+const sr_matrix &wvp=*p_shade.wvp;
+const sr_matrix &wv=*p_shade.wv;
+clip_vertex &v=*p_out;
+
+   for(int c=0;c<4;c++)
+   {
+      v.pos[c]=p_src.x * wvp.m[0][c] + p_src.y * wvp.m[1][c] + p_src.z * wvp.m[2][c] + wvp.m[3][c];
+   }
+
+   v.colour[0]=(float)((p_src.colour >> 16) & 0xFF);
+   v.colour[1]=(float)((p_src.colour >> 8) & 0xFF);
+   v.colour[2]=(float)(p_src.colour & 0xFF);
+   v.colour[3]=(float)((p_src.colour >> 24) & 0xFF);
+
+   if(m_state.lighting)
+   {
+      v.colour[0]=v.colour[1]=v.colour[2]=0.0f;
+   }
+   else if(p_shade.tinted)
+   {
+      for(int c=0;c<4;c++)
+      {
+         v.colour[c]*=p_shade.tint[c];
+      }
+   }
+
+   //Linear fog on the camera space depth, blended per vertex like D3D's vertex fog
+   if(m_state.fog_enable)
+   {
+      float depth=p_src.x * wv.m[0][2] + p_src.y * wv.m[1][2] + p_src.z * wv.m[2][2] + wv.m[3][2];
+      float f=(m_state.fog_end - depth) * p_shade.fog_scale;
+      f=f < 0.0f ? 0.0f : (f > 1.0f ? 1.0f : f);
+      for(int c=0;c<3;c++)
+      {
+         v.colour[c]=v.colour[c] * f + p_shade.fog_colour[c] * (1.0f - f);
+      }
+   }
+
+   m_stats.vertices_shaded++;
+
+   const float gw=v.pos[3] * g_guard_band;
+
+   return !(v.pos[2] < 0.0f || v.pos[2] > v.pos[3] || v.pos[0] < -gw || v.pos[0] > gw ||
+            v.pos[1] < -gw || v.pos[1] > gw);
+}
+//******************************************************************************************
+// Function:TransformBatch
+// Whazzit:Non-indexed triangles: every vertex is shaded once per triangle that uses it,
+//         then the triangle is culled, clipped and binned.
+//******************************************************************************************
+void SoftRaster::TransformBatch(const shade_params &p_shade, const tri_vertex *p_vertices, size_t p_prim_count){
+const tri_vertex *src=p_vertices;
+clip_vertex verts[3];
+
+   m_stats.triangles_in+=(unsigned int)p_prim_count;
+
+   for(size_t t=0;t<p_prim_count;t++,src+=3)
+   {
+      bool inside=ShadeVertex(p_shade,src[0],&verts[0]);
+      inside&=ShadeVertex(p_shade,src[1],&verts[1]);
+      inside&=ShadeVertex(p_shade,src[2],&verts[2]);
+
+      if(inside)
+      {
+         SetupTriangle(&verts[0],&verts[1],&verts[2]);
+      }
+      else
+      {
+         m_stats.triangles_clipped++;
+         ClipTriangle(verts);
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:TransformIndexed
+// Whazzit:Indexed triangles: the vertex range is shaded once up front, which is the
+//         post-transform cache taken to its limit, then the triangles pick the results up
+//         by index.  Triangles with an index outside the range are dropped.
+//******************************************************************************************
+void SoftRaster::TransformIndexed(const shade_params &p_shade, const tri_vertex *p_vertices, const void *p_indices,
+                                  int p_index_size, size_t p_min_index, size_t p_num_vertices, size_t p_start_index,
+                                  size_t p_prim_count){
+const unsigned short *indices16=(const unsigned short *)p_indices + p_start_index;
+const unsigned int *indices32=(const unsigned int *)p_indices + p_start_index;
+clip_vertex verts[3];
+size_t index[3];
+
+   if(m_shaded.size() < p_num_vertices)
+   {
+      m_shaded.resize(p_num_vertices);
+      m_shaded_inside.resize(p_num_vertices);
+   }
+
+   for(size_t i=0;i<p_num_vertices;i++)
+   {
+      m_shaded_inside[i]=ShadeVertex(p_shade,p_vertices[p_min_index + i],&m_shaded[i]);
+   }
+
+   m_stats.triangles_in+=(unsigned int)p_prim_count;
+
+   for(size_t t=0;t<p_prim_count;t++)
+   {
+      for(int i=0;i<3;i++)
+      {
+         index[i]=(p_index_size == 2 ? indices16[t * 3 + i] : indices32[t * 3 + i]) - p_min_index;
+      }
+
+      if(index[0] >= p_num_vertices || index[1] >= p_num_vertices || index[2] >= p_num_vertices)
+      {
+         continue;
+      }
+
+      if(m_shaded_inside[index[0]] && m_shaded_inside[index[1]] && m_shaded_inside[index[2]])
+      {
+         SetupTriangle(&m_shaded[index[0]],&m_shaded[index[1]],&m_shaded[index[2]]);
+      }
+      else
+      {
+         verts[0]=m_shaded[index[0]];
+         verts[1]=m_shaded[index[1]];
+         verts[2]=m_shaded[index[2]];
+         m_stats.triangles_clipped++;
+         ClipTriangle(verts);
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:ClipTriangle
+// Whazzit:Sutherland-Hodgman against near, far and the guard band, then fans the result.
+//******************************************************************************************
+void SoftRaster::ClipTriangle(const clip_vertex *p_verts){
+clip_vertex buffer_a[9];
+clip_vertex buffer_b[9];
+clip_vertex *in=buffer_a;
+clip_vertex *out=buffer_b;
+int count=3;
+
+   in[0]=p_verts[0];
+   in[1]=p_verts[1];
+   in[2]=p_verts[2];
+
+   for(int plane=0;plane<6 && count >= 3;plane++)
+   {
+      int out_count=0;
+      float d_prev=0.0f;
+
+      for(int i=0;i<=count;i++)
+      {
+         const clip_vertex &v=in[i % count];
+         float d;
+
+         //Signed distance, >= 0 is inside
+         switch(plane)
+         {
+            case 0:  d=v.pos[2]; break;                                  //near z >= 0
+            case 1:  d=v.pos[3] - v.pos[2]; break;                       //far  z <= w
+            case 2:  d=v.pos[3] * g_guard_band + v.pos[0]; break;
+            case 3:  d=v.pos[3] * g_guard_band - v.pos[0]; break;
+            case 4:  d=v.pos[3] * g_guard_band + v.pos[1]; break;
+            default: d=v.pos[3] * g_guard_band - v.pos[1]; break;
+         }
+
+         if(i > 0)
+         {
+            const clip_vertex &p=in[i - 1];
+            if((d_prev >= 0.0f) != (d >= 0.0f))
+            {
+               float t=d_prev / (d_prev - d);
+               clip_vertex &n=out[out_count++];
+               for(int c=0;c<4;c++)
+               {
+                  n.pos[c]=p.pos[c] + (v.pos[c] - p.pos[c]) * t;
+                  n.colour[c]=p.colour[c] + (v.colour[c] - p.colour[c]) * t;
+               }
+            }
+         }
+
+         if(i < count && d >= 0.0f)
+         {
+            out[out_count++]=v;
+         }
+
+         d_prev=d;
+      }
+
+      count=out_count;
+      clip_vertex *swap=in;
+      in=out;
+      out=swap;
+   }
+
+   for(int i=1;i + 1<count;i++)
+   {
+      SetupTriangle(&in[0],&in[i],&in[i + 1]);
+   }
+
+}
+//******************************************************************************************
+// Function:SetupTriangle
+// Whazzit:Perspective divide, viewport transform, snap to the subpixel grid, cull, then
+//         add the triangle to every tile its bounding box touches.
+//******************************************************************************************
+void SoftRaster::SetupTriangle(const clip_vertex *p_v0, const clip_vertex *p_v1, const clip_vertex *p_v2){
+const clip_vertex *src[3]={ p_v0,p_v1,p_v2 };
+triangle tri;
+long long area;
+
+   for(int i=0;i<3;i++)
+   {
+      float inv_w=1.0f / src[i]->pos[3];
+      float sx=(src[i]->pos[0] * inv_w + 1.0f) * 0.5f * (float)m_width;
+      float sy=(1.0f - src[i]->pos[1] * inv_w) * 0.5f * (float)m_height;
+
+      tri.x[i]=(long long)floorf(sx * g_subpixel + 0.5f);
+      tri.y[i]=(long long)floorf(sy * g_subpixel + 0.5f);
+      tri.inv_w[i]=inv_w;
+      for(int c=0;c<4;c++)
+      {
+         tri.colour[i][c]=src[i]->colour[c] * inv_w;
+      }
+   }
+
+   //Positive area is clockwise on screen (y points down)
+   area=(tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+
+   if(area == 0 ||
+      (m_state.cull == SR_CULL_CCW && area < 0) ||
+      (m_state.cull == SR_CULL_CW && area > 0))
+   {
+      m_stats.triangles_culled++;
+      return;
+   }
+
+   //The rasterizer wants clockwise triangles, flip the rest
+   if(area < 0)
+   {
+      long long tx=tri.x[1]; tri.x[1]=tri.x[2]; tri.x[2]=tx;
+      long long ty=tri.y[1]; tri.y[1]=tri.y[2]; tri.y[2]=ty;
+      float tw=tri.inv_w[1]; tri.inv_w[1]=tri.inv_w[2]; tri.inv_w[2]=tw;
+      for(int c=0;c<4;c++)
+      {
+         float tc=tri.colour[1][c]; tri.colour[1][c]=tri.colour[2][c]; tri.colour[2][c]=tc;
+      }
+   }
+
+   tri.inv_area=1.0f / (float)(area < 0 ? -area : area);
+
+   //Pixel centres are at integer coordinates, as in D3D9
+   long long min_x=tri.x[0],max_x=tri.x[0],min_y=tri.y[0],max_y=tri.y[0];
+   for(int i=1;i<3;i++)
+   {
+      if(tri.x[i] < min_x) min_x=tri.x[i];
+      if(tri.x[i] > max_x) max_x=tri.x[i];
+      if(tri.y[i] < min_y) min_y=tri.y[i];
+      if(tri.y[i] > max_y) max_y=tri.y[i];
+   }
+   min_x=(min_x + g_subpixel - 1) >> g_subpixel_bits;
+   min_y=(min_y + g_subpixel - 1) >> g_subpixel_bits;
+   max_x=max_x >> g_subpixel_bits;
+   max_y=max_y >> g_subpixel_bits;
+   if(min_x < 0) min_x=0;
+   if(min_y < 0) min_y=0;
+   if(max_x > m_width - 1) max_x=m_width - 1;
+   if(max_y > m_height - 1) max_y=m_height - 1;
+   if(min_x > max_x || min_y > max_y)
+   {
+      m_stats.triangles_culled++;
+      return;
+   }
+
+   tri.min_x=(int)min_x;
+   tri.min_y=(int)min_y;
+   tri.max_x=(int)max_x;
+   tri.max_y=(int)max_y;
+
+   unsigned int index=(unsigned int)m_triangles.size();
+   m_triangles.push_back(tri);
+   m_stats.triangles_binned++;
+
+   for(int ty=tri.min_y / g_tile_size;ty<=tri.max_y / g_tile_size;ty++)
+   {
+      for(int tx=tri.min_x / g_tile_size;tx<=tri.max_x / g_tile_size;tx++)
+      {
+         m_bins[ty * m_tiles_x + tx].push_back(index);
+         m_stats.bin_entries++;
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:DrawGlyphs
+// Whazzit:Clips each glyph to the target, moving its atlas corner along with it, and bins
+//         it to every tile it touches
+//******************************************************************************************
+void SoftRaster::DrawGlyphs(const sr_glyph *p_glyphs, size_t p_count, const BYTE *p_atlas, int p_pitch){
+
+   for(size_t i=0;i<p_count;i++)
+   {
+      glyph_entry entry={ p_glyphs[i],p_atlas,p_pitch };
+      sr_glyph &glyph=entry.glyph;
+      unsigned int index;
+
+      if(glyph.x0 < 0)
+      {
+         glyph.u-=glyph.x0;
+         glyph.x0=0;
+      }
+      if(glyph.y0 < 0)
+      {
+         glyph.v-=glyph.y0;
+         glyph.y0=0;
+      }
+      glyph.x1=glyph.x1 < m_width ? glyph.x1 : m_width;
+      glyph.y1=glyph.y1 < m_height ? glyph.y1 : m_height;
+      if(glyph.x0 >= glyph.x1 || glyph.y0 >= glyph.y1)
+      {
+         continue;
+      }
+
+      index=(unsigned int)m_glyphs.size() | g_sr_glyph_bit;
+      m_glyphs.push_back(entry);
+      m_stats.glyphs++;
+
+      for(int ty=glyph.y0 / g_tile_size;ty<=(glyph.y1 - 1) / g_tile_size;ty++)
+      {
+         for(int tx=glyph.x0 / g_tile_size;tx<=(glyph.x1 - 1) / g_tile_size;tx++)
+         {
+            m_bins[ty * m_tiles_x + tx].push_back(index);
+            m_stats.bin_entries++;
+         }
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:BlendGlyph
+// Whazzit:The part of one glyph inside [p_x0,p_x1] x [p_y0,p_y1], colour over target by
+//         coverage times the colour's alpha
+//******************************************************************************************
+void SoftRaster::BlendGlyph(size_t p_index, int p_x0, int p_y0, int p_x1, int p_y1, unsigned long long *p_pixels){
+const glyph_entry &entry=m_glyphs[p_index];
+const sr_glyph &glyph=entry.glyph;
+const int x0=glyph.x0 > p_x0 ? glyph.x0 : p_x0;
+const int x1=glyph.x1 - 1 < p_x1 ? glyph.x1 - 1 : p_x1;
+const int y0=glyph.y0 > p_y0 ? glyph.y0 : p_y0;
+const int y1=glyph.y1 - 1 < p_y1 ? glyph.y1 - 1 : p_y1;
+const unsigned int alpha=glyph.colour >> 24;
+const unsigned int src_r=(glyph.colour >> 16) & 0xFF;
+const unsigned int src_g=(glyph.colour >> 8) & 0xFF;
+const unsigned int src_b=glyph.colour & 0xFF;
+
+   for(int y=y0;y<=y1;y++)
+   {
+      const BYTE *texels=entry.atlas + (size_t)(glyph.v + y - glyph.y0) * entry.pitch + glyph.u - glyph.x0;
+      DWORD *row=&m_colour[(size_t)y * m_width];
+
+      for(int x=x0;x<=x1;x++)
+      {
+         //0..255*255, so the blend stays in integers
+         const unsigned int a=texels[x] * alpha;
+         const DWORD dst=row[x];
+
+         if(a == 0)
+         {
+            continue;
+         }
+
+         row[x]=(((((dst >> 16) & 0xFF) * (65025 - a) + src_r * a) / 65025) << 16) |
+                (((((dst >> 8) & 0xFF) * (65025 - a) + src_g * a) / 65025) << 8) |
+                (((dst & 0xFF) * (65025 - a) + src_b * a) / 65025) | (dst & 0xFF000000);
+         (*p_pixels)++;
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:RasterTile
+// Whazzit:Half-space rasterization of every triangle binned to one tile, in submission
+//         order.  Edge functions are stepped in 64 bit fixed point with the top-left fill
+//         rule, colours are interpolated with perspective correction.  Glyphs are
+//         blended in where they fall in the order.
+//******************************************************************************************
+void SoftRaster::RasterTile(int p_tile, unsigned long long *p_pixels){
+const int tile_x0=(p_tile % m_tiles_x) * g_tile_size;
+const int tile_y0=(p_tile / m_tiles_x) * g_tile_size;
+const int tile_x1=(tile_x0 + g_tile_size < m_width ? tile_x0 + g_tile_size : m_width) - 1;
+const int tile_y1=(tile_y0 + g_tile_size < m_height ? tile_y0 + g_tile_size : m_height) - 1;
+std::vector<unsigned int> &bin=m_bins[p_tile];
+unsigned long long pixels=0;
+
+   if(m_tile_clear[p_tile])
+   {
+      for(int y=tile_y0;y<=tile_y1;y++)
+      {
+         DWORD *row=&m_colour[(size_t)y * m_width];
+         for(int x=tile_x0;x<=tile_x1;x++)
+         {
+            row[x]=m_clear_colour;
+         }
+      }
+      m_tile_clear[p_tile]=0;
+   }
+
+   for(size_t b=0;b<bin.size();b++)
+   {
+      if(bin[b] & g_sr_glyph_bit)
+      {
+         BlendGlyph(bin[b] & ~g_sr_glyph_bit,tile_x0,tile_y0,tile_x1,tile_y1,&pixels);
+         continue;
+      }
+
+      const triangle &tri=m_triangles[bin[b]];
+      const int x0=tri.min_x > tile_x0 ? tri.min_x : tile_x0;
+      const int x1=tri.max_x < tile_x1 ? tri.max_x : tile_x1;
+      const int y0=tri.min_y > tile_y0 ? tri.min_y : tile_y0;
+      const int y1=tri.max_y < tile_y1 ? tri.max_y : tile_y1;
+      long long step_x[3],step_y[3],row_e[3],bias[3];
+
+      if(x0 > x1 || y0 > y1)
+      {
+         continue;
+      }
+
+      //Edge i is opposite vertex i, so its value divided by the area is that vertex's
+      //barycentric weight
+      for(int e=0;e<3;e++)
+      {
+         const int a=(e + 1) % 3;
+         const int c=(e + 2) % 3;
+         const long long dx=tri.x[c] - tri.x[a];
+         const long long dy=tri.y[c] - tri.y[a];
+         const long long px=(long long)x0 << g_subpixel_bits;
+         const long long py=(long long)y0 << g_subpixel_bits;
+
+         row_e[e]=dx * (py - tri.y[a]) - dy * (px - tri.x[a]);
+         step_x[e]=-dy * g_subpixel;
+         step_y[e]=dx * g_subpixel;
+
+         //Top edge (flat, going right) or left edge (going up) owns its boundary pixels
+         const bool top_left=(dy == 0 && dx > 0) || dy < 0;
+         bias[e]=top_left ? 0 : 1;
+      }
+
+      const float inv_area=tri.inv_area;
+
+      for(int y=y0;y<=y1;y++)
+      {
+         DWORD *row=&m_colour[(size_t)y * m_width];
+         long long e0=row_e[0],e1=row_e[1],e2=row_e[2];
+
+         for(int x=x0;x<=x1;x++)
+         {
+            if(((e0 - bias[0]) | (e1 - bias[1]) | (e2 - bias[2])) >= 0)
+            {
+               const float l0=(float)e0 * inv_area;
+               const float l1=(float)e1 * inv_area;
+               const float l2=(float)e2 * inv_area;
+               const float w=1.0f / (l0 * tri.inv_w[0] + l1 * tri.inv_w[1] + l2 * tri.inv_w[2]);
+               DWORD out=0;
+
+               for(int c=0;c<4;c++)
+               {
+                  float v=(l0 * tri.colour[0][c] + l1 * tri.colour[1][c] + l2 * tri.colour[2][c]) * w;
+                  int iv=(int)(v + 0.5f);
+                  iv=iv < 0 ? 0 : (iv > 255 ? 255 : iv);
+                  out|=(DWORD)iv << (c == 3 ? 24 : 16 - c * 8);
+               }
+
+               row[x]=out;
+               pixels++;
+            }
+
+            e0+=step_x[0];
+            e1+=step_x[1];
+            e2+=step_x[2];
+         }
+
+         row_e[0]+=step_y[0];
+         row_e[1]+=step_y[1];
+         row_e[2]+=step_y[2];
+      }
+   }
+
+   bin.clear();
+   *p_pixels+=pixels;
+
+}
+//******************************************************************************************
+// Function:RunTiles
+// Whazzit:Grabs tiles until there are none left.  Runs on every worker and on the thread
+//         that called Flush.
+//******************************************************************************************
+void SoftRaster::RunTiles(void){
+const int tile_count=m_tiles_x * m_tiles_y;
+unsigned long long pixels=0;
+int tile;
+
+   while((tile=m_pool->next_tile.fetch_add(1)) < tile_count)
+   {
+      RasterTile(tile,&pixels);
+   }
+
+   m_pool->pixels+=pixels;
+
+}
+
+void SoftRaster::WorkerMain(SoftRaster *p_self, int){
+worker_pool *pool=p_self->m_pool;
+unsigned int seen=0;
+
+   for(;;)
+   {
+      {
+         std::unique_lock<std::mutex> guard(pool->lock);
+         pool->wake.wait(guard,[&]{ return pool->quit || pool->generation != seen; });
+         if(pool->quit)
+         {
+            return;
+         }
+         seen=pool->generation;
+      }
+
+      p_self->RunTiles();
+
+      {
+         std::lock_guard<std::mutex> guard(pool->lock);
+         pool->busy--;
+      }
+      pool->done.notify_one();
+   }
+
+}
+//******************************************************************************************
+// Function:Flush
+// Whazzit:Rasterizes all binned triangles across the worker threads and resets the bins
+//         for the next batch.
+//******************************************************************************************
+void SoftRaster::Flush(void){
+
+   m_pool->next_tile=0;
+   m_pool->pixels=0;
+
+   if(!m_pool->threads.empty())
+   {
+      {
+         std::lock_guard<std::mutex> guard(m_pool->lock);
+         m_pool->busy=(int)m_pool->threads.size();
+         m_pool->generation++;
+      }
+      m_pool->wake.notify_all();
+   }
+
+   RunTiles();
+
+   if(!m_pool->threads.empty())
+   {
+      std::unique_lock<std::mutex> guard(m_pool->lock);
+      m_pool->done.wait(guard,[&]{ return m_pool->busy == 0; });
+   }
+
+   m_stats.pixels+=m_pool->pixels;
+   m_triangles.clear();
+   m_glyphs.clear();
+
+}
+
+unsigned int SoftRaster::GetChecksum(void) const{
+unsigned int hash=2166136261u;
+
+   for(size_t i=0;i<m_colour.size();i++)
+   {
+      DWORD v=m_colour[i];
+      for(int b=0;b<4;b++)
+      {
+         hash=(hash ^ ((v >> (b * 8)) & 0xFF)) * 16777619u;
+      }
+   }
+
+   return hash;
+}
+//******************************************************************************************
+// Function:WriteTGA
+// Whazzit:Dumps the framebuffer as an uncompressed 32-bit TGA so it can be inspected
+//******************************************************************************************
+bool SoftRaster::WriteTGA(const char *p_filename) const{
+unsigned char header[18];
+FILE *file;
+
+   file=fopen(p_filename,"wb");
+   if(file == NULL)
+   {
+      return false;
+   }
+
+   memset(header,0,sizeof(header));
+   header[2]=2;                              //Uncompressed true colour
+   header[12]=(unsigned char)(m_width & 0xFF);
+   header[13]=(unsigned char)(m_width >> 8);
+   header[14]=(unsigned char)(m_height & 0xFF);
+   header[15]=(unsigned char)(m_height >> 8);
+   header[16]=32;
+   header[17]=0x20 | 8;                      //Top-left origin, 8 alpha bits
+
+   fwrite(header,1,sizeof(header),file);
+   //X8R8G8B8 in little endian memory is already the B,G,R,A order TGA wants
+   fwrite(&m_colour[0],4,m_colour.size(),file);
+   fclose(file);
+
+   return true;
+}
@@ -0,0 +1,204 @@
+//
+// soft_raster.h - Multithreaded tile based software rasterizer
+//
+// Consumes the same untransformed XYZ|DIFFUSE triangle lists we hand to D3D, applies
+// the world/view/projection transforms, CCW/CW culling and linear vertex fog the way
+// the fixed function pipeline does, and rasterizes into an in-memory X8R8G8B8
+// framebuffer.  Triangles are binned into screen tiles as they are submitted and
+// the tiles are rasterized in parallel when the frame is flushed.  Draw order is
+// preserved within each tile, and like our D3D device there is no depth buffer.
+//
+// Text comes in as glyphs, screen aligned rectangles of an 8 bit coverage atlas that
+// are binned alongside the triangles and blended over them in the same order.
+//
+#ifndef SOFT_RASTER_H
+#define SOFT_RASTER_H
+
+#include <stddef.h>
+#include <vector>
+#include "vertex.h"
+
+//Row-major, row vector matrix: the same memory layout as D3DXMATRIX
+struct sr_matrix
+{
+   float m[4][4];
+};
+
+//One copy of the mesh for DrawTriangleListInstanced
+struct sr_instance
+{
+   sr_matrix world;
+   DWORD tint;   //ARGB, multiplied with the vertex colour
+};
+
+enum sr_transform
+{
+   SR_WORLD,
+   SR_VIEW,
+   SR_PROJECTION
+};
+
+enum sr_cull
+{
+   SR_CULL_NONE,
+   SR_CULL_CW,
+   SR_CULL_CCW
+};
+
+//The subset of fixed function state we emulate
+struct sr_state
+{
+   bool lighting;          //Lit with no lights set, so only the vertex alpha survives
+   bool fog_enable;
+   DWORD fog_colour;
+   float fog_start;
+   float fog_end;
+   sr_cull cull;
+};
+
+//A screen aligned rectangle of atlas coverage, blended over the target
+struct sr_glyph
+{
+   int x0, y0, x1, y1;   //Pixels covered, x1 and y1 exclusive
+   int u, v;             //Atlas texel that lands on x0,y0
+   DWORD colour;         //ARGB, the alpha scales the coverage
+};
+
+struct sr_stats
+{
+   unsigned int triangles_in;
+   unsigned int vertices_shaded;     //Per triangle corner when not indexed, per vertex when indexed
+   unsigned int triangles_culled;
+   unsigned int triangles_clipped;   //Needed clipping against the near/far/guard band planes
+   unsigned int triangles_binned;
+   unsigned int bin_entries;
+   unsigned int glyphs;
+   unsigned long long pixels;
+};
+
+class SoftRaster
+{
+public:
+   //p_threads of 0 uses one thread per core
+   SoftRaster(int p_width, int p_height, int p_threads=0);
+   ~SoftRaster(void);
+
+   void SetTransform(sr_transform p_which, const sr_matrix &p_matrix);
+   const sr_matrix &GetTransform(sr_transform p_which) const { return m_transforms[p_which]; }
+   void SetState(const sr_state &p_state) { m_state=p_state; }
+   const sr_state &GetState(void) const { return m_state; }
+
+   //Clears the whole target, any draws queued so far are rasterized first
+   void Clear(DWORD p_colour);
+   //Transforms, culls, clips and bins p_prim_count triangles starting at p_start_vertex
+   void DrawTriangleList(const tri_vertex *p_vertices, size_t p_start_vertex, size_t p_prim_count);
+   //Draws the same range once per instance, replacing the world transform each time
+   void DrawTriangleListInstanced(const tri_vertex *p_vertices, size_t p_start_vertex, size_t p_prim_count,
+                                  const sr_instance *p_instances, size_t p_instance_count);
+   //Indexed versions.  p_vertices is already offset by the base vertex, p_index_size is 2
+   //or 4, and every index must fall in [p_min_index,p_min_index + p_num_vertices).  That
+   //range is transformed once per draw (or per instance) however often it is referenced.
+   void DrawIndexedTriangleList(const tri_vertex *p_vertices, const void *p_indices, int p_index_size,
+                                size_t p_min_index, size_t p_num_vertices, size_t p_start_index,
+                                size_t p_prim_count);
+   void DrawIndexedTriangleListInstanced(const tri_vertex *p_vertices, const void *p_indices, int p_index_size,
+                                         size_t p_min_index, size_t p_num_vertices, size_t p_start_index,
+                                         size_t p_prim_count, const sr_instance *p_instances,
+                                         size_t p_instance_count);
+   //Blends p_count glyphs over everything drawn before them, one texel of p_atlas (rows
+   //p_pitch bytes apart) to a pixel.  The atlas has to stay put until the Flush.
+   void DrawGlyphs(const sr_glyph *p_glyphs, size_t p_count, const BYTE *p_atlas, int p_pitch);
+   //Rasterizes everything binned so far.  Call it at the end of a frame (Present).
+   void Flush(void);
+
+   const DWORD *GetFramebuffer(void) const { return &m_colour[0]; }
+   int GetWidth(void) const { return m_width; }
+   int GetHeight(void) const { return m_height; }
+   int GetThreadCount(void) const { return m_thread_count; }
+
+   const sr_stats &GetStats(void) const { return m_stats; }
+   void ResetStats(void);
+
+   //FNV-1a hash of the framebuffer, handy for regression tests
+   unsigned int GetChecksum(void) const;
+   bool WriteTGA(const char *p_filename) const;
+
+   //A triangle after setup, in 28.4 fixed point screen space
+   struct triangle
+   {
+      long long x[3], y[3];
+      float inv_w[3];
+      float colour[3][4];   //r,g,b,a premultiplied by inv_w for perspective correction
+      float inv_area;
+      int min_x, min_y, max_x, max_y;
+   };
+
+private:
+   SoftRaster(const SoftRaster &);
+   SoftRaster &operator=(const SoftRaster &);
+
+   struct clip_vertex
+   {
+      float pos[4];
+      float colour[4];
+   };
+
+   //Per draw constants for ShadeVertex
+   struct shade_params
+   {
+      const sr_matrix *wvp;
+      const sr_matrix *wv;
+      float tint[4];
+      bool tinted;
+      float fog_colour[4];
+      float fog_scale;
+   };
+
+   void UpdateMatrices(void);
+   void InstanceMatrices(const sr_matrix &p_world, const sr_matrix &p_view_proj, sr_matrix *p_wvp,
+                         sr_matrix *p_wv) const;
+   void InitShade(shade_params *p_shade, const sr_matrix &p_wvp, const sr_matrix &p_wv, DWORD p_tint) const;
+   bool ShadeVertex(const shade_params &p_shade, const tri_vertex &p_src, clip_vertex *p_out);
+   void TransformBatch(const shade_params &p_shade, const tri_vertex *p_vertices, size_t p_prim_count);
+   void TransformIndexed(const shade_params &p_shade, const tri_vertex *p_vertices, const void *p_indices,
+                         int p_index_size, size_t p_min_index, size_t p_num_vertices, size_t p_start_index,
+                         size_t p_prim_count);
+   void SetupTriangle(const clip_vertex *p_v0, const clip_vertex *p_v1, const clip_vertex *p_v2);
+   void ClipTriangle(const clip_vertex *p_verts);
+   void BlendGlyph(size_t p_index, int p_x0, int p_y0, int p_x1, int p_y1, unsigned long long *p_pixels);
+   void RasterTile(int p_tile, unsigned long long *p_pixels);
+   void RunTiles(void);
+
+   static void WorkerMain(SoftRaster *p_self, int p_index);
+
+   int m_width, m_height;
+   int m_tiles_x, m_tiles_y;
+   std::vector<DWORD> m_colour;
+   std::vector<triangle> m_triangles;
+   //Bin entries with g_sr_glyph_bit set index m_glyphs rather than m_triangles
+   struct glyph_entry
+   {
+      sr_glyph glyph;
+      const BYTE *atlas;
+      int pitch;
+   };
+   std::vector<glyph_entry> m_glyphs;
+   std::vector< std::vector<unsigned int> > m_bins;
+   std::vector<char> m_tile_clear;
+   std::vector<clip_vertex> m_shaded;   //Scratch for indexed draws
+   std::vector<char> m_shaded_inside;
+   DWORD m_clear_colour;
+
+   sr_matrix m_transforms[3];
+   sr_matrix m_world_view;
+   sr_matrix m_world_view_proj;
+   bool m_matrices_dirty;
+   sr_state m_state;
+   sr_stats m_stats;
+
+   struct worker_pool;
+   worker_pool *m_pool;
+   int m_thread_count;
+};
+
+#endif
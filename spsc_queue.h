@@ -0,0 +1,69 @@
+//
+// spsc_queue.h - Fixed size lock-free queue for one producer thread and one consumer
+//
+// The producer only ever writes m_tail and the consumer only m_head, so neither needs
+// a lock or a compare-exchange: a release store publishes the slot it just filled or
+// emptied and the other side's acquire load sees it.  The two indices live on their
+// own cache lines so the threads don't fight over one.  Push fails when the queue is
+// full rather than waiting, it's up to the producer whether to drop or retry.
+//
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+
+//p_size must be a power of two, one slot is always left empty
+template<class T, unsigned int p_size>
+class SpscQueue
+{
+public:
+   SpscQueue(void) : m_head(0),m_tail(0) {}
+
+   //Producer only
+   bool Push(const T &p_item){
+   const unsigned int tail=m_tail.load(std::memory_order_relaxed);
+   const unsigned int next=(tail + 1) & (p_size - 1);
+
+      if(next == m_head.load(std::memory_order_acquire))
+      {
+         return false;
+      }
+
+      m_items[tail]=p_item;
+      m_tail.store(next,std::memory_order_release);
+
+      return true;
+   }
+
+   //Consumer only
+   bool Pop(T *p_item){
+   const unsigned int head=m_head.load(std::memory_order_relaxed);
+
+      if(head == m_tail.load(std::memory_order_acquire))
+      {
+         return false;
+      }
+
+      *p_item=m_items[head];
+      m_head.store((head + 1) & (p_size - 1),std::memory_order_release);
+
+      return true;
+   }
+
+   //Either side, only a snapshot
+   bool IsEmpty(void) const { return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire); }
+
+private:
+   SpscQueue(const SpscQueue &);
+   SpscQueue &operator=(const SpscQueue &);
+
+   static_assert((p_size & (p_size - 1)) == 0 && p_size >= 2,"SpscQueue size must be a power of two");
+
+   std::atomic<unsigned int> m_head;
+   char m_pad_head[64 - sizeof(std::atomic<unsigned int>)];
+   std::atomic<unsigned int> m_tail;
+   char m_pad_tail[64 - sizeof(std::atomic<unsigned int>)];
+   T m_items[p_size];
+};
+
+#endif
@@ -0,0 +1,82 @@
+//
+// sysmem_buffer.h - Vertex or index buffer kept in plain system memory
+//
+// Used by the backends that don't have a GPU behind them.  Lock hands back a pointer
+// straight into the buffer, the flags are accepted and ignored since nothing else
+// can be reading it at the same time.  SysMemTexture is the same for textures.
+//
+#ifndef SYSMEM_BUFFER_H
+#define SYSMEM_BUFFER_H
+
+#include <vector>
+#include "render_device.h"
+
+class SysMemBuffer : public RenderBuffer
+{
+public:
+   //p_lock_bytes, if not NULL, is incremented by the size of every Lock.  p_format is
+   //the index format for index buffers.
+   SysMemBuffer(UINT p_length, rd_pool p_pool, unsigned long long *p_lock_bytes=NULL,
+                rd_format p_format=RD_FMT_UNKNOWN) :
+      m_data(p_length),m_pool(p_pool),m_lock_bytes(p_lock_bytes),m_format(p_format) {}
+
+   virtual HRESULT Lock(UINT p_offset, UINT p_size, void **p_data, DWORD){
+
+      if(p_offset > m_data.size() || p_size > m_data.size() - p_offset)
+      {
+         return E_INVALIDARG;
+      }
+
+      if(m_lock_bytes)
+      {
+         *m_lock_bytes+=p_size ? p_size : (UINT)m_data.size() - p_offset;
+      }
+
+      *p_data=m_data.empty() ? NULL : &m_data[p_offset];
+
+      return S_OK;
+   }
+
+   virtual HRESULT Unlock(void) { return S_OK; }
+   virtual UINT GetSize(void) const { return (UINT)m_data.size(); }
+   virtual rd_pool GetPool(void) const { return m_pool; }
+   virtual void Release(void) { delete this; }
+
+   const BYTE *GetData(void) const { return m_data.empty() ? NULL : &m_data[0]; }
+   rd_format GetFormat(void) const { return m_format; }
+   //Bytes per index, 0 for a vertex buffer
+   UINT GetIndexSize(void) const { return m_format == RD_FMT_INDEX16 ? 2 : (m_format == RD_FMT_INDEX32 ? 4 : 0); }
+
+private:
+   std::vector<BYTE> m_data;
+   rd_pool m_pool;
+   unsigned long long *m_lock_bytes;
+   rd_format m_format;
+};
+
+class SysMemTexture : public RenderTexture
+{
+public:
+   SysMemTexture(UINT p_width, UINT p_height) :
+      m_data((size_t)p_width * p_height),m_width(p_width),m_height(p_height) {}
+
+   virtual HRESULT Lock(void **p_data, UINT *p_pitch){
+      *p_data=m_data.empty() ? NULL : &m_data[0];
+      *p_pitch=m_width;
+      return S_OK;
+   }
+   virtual HRESULT Unlock(void) { return S_OK; }
+   virtual UINT GetWidth(void) const { return m_width; }
+   virtual UINT GetHeight(void) const { return m_height; }
+   virtual void Release(void) { delete this; }
+
+   //Rows are GetWidth bytes apart
+   const BYTE *GetData(void) const { return m_data.empty() ? NULL : &m_data[0]; }
+
+private:
+   std::vector<BYTE> m_data;
+   UINT m_width;
+   UINT m_height;
+};
+
+#endif
@@ -0,0 +1,356 @@
+//
+// text_format.cpp - printf style formatting that never allocates, and a per frame arena
+//
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "text_format.h"
+
+//Past this many digits after the point %f is already noise
+const int g_tx_max_precision = 9;
+
+struct tx_writer
+{
+   char *out;
+   char *end;   //Room for the terminator is kept back
+};
+
+static void put(tx_writer *p_writer, char p_char){
+
+   if(p_writer->out < p_writer->end)
+   {
+      *p_writer->out++=p_char;
+   }
+
+}
+
+static void put_repeat(tx_writer *p_writer, char p_char, int p_count){
+
+   for(int i=0;i<p_count;i++)
+   {
+      put(p_writer,p_char);
+   }
+
+}
+//******************************************************************************************
+// Function:put_field
+// Whazzit:Writes p_sign (if any) and p_body padded out to p_width.  Zero padding goes
+//         between the sign and the digits, the way printf does it.
+//******************************************************************************************
+static void put_field(tx_writer *p_writer, char p_sign, const char *p_body, int p_length, int p_width,
+                      bool p_left, bool p_zero){
+const int length=p_length + (p_sign ? 1 : 0);
+const int pad=p_width > length ? p_width - length : 0;
+
+   if(!p_left && !p_zero)
+   {
+      put_repeat(p_writer,' ',pad);
+   }
+   if(p_sign)
+   {
+      put(p_writer,p_sign);
+   }
+   if(!p_left && p_zero)
+   {
+      put_repeat(p_writer,'0',pad);
+   }
+   for(int i=0;i<p_length;i++)
+   {
+      put(p_writer,p_body[i]);
+   }
+   if(p_left)
+   {
+      put_repeat(p_writer,' ',pad);
+   }
+
+}
+
+//Digits of p_value in p_base into the end of p_buffer, returns where they start
+static char *format_unsigned(char *p_end, unsigned long long p_value, unsigned int p_base, bool p_upper){
+const char *digits=p_upper ? "0123456789ABCDEF" : "0123456789abcdef";
+char *start=p_end;
+
+   do
+   {
+      *--start=digits[p_value % p_base];
+      p_value/=p_base;
+   } while(p_value);
+
+   return start;
+}
+//******************************************************************************************
+// Function:format_fixed
+// Whazzit:%f with the whole part as a 64 bit integer and the fraction (exact, since it's
+//         the value less its floor) scaled up by 10^precision.  Rounds the exact binary
+//         value, ties to even, like the C library.  False when the value is too big for
+//         that, the caller falls back to snprintf.
+//******************************************************************************************
+static bool format_fixed(char *p_buffer, int *p_length, double p_value, int p_precision){
+static const double scale[g_tx_max_precision + 1]={ 1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9 };
+const double floor_value=floor(p_value);
+char digits[32];
+char *end=digits + sizeof(digits);
+char *start;
+unsigned long long whole;
+unsigned long long fraction;
+double scaled;
+double rest;
+int length=0;
+
+   if(!(floor_value < 1.8e19))
+   {
+      return false;
+   }
+   whole=(unsigned long long)floor_value;
+   scaled=(p_value - floor_value) * scale[p_precision];
+   fraction=(unsigned long long)floor(scaled);
+   rest=scaled - floor(scaled);
+
+   //The product can round onto a tie that isn't one, fma gives back what it lost
+   if(rest == 0.5)
+   {
+      const double lost=fma(p_value - floor_value,scale[p_precision],-scaled);
+
+      rest=lost > 0.0 ? 0.75 : (lost < 0.0 ? 0.25 : rest);
+   }
+
+   if(rest > 0.5 || (rest == 0.5 && ((p_precision ? fraction : whole) & 1)))
+   {
+      fraction++;
+      if(fraction >= (unsigned long long)scale[p_precision])
+      {
+         fraction=0;
+         whole++;
+      }
+   }
+
+   start=format_unsigned(end,whole,10,false);
+   memcpy(p_buffer,start,end - start);
+   length=(int)(end - start);
+
+   if(p_precision > 0)
+   {
+      p_buffer[length++]='.';
+      for(int i=p_precision - 1;i >= 0;i--)
+      {
+         p_buffer[length + i]=(char)('0' + fraction % 10);
+         fraction/=10;
+      }
+      length+=p_precision;
+   }
+
+   *p_length=length;
+
+   return true;
+}
+
+size_t tx_vformat(char *p_buffer, size_t p_size, const char *p_format, va_list p_args){
+tx_writer writer;
+
+   if(p_size == 0)
+   {
+      return 0;
+   }
+
+   writer.out=p_buffer;
+   writer.end=p_buffer + p_size - 1;
+
+   for(const char *c=p_format;*c;c++)
+   {
+      bool left=false;
+      bool zero=false;
+      int width=0;
+      int precision=-1;
+      int longs=0;
+      bool size=false;
+      char body[64];
+      char *end=body + sizeof(body);
+      char *start;
+      char sign=0;
+
+      if(*c != '%')
+      {
+         put(&writer,*c);
+         continue;
+      }
+      c++;
+
+      for(;*c == '-' || *c == '0';c++)
+      {
+         left=left || *c == '-';
+         zero=zero || *c == '0';
+      }
+      for(;*c >= '0' && *c <= '9';c++)
+      {
+         width=width * 10 + (*c - '0');
+      }
+      if(*c == '.')
+      {
+         precision=0;
+         for(c++;*c >= '0' && *c <= '9';c++)
+         {
+            precision=precision * 10 + (*c - '0');
+         }
+      }
+      for(;*c == 'l' || *c == 'h' || *c == 'z';c++)
+      {
+         longs+=(*c == 'l');
+         size=size || *c == 'z';
+      }
+
+      switch(*c)
+      {
+         case 'd':
+         case 'i':
+         {
+            //z is the width of size_t, 32 bits on Win32, so it gets its own va_arg
+            long long value=size ? va_arg(p_args,ptrdiff_t) :
+                            (longs >= 2 ? va_arg(p_args,long long) :
+                            (longs == 1 ? va_arg(p_args,long) : va_arg(p_args,int)));
+            unsigned long long magnitude=value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+
+            sign=value < 0 ? '-' : 0;
+            start=format_unsigned(end,magnitude,10,false);
+            put_field(&writer,sign,start,(int)(end - start),width,left,zero);
+            break;
+         }
+         case 'u':
+         case 'x':
+         case 'X':
+         {
+            unsigned long long value=size ? va_arg(p_args,size_t) :
+                                     (longs >= 2 ? va_arg(p_args,unsigned long long) :
+                                     (longs == 1 ? va_arg(p_args,unsigned long) : va_arg(p_args,unsigned int)));
+
+            start=format_unsigned(end,value,*c == 'u' ? 10 : 16,*c == 'X');
+            put_field(&writer,0,start,(int)(end - start),width,left,zero);
+            break;
+         }
+         case 'c':
+            body[0]=(char)va_arg(p_args,int);
+            put_field(&writer,0,body,1,width,left,false);
+            break;
+         case 's':
+         {
+            const char *text=va_arg(p_args,const char *);
+            int length=0;
+
+            text=text ? text : "(null)";
+            while(text[length] && (precision < 0 || length < precision))
+            {
+               length++;
+            }
+            put_field(&writer,0,text,length,width,left,false);
+            break;
+         }
+         case 'f':
+         {
+            double value=va_arg(p_args,double);
+            int length;
+
+            precision=precision < 0 ? 6 : (precision > g_tx_max_precision ? g_tx_max_precision : precision);
+            if(value != value)
+            {
+               put_field(&writer,0,"nan",3,width,left,false);
+               break;
+            }
+            sign=value < 0.0 ? '-' : 0;
+            value=fabs(value);
+            if(!format_fixed(body,&length,value,precision))
+            {
+               length=snprintf(body,sizeof(body),"%.*f",precision,value);
+               length=length < 0 ? 0 : (length >= (int)sizeof(body) ? (int)sizeof(body) - 1 : length);
+            }
+            put_field(&writer,sign,body,length,width,left,zero && value <= 1.8e19);
+            break;
+         }
+         case '%':
+            put(&writer,'%');
+            break;
+         case 0:
+            //A lone % at the end
+            c--;
+            break;
+         default:
+            //Not ours, echo it so the mistake shows on screen
+            put(&writer,'%');
+            put(&writer,*c);
+            break;
+      }
+   }
+
+   *writer.out=0;
+
+   return (size_t)(writer.out - p_buffer);
+}
+
+size_t tx_format(char *p_buffer, size_t p_size, const char *p_format, ...){
+va_list args;
+size_t length;
+
+   va_start(args,p_format);
+   length=tx_vformat(p_buffer,p_size,p_format,args);
+   va_end(args);
+
+   return length;
+}
+
+TextArena::TextArena(size_t p_size) :
+   m_data(new char[p_size > 0 ? p_size : 1]),m_size(p_size > 0 ? p_size : 1)
+{
+   memset(&m_stats,0,sizeof(m_stats));
+}
+
+TextArena::~TextArena(void){
+
+   delete[] m_data;
+
+}
+//******************************************************************************************
+// Function:VFormat
+// Whazzit:Formats into whatever is left.  Running into the end means the string may have
+//         been cut short, so it's dropped and counted rather than shown truncated.
+//******************************************************************************************
+const char *TextArena::VFormat(const char *p_format, va_list p_args){
+char *start=m_data + m_stats.used;
+const size_t room=m_size - m_stats.used;
+size_t length;
+
+   if(room < 2)
+   {
+      m_stats.overflows++;
+      return "";
+   }
+
+   length=tx_vformat(start,room,p_format,p_args);
+   if(length + 1 >= room)
+   {
+      *start=0;
+      m_stats.overflows++;
+      return "";
+   }
+
+   m_stats.used+=length + 1;
+   m_stats.peak=m_stats.used > m_stats.peak ? m_stats.used : m_stats.peak;
+   m_stats.strings++;
+
+   return start;
+}
+
+const char *TextArena::Format(const char *p_format, ...){
+va_list args;
+const char *text;
+
+   va_start(args,p_format);
+   text=VFormat(p_format,args);
+   va_end(args);
+
+   return text;
+}
+
+void TextArena::Reset(void){
+
+   m_stats.used=0;
+   m_stats.strings=0;
+
+}
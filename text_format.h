@@ -0,0 +1,55 @@
+//
+// text_format.h - printf style formatting that never allocates, and a per frame arena
+//
+// The HUD rebuilds a few dozen lines of numbers every frame.  tx_format covers the part
+// of printf those lines use (%d %i %u %x %X %c %s %f %% with the '-' and '0' flags,
+// width, precision and the h/l/ll/z lengths) without locales, wide conversions or any
+// chance of the C library reaching for the heap.  Unlike snprintf it returns what it
+// actually wrote, so appending in a loop can't run past the end.  A %f too big for
+// 64 bits of fixed point is handed to snprintf.
+//
+// TextArena is one block reserved up front and handed out a string at a time.  Reset
+// it at the start of a frame and everything formatted into it stays valid until the
+// next Reset; when it fills, Format returns an empty string rather than growing.
+//
+#ifndef TEXT_FORMAT_H
+#define TEXT_FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+//Always terminates when p_size > 0.  Returns the characters written, not counting the
+//terminator.
+size_t tx_format(char *p_buffer, size_t p_size, const char *p_format, ...);
+size_t tx_vformat(char *p_buffer, size_t p_size, const char *p_format, va_list p_args);
+
+struct tx_arena_stats
+{
+   size_t used;       //Since the last Reset
+   size_t peak;
+   unsigned int strings;
+   unsigned int overflows;   //Format calls that didn't fit
+};
+
+class TextArena
+{
+public:
+   explicit TextArena(size_t p_size);
+   ~TextArena(void);
+
+   const char *Format(const char *p_format, ...);
+   const char *VFormat(const char *p_format, va_list p_args);
+   void Reset(void);
+
+   const tx_arena_stats &GetStats(void) const { return m_stats; }
+
+private:
+   TextArena(const TextArena &);
+   TextArena &operator=(const TextArena &);
+
+   char *m_data;
+   size_t m_size;
+   tx_arena_stats m_stats;
+};
+
+#endif
@@ -0,0 +1,166 @@
+//
+// text_renderer.cpp - Screen text batched into one glyph draw per frame
+//
+#include <string.h>
+#include "text_renderer.h"
+
+TextRenderer::TextRenderer(void) :
+   m_arena(g_tx_arena_size),m_strings(0),m_dropped(0)
+{
+   memset(&m_stats,0,sizeof(m_stats));
+   m_glyphs.reserve(g_tx_max_glyphs);
+}
+
+HRESULT TextRenderer::Init(RenderDevice *p_device){
+
+   m_ring.Init(p_device,g_tx_ring_size);
+   memset(&m_stats,0,sizeof(m_stats));
+   BeginFrame();
+
+   return m_atlas.Init(p_device);
+}
+
+void TextRenderer::OnLostDevice(void){
+
+   m_ring.OnLostDevice();
+
+}
+
+void TextRenderer::Release(void){
+
+   m_ring.Release();
+   m_atlas.Release();
+
+}
+
+void TextRenderer::BeginFrame(void){
+
+   m_arena.Reset();
+   m_glyphs.clear();
+   m_strings=0;
+   m_dropped=0;
+
+}
+
+void TextRenderer::Print(int p_x, int p_y, DWORD p_colour, const char *p_text){
+glyph entry;
+
+   entry.x=(short)p_x;
+   entry.y=(short)p_y;
+   entry.colour=p_colour;
+
+   for(const char *c=p_text;*c;c++)
+   {
+      if(*c == '\n')
+      {
+         entry.x=(short)p_x;
+         entry.y=(short)(entry.y + g_ga_line_height);
+         continue;
+      }
+
+      if(*c != ' ')
+      {
+         if(m_glyphs.size() < g_tx_max_glyphs)
+         {
+            entry.character=(unsigned char)*c;
+            m_glyphs.push_back(entry);
+         }
+         else
+         {
+            m_dropped++;
+         }
+      }
+      entry.x=(short)(entry.x + g_ga_advance);
+   }
+   m_strings++;
+
+}
+
+void TextRenderer::Printf(int p_x, int p_y, DWORD p_colour, const char *p_format, ...){
+va_list args;
+const char *text;
+
+   va_start(args,p_format);
+   text=m_arena.VFormat(p_format,args);
+   va_end(args);
+
+   Print(p_x,p_y,p_colour,text);
+
+}
+
+const char *TextRenderer::Format(const char *p_format, ...){
+va_list args;
+const char *text;
+
+   va_start(args,p_format);
+   text=m_arena.VFormat(p_format,args);
+   va_end(args);
+
+   return text;
+}
+//******************************************************************************************
+// Function:Flush
+// Whazzit:Four corners per record straight into the ring, pixel edges half a pixel
+//         before the centres so every texel lands on one pixel
+//******************************************************************************************
+HRESULT TextRenderer::Flush(RenderDevice *p_device){
+const UINT count=(UINT)m_glyphs.size();
+const tx_arena_stats &arena=m_arena.GetStats();
+rd_glyph_vertex *vertex;
+vr_alloc alloc;
+HRESULT hr=S_OK;
+
+   m_stats.strings=m_strings;
+   m_stats.glyphs=0;
+   m_stats.draws=0;
+   m_stats.dropped=m_dropped;
+   m_stats.arena_peak=arena.peak;
+   m_stats.overflows=arena.overflows;
+
+   if(count == 0 || m_atlas.GetTexture() == NULL)
+   {
+      return S_OK;
+   }
+
+   if(!m_ring.Lock(count * RD_GLYPH_CORNERS * sizeof(rd_glyph_vertex),sizeof(rd_glyph_vertex),&alloc))
+   {
+      return E_FAIL;
+   }
+
+   vertex=(rd_glyph_vertex *)alloc.data;
+   for(UINT i=0;i<count;i++,vertex+=RD_GLYPH_CORNERS)
+   {
+      const glyph &entry=m_glyphs[i];
+      const ga_glyph &uv=m_atlas.GetGlyph(entry.character);
+      const float x0=entry.x - 0.5f;
+      const float y0=entry.y - 0.5f;
+      const float x1=x0 + g_ga_glyph_width;
+      const float y1=y0 + g_ga_cell;
+
+      for(int corner=0;corner<RD_GLYPH_CORNERS;corner++)
+      {
+         const bool right=(corner == RD_GLYPH_TOP_RIGHT || corner == RD_GLYPH_BOTTOM_RIGHT);
+         const bool bottom=(corner >= RD_GLYPH_BOTTOM_LEFT);
+
+         vertex[corner].x=right ? x1 : x0;
+         vertex[corner].y=bottom ? y1 : y0;
+         vertex[corner].z=0.0f;
+         vertex[corner].rhw=1.0f;
+         vertex[corner].colour=entry.colour;
+         vertex[corner].u=right ? uv.u1 : uv.u0;
+         vertex[corner].v=bottom ? uv.v1 : uv.v0;
+      }
+   }
+   m_ring.Unlock();
+
+   hr=p_device->DrawGlyphs(m_atlas.GetTexture(),alloc.buffer,alloc.offset / sizeof(rd_glyph_vertex),count);
+   m_ring.EndFrame();
+
+   if(SUCCEEDED(hr))
+   {
+      m_stats.glyphs=count;
+      m_stats.draws=1;
+   }
+
+   return hr;
+}
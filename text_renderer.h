@@ -0,0 +1,80 @@
+//
+// text_renderer.h - Screen text batched into one glyph draw per frame
+//
+// Print and Printf don't draw anything, they append a record per character to a list
+// reserved up front.  Flush turns the whole list into quads in a VertexRing slice and
+// hands it to the device's DrawGlyphs in one go, so a HUD of thirty lines costs one
+// draw and no GDI layout.  Printf formats into the frame's TextArena, which Format
+// also hands out for text going somewhere else, and nothing on the way allocates.
+//
+// Text past g_tx_max_glyphs in a frame is dropped and counted.  Call BeginFrame before
+// the frame's first Print, Flush inside the scene after everything it should cover.
+//
+#ifndef TEXT_RENDERER_H
+#define TEXT_RENDERER_H
+
+#include <stdarg.h>
+#include <vector>
+#include "glyph_atlas.h"
+#include "text_format.h"
+#include "vertex_ring.h"
+
+const UINT g_tx_max_glyphs = 8192;
+const size_t g_tx_arena_size = 64 * 1024;
+//Holds a few frames of a full glyph list
+const UINT g_tx_ring_size = 4 * g_tx_max_glyphs * RD_GLYPH_CORNERS * sizeof(rd_glyph_vertex);
+
+struct tx_stats
+{
+   unsigned int strings;       //Printed in the last flushed frame
+   unsigned int glyphs;        //Drawn, spaces aren't
+   unsigned int draws;
+   unsigned int dropped;       //Glyphs past g_tx_max_glyphs
+   size_t arena_peak;          //Most the arena has held in a frame
+   unsigned int overflows;     //Formats that didn't fit the arena, since Init
+};
+
+class TextRenderer
+{
+public:
+   TextRenderer(void);
+
+   HRESULT Init(RenderDevice *p_device);
+   //The ring is in the default pool, the atlas is managed and rides out a reset
+   void OnLostDevice(void);
+   HRESULT OnResetDevice(void) { return m_ring.OnResetDevice(); }
+   void Release(void);
+
+   void BeginFrame(void);
+   //Top left of the first character at p_x,p_y, '\n' starts a line below p_x
+   void Print(int p_x, int p_y, DWORD p_colour, const char *p_text);
+   void Printf(int p_x, int p_y, DWORD p_colour, const char *p_format, ...);
+   //Valid until the next BeginFrame
+   const char *Format(const char *p_format, ...);
+   HRESULT Flush(RenderDevice *p_device);
+
+   const tx_stats &GetStats(void) const { return m_stats; }
+   //The managed atlas texture, 0 until Init has made it
+   UINT GetAtlasBytes(void) const { return m_atlas.GetBytes(); }
+
+private:
+   TextRenderer(const TextRenderer &);
+   TextRenderer &operator=(const TextRenderer &);
+
+   struct glyph
+   {
+      short x,y;
+      unsigned char character;
+      DWORD colour;
+   };
+
+   GlyphAtlas m_atlas;
+   VertexRing m_ring;
+   TextArena m_arena;
+   std::vector<glyph> m_glyphs;   //Capacity g_tx_max_glyphs, never grows past it
+   unsigned int m_strings;
+   unsigned int m_dropped;
+   tx_stats m_stats;
+};
+
+#endif
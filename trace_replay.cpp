@@ -0,0 +1,476 @@
+//
+// trace_replay.cpp - Plays a device trace back as fast as the device will take it
+//
+#include <string.h>
+#include "trace_replay.h"
+#include "hires_timer.h"
+#include "text_format.h"
+
+//A record's header and where the next one starts
+static bool next_record(const BYTE *p_at, const BYTE *p_end, int *p_op, UINT *p_size, const BYTE **p_next){
+UINT header;
+
+   if(p_end - p_at < (ptrdiff_t)sizeof(header))
+   {
+      return false;
+   }
+   memcpy(&header,p_at,sizeof(header));
+   *p_op=(int)(header & 0xFF);
+   *p_size=header >> 8;
+   if((size_t)(p_end - p_at - sizeof(header)) < *p_size)
+   {
+      return false;
+   }
+   *p_next=p_at + sizeof(header) + ((*p_size + 3) & ~3u);
+   *p_next=*p_next > p_end ? p_end : *p_next;
+
+   return true;
+}
+
+TraceReplay::TraceReplay(void) :
+   m_setup(NULL),m_frames(NULL),m_end(NULL)
+{
+   memset(&m_header,0,sizeof(m_header));
+   memset(&m_stats,0,sizeof(m_stats));
+   memset(&m_quant,0,sizeof(m_quant));
+}
+
+TraceReplay::~TraceReplay(void){
+
+   Release();
+
+}
+//******************************************************************************************
+// Function:Load
+// Whazzit:Walks the records once up front, so a truncated trace (the capture was
+//         killed before Stop) is cut back to its last whole record rather than found
+//         out half way through playing it
+//******************************************************************************************
+bool TraceReplay::Load(const char *p_filename){
+const BYTE *at;
+const BYTE *next;
+int op;
+UINT size;
+
+   m_setup=m_frames=m_end=NULL;
+   if(!m_file.Open(p_filename) || m_file.GetSize() < sizeof(m_header))
+   {
+      return false;
+   }
+
+   memcpy(&m_header,m_file.GetData(),sizeof(m_header));
+   if(memcmp(m_header.magic,g_dt_magic,sizeof(m_header.magic)) != 0 || m_header.version != g_dt_version)
+   {
+      m_file.Close();
+      return false;
+   }
+
+   m_setup=m_file.GetData() + sizeof(m_header);
+   m_end=m_file.GetData() + m_file.GetSize();
+   for(at=m_setup;next_record(at,m_end,&op,&size,&next);at=next)
+   {
+      if(op == DT_OP_FRAMES && m_frames == NULL)
+      {
+         m_frames=next;
+      }
+   }
+   m_end=at;
+
+   if(m_frames == NULL)
+   {
+      m_file.Close();
+      return false;
+   }
+
+   return true;
+}
+
+RenderBuffer *TraceReplay::GetBuffer(UINT p_id, HRESULT *p_hr) const{
+RenderBuffer *buffer=p_id < m_buffers.size() ? m_buffers[p_id] : NULL;
+
+   *p_hr=(p_id != 0 && buffer == NULL) ? E_INVALIDARG : S_OK;
+
+   return buffer;
+}
+
+RenderTexture *TraceReplay::GetTexture(UINT p_id, HRESULT *p_hr) const{
+RenderTexture *texture=p_id < m_textures.size() ? m_textures[p_id] : NULL;
+
+   *p_hr=(p_id != 0 && texture == NULL) ? E_INVALIDARG : S_OK;
+
+   return texture;
+}
+
+void TraceReplay::ReleaseBuffer(UINT p_id){
+
+   if(p_id < m_buffers.size() && m_buffers[p_id])
+   {
+      m_buffers[p_id]->Release();
+      m_buffers[p_id]=NULL;
+   }
+
+}
+
+void TraceReplay::ReleaseTexture(UINT p_id){
+
+   if(p_id < m_textures.size() && m_textures[p_id])
+   {
+      m_textures[p_id]->Release();
+      m_textures[p_id]=NULL;
+   }
+
+}
+
+void TraceReplay::Release(void){
+
+   for(UINT i=0;i<m_buffers.size();i++)
+   {
+      ReleaseBuffer(i);
+   }
+   for(UINT i=0;i<m_textures.size();i++)
+   {
+      ReleaseTexture(i);
+   }
+   m_buffers.clear();
+   m_textures.clear();
+
+}
+//******************************************************************************************
+// Function:Execute
+// Whazzit:One record.  Arguments are copied out rather than read in place, the payload
+//         is only 4 byte aligned.
+//******************************************************************************************
+HRESULT TraceReplay::Execute(RenderDevice *p_device, int p_op, const BYTE *p_payload, UINT p_size){
+HRESULT hr=S_OK;
+
+//Copies the payload's leading arguments into args, or gives up on a short record
+#define DT_ARGS(type) type args; if(p_size < sizeof(args)) { return E_INVALIDARG; } memcpy(&args,p_payload,sizeof(args))
+
+   switch(p_op)
+   {
+      case DT_OP_CREATE_VERTEX_BUFFER:
+      case DT_OP_CREATE_INDEX_BUFFER:
+      {
+         DT_ARGS(dt_create_buffer);
+         RenderBuffer *buffer=NULL;
+
+         if(args.id == 0)
+         {
+            return E_INVALIDARG;
+         }
+         ReleaseBuffer(args.id);
+         if(p_op == DT_OP_CREATE_VERTEX_BUFFER)
+         {
+            hr=p_device->CreateVertexBuffer(args.length,args.usage,args.fvf,(rd_pool)args.pool,&buffer);
+         }
+         else
+         {
+            hr=p_device->CreateIndexBuffer(args.length,args.usage,(rd_format)args.fvf,(rd_pool)args.pool,&buffer);
+         }
+         if(SUCCEEDED(hr))
+         {
+            m_buffers.resize(args.id >= m_buffers.size() ? args.id + 1 : m_buffers.size(),NULL);
+            m_buffers[args.id]=buffer;
+         }
+         return hr;
+      }
+      case DT_OP_CREATE_TEXTURE:
+      {
+         DT_ARGS(dt_create_texture);
+         RenderTexture *texture=NULL;
+
+         if(args.id == 0)
+         {
+            return E_INVALIDARG;
+         }
+         ReleaseTexture(args.id);
+         hr=p_device->CreateTexture(args.width,args.height,&texture);
+         if(SUCCEEDED(hr))
+         {
+            m_textures.resize(args.id >= m_textures.size() ? args.id + 1 : m_textures.size(),NULL);
+            m_textures[args.id]=texture;
+         }
+         return hr;
+      }
+      case DT_OP_RELEASE_BUFFER:
+      {
+         DT_ARGS(dt_release);
+
+         ReleaseBuffer(args.id);
+         return S_OK;
+      }
+      case DT_OP_RELEASE_TEXTURE:
+      {
+         DT_ARGS(dt_release);
+
+         ReleaseTexture(args.id);
+         return S_OK;
+      }
+      case DT_OP_BUFFER_DATA:
+      {
+         DT_ARGS(dt_buffer_data);
+         RenderBuffer *buffer=GetBuffer(args.id,&hr);
+         const UINT size=p_size - sizeof(args);
+         void *data;
+
+         if(buffer == NULL || size == 0)
+         {
+            return buffer ? S_OK : E_INVALIDARG;
+         }
+         hr=buffer->Lock(args.offset,size,&data,args.flags);
+         if(SUCCEEDED(hr))
+         {
+            memcpy(data,p_payload + sizeof(args),size);
+            hr=buffer->Unlock();
+         }
+         return hr;
+      }
+      case DT_OP_TEXTURE_DATA:
+      {
+         DT_ARGS(dt_texture_data);
+         RenderTexture *texture=GetTexture(args.id,&hr);
+         BYTE *data;
+         UINT pitch;
+         UINT width;
+         UINT rows;
+
+         if(texture == NULL)
+         {
+            return E_INVALIDARG;
+         }
+         width=texture->GetWidth();
+         rows=width ? (p_size - sizeof(args)) / width : 0;
+         if(args.row > texture->GetHeight() || rows > texture->GetHeight() - args.row)
+         {
+            return E_INVALIDARG;
+         }
+         hr=texture->Lock((void **)&data,&pitch);
+         if(SUCCEEDED(hr))
+         {
+            for(UINT y=0;y<rows;y++)
+            {
+               memcpy(data + (size_t)(args.row + y) * pitch,p_payload + sizeof(args) + (size_t)y * width,width);
+            }
+            hr=texture->Unlock();
+         }
+         return hr;
+      }
+      case DT_OP_FRAMES:
+         return S_OK;
+      case DT_OP_CLEAR:
+      {
+         DT_ARGS(dt_clear);
+
+         return p_device->Clear(args.colour);
+      }
+      case DT_OP_BEGIN_SCENE:
+         return p_device->BeginScene();
+      case DT_OP_END_SCENE:
+         return p_device->EndScene();
+      case DT_OP_PRESENT:
+         return p_device->Present();
+      case DT_OP_SET_TRANSFORM:
+      {
+         DT_ARGS(dt_set_transform);
+
+         return p_device->SetTransform((rd_transform)args.which,args.matrix);
+      }
+      case DT_OP_SET_RENDER_STATE:
+      {
+         DT_ARGS(dt_set_render_state);
+
+         return p_device->SetRenderState((rd_render_state)args.state,args.value);
+      }
+      case DT_OP_SET_FVF:
+      {
+         DT_ARGS(dt_set_fvf);
+
+         return p_device->SetFVF(args.fvf);
+      }
+      case DT_OP_SET_STREAM_SOURCE:
+      {
+         DT_ARGS(dt_set_stream_source);
+         RenderBuffer *buffer=GetBuffer(args.id,&hr);
+
+         return FAILED(hr) ? hr : p_device->SetStreamSource(args.stream,buffer,args.offset,args.stride);
+      }
+      case DT_OP_SET_INDICES:
+      {
+         DT_ARGS(dt_set_indices);
+         RenderBuffer *buffer=GetBuffer(args.id,&hr);
+
+         return FAILED(hr) ? hr : p_device->SetIndices(buffer);
+      }
+      case DT_OP_DRAW_PRIMITIVE:
+      {
+         DT_ARGS(dt_draw);
+
+         return p_device->DrawPrimitive((rd_primitive)args.type,args.start_vertex,args.prim_count);
+      }
+      case DT_OP_DRAW_INDEXED_PRIMITIVE:
+      {
+         DT_ARGS(dt_draw_indexed);
+
+         return p_device->DrawIndexedPrimitive((rd_primitive)args.type,args.base_vertex,args.min_index,
+                                               args.num_vertices,args.start_index,args.prim_count);
+      }
+      case DT_OP_DRAW_INSTANCED:
+      {
+         DT_ARGS(dt_draw);
+         const rd_instance *instances=(const rd_instance *)(p_payload + sizeof(args));
+         const UINT count=(p_size - sizeof(args)) / sizeof(rd_instance);
+
+         return p_device->DrawInstanced((rd_primitive)args.type,args.start_vertex,args.prim_count,instances,count);
+      }
+      case DT_OP_DRAW_INDEXED_INSTANCED:
+      {
+         DT_ARGS(dt_draw_indexed);
+         const rd_instance *instances=(const rd_instance *)(p_payload + sizeof(args));
+         const UINT count=(p_size - sizeof(args)) / sizeof(rd_instance);
+
+         return p_device->DrawIndexedInstanced((rd_primitive)args.type,args.base_vertex,args.min_index,
+                                               args.num_vertices,args.start_index,args.prim_count,instances,count);
+      }
+      case DT_OP_DRAW_GLYPHS:
+      {
+         DT_ARGS(dt_draw_glyphs);
+         RenderTexture *atlas=GetTexture(args.atlas,&hr);
+         RenderBuffer *vertices;
+
+         if(FAILED(hr))
+         {
+            return hr;
+         }
+         vertices=GetBuffer(args.vertices,&hr);
+         return FAILED(hr) ? hr : p_device->DrawGlyphs(atlas,vertices,args.start_vertex,args.glyph_count);
+      }
+      case DT_OP_INSERT_FENCE:
+         p_device->InsertFence();
+         return S_OK;
+      case DT_OP_SET_QUANTIZATION:
+      {
+         DT_ARGS(dt_set_quantization);
+
+         if(args.set == 0)
+         {
+            return p_device->SetQuantization(NULL);
+         }
+         if(p_size - sizeof(args) < args.palette_count * sizeof(DWORD))
+         {
+            return E_INVALIDARG;
+         }
+         memcpy(m_quant.scale,args.scale,sizeof(m_quant.scale));
+         memcpy(m_quant.bias,args.bias,sizeof(m_quant.bias));
+         m_quant.palette=args.palette_count ? (const DWORD *)(p_payload + sizeof(args)) : NULL;
+         m_quant.palette_count=args.palette_count;
+         return p_device->SetQuantization(&m_quant);
+      }
+   }
+
+#undef DT_ARGS
+
+   return E_INVALIDARG;
+}
+
+void TraceReplay::Run(RenderDevice *p_device, const BYTE *p_begin, const BYTE *p_end, bool p_timed){
+const double period=hires_tick_period();
+double frame_start=hires_seconds();
+const BYTE *next;
+int op;
+UINT size;
+
+   for(const BYTE *at=p_begin;next_record(at,p_end,&op,&size,&next);at=next)
+   {
+      const BYTE *payload=at + sizeof(UINT);
+      HRESULT hr;
+
+      if(!p_timed)
+      {
+         hr=Execute(p_device,op,payload,size);
+      }
+      else
+      {
+         const unsigned long long start=hires_ticks();
+         double seconds;
+
+         hr=Execute(p_device,op,payload,size);
+         seconds=(double)(hires_ticks() - start) * period;
+
+         dt_op_stats &stats=m_stats.ops[op < DT_OP_COUNT ? op : DT_OP_NONE];
+         stats.calls++;
+         stats.seconds+=seconds;
+         stats.max=seconds > stats.max ? seconds : stats.max;
+         m_stats.calls++;
+
+         if(op == DT_OP_PRESENT)
+         {
+            const double now=hires_seconds();
+
+            m_frame_times.Add(now - frame_start);
+            m_stats.seconds+=now - frame_start;
+            m_stats.frames++;
+            frame_start=now;
+         }
+      }
+
+      if(FAILED(hr))
+      {
+         m_stats.errors++;
+      }
+   }
+
+}
+
+HRESULT TraceReplay::Play(RenderDevice *p_device, int p_loops){
+double start;
+
+   if(m_frames == NULL)
+   {
+      return E_FAIL;
+   }
+
+   Release();
+   memset(&m_stats,0,sizeof(m_stats));
+   m_frame_times.Clear();
+   m_frame_times.Reserve((size_t)m_header.frames * (p_loops > 0 ? p_loops : 1));
+
+   start=hires_seconds();
+   Run(p_device,m_setup,m_frames,false);
+   m_stats.setup_seconds=hires_seconds() - start;
+
+   for(int i=0;i<p_loops;i++)
+   {
+      Run(p_device,m_frames,m_end,true);
+   }
+
+   Release();
+
+   return m_stats.errors ? E_FAIL : S_OK;
+}
+
+size_t TraceReplay::FormatReport(char *p_buffer, size_t p_size) const{
+const frame_summary frames=m_frame_times.Summarize();
+size_t length=0;
+
+   length+=tx_format(p_buffer + length,p_size - length,
+                     "frames %u in %.3f s (setup %.3f s), min %.3f avg %.3f p50 %.3f p99 %.3f max %.3f ms, "
+                     "%u errors\n",m_stats.frames,m_stats.seconds,m_stats.setup_seconds,frames.min * 1000.0,
+                     frames.avg * 1000.0,frames.p50 * 1000.0,frames.p99 * 1000.0,frames.max * 1000.0,m_stats.errors);
+   length+=tx_format(p_buffer + length,p_size - length,"%-24s %10s %10s %10s %10s %6s\n","op","calls","total ms",
+                     "avg us","max us","share");
+
+   for(int i=0;i<DT_OP_COUNT;i++)
+   {
+      const dt_op_stats &op=m_stats.ops[i];
+
+      if(op.calls == 0)
+      {
+         continue;
+      }
+      length+=tx_format(p_buffer + length,p_size - length,"%-24s %10llu %10.3f %10.3f %10.3f %5.1f%%\n",
+                        dt_op_name(i),op.calls,op.seconds * 1000.0,op.seconds * 1e6 / op.calls,op.max * 1e6,
+                        m_stats.seconds > 0.0 ? op.seconds * 100.0 / m_stats.seconds : 0.0);
+   }
+
+   return length;
+}
@@ -0,0 +1,86 @@
+//
+// trace_replay.h - Plays a device trace back as fast as the device will take it
+//
+// Loads a trace written by CaptureDevice (device_trace.h) and makes the same calls on
+// any RenderDevice.  Play first makes the trace's buffers and textures and runs its
+// state dump, untimed.  Then it runs the captured frames as many times as asked with
+// nothing in between: no scene, no input and no pacing.  Every call is timed and
+// totalled by op.  Every frame is timed from the end of the last Present to the end
+// of its own.  So a frame captured where it was slow becomes a repeatable benchmark
+// on the null or software backend, on whatever they build on.
+//
+// Buffer contents are written with the lock flags they were captured with.  Looping
+// assumes the frames don't release what they didn't make themselves; a call naming a
+// buffer that isn't there any more is skipped and counted as an error.
+//
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include <vector>
+#include "device_trace.h"
+#include "frame_stats.h"
+#include "mapped_file.h"
+
+struct dt_op_stats
+{
+   unsigned long long calls;
+   double seconds;
+   double max;
+};
+
+struct dt_replay_stats
+{
+   unsigned int frames;          //Presents replayed, over every loop
+   unsigned long long calls;     //Timed ones
+   double seconds;               //In the frames, not the setup
+   double setup_seconds;
+   unsigned int errors;          //Calls the device failed, and records that made no sense
+   dt_op_stats ops[DT_OP_COUNT];
+};
+
+class TraceReplay
+{
+public:
+   TraceReplay(void);
+   ~TraceReplay(void);
+
+   //Maps the trace and checks it through.  False if it isn't one we can play.
+   bool Load(const char *p_filename);
+   const dt_header &GetHeader(void) const { return m_header; }
+
+   //The setup, then the frames p_loops times.  Everything made is released before
+   //returning, but what was last drawn is left on the device.
+   HRESULT Play(RenderDevice *p_device, int p_loops=1);
+
+   const dt_replay_stats &GetStats(void) const { return m_stats; }
+   frame_summary GetFrameSummary(void) const { return m_frame_times.Summarize(); }
+   //The frame times, then a line for each op that was called
+   size_t FormatReport(char *p_buffer, size_t p_size) const;
+
+private:
+   TraceReplay(const TraceReplay &);
+   TraceReplay &operator=(const TraceReplay &);
+
+   void Run(RenderDevice *p_device, const BYTE *p_begin, const BYTE *p_end, bool p_timed);
+   HRESULT Execute(RenderDevice *p_device, int p_op, const BYTE *p_payload, UINT p_size);
+   RenderBuffer *GetBuffer(UINT p_id, HRESULT *p_hr) const;
+   RenderTexture *GetTexture(UINT p_id, HRESULT *p_hr) const;
+   void ReleaseBuffer(UINT p_id);
+   void ReleaseTexture(UINT p_id);
+   void Release(void);
+
+   MappedFile m_file;
+   dt_header m_header;
+   const BYTE *m_setup;          //First record
+   const BYTE *m_frames;         //First record after DT_OP_FRAMES
+   const BYTE *m_end;
+
+   std::vector<RenderBuffer *> m_buffers;      //By id
+   std::vector<RenderTexture *> m_textures;
+   rd_quantization m_quant;      //Set on the device by pointer, its palette is in the trace
+
+   FrameStats m_frame_times;
+   dt_replay_stats m_stats;
+};
+
+#endif
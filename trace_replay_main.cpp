@@ -0,0 +1,118 @@
+//
+// trace_replay_main.cpp - Command line player for device traces, no window and no D3D
+//
+// trace_replay <trace> [-device null|soft] [-loops n] [-threads n] [-tga file]
+//
+// Plays a trace made with 3d_objects -capture (or F11) and prints the frame times and
+// what each kind of call cost.  The null device times our side of the calls on its
+// own, the soft device adds the rasterizer and ends with a checksum of the last frame
+// so two builds can be checked for drawing the same thing as well as for speed.
+//
+// It isn't in the project, it's meant for the machines without D3D.  Build it with:
+//
+//    g++ -std=c++11 -O2 -pthread -o trace_replay trace_replay_main.cpp trace_replay.cpp
+//        device_trace.cpp frame_stats.cpp mapped_file.cpp text_format.cpp
+//        null_device.cpp soft_device.cpp soft_raster.cpp vertex_quant.cpp job_system.cpp
+//        cpu_features.cpp
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace_replay.h"
+#include "null_device.h"
+#include "soft_device.h"
+
+static void usage(void){
+
+   fprintf(stderr,"usage: trace_replay <trace> [-device null|soft] [-loops n] [-threads n] [-tga file]\n");
+
+}
+
+int main(int argc, char **argv){
+const char *filename=NULL;
+const char *device_name="null";
+const char *tga=NULL;
+int loops=1;
+int threads=0;
+TraceReplay replay;
+RenderDevice *device;
+static char report[8192];
+HRESULT hr;
+
+   for(int i=1;i<argc;i++)
+   {
+      if(strcmp(argv[i],"-device") == 0 && i + 1 < argc)
+      {
+         device_name=argv[++i];
+      }
+      else if(strcmp(argv[i],"-loops") == 0 && i + 1 < argc)
+      {
+         loops=atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i],"-threads") == 0 && i + 1 < argc)
+      {
+         threads=atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i],"-tga") == 0 && i + 1 < argc)
+      {
+         tga=argv[++i];
+      }
+      else if(argv[i][0] != '-' && filename == NULL)
+      {
+         filename=argv[i];
+      }
+      else
+      {
+         usage();
+         return 2;
+      }
+   }
+
+   if(filename == NULL || loops < 1)
+   {
+      usage();
+      return 2;
+   }
+
+   if(!replay.Load(filename))
+   {
+      fprintf(stderr,"trace_replay: %s isn't a trace we can play\n",filename);
+      return 1;
+   }
+
+   if(strcmp(device_name,"soft") == 0)
+   {
+      device=new SoftDevice(replay.GetHeader().width,replay.GetHeader().height,threads);
+   }
+   else if(strcmp(device_name,"null") == 0)
+   {
+      device=new NullDevice();
+   }
+   else
+   {
+      usage();
+      return 2;
+   }
+
+   printf("%s: %ux%u, %u frames, %d loops on %s\n",filename,replay.GetHeader().width,replay.GetHeader().height,
+          replay.GetHeader().frames,loops,device->GetName());
+
+   hr=replay.Play(device,loops);
+   replay.FormatReport(report,sizeof(report));
+   fputs(report,stdout);
+
+   if(strcmp(device_name,"soft") == 0)
+   {
+      const SoftRaster &raster=((SoftDevice *)device)->GetRaster();
+
+      printf("checksum %08X\n",raster.GetChecksum());
+      if(tga && !raster.WriteTGA(tga))
+      {
+         fprintf(stderr,"trace_replay: couldn't write %s\n",tga);
+      }
+   }
+
+   delete device;
+
+   return FAILED(hr) ? 1 : 0;
+}
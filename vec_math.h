@@ -0,0 +1,641 @@
+//
+// vec_math.h - Portable vector and matrix math for the per frame paths
+//
+// Replaces the D3DX matrix helpers the scene calls every frame, with the same
+// conventions: row vectors, row-major storage, left-handed.  vm_matrix has the memory
+// layout of D3DXMATRIX (and sr_matrix, and rd_instance::world) so they can be cast
+// freely, and it converts to const float * for RenderDevice::SetTransform just as
+// D3DXMATRIX does.  The single matrix functions use D3DX's formulas in the same
+// evaluation order, so they agree with D3DX bit for bit apart from any difference
+// between D3DX's sin/cos and the CRT's.
+//
+// The _batch functions work on whole arrays.  They use SSE2 on x86/x64 and AVX when
+// the compiler targets it (__AVX__), and plain loops elsewhere that an ARM compiler
+// can vectorize for NEON.  Every path does the same operations in the same order with
+// no fused multiply-adds, so they all give identical results.
+//
+// Header only, no dependencies beyond the CRT.
+//
+#ifndef VEC_MATH_H
+#define VEC_MATH_H
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+//Define VM_NO_SIMD to force the plain loops, e.g. to compare against the SIMD paths
+#if !defined(VM_NO_SIMD) && (defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || \
+                             (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define VM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(VM_SSE2) && defined(__AVX__)
+#define VM_AVX 1
+#include <immintrin.h>
+#endif
+
+const float VM_PI = 3.141592654f;
+
+struct vm_vec3
+{
+   float x, y, z;
+
+   vm_vec3(void) {}
+   vm_vec3(float p_x, float p_y, float p_z) : x(p_x),y(p_y),z(p_z) {}
+};
+
+struct vm_vec4
+{
+   float x, y, z, w;
+};
+
+struct vm_matrix
+{
+   float m[4][4];
+
+   operator float *(void) { return &m[0][0]; }
+   operator const float *(void) const { return &m[0][0]; }
+};
+
+//******************************************************************************************
+// Vectors
+//******************************************************************************************
+inline vm_vec3 vm_vec3_sub(const vm_vec3 &p_a, const vm_vec3 &p_b){
+
+   return vm_vec3(p_a.x - p_b.x,p_a.y - p_b.y,p_a.z - p_b.z);
+}
+
+inline float vm_vec3_dot(const vm_vec3 &p_a, const vm_vec3 &p_b){
+
+   return p_a.x * p_b.x + p_a.y * p_b.y + p_a.z * p_b.z;
+}
+
+inline vm_vec3 vm_vec3_cross(const vm_vec3 &p_a, const vm_vec3 &p_b){
+
+   return vm_vec3(p_a.y * p_b.z - p_a.z * p_b.y,
+                  p_a.z * p_b.x - p_a.x * p_b.z,
+                  p_a.x * p_b.y - p_a.y * p_b.x);
+}
+
+//A zero vector stays zero, like D3DXVec3Normalize
+inline vm_vec3 vm_vec3_normalize(const vm_vec3 &p_v){
+float length=sqrtf(vm_vec3_dot(p_v,p_v));
+
+   if(length == 0.0f)
+   {
+      return vm_vec3(0.0f,0.0f,0.0f);
+   }
+
+   return vm_vec3(p_v.x / length,p_v.y / length,p_v.z / length);
+}
+
+//p_v * p_m with w=1, then divided through by w (D3DXVec3TransformCoord)
+inline vm_vec3 vm_vec3_transform_coord(const vm_vec3 &p_v, const vm_matrix &p_m){
+float x=((p_v.x * p_m.m[0][0] + p_v.y * p_m.m[1][0]) + p_v.z * p_m.m[2][0]) + p_m.m[3][0];
+float y=((p_v.x * p_m.m[0][1] + p_v.y * p_m.m[1][1]) + p_v.z * p_m.m[2][1]) + p_m.m[3][1];
+float z=((p_v.x * p_m.m[0][2] + p_v.y * p_m.m[1][2]) + p_v.z * p_m.m[2][2]) + p_m.m[3][2];
+float w=((p_v.x * p_m.m[0][3] + p_v.y * p_m.m[1][3]) + p_v.z * p_m.m[2][3]) + p_m.m[3][3];
+
+   return vm_vec3(x / w,y / w,z / w);
+}
+
+//p_v * p_m with w=0, a direction, not renormalised (D3DXVec3TransformNormal)
+inline vm_vec3 vm_vec3_transform_normal(const vm_vec3 &p_v, const vm_matrix &p_m){
+float x=(p_v.x * p_m.m[0][0] + p_v.y * p_m.m[1][0]) + p_v.z * p_m.m[2][0];
+float y=(p_v.x * p_m.m[0][1] + p_v.y * p_m.m[1][1]) + p_v.z * p_m.m[2][1];
+float z=(p_v.x * p_m.m[0][2] + p_v.y * p_m.m[1][2]) + p_v.z * p_m.m[2][2];
+
+   return vm_vec3(x,y,z);
+}
+
+//******************************************************************************************
+// Single matrices.  They return p_out like the D3DX functions, and p_out may be one of
+// the inputs.
+//******************************************************************************************
+inline vm_matrix *vm_matrix_identity(vm_matrix *p_out){
+
+   memset(p_out,0,sizeof(*p_out));
+   p_out->m[0][0]=p_out->m[1][1]=p_out->m[2][2]=p_out->m[3][3]=1.0f;
+
+   return p_out;
+}
+
+inline vm_matrix *vm_matrix_translation(vm_matrix *p_out, float p_x, float p_y, float p_z){
+
+   vm_matrix_identity(p_out);
+   p_out->m[3][0]=p_x;
+   p_out->m[3][1]=p_y;
+   p_out->m[3][2]=p_z;
+
+   return p_out;
+}
+
+inline vm_matrix *vm_matrix_scaling(vm_matrix *p_out, float p_x, float p_y, float p_z){
+
+   vm_matrix_identity(p_out);
+   p_out->m[0][0]=p_x;
+   p_out->m[1][1]=p_y;
+   p_out->m[2][2]=p_z;
+
+   return p_out;
+}
+
+inline vm_matrix *vm_matrix_rotation_x(vm_matrix *p_out, float p_angle){
+const float c=cosf(p_angle);
+const float s=sinf(p_angle);
+
+   vm_matrix_identity(p_out);
+   p_out->m[1][1]=c;
+   p_out->m[1][2]=s;
+   p_out->m[2][1]=-s;
+   p_out->m[2][2]=c;
+
+   return p_out;
+}
+
+inline vm_matrix *vm_matrix_rotation_y(vm_matrix *p_out, float p_angle){
+const float c=cosf(p_angle);
+const float s=sinf(p_angle);
+
+   vm_matrix_identity(p_out);
+   p_out->m[0][0]=c;
+   p_out->m[0][2]=-s;
+   p_out->m[2][0]=s;
+   p_out->m[2][2]=c;
+
+   return p_out;
+}
+
+inline vm_matrix *vm_matrix_rotation_z(vm_matrix *p_out, float p_angle){
+const float c=cosf(p_angle);
+const float s=sinf(p_angle);
+
+   vm_matrix_identity(p_out);
+   p_out->m[0][0]=c;
+   p_out->m[0][1]=s;
+   p_out->m[1][0]=-s;
+   p_out->m[1][1]=c;
+
+   return p_out;
+}
+//******************************************************************************************
+// Function:vm_matrix_rotation_yaw_pitch_roll
+// Whazzit:Roll about Z, then pitch about X, then yaw about Y, written out in closed form
+//         rather than as two matrix multiplies.
+//******************************************************************************************
+inline vm_matrix *vm_matrix_rotation_yaw_pitch_roll(vm_matrix *p_out, float p_yaw, float p_pitch, float p_roll){
+const float cy=cosf(p_yaw), sy=sinf(p_yaw);
+const float cp=cosf(p_pitch), sp=sinf(p_pitch);
+const float cr=cosf(p_roll), sr=sinf(p_roll);
+
+   p_out->m[0][0]=cr * cy + sr * sp * sy;
+   p_out->m[0][1]=sr * cp;
+   p_out->m[0][2]=sr * sp * cy - cr * sy;
+   p_out->m[0][3]=0.0f;
+
+   p_out->m[1][0]=cr * sp * sy - sr * cy;
+   p_out->m[1][1]=cr * cp;
+   p_out->m[1][2]=sr * sy + cr * sp * cy;
+   p_out->m[1][3]=0.0f;
+
+   p_out->m[2][0]=cp * sy;
+   p_out->m[2][1]=-sp;
+   p_out->m[2][2]=cp * cy;
+   p_out->m[2][3]=0.0f;
+
+   p_out->m[3][0]=p_out->m[3][1]=p_out->m[3][2]=0.0f;
+   p_out->m[3][3]=1.0f;
+
+   return p_out;
+}
+
+inline vm_matrix *vm_matrix_transpose(vm_matrix *p_out, const vm_matrix *p_m){
+vm_matrix result;
+
+   for(int r=0;r<4;r++)
+   {
+      for(int c=0;c<4;c++)
+      {
+         result.m[r][c]=p_m->m[c][r];
+      }
+   }
+   *p_out=result;
+
+   return p_out;
+}
+
+#ifdef VM_SSE2
+//One output row: p_row * p_b, as ((x*b0 + y*b1) + z*b2) + w*b3
+inline __m128 vm_row_sse(const float *p_row, __m128 p_b0, __m128 p_b1, __m128 p_b2, __m128 p_b3){
+__m128 sum;
+
+   sum=_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p_row[0]),p_b0),_mm_mul_ps(_mm_set1_ps(p_row[1]),p_b1));
+   sum=_mm_add_ps(sum,_mm_mul_ps(_mm_set1_ps(p_row[2]),p_b2));
+
+   return _mm_add_ps(sum,_mm_mul_ps(_mm_set1_ps(p_row[3]),p_b3));
+}
+#endif
+
+inline vm_matrix *vm_matrix_multiply(vm_matrix *p_out, const vm_matrix *p_a, const vm_matrix *p_b){
+#ifdef VM_SSE2
+const __m128 b0=_mm_loadu_ps(p_b->m[0]);
+const __m128 b1=_mm_loadu_ps(p_b->m[1]);
+const __m128 b2=_mm_loadu_ps(p_b->m[2]);
+const __m128 b3=_mm_loadu_ps(p_b->m[3]);
+__m128 r0,r1,r2,r3;
+
+   r0=vm_row_sse(p_a->m[0],b0,b1,b2,b3);
+   r1=vm_row_sse(p_a->m[1],b0,b1,b2,b3);
+   r2=vm_row_sse(p_a->m[2],b0,b1,b2,b3);
+   r3=vm_row_sse(p_a->m[3],b0,b1,b2,b3);
+
+   _mm_storeu_ps(p_out->m[0],r0);
+   _mm_storeu_ps(p_out->m[1],r1);
+   _mm_storeu_ps(p_out->m[2],r2);
+   _mm_storeu_ps(p_out->m[3],r3);
+#else
+vm_matrix result;
+
+   for(int r=0;r<4;r++)
+   {
+      for(int c=0;c<4;c++)
+      {
+         result.m[r][c]=((p_a->m[r][0] * p_b->m[0][c] + p_a->m[r][1] * p_b->m[1][c]) +
+                         p_a->m[r][2] * p_b->m[2][c]) + p_a->m[r][3] * p_b->m[3][c];
+      }
+   }
+   *p_out=result;
+#endif
+
+   return p_out;
+}
+//******************************************************************************************
+// Function:vm_matrix_look_at_lh
+// Whazzit:View matrix looking from p_eye towards p_at (D3DXMatrixLookAtLH)
+//******************************************************************************************
+inline vm_matrix *vm_matrix_look_at_lh(vm_matrix *p_out, const vm_vec3 &p_eye, const vm_vec3 &p_at,
+                                       const vm_vec3 &p_up){
+const vm_vec3 z_axis=vm_vec3_normalize(vm_vec3_sub(p_at,p_eye));
+const vm_vec3 x_axis=vm_vec3_normalize(vm_vec3_cross(p_up,z_axis));
+const vm_vec3 y_axis=vm_vec3_cross(z_axis,x_axis);
+
+   p_out->m[0][0]=x_axis.x; p_out->m[0][1]=y_axis.x; p_out->m[0][2]=z_axis.x; p_out->m[0][3]=0.0f;
+   p_out->m[1][0]=x_axis.y; p_out->m[1][1]=y_axis.y; p_out->m[1][2]=z_axis.y; p_out->m[1][3]=0.0f;
+   p_out->m[2][0]=x_axis.z; p_out->m[2][1]=y_axis.z; p_out->m[2][2]=z_axis.z; p_out->m[2][3]=0.0f;
+   p_out->m[3][0]=-vm_vec3_dot(x_axis,p_eye);
+   p_out->m[3][1]=-vm_vec3_dot(y_axis,p_eye);
+   p_out->m[3][2]=-vm_vec3_dot(z_axis,p_eye);
+   p_out->m[3][3]=1.0f;
+
+   return p_out;
+}
+//******************************************************************************************
+// Function:vm_matrix_perspective_fov_lh
+// Whazzit:Projection with a vertical field of view in radians (D3DXMatrixPerspectiveFovLH)
+//******************************************************************************************
+inline vm_matrix *vm_matrix_perspective_fov_lh(vm_matrix *p_out, float p_fov_y, float p_aspect,
+                                               float p_near, float p_far){
+const float y_scale=1.0f / tanf(p_fov_y / 2.0f);
+
+   memset(p_out,0,sizeof(*p_out));
+   p_out->m[0][0]=y_scale / p_aspect;
+   p_out->m[1][1]=y_scale;
+   p_out->m[2][2]=p_far / (p_far - p_near);
+   p_out->m[2][3]=1.0f;
+   p_out->m[3][2]=-p_near * p_far / (p_far - p_near);
+
+   return p_out;
+}
+//******************************************************************************************
+// Function:vm_matrix_inverse
+// Whazzit:General inverse by cofactors, returns NULL and leaves p_out alone when p_m is
+//         singular (D3DXMatrixInverse).  Not bit for bit with D3DX, whose formula
+//         isn't documented; it's for picking, not for anything drawn.
+//******************************************************************************************
+inline vm_matrix *vm_matrix_inverse(vm_matrix *p_out, const vm_matrix *p_m){
+const float (*m)[4]=p_m->m;
+//2x2 determinants of the top two rows and of the bottom two
+const float s0=m[0][0] * m[1][1] - m[1][0] * m[0][1];
+const float s1=m[0][0] * m[1][2] - m[1][0] * m[0][2];
+const float s2=m[0][0] * m[1][3] - m[1][0] * m[0][3];
+const float s3=m[0][1] * m[1][2] - m[1][1] * m[0][2];
+const float s4=m[0][1] * m[1][3] - m[1][1] * m[0][3];
+const float s5=m[0][2] * m[1][3] - m[1][2] * m[0][3];
+const float c5=m[2][2] * m[3][3] - m[3][2] * m[2][3];
+const float c4=m[2][1] * m[3][3] - m[3][1] * m[2][3];
+const float c3=m[2][1] * m[3][2] - m[3][1] * m[2][2];
+const float c2=m[2][0] * m[3][3] - m[3][0] * m[2][3];
+const float c1=m[2][0] * m[3][2] - m[3][0] * m[2][2];
+const float c0=m[2][0] * m[3][1] - m[3][0] * m[2][1];
+const float det=s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+vm_matrix result;
+float inv_det;
+
+   if(det == 0.0f)
+   {
+      return NULL;
+   }
+   inv_det=1.0f / det;
+
+   result.m[0][0]=( m[1][1] * c5 - m[1][2] * c4 + m[1][3] * c3) * inv_det;
+   result.m[0][1]=(-m[0][1] * c5 + m[0][2] * c4 - m[0][3] * c3) * inv_det;
+   result.m[0][2]=( m[3][1] * s5 - m[3][2] * s4 + m[3][3] * s3) * inv_det;
+   result.m[0][3]=(-m[2][1] * s5 + m[2][2] * s4 - m[2][3] * s3) * inv_det;
+   result.m[1][0]=(-m[1][0] * c5 + m[1][2] * c2 - m[1][3] * c1) * inv_det;
+   result.m[1][1]=( m[0][0] * c5 - m[0][2] * c2 + m[0][3] * c1) * inv_det;
+   result.m[1][2]=(-m[3][0] * s5 + m[3][2] * s2 - m[3][3] * s1) * inv_det;
+   result.m[1][3]=( m[2][0] * s5 - m[2][2] * s2 + m[2][3] * s1) * inv_det;
+   result.m[2][0]=( m[1][0] * c4 - m[1][1] * c2 + m[1][3] * c0) * inv_det;
+   result.m[2][1]=(-m[0][0] * c4 + m[0][1] * c2 - m[0][3] * c0) * inv_det;
+   result.m[2][2]=( m[3][0] * s4 - m[3][1] * s2 + m[3][3] * s0) * inv_det;
+   result.m[2][3]=(-m[2][0] * s4 + m[2][1] * s2 - m[2][3] * s0) * inv_det;
+   result.m[3][0]=(-m[1][0] * c3 + m[1][1] * c1 - m[1][2] * c0) * inv_det;
+   result.m[3][1]=( m[0][0] * c3 - m[0][1] * c1 + m[0][2] * c0) * inv_det;
+   result.m[3][2]=(-m[3][0] * s3 + m[3][1] * s1 - m[3][2] * s0) * inv_det;
+   result.m[3][3]=( m[2][0] * s3 - m[2][1] * s1 + m[2][2] * s0) * inv_det;
+   *p_out=result;
+
+   return p_out;
+}
+
+//******************************************************************************************
+// Batches
+//******************************************************************************************
+
+//******************************************************************************************
+// Function:vm_matrix_multiply_batch
+// Whazzit:p_out[i] = p_a[i] * p_b for p_count matrices, e.g. a world array times
+//         view*projection.  p_out may be p_a.
+//******************************************************************************************
+inline void vm_matrix_multiply_batch(vm_matrix *p_out, const vm_matrix *p_a, const vm_matrix *p_b,
+                                     size_t p_count){
+#if defined(VM_AVX)
+//Two rows per operation, with each row of p_b in both halves
+const __m256 b0=_mm256_broadcast_ps((const __m128 *)p_b->m[0]);
+const __m256 b1=_mm256_broadcast_ps((const __m128 *)p_b->m[1]);
+const __m256 b2=_mm256_broadcast_ps((const __m128 *)p_b->m[2]);
+const __m256 b3=_mm256_broadcast_ps((const __m128 *)p_b->m[3]);
+
+   for(size_t i=0;i<p_count;i++)
+   {
+      const float *a=&p_a[i].m[0][0];
+      float *out=&p_out[i].m[0][0];
+
+      for(int r=0;r<4;r+=2)
+      {
+         const float *a0=a + r * 4;
+         const float *a1=a0 + 4;
+         __m256 sum;
+
+         sum=_mm256_add_ps(_mm256_mul_ps(_mm256_setr_ps(a0[0],a0[0],a0[0],a0[0],a1[0],a1[0],a1[0],a1[0]),b0),
+                           _mm256_mul_ps(_mm256_setr_ps(a0[1],a0[1],a0[1],a0[1],a1[1],a1[1],a1[1],a1[1]),b1));
+         sum=_mm256_add_ps(sum,_mm256_mul_ps(_mm256_setr_ps(a0[2],a0[2],a0[2],a0[2],a1[2],a1[2],a1[2],a1[2]),b2));
+         sum=_mm256_add_ps(sum,_mm256_mul_ps(_mm256_setr_ps(a0[3],a0[3],a0[3],a0[3],a1[3],a1[3],a1[3],a1[3]),b3));
+         _mm256_storeu_ps(out + r * 4,sum);
+      }
+   }
+#elif defined(VM_SSE2)
+const __m128 b0=_mm_loadu_ps(p_b->m[0]);
+const __m128 b1=_mm_loadu_ps(p_b->m[1]);
+const __m128 b2=_mm_loadu_ps(p_b->m[2]);
+const __m128 b3=_mm_loadu_ps(p_b->m[3]);
+
+   for(size_t i=0;i<p_count;i++)
+   {
+      __m128 r0=vm_row_sse(p_a[i].m[0],b0,b1,b2,b3);
+      __m128 r1=vm_row_sse(p_a[i].m[1],b0,b1,b2,b3);
+      __m128 r2=vm_row_sse(p_a[i].m[2],b0,b1,b2,b3);
+      __m128 r3=vm_row_sse(p_a[i].m[3],b0,b1,b2,b3);
+
+      _mm_storeu_ps(p_out[i].m[0],r0);
+      _mm_storeu_ps(p_out[i].m[1],r1);
+      _mm_storeu_ps(p_out[i].m[2],r2);
+      _mm_storeu_ps(p_out[i].m[3],r3);
+   }
+#else
+   for(size_t i=0;i<p_count;i++)
+   {
+      vm_matrix_multiply(&p_out[i],&p_a[i],p_b);
+   }
+#endif
+
+}
+
+//Cephes single precision sin/cos, good to a couple of ulp for |x| below about 8192
+const float VM_FOPI    = 1.27323954473516f;   //4/pi
+const float VM_DP1     = -0.78515625f;        //-pi/4 split in three for the reduction
+const float VM_DP2     = -2.4187564849853515625e-4f;
+const float VM_DP3     = -3.77489497744594108e-8f;
+const float VM_SIN_P0  = -1.9515295891e-4f;
+const float VM_SIN_P1  = 8.3321608736e-3f;
+const float VM_SIN_P2  = -1.6666654611e-1f;
+const float VM_COS_P0  = 2.443315711809948e-5f;
+const float VM_COS_P1  = -1.388731625493765e-3f;
+const float VM_COS_P2  = 4.166664568298827e-2f;
+
+//******************************************************************************************
+// Function:vm_sincos
+// Whazzit:Scalar version of the vm_sincos_batch kernel, same steps in the same order
+//******************************************************************************************
+inline void vm_sincos(float p_x, float *p_sin, float *p_cos){
+float x=fabsf(p_x);
+int j=((int)(x * VM_FOPI) + 1) & ~1;   //Octant, rounded to even
+const float y=(float)j;
+float z,poly_sin,poly_cos,s,c;
+
+   x=((x + y * VM_DP1) + y * VM_DP2) + y * VM_DP3;
+   z=x * x;
+
+   poly_cos=((VM_COS_P0 * z + VM_COS_P1) * z + VM_COS_P2) * z * z - z * 0.5f + 1.0f;
+   poly_sin=((VM_SIN_P0 * z + VM_SIN_P1) * z + VM_SIN_P2) * z * x + x;
+
+   if(j & 2)
+   {
+      s=poly_cos;
+      c=poly_sin;
+   }
+   else
+   {
+      s=poly_sin;
+      c=poly_cos;
+   }
+
+   *p_sin=((p_x < 0.0f) != ((j & 4) != 0)) ? -s : s;
+   *p_cos=((j - 2) & 4) ? c : -c;
+
+}
+//******************************************************************************************
+// Function:vm_sincos_batch
+// Whazzit:Sine and cosine of p_count angles.  Not bit compatible with the CRT's sinf/cosf,
+//         but the SIMD and scalar paths agree with each other exactly.
+//******************************************************************************************
+inline void vm_sincos_batch(const float *p_angles, float *p_sin, float *p_cos, size_t p_count){
+size_t i=0;
+
+#ifdef VM_SSE2
+const __m128 sign_mask=_mm_castsi128_ps(_mm_set1_epi32((int)0x80000000));
+const __m128i one=_mm_set1_epi32(1);
+const __m128i two=_mm_set1_epi32(2);
+const __m128i four=_mm_set1_epi32(4);
+
+   for(;i + 4 <= p_count;i+=4)
+   {
+      __m128 x=_mm_loadu_ps(p_angles + i);
+      __m128 sign_sin=_mm_and_ps(x,sign_mask);
+      __m128 sign_cos;
+      __m128 y,z,poly_sin,poly_cos,use_cos;
+      __m128i j;
+
+      x=_mm_andnot_ps(sign_mask,x);
+
+      j=_mm_cvttps_epi32(_mm_mul_ps(x,_mm_set1_ps(VM_FOPI)));
+      j=_mm_andnot_si128(one,_mm_add_epi32(j,one));
+      y=_mm_cvtepi32_ps(j);
+
+      sign_sin=_mm_xor_ps(sign_sin,_mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j,four),29)));
+      sign_cos=_mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(j,two),four),29));
+      use_cos=_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j,two),two));
+
+      x=_mm_add_ps(x,_mm_mul_ps(y,_mm_set1_ps(VM_DP1)));
+      x=_mm_add_ps(x,_mm_mul_ps(y,_mm_set1_ps(VM_DP2)));
+      x=_mm_add_ps(x,_mm_mul_ps(y,_mm_set1_ps(VM_DP3)));
+      z=_mm_mul_ps(x,x);
+
+      poly_cos=_mm_add_ps(_mm_mul_ps(_mm_set1_ps(VM_COS_P0),z),_mm_set1_ps(VM_COS_P1));
+      poly_cos=_mm_add_ps(_mm_mul_ps(poly_cos,z),_mm_set1_ps(VM_COS_P2));
+      poly_cos=_mm_mul_ps(_mm_mul_ps(poly_cos,z),z);
+      poly_cos=_mm_sub_ps(poly_cos,_mm_mul_ps(z,_mm_set1_ps(0.5f)));
+      poly_cos=_mm_add_ps(poly_cos,_mm_set1_ps(1.0f));
+
+      poly_sin=_mm_add_ps(_mm_mul_ps(_mm_set1_ps(VM_SIN_P0),z),_mm_set1_ps(VM_SIN_P1));
+      poly_sin=_mm_add_ps(_mm_mul_ps(poly_sin,z),_mm_set1_ps(VM_SIN_P2));
+      poly_sin=_mm_add_ps(_mm_mul_ps(_mm_mul_ps(poly_sin,z),x),x);
+
+      _mm_storeu_ps(p_sin + i,_mm_xor_ps(_mm_or_ps(_mm_and_ps(use_cos,poly_cos),
+                                                   _mm_andnot_ps(use_cos,poly_sin)),sign_sin));
+      _mm_storeu_ps(p_cos + i,_mm_xor_ps(_mm_or_ps(_mm_and_ps(use_cos,poly_sin),
+                                                   _mm_andnot_ps(use_cos,poly_cos)),sign_cos));
+   }
+#endif
+
+   for(;i<p_count;i++)
+   {
+      vm_sincos(p_angles[i],&p_sin[i],&p_cos[i]);
+   }
+
+}
+//******************************************************************************************
+// Function:vm_compose_srt_y_batch
+// Whazzit:World matrices for p_count objects given as structure of arrays: uniform scale,
+//         rotation about Y, then translation.  The same as
+//         vm_matrix_scaling * vm_matrix_rotation_y * vm_matrix_translation, except the
+//         angles go through vm_sincos_batch.  p_out_stride is the distance in bytes
+//         between output matrices, so they can be written straight into a larger record
+//         (sizeof(vm_matrix) for a plain array).
+//******************************************************************************************
+inline void vm_compose_srt_y_batch(const float *p_scale, const float *p_angle, const float *p_x,
+                                   const float *p_y, const float *p_z, size_t p_count,
+                                   vm_matrix *p_out, size_t p_out_stride){
+const size_t block=256;
+float sin_y[block];
+float cos_y[block];
+unsigned char *out=(unsigned char *)p_out;
+
+   for(size_t base=0;base < p_count;base+=block)
+   {
+      const size_t count=p_count - base < block ? p_count - base : block;
+
+      vm_sincos_batch(p_angle + base,sin_y,cos_y,count);
+
+      for(size_t i=0;i<count;i++)
+      {
+         float (*m)[4]=((vm_matrix *)(out + (base + i) * p_out_stride))->m;
+         const float scale=p_scale[base + i];
+         const float c=cos_y[i] * scale;
+         const float s=sin_y[i] * scale;
+
+         m[0][0]=c;     m[0][1]=0.0f;  m[0][2]=-s;    m[0][3]=0.0f;
+         m[1][0]=0.0f;  m[1][1]=scale; m[1][2]=0.0f;  m[1][3]=0.0f;
+         m[2][0]=s;     m[2][1]=0.0f;  m[2][2]=c;     m[2][3]=0.0f;
+         m[3][0]=p_x[base + i];
+         m[3][1]=p_y[base + i];
+         m[3][2]=p_z[base + i];
+         m[3][3]=1.0f;
+      }
+   }
+
+}
+//******************************************************************************************
+// Function:vm_transform_points_soa
+// Whazzit:Transforms p_count points (w=1) by p_m, inputs and outputs as separate x/y/z(/w)
+//         arrays.  p_out_w may be NULL when only the affine part is wanted.  The outputs
+//         must not overlap the inputs.
+//******************************************************************************************
+inline void vm_transform_points_soa(const vm_matrix *p_m, const float *p_x, const float *p_y,
+                                    const float *p_z, size_t p_count, float *p_out_x, float *p_out_y,
+                                    float *p_out_z, float *p_out_w){
+const float (*m)[4]=p_m->m;
+size_t i=0;
+
+#if defined(VM_AVX)
+   for(;i + 8 <= p_count;i+=8)
+   {
+      const __m256 x=_mm256_loadu_ps(p_x + i);
+      const __m256 y=_mm256_loadu_ps(p_y + i);
+      const __m256 z=_mm256_loadu_ps(p_z + i);
+      float *outs[4]={p_out_x,p_out_y,p_out_z,p_out_w};
+
+      for(int c=0;c<4;c++)
+      {
+         __m256 sum;
+
+         if(outs[c] == NULL)
+         {
+            continue;
+         }
+         sum=_mm256_add_ps(_mm256_mul_ps(x,_mm256_set1_ps(m[0][c])),_mm256_mul_ps(y,_mm256_set1_ps(m[1][c])));
+         sum=_mm256_add_ps(sum,_mm256_mul_ps(z,_mm256_set1_ps(m[2][c])));
+         _mm256_storeu_ps(outs[c] + i,_mm256_add_ps(sum,_mm256_set1_ps(m[3][c])));
+      }
+   }
+#endif
+#if defined(VM_SSE2)
+   for(;i + 4 <= p_count;i+=4)
+   {
+      const __m128 x=_mm_loadu_ps(p_x + i);
+      const __m128 y=_mm_loadu_ps(p_y + i);
+      const __m128 z=_mm_loadu_ps(p_z + i);
+      float *outs[4]={p_out_x,p_out_y,p_out_z,p_out_w};
+
+      for(int c=0;c<4;c++)
+      {
+         __m128 sum;
+
+         if(outs[c] == NULL)
+         {
+            continue;
+         }
+         sum=_mm_add_ps(_mm_mul_ps(x,_mm_set1_ps(m[0][c])),_mm_mul_ps(y,_mm_set1_ps(m[1][c])));
+         sum=_mm_add_ps(sum,_mm_mul_ps(z,_mm_set1_ps(m[2][c])));
+         _mm_storeu_ps(outs[c] + i,_mm_add_ps(sum,_mm_set1_ps(m[3][c])));
+      }
+   }
+#endif
+
+   for(;i<p_count;i++)
+   {
+      const float x=p_x[i], y=p_y[i], z=p_z[i];
+
+      p_out_x[i]=((x * m[0][0] + y * m[1][0]) + z * m[2][0]) + m[3][0];
+      p_out_y[i]=((x * m[0][1] + y * m[1][1]) + z * m[2][1]) + m[3][1];
+      p_out_z[i]=((x * m[0][2] + y * m[1][2]) + z * m[2][2]) + m[3][2];
+      if(p_out_w)
+      {
+         p_out_w[i]=((x * m[0][3] + y * m[1][3]) + z * m[2][3]) + m[3][3];
+      }
+   }
+
+}
+
+#endif
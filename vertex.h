@@ -0,0 +1,24 @@
+//
+// vertex.h - Vertex formats shared between the renderer and the asset code
+//
+#ifndef VERTEX_H
+#define VERTEX_H
+
+#include <stdint.h>
+#include "platform_types.h"
+
+struct tri_vertex
+{
+    float x, y, z;  // The untransformed (model space) position for the vertex.
+    DWORD colour;        // The vertex colour.
+};
+
+//The same vertex in half the space: the position in 16 bit steps across the mesh's
+//bounding box and the colour as an index into its palette (see vertex_quant.h)
+struct tri_qvertex
+{
+    int16_t x, y, z;
+    uint16_t colour;
+};
+
+#endif
@@ -0,0 +1,256 @@
+//
+// vertex_quant.cpp - 8 byte quantized vertices, half the size of tri_vertex
+//
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "vertex_quant.h"
+#include "cpu_features.h"
+
+#ifdef CPU_X86
+   #include <emmintrin.h>
+#endif
+
+//Vertices vq_encode decodes at a time to measure its error
+const size_t g_vq_check_batch = 256;
+
+uint16_t vq_pack_565(DWORD p_colour){
+const DWORD r=(((p_colour >> 16) & 0xFF) * 31 + 127) / 255;
+const DWORD g=(((p_colour >> 8) & 0xFF) * 63 + 127) / 255;
+const DWORD b=((p_colour & 0xFF) * 31 + 127) / 255;
+
+   return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+DWORD vq_unpack_565(uint16_t p_colour){
+const DWORD r=(((p_colour >> 11) & 31) * 255 + 15) / 31;
+const DWORD g=(((p_colour >> 5) & 63) * 255 + 31) / 63;
+const DWORD b=((p_colour & 31) * 255 + 15) / 31;
+
+   return 0xFF000000 | (r << 16) | (g << 8) | b;
+}
+
+static inline DWORD decode_colour(uint16_t p_colour, const rd_quantization &p_quant){
+
+   if(p_quant.palette_count == 0)
+   {
+      return vq_unpack_565(p_colour);
+   }
+
+   return p_quant.palette[p_colour < p_quant.palette_count ? p_colour : p_quant.palette_count - 1];
+}
+
+static void decode_scalar(const tri_qvertex *p_src, size_t p_count, const rd_quantization &p_quant,
+                          tri_vertex *p_dst){
+
+   for(size_t i=0;i<p_count;i++)
+   {
+      p_dst[i].x=(float)p_src[i].x * p_quant.scale[0] + p_quant.bias[0];
+      p_dst[i].y=(float)p_src[i].y * p_quant.scale[1] + p_quant.bias[1];
+      p_dst[i].z=(float)p_src[i].z * p_quant.scale[2] + p_quant.bias[2];
+      p_dst[i].colour=decode_colour(p_src[i].colour,p_quant);
+   }
+
+}
+
+#ifdef CPU_X86
+//******************************************************************************************
+// Function:decode_sse2
+// Whazzit:Two vertices to a load.  Unpacking the words with themselves and shifting back
+//         down sign extends them to four ints, x,y,z and the colour, which comes out as
+//         junk in the fourth float and is written over with the real one.
+//******************************************************************************************
+TARGET_SSE2 static void decode_sse2(const tri_qvertex *p_src, size_t p_count, const rd_quantization &p_quant,
+                                    tri_vertex *p_dst){
+const __m128 scale=_mm_setr_ps(p_quant.scale[0],p_quant.scale[1],p_quant.scale[2],0.0f);
+const __m128 bias=_mm_setr_ps(p_quant.bias[0],p_quant.bias[1],p_quant.bias[2],0.0f);
+size_t i=0;
+
+   for(;i + 2 <= p_count;i+=2)
+   {
+      const __m128i packed=_mm_loadu_si128((const __m128i *)(p_src + i));
+      const __m128i first=_mm_srai_epi32(_mm_unpacklo_epi16(packed,packed),16);
+      const __m128i second=_mm_srai_epi32(_mm_unpackhi_epi16(packed,packed),16);
+
+      _mm_storeu_ps((float *)(p_dst + i),_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(first),scale),bias));
+      _mm_storeu_ps((float *)(p_dst + i + 1),_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(second),scale),bias));
+      p_dst[i].colour=decode_colour(p_src[i].colour,p_quant);
+      p_dst[i + 1].colour=decode_colour(p_src[i + 1].colour,p_quant);
+   }
+
+   decode_scalar(p_src + i,p_count - i,p_quant,p_dst + i);
+
+}
+#endif
+
+void vq_decode(const tri_qvertex *p_src, size_t p_count, const rd_quantization &p_quant, tri_vertex *p_dst){
+
+#ifdef CPU_X86
+   if(cpu_get_level() >= CPU_LEVEL_SSE2)
+   {
+      decode_sse2(p_src,p_count,p_quant,p_dst);
+      return;
+   }
+#endif
+
+   decode_scalar(p_src,p_count,p_quant,p_dst);
+
+}
+
+void vq_quantization(const vq_mesh &p_mesh, rd_quantization *p_quant){
+
+   for(int k=0;k<3;k++)
+   {
+      p_quant->scale[k]=p_mesh.scale[k];
+      p_quant->bias[k]=p_mesh.bias[k];
+   }
+   p_quant->palette=p_mesh.palette.empty() ? NULL : &p_mesh.palette[0];
+   p_quant->palette_count=(UINT)p_mesh.palette.size();
+
+}
+//******************************************************************************************
+// Function:is_finite
+// Whazzit:False for NaN and the infinities, which both give NaN when subtracted from themselves
+//******************************************************************************************
+static inline bool is_finite(float p_value){
+
+   return p_value - p_value == 0.0f;
+}
+//******************************************************************************************
+// Function:quantize
+// Whazzit:Nearest step to p_value, clamped so a box edge that rounds out stays in range.
+//         A value that isn't finite gets step 0, the centre of the box, since the clamps
+//         can't catch a NaN and casting one to an integer is undefined.
+//******************************************************************************************
+static inline int16_t quantize(float p_value, float p_bias, float p_inv_scale){
+const float step=floorf((p_value - p_bias) * p_inv_scale + 0.5f);
+
+   if(!is_finite(p_value))
+   {
+      return 0;
+   }
+   if(step > (float)g_vq_max_step)
+   {
+      return (int16_t)g_vq_max_step;
+   }
+   if(step < (float)-g_vq_max_step)
+   {
+      return (int16_t)-g_vq_max_step;
+   }
+
+   return (int16_t)step;
+}
+
+static int channel_error(DWORD p_a, DWORD p_b){
+int worst=0;
+
+   for(int shift=0;shift < 32;shift+=8)
+   {
+      const int diff=abs((int)((p_a >> shift) & 0xFF) - (int)((p_b >> shift) & 0xFF));
+
+      worst=diff > worst ? diff : worst;
+   }
+
+   return worst;
+}
+//******************************************************************************************
+// Function:vq_encode
+// Whazzit:Finds the box and the distinct colours, quantizes, then decodes everything
+//         again through vq_decode to measure what the backends will really draw
+//******************************************************************************************
+void vq_encode(const tri_vertex *p_vertices, size_t p_count, vq_mesh *p_out){
+float low[3]={ 0.0f,0.0f,0.0f };
+float high[3]={ 0.0f,0.0f,0.0f };
+float inv_scale[3];
+float diagonal=0.0f;
+std::vector<DWORD> colours(p_count);
+rd_quantization quant;
+tri_vertex check[g_vq_check_batch];
+vq_error &error=p_out->error;
+bool first=true;
+
+   memset(&error,0,sizeof(error));
+   for(size_t i=0;i<p_count;i++)
+   {
+      const float pos[3]={ p_vertices[i].x,p_vertices[i].y,p_vertices[i].z };
+
+      colours[i]=p_vertices[i].colour;
+      if(!is_finite(pos[0]) || !is_finite(pos[1]) || !is_finite(pos[2]))
+      {
+         error.non_finite++;
+         continue;
+      }
+      for(int k=0;k<3;k++)
+      {
+         low[k]=(first || pos[k] < low[k]) ? pos[k] : low[k];
+         high[k]=(first || pos[k] > high[k]) ? pos[k] : high[k];
+      }
+      first=false;
+   }
+
+   for(int k=0;k<3;k++)
+   {
+      p_out->bias[k]=(low[k] + high[k]) * 0.5f;
+      p_out->scale[k]=(high[k] - low[k]) * 0.5f / (float)g_vq_max_step;
+      inv_scale[k]=p_out->scale[k] > 0.0f ? 1.0f / p_out->scale[k] : 0.0f;
+      error.position_bound=p_out->scale[k] * 0.5f > error.position_bound ? p_out->scale[k] * 0.5f :
+                                                                           error.position_bound;
+      diagonal+=(high[k] - low[k]) * (high[k] - low[k]);
+   }
+   diagonal=sqrtf(diagonal);
+
+   std::sort(colours.begin(),colours.end());
+   colours.erase(std::unique(colours.begin(),colours.end()),colours.end());
+   error.colours=(UINT)colours.size();
+   p_out->palette.clear();
+   if(colours.size() <= g_vq_max_palette)
+   {
+      p_out->palette.swap(colours);
+   }
+
+   p_out->vertices.resize(p_count);
+   for(size_t i=0;i<p_count;i++)
+   {
+      tri_qvertex &out=p_out->vertices[i];
+
+      out.x=quantize(p_vertices[i].x,p_out->bias[0],inv_scale[0]);
+      out.y=quantize(p_vertices[i].y,p_out->bias[1],inv_scale[1]);
+      out.z=quantize(p_vertices[i].z,p_out->bias[2],inv_scale[2]);
+      if(p_out->palette.empty())
+      {
+         out.colour=vq_pack_565(p_vertices[i].colour);
+      }
+      else
+      {
+         out.colour=(uint16_t)(std::lower_bound(p_out->palette.begin(),p_out->palette.end(),p_vertices[i].colour) -
+                               p_out->palette.begin());
+      }
+   }
+
+   vq_quantization(*p_out,&quant);
+   for(size_t start=0;start < p_count;start+=g_vq_check_batch)
+   {
+      const size_t count=p_count - start < g_vq_check_batch ? p_count - start : g_vq_check_batch;
+
+      vq_decode(&p_out->vertices[start],count,quant,check);
+      for(size_t i=0;i<count;i++)
+      {
+         const tri_vertex &before=p_vertices[start + i];
+         const float diff[3]={ fabsf(check[i].x - before.x),fabsf(check[i].y - before.y),fabsf(check[i].z - before.z) };
+         const int colour=channel_error(check[i].colour,before.colour);
+
+         error.colour_max=colour > error.colour_max ? colour : error.colour_max;
+         if(!is_finite(before.x) || !is_finite(before.y) || !is_finite(before.z))
+         {
+            continue;   //Already counted in non_finite, its difference means nothing
+         }
+         for(int k=0;k<3;k++)
+         {
+            error.position_max=diff[k] > error.position_max ? diff[k] : error.position_max;
+         }
+      }
+   }
+   error.position_rel=diagonal > 0.0f ? error.position_max / diagonal : 0.0f;
+
+}
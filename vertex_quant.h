@@ -0,0 +1,65 @@
+//
+// vertex_quant.h - 8 byte quantized vertices, half the size of tri_vertex
+//
+// tri_vertex spends 16 bytes on three floats and a colour.  tri_qvertex keeps each
+// coordinate as a signed 16 bit step across the mesh's bounding box and the colour as
+// an index into the mesh's palette.  A mesh with more colours than g_vq_max_palette
+// (what fits in the D3D9 vertex shader's constants next to everything else) keeps
+// R5G6B5 in those 16 bits instead, which drops alpha and the low bits of each channel.
+//
+// A coordinate decodes as q * scale + bias, q from -32767 to 32767, with the box's
+// centre as the bias.  So no coordinate is more than half a step out, the box's extent
+// on that axis over 2 * 65534, give or take the rounding of the decode's own float
+// maths.  For a mesh a few units across that is well under a pixel at any distance the
+// camera gets to.  vq_encode measures the worst errors it actually made and reports
+// them with that bound.
+//
+// Decoding is the backend's job: D3D9 does it in a vertex shader, the software device
+// unpacks each draw's vertex range with vq_decode.
+//
+#ifndef VERTEX_QUANT_H
+#define VERTEX_QUANT_H
+
+#include <stddef.h>
+#include <vector>
+#include "vertex.h"
+#include "render_device.h"
+
+//Largest palette, beyond that the colours are R5G6B5
+const UINT g_vq_max_palette = 240;
+//Largest stored coordinate, -32768 is never used so the range is symmetric
+const int g_vq_max_step = 32767;
+
+struct vq_error
+{
+   float position_max;     //Worst difference on any axis, object space
+   float position_bound;   //Half a step on the box's longest axis, what the format promises
+   float position_rel;     //position_max over the box's diagonal
+   int colour_max;         //Worst difference in any channel, alpha included, 0 to 255
+   UINT colours;           //Distinct colours in the mesh
+   UINT non_finite;        //Vertices with a NaN or infinite coordinate, that axis is stored at the centre
+};
+
+struct vq_mesh
+{
+   std::vector<tri_qvertex> vertices;
+   std::vector<DWORD> palette;   //Empty when the colours are R5G6B5
+   float scale[3];
+   float bias[3];
+   vq_error error;
+};
+
+//Quantizes p_count vertices into p_out and measures the error
+void vq_encode(const tri_vertex *p_vertices, size_t p_count, vq_mesh *p_out);
+//p_mesh's decode parameters.  The palette pointer is into p_mesh.
+void vq_quantization(const vq_mesh &p_mesh, rd_quantization *p_quant);
+
+//Unpacks p_count vertices with the widest SIMD path the CPU has.  A palette index past
+//the end of the palette gets its last entry.
+void vq_decode(const tri_qvertex *p_src, size_t p_count, const rd_quantization &p_quant, tri_vertex *p_dst);
+
+//R5G6B5 and back, each channel rounded to the nearest step
+uint16_t vq_pack_565(DWORD p_colour);
+DWORD vq_unpack_565(uint16_t p_colour);
+
+#endif
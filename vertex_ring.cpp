@@ -0,0 +1,220 @@
+//
+// vertex_ring.cpp - Ring allocator over one big dynamic vertex buffer
+//
+#include <string.h>
+#include "vertex_ring.h"
+
+VertexRing::VertexRing(void) :
+   m_device(NULL),m_buffer(NULL),m_size(0),m_fvf(0),m_head(0),m_tail(0),m_frame_start(0),
+   m_frames(g_vr_max_frames),m_discard(true),m_locked(false),m_allocs(0),m_bytes(0)
+{
+
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+
+VertexRing::~VertexRing(void){
+
+   Release();
+
+}
+
+void VertexRing::Init(RenderDevice *p_device, UINT p_size, DWORD p_fvf){
+
+   Release();
+
+   m_device=p_device;
+   m_size=p_size;
+   m_fvf=p_fvf;
+   memset(&m_stats,0,sizeof(m_stats));
+
+}
+HRESULT VertexRing::CreateBuffer(void){
+HRESULT hr;
+
+   hr=m_device->CreateVertexBuffer(m_size,RD_USAGE_DYNAMIC | RD_USAGE_WRITEONLY,m_fvf,RD_POOL_DEFAULT,&m_buffer);
+   if(FAILED(hr))
+   {
+      m_buffer=NULL;
+      return hr;
+   }
+   m_discard=true;
+
+   return S_OK;
+}
+//******************************************************************************************
+// Function:Retire
+// Whazzit:Drops the frames whose fences have passed, oldest first, and moves the tail
+//         up behind them.  With nothing left in flight the tail is the start of the
+//         current frame, whose slices the device may already be drawing from.
+//******************************************************************************************
+void VertexRing::Retire(void){
+
+   while(!m_frames.empty() && m_device->FenceDone(m_frames.front().fence))
+   {
+      m_tail=m_frames.front().end;
+      m_frames.pop_front();
+   }
+
+   if(m_frames.empty())
+   {
+      m_tail=m_frame_start;
+   }
+
+}
+//******************************************************************************************
+// Function:Lock
+// Whazzit:Takes the next aligned slice, or the front of the buffer if it won't fit
+//         before the end.  Only data in flight can stop it, and that is dodged with a
+//         discard rather than waited for.
+//******************************************************************************************
+bool VertexRing::Lock(UINT p_size, UINT p_align, vr_alloc *p_alloc){
+unsigned long long start;
+UINT offset;
+DWORD flags=RD_LOCK_NOOVERWRITE;
+
+   if(m_device == NULL || m_locked || p_size == 0 || p_size > m_size)
+   {
+      m_stats.failures+=(p_size > m_size);
+      return false;
+   }
+
+   if(m_buffer == NULL && FAILED(CreateBuffer()))
+   {
+      return false;
+   }
+
+   offset=(UINT)(m_head % m_size);
+   p_align=p_align ? p_align : 1;
+   offset=(offset + p_align - 1) / p_align * p_align;
+   if(offset > m_size - p_size)
+   {
+      //Skip the end of the buffer
+      offset=0;
+      start=m_head - m_head % m_size + m_size;
+   }
+   else
+   {
+      start=m_head - m_head % m_size + offset;
+   }
+
+   Retire();
+   if(start + p_size - m_tail > m_size)
+   {
+      m_stats.stalls++;
+      m_discard=true;
+   }
+
+   if(m_discard)
+   {
+      //Everything before this now lives in memory the driver took back
+      flags=RD_LOCK_DISCARD;
+      if(offset != 0)
+      {
+         offset=0;
+         start=m_head - m_head % m_size + m_size;
+      }
+      m_frames.clear();
+      m_tail=start;
+      m_frame_start=start;
+      m_discard=false;
+      m_stats.discards++;
+   }
+
+   if(FAILED(m_buffer->Lock(offset,p_size,&p_alloc->data,flags)))
+   {
+      m_discard=true;
+      return false;
+   }
+
+   if(flags == RD_LOCK_NOOVERWRITE && offset == 0)
+   {
+      //Back at the front, whether the last slice skipped the end or filled it exactly
+      m_stats.wraps++;
+   }
+   m_head=start + p_size;
+   m_locked=true;
+   m_allocs++;
+   m_bytes+=p_size;
+   m_stats.bytes+=p_size;
+
+   p_alloc->buffer=m_buffer;
+   p_alloc->offset=offset;
+
+   return true;
+}
+
+void VertexRing::Unlock(void){
+
+   if(m_locked)
+   {
+      m_buffer->Unlock();
+      m_locked=false;
+   }
+
+}
+
+void VertexRing::EndFrame(void){
+
+   m_stats.frame_bytes=m_bytes;
+   m_stats.frame_allocs=m_allocs;
+   if(m_stats.frame_bytes > m_stats.peak_frame_bytes)
+   {
+      m_stats.peak_frame_bytes=m_stats.frame_bytes;
+   }
+   m_allocs=0;
+   m_bytes=0;
+
+   if(m_device && m_head != m_frame_start)
+   {
+      frame entry={ m_device->InsertFence(),m_head };
+
+      //Too many to keep track of, start the next frame on a fresh chunk
+      if(!m_frames.push_back(entry))
+      {
+         m_discard=true;
+      }
+   }
+   m_frame_start=m_head;
+
+   if(m_device)
+   {
+      Retire();
+   }
+   m_stats.frames_in_flight=(unsigned int)m_frames.size();
+
+}
+
+void VertexRing::OnLostDevice(void){
+
+   Unlock();
+   if(m_buffer)
+   {
+      m_buffer->Release();
+      m_buffer=NULL;
+   }
+
+   //Nothing the device was reading survives a reset
+   m_frames.clear();
+   m_tail=m_head;
+   m_frame_start=m_head;
+   m_discard=true;
+
+}
+
+HRESULT VertexRing::OnResetDevice(void){
+
+   if(m_device == NULL || m_buffer)
+   {
+      return S_OK;
+   }
+
+   return CreateBuffer();
+}
+
+void VertexRing::Release(void){
+
+   OnLostDevice();
+   m_device=NULL;
+
+}
@@ -0,0 +1,103 @@
+//
+// vertex_ring.h - Ring allocator over one big dynamic vertex buffer
+//
+// For geometry that is rebuilt on the CPU every frame.  Each Lock takes the next
+// aligned slice of the buffer with D3DLOCK_NOOVERWRITE, which promises the driver we
+// won't touch anything it might still be reading, so it hands the memory straight
+// back without synchronizing.  EndFrame puts a fence after the frame's draws; once it
+// passes, that frame's slices can be written again.
+//
+// When the next slice would run into a frame the device hasn't finished with, we
+// don't wait for it: the Lock uses D3DLOCK_DISCARD instead, the driver renames the
+// buffer to a fresh chunk and the ring starts over at its front.  That is counted as
+// a stall, since it's what would have stalled, and if it shows up every frame the
+// ring is too small for what goes through it.
+//
+// The buffer lives in the default pool.  Call OnLostDevice before a Reset and
+// OnResetDevice after, or leave it to the next Lock to make a new one.
+//
+#ifndef VERTEX_RING_H
+#define VERTEX_RING_H
+
+#include "fixed_deque.h"
+#include "render_device.h"
+
+const UINT g_vr_default_size = 4 * 1024 * 1024;
+//Frames tracked in flight, past that the next Lock discards instead
+const size_t g_vr_max_frames = 16;
+
+struct vr_alloc
+{
+   RenderBuffer *buffer;
+   UINT offset;         //Bytes from the start of buffer, a multiple of the alignment
+   void *data;          //Write only, until Unlock
+};
+
+struct vr_stats
+{
+   unsigned long long bytes;        //Streamed since Init
+   UINT frame_bytes;                //In the last finished frame
+   UINT peak_frame_bytes;
+   unsigned int frame_allocs;       //Locks in the last finished frame
+   unsigned int frames_in_flight;   //Fenced frames the device may still be reading
+   unsigned int wraps;              //Slices at the front with NOOVERWRITE, not counting discards
+   unsigned int discards;           //Fresh chunks, including the first
+   unsigned int stalls;             //Discards forced by wrapping into in-flight data
+   unsigned int failures;           //Bigger than the whole ring
+};
+
+class VertexRing
+{
+public:
+   VertexRing(void);
+   ~VertexRing(void);
+
+   void Init(RenderDevice *p_device, UINT p_size=g_vr_default_size, DWORD p_fvf=0);
+   //Reserves p_size bytes at an offset that is a multiple of p_align (the vertex
+   //stride, so the slice can be addressed by vertex) and locks them.  False if it
+   //doesn't fit or the buffer can't be made.
+   bool Lock(UINT p_size, UINT p_align, vr_alloc *p_alloc);
+   void Unlock(void);
+   //After the frame's last draw from the ring
+   void EndFrame(void);
+
+   void OnLostDevice(void);
+   HRESULT OnResetDevice(void);
+   void Release(void);
+
+   RenderBuffer *GetBuffer(void) const { return m_buffer; }
+   const vr_stats &GetStats(void) const { return m_stats; }
+
+private:
+   VertexRing(const VertexRing &);
+   VertexRing &operator=(const VertexRing &);
+
+   struct frame
+   {
+      rd_fence fence;
+      unsigned long long end;
+   };
+
+   HRESULT CreateBuffer(void);
+   void Retire(void);
+
+   RenderDevice *m_device;
+   RenderBuffer *m_buffer;
+   UINT m_size;
+   DWORD m_fvf;
+
+   //Positions count up forever, the offset in the buffer is position % m_size.
+   //Everything from m_tail to m_head may still be read by the device.
+   unsigned long long m_head;
+   unsigned long long m_tail;
+   unsigned long long m_frame_start;
+   FixedDeque<frame> m_frames;
+   bool m_discard;               //Next Lock gets a fresh chunk
+   bool m_locked;
+
+   vr_stats m_stats;
+   unsigned int m_allocs;        //This frame's
+   UINT m_bytes;
+};
+
+#endif